@@ -937,12 +937,16 @@ static void subfamilyTrav(BelvuContext *bc, TreeNode *node)
 
 void mksubfamilies(BelvuContext *bc, double cutoff)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_TREE, "mksubfamilies");
+
   separateMarkupLines(bc);
 
   strcpy(bc->treeMethodString, UPGMAstr);
   bc->treeMethod = UPGMA;
 
-  Tree *tree = treeMake(bc, FALSE, TRUE);
+  /* Only the subfamily listing is wanted, so there is no need to hold the
+   * whole distance matrix in memory (which is prohibitive for large alignments) */
+  Tree *tree = treeMakeBoundedUPGMA(bc);
 
   treeTraverseLRfirst(bc, tree->head, subfamilyTrav);
 }
@@ -4590,6 +4594,8 @@ void writeMul(BelvuContext *bc, FILE *fil)
  */
 void readFile(BelvuContext *bc, FILE *pipe)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_PARSE, "readAlignment");
+
   char   ch = '\0';
   char line[MAXLENGTH+1];
   line[0] = 0;
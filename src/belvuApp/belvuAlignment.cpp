@@ -50,9 +50,43 @@ using namespace std;
 #define TICKMARK_INTERVAL                       10 /* number of coords between each tick marker in the sequence area header */
 #define MAJOR_TICKMARK_HEIGHT                   6  /* height of major tick marks in the sequence area header */
 #define MINOR_TICKMARK_HEIGHT                   3  /* height of minor tick marks in the sequence area header */
+#define ALIGN_TILE_COLS                         64 /* number of alignment columns in each cached tile */
+#define ALIGN_TILE_ROWS                         32 /* number of alignment rows in each cached tile */
+#define ALIGN_TILE_CACHE_MAX                    64 /* max number of tiles to keep before re-using the least-recently-used */
+#define GLYPH_ATLAS_PAGE_SIZE                   128 /* number of glyphs in each glyph atlas pixmap */
+
+
+/* A cached, rendered rectangle of the alignment, ALIGN_TILE_COLS x ALIGN_TILE_ROWS
+ * residues in size. Tiles are rendered when they first scroll into view and are
+ * only re-rendered after the colours, selection or sequences change. */
+typedef struct _AlignmentTile
+{
+  GdkDrawable *pixmap;
+  int lastUsed;                     /* the frame number when this tile was last displayed */
+} AlignmentTile;
+
+
+/* A cache of pre-rendered residue glyphs. Each glyph is a character drawn in
+ * a particular foreground colour on a particular background colour, so residues
+ * can be copied from here rather than laying out text for each one. The glyphs
+ * are stored side by side in "pages" of GLYPH_ATLAS_PAGE_SIZE glyphs. */
+typedef struct _GlyphAtlas
+{
+  GPtrArray *pages;                 /* array of pixmaps containing the glyphs */
+  GHashTable *lookup;               /* maps a glyph key (see glyphAtlasKey) to the glyph's index */
+  int numGlyphs;
+  int glyphWidth;
+  int glyphHeight;
+} GlyphAtlas;
+
 
 /* Local function declarations */
+class BelvuAlignmentProperties;
+
 static void               bg2fgColor(BelvuContext *bc, GdkColor *bgColor, GdkColor *result);
+static void               belvuAlignmentInvalidateTiles(BelvuAlignmentProperties *properties);
+static void               destroySpareTiles(BelvuAlignmentProperties *properties);
+static void               glyphAtlasClear(GlyphAtlas *atlas);
 
 
 /* Properties specific to the belvu alignment */
@@ -79,6 +113,12 @@ public:
 
   gdouble charWidth;                /* The width of each character in the display */
   gdouble charHeight;               /* The height of each character in the display */
+
+  GlyphAtlas glyphAtlas;            /* Pre-rendered residues, used to draw the sequence area */
+  GHashTable *tiles;                /* Cached tiles of the sequence area (AlignmentTile), keyed on tile index */
+  GSList *spareTiles;               /* Invalidated tiles whose pixmaps can be re-used */
+  GArray *displayLines;             /* The non-hidden alignments in display order, or NULL if not calculated yet */
+  int frameNum;                     /* Incremented each time the sequence area is drawn */
 };
 
 
@@ -103,6 +143,13 @@ static void onDestroyBelvuAlignment(GtkWidget *belvuAlignment)
           properties->title = NULL;
         }
 
+      belvuAlignmentInvalidateTiles(properties);
+      destroySpareTiles(properties);
+      g_hash_table_destroy(properties->tiles);
+      glyphAtlasClear(&properties->glyphAtlas);
+      g_hash_table_destroy(properties->glyphAtlas.lookup);
+      g_ptr_array_free(properties->glyphAtlas.pages, TRUE);
+
       /* Free the properties struct itself */
       delete properties;
       properties = NULL;
@@ -139,6 +186,17 @@ static void belvuAlignmentCreateProperties(GtkWidget *belvuAlignment,
       properties->title = g_strdup(title);
       properties->wrapWidth = wrapWidth;
 
+      properties->glyphAtlas.pages = g_ptr_array_new();
+      properties->glyphAtlas.lookup = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+      properties->glyphAtlas.numGlyphs = 0;
+      properties->glyphAtlas.glyphWidth = 0;
+      properties->glyphAtlas.glyphHeight = 0;
+
+      properties->tiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
+      properties->spareTiles = NULL;
+      properties->displayLines = NULL;
+      properties->frameNum = 0;
+
       properties->seqRect.x = 0;
       properties->seqRect.y = DEFAULT_YPAD;
       properties->seqHeaderRect.x = properties->seqRect.x;
@@ -220,8 +278,9 @@ void belvuAlignmentRefreshAll(GtkWidget *belvuAlignment)
 }
 
 
-/* Clear cached drawables and redraw all */
-void belvuAlignmentRedrawAll(GtkWidget *belvuAlignment)
+/* Clear cached drawables and redraw all, keeping any cached tiles (i.e. for when
+ * the view has scrolled but the alignment itself has not changed) */
+static void belvuAlignmentRedrawView(GtkWidget *belvuAlignment)
 {
   BelvuAlignmentProperties *properties = belvuAlignmentGetProperties(belvuAlignment);
 
@@ -241,7 +300,19 @@ void belvuAlignmentRedrawAll(GtkWidget *belvuAlignment)
 }
 
 
-/* Clear cached drawables for the sequence area only */
+/* Clear cached drawables and tiles and redraw all. This must be called after
+ * anything that changes how the alignment looks, e.g. colours, selection or the
+ * order of the sequences. */
+void belvuAlignmentRedrawAll(GtkWidget *belvuAlignment)
+{
+  BelvuAlignmentProperties *properties = belvuAlignmentGetProperties(belvuAlignment);
+
+  belvuAlignmentInvalidateTiles(properties);
+  belvuAlignmentRedrawView(belvuAlignment);
+}
+
+
+/* Clear cached drawables for the sequence area only (cached tiles are kept) */
 static void belvuAlignmentRedrawSequenceArea(GtkWidget *belvuAlignment)
 {
   BelvuAlignmentProperties *properties = belvuAlignmentGetProperties(belvuAlignment);
@@ -356,150 +427,199 @@ static gboolean alignmentSelected(BelvuContext *bc, ALN *alnp)
 }
 
 
-/* Draw a single character in the given sequence. In standard mode, fgColorsOnly
- * should be false and the function will draw the background color for the
- * base (and will not draw any text). This is because drawing each character
- * separately is slow, so all text in the default color is drawn at once
- * by the calling function.
- * However, if fgColorsOnly is true then this function checks if the required
- * foreground color is different to the default and, if so, draws the character
- * in that color. (It does not draw background colors in this mode.) */
-static void drawSequenceChar(BelvuAlignmentProperties *properties,
-                             ALN *alnp,
-                             const int colIdx,
-                             const gboolean rowHighlighted,
-                             GtkWidget *widget,
-                             GdkDrawable *drawable,
-                             GdkGC *gc,
-                             GdkColor *defaultFgColor,
-                             const gboolean fgColorsOnly,
-                             const int x,
-                             const int y)
+/* Return the key used to look up a glyph in the glyph atlas. The key combines
+ * the character with its foreground and background colours (as 24-bit RGB). */
+static gint64 glyphAtlasKey(const char residue, GdkColor *fgColor, GdkColor *bgColor)
 {
-  if (!fgColorsOnly)
-    {
-      /* Draw the background */
-      GdkColor bgColor;
-      findResidueBGcolor(properties->bc, alnp, colIdx, rowHighlighted, &bgColor);
-      gdk_gc_set_foreground(gc, &bgColor);
+  const gint64 fgRgb = ((fgColor->red >> 8) << 16) | ((fgColor->green >> 8) << 8) | (fgColor->blue >> 8);
+  const gint64 bgRgb = ((bgColor->red >> 8) << 16) | ((bgColor->green >> 8) << 8) | (bgColor->blue >> 8);
 
-      gdk_draw_rectangle(drawable, gc, TRUE, x, y, properties->charWidth, properties->charHeight);
-    }
-  else if (colIdx < alnGetSeqLen(alnp) && colorByConservation(properties->bc))
+  return (gint64)(unsigned char)residue | (fgRgb << 8) | (bgRgb << 32);
+}
+
+
+/* Discard all glyphs in the glyph atlas */
+static void glyphAtlasClear(GlyphAtlas *atlas)
+{
+  int i = 0;
+  for ( ; i < (int)atlas->pages->len; ++i)
+    g_object_unref(g_ptr_array_index(atlas->pages, i));
+
+  g_ptr_array_set_size(atlas->pages, 0);
+  g_hash_table_remove_all(atlas->lookup);
+  atlas->numGlyphs = 0;
+}
+
+
+/* Return the index in the glyph atlas of the given character in the given
+ * colours, rendering it into the atlas first if it is not there already */
+static int glyphAtlasGetGlyph(GtkWidget *widget,
+                              GdkDrawable *drawable,
+                              BelvuAlignmentProperties *properties,
+                              const char residue,
+                              GdkColor *fgColor,
+                              GdkColor *bgColor)
+{
+  GlyphAtlas *atlas = &properties->glyphAtlas;
+
+  /* If the font size has changed, all of the existing glyphs are invalid */
+  if (atlas->glyphWidth != (int)properties->charWidth || atlas->glyphHeight != (int)properties->charHeight)
     {
-      /* Draw the text if it is in a different color to the default. This is only
-       * possible in color by conservation mode. We get the text colour from the
-       * background color */
-      GdkColor fgColor, bgColor;
-      findResidueBGcolor(properties->bc, alnp, colIdx, rowHighlighted, &bgColor);
-      bg2fgColor(properties->bc, &bgColor, &fgColor);
-
-      if (!colorsEqual(&fgColor, defaultFgColor))
-        {
-          gdk_gc_set_foreground(gc, &fgColor);
+      glyphAtlasClear(atlas);
+      atlas->glyphWidth = properties->charWidth;
+      atlas->glyphHeight = properties->charHeight;
+    }
 
-          char displayText[2];
-          displayText[0] = alnGetSeq(alnp)[colIdx];
-          displayText[1] = '\0';
-          drawText(widget, drawable, gc, x, y, displayText, NULL, NULL);
-        }
+  gint64 key = glyphAtlasKey(residue, fgColor, bgColor);
+  gpointer value = NULL;
+
+  if (g_hash_table_lookup_extended(atlas->lookup, &key, NULL, &value))
+    return GPOINTER_TO_INT(value);
+
+  /* Not found, so add a new glyph, creating a new page if the last one is full */
+  const int glyphIdx = atlas->numGlyphs++;
+  const int pageIdx = glyphIdx / GLYPH_ATLAS_PAGE_SIZE;
+  const int x = (glyphIdx % GLYPH_ATLAS_PAGE_SIZE) * atlas->glyphWidth;
+
+  if (pageIdx >= (int)atlas->pages->len)
+    {
+      GdkDrawable *page = gdk_pixmap_new(drawable, GLYPH_ATLAS_PAGE_SIZE * atlas->glyphWidth, atlas->glyphHeight, -1);
+      gdk_drawable_set_colormap(page, gdk_colormap_get_system());
+      g_ptr_array_add(atlas->pages, page);
     }
 
+  GdkDrawable *page = (GdkDrawable*)g_ptr_array_index(atlas->pages, pageIdx);
+  GdkGC *gc = gdk_gc_new(page);
+
+  gdk_gc_set_foreground(gc, bgColor);
+  gdk_draw_rectangle(page, gc, TRUE, x, 0, atlas->glyphWidth, atlas->glyphHeight);
+
+  char displayText[2];
+  displayText[0] = residue;
+  displayText[1] = '\0';
+
+  gdk_gc_set_foreground(gc, fgColor);
+  drawText(widget, page, gc, x, 0, displayText, NULL, NULL);
+
+  g_object_unref(gc);
+
+  gint64 *keyPtr = g_new(gint64, 1);
+  *keyPtr = key;
+  g_hash_table_insert(atlas->lookup, keyPtr, GINT_TO_POINTER(glyphIdx));
+
+  return glyphIdx;
 }
 
 
-/* Draw a single line in the sequence area.
+/* Draw a single character in the given colours at the given position, by
+ * copying it from the glyph atlas */
+static void drawGlyph(GtkWidget *widget,
+                      GdkDrawable *drawable,
+                      GdkGC *gc,
+                      BelvuAlignmentProperties *properties,
+                      const char residue,
+                      GdkColor *fgColor,
+                      GdkColor *bgColor,
+                      const int x,
+                      const int y)
+{
+  const int glyphIdx = glyphAtlasGetGlyph(widget, drawable, properties, residue, fgColor, bgColor);
+  GlyphAtlas *atlas = &properties->glyphAtlas;
+  GdkDrawable *page = (GdkDrawable*)g_ptr_array_index(atlas->pages, glyphIdx / GLYPH_ATLAS_PAGE_SIZE);
+
+  gdk_draw_drawable(drawable, gc, page,
+                    (glyphIdx % GLYPH_ATLAS_PAGE_SIZE) * atlas->glyphWidth, 0,
+                    x, y, atlas->glyphWidth, atlas->glyphHeight);
+}
+
+
+/* Draw the columns [colStart, colEnd) of a single line in the sequence area,
+ * with the first column at the given x coord.
  *
- * This is rather convoluted in an attempt to maximise speed.  Drawing of text in
- * GTK is particularly slow, and is best done a whole line at a time, rather than
- * drawing individual characters.  The characters may each have a different background
- * colour, so we draw the background colours first and then draw the text over the top
- * a whole line at a time.  A further problem, though, is that some characters may
- * have a different foreground colour to others on the same line (in colour-by-conservation
- * mode), so some characters do need to be drawn individually.  There are usually
- * relatively few characters that this affects, though, so we continue to draw the
- * whole line in the default colour first, and then we look to see if any individual
- * characters have a different foreground colour and just draw those over the top.
-*/
+ * Laying out text in GTK is slow, so rather than drawing the text we copy each
+ * residue from the glyph atlas, which holds each character pre-rendered in
+ * each combination of colours that has been needed so far. Background colours
+ * are drawn first, as one rectangle per run of residues with the same colour,
+ * so that the background is continuous even where there is no residue. */
 static void drawSingleSequence(GtkWidget *widget,
-                                GdkDrawable *drawable,
-                                BelvuAlignmentProperties *properties,
-                                ALN *alnp,
-                                const int lineNum)
+                               GdkDrawable *drawable,
+                               BelvuAlignmentProperties *properties,
+                               ALN *alnp,
+                               const int colStart,
+                               const int colEnd,
+                               const int startX,
+                               const int y)
 {
-  if (!alnGetSeq(alnp))
-    return;
+  char *alnpSeq = alnGetSeq(alnp);
+  const int numCols = colEnd - colStart;
 
-  const int startX = properties->seqRect.x;
-  int x = startX;
-  const int y = properties->seqRect.y + (properties->charHeight * lineNum);
+  if (!alnpSeq || numCols < 1)
+    return;
 
+  BelvuContext *bc = properties->bc;
   GdkGC *gc = gdk_gc_new(drawable);
-  GtkAdjustment *hAdjustment = properties->hAdjustment;
-
-  GdkColor *defaultFgColor = getGdkColor(BELCOLOR_ALIGN_TEXT, properties->bc->defaultColors, FALSE, FALSE);
 
-  /* Loop through each column in the current display range and color
-   * the according to the relevant highlight color */
-  int colIdx = hAdjustment->value;
-  int iMax = min(properties->bc->maxLen, (int)hAdjustment->value + (int)hAdjustment->page_size);
-  const gboolean rowHighlighted = alignmentSelected(properties->bc, alnp);
+  const gboolean rowHighlighted = alignmentSelected(bc, alnp);
+  GdkColor *defaultFgColor = getGdkColor(BELCOLOR_ALIGN_TEXT, bc->defaultColors, FALSE, FALSE);
+  GdkColor defaultBgColor = widget->style->bg[GTK_STATE_NORMAL];
+  GdkColor *bgColors = NULL;
 
-  if (properties->bc->displayColors)
+  if (bc->displayColors)
     {
-      for ( ; colIdx < iMax; ++colIdx)
+      /* Find the background color for each column and draw each run of
+       * columns with the same color as a single rectangle */
+      bgColors = g_new(GdkColor, numCols);
+
+      int i = 0;
+      for ( ; i < numCols; ++i)
+        findResidueBGcolor(bc, alnp, colStart + i, rowHighlighted, &bgColors[i]);
+
+      int runStart = 0;
+      for (i = 1; i <= numCols; ++i)
         {
-          drawSequenceChar(properties, alnp, colIdx, rowHighlighted, widget, drawable, gc, defaultFgColor, FALSE, x, y);
-          x += properties->charWidth;
+          if (i == numCols || !colorsEqual(&bgColors[i], &bgColors[runStart]))
+            {
+              gdk_gc_set_foreground(gc, &bgColors[runStart]);
+              gdk_draw_rectangle(drawable, gc, TRUE,
+                                 startX + runStart * properties->charWidth, y,
+                                 (i - runStart) * properties->charWidth, properties->charHeight);
+              runStart = i;
+            }
         }
     }
   else if (rowHighlighted)
     {
       /* We're not displaying colors for individual chars, but we still need to
        * highlight the background if the row is selected. */
-      GdkColor color;
-      convertColorNumToGdkColor(WHITE, TRUE, &color);
-      gdk_gc_set_foreground(gc, &color);
+      convertColorNumToGdkColor(WHITE, TRUE, &defaultBgColor);
+      gdk_gc_set_foreground(gc, &defaultBgColor);
 
-      gdk_draw_rectangle(drawable, gc, TRUE, startX, y, properties->seqRect.width, properties->charHeight);
+      gdk_draw_rectangle(drawable, gc, TRUE, startX, y, numCols * properties->charWidth, properties->charHeight);
     }
 
+  /* Draw the residues. The text color is the default unless we're coloring by
+   * conservation, in which case we get it from the background color. */
+  const int iMax = min(colEnd, alnGetSeqLen(alnp));
+  int colIdx = colStart;
 
-  /* Draw the sequence text (current display range only) */
-  if (alnGetSeq(alnp))
+  for ( ; colIdx < iMax; ++colIdx)
     {
-      GdkColor *textColor = getGdkColor(BELCOLOR_ALIGN_TEXT, properties->bc->defaultColors, FALSE, FALSE);
-      gdk_gc_set_foreground(gc, textColor);
+      const char residue = alnpSeq[colIdx];
 
-      /* Start at the number of characters into the string where the horizontal
-       * scrollbar indicates we are (making sure that's not out of the end of the
-       * string) */
-      if ((int)hAdjustment->value < alnGetSeqLen(alnp))
-        {
-          char *cp = alnGetSeq(alnp) + (int)hAdjustment->value;
-          char *displayText = g_strndup(cp, iMax - properties->hAdjustment->value);
+      if (residue == ' ')
+        continue;
 
-          drawText(widget, drawable, gc, startX, y, displayText, NULL, NULL);
+      GdkColor *bgColor = bgColors ? &bgColors[colIdx - colStart] : &defaultBgColor;
+      GdkColor fgColor = *defaultFgColor;
 
-          g_free(displayText);
-        }
-    }
+      if (bgColors && colorByConservation(bc))
+        bg2fgColor(bc, bgColor, &fgColor);
 
-  /* Loop again and draw any characters that are not in the default text color.
-   * We don't draw every character individually because the pango layout calls
-   * are expensive, but we can't really avoid it when some characters are in
-   * difference colors.  (We could put markup in the pango layout instead, but
-   * generally the number of characters in a non-default color is small, so
-   * this should be good enough for most cases.) */
-  if (properties->bc->displayColors)
-    {
-      for (x = startX, colIdx = hAdjustment->value; colIdx < iMax; ++colIdx)
-        {
-          drawSequenceChar(properties, alnp, colIdx, rowHighlighted, widget, drawable, gc, defaultFgColor, TRUE, x, y);
-          x += properties->charWidth;
-        }
+      drawGlyph(widget, drawable, gc, properties, residue, &fgColor, bgColor,
+                startX + (colIdx - colStart) * properties->charWidth, y);
     }
 
+  g_free(bgColors);
   g_object_unref(gc);
 }
 
@@ -554,12 +674,9 @@ static void drawWrappedSequences(GtkWidget *widget, GdkDrawable *drawable, Belvu
 
   int i, oldpos, collapseRes = 0, collapsePos = 0, collapseOn = 0;
   int numSpaces = WRAP_DISPLAY_PADDING_CHARS;
-  char collapseStr[10],
-  ch[2] = " ";
+  char collapseStr[10];
   static int *pos=0;                    /* Current residue position of sequence j */
 
-  GdkColor bgColor;
-  GdkColor *pBgColor = &bgColor;
   GdkGC *gcText = gdk_gc_new(drawable);
   GdkGC *gc = gdk_gc_new(drawable);
 
@@ -679,27 +796,27 @@ static void drawWrappedSequences(GtkWidget *widget, GdkDrawable *drawable, Belvu
                     }
 
 
-                  if (!isGap(alnpSeq[i]) && alnpSeq[i] != ' ')
-                    {
-                      findResidueBGcolor(bc, alnp, i, FALSE, pBgColor);
-                      gdk_gc_set_foreground(gc, pBgColor);
+                  if (alnpSeq[i] == ' ')
+                    continue;
 
-                      gdk_draw_rectangle(drawable, gc, TRUE, x, y, properties->charWidth, properties->charHeight);
+                  /* Residues are drawn on their background color; gaps on the
+                   * plain background */
+                  GdkColor bgColor = widget->style->bg[GTK_STATE_NORMAL];
 
+                  if (!isGap(alnpSeq[i]))
+                    {
+                      findResidueBGcolor(bc, alnp, i, FALSE, &bgColor);
                       pos[j]++;
                     }
 
                   /* Foreground color */
                   GdkColor fgColor;
                   if (colorByConservation(bc))
-                    bg2fgColor(bc, pBgColor, &fgColor);
+                    bg2fgColor(bc, &bgColor, &fgColor);
                   else
                     convertColorNumToGdkColor(BLACK, FALSE, &fgColor);
 
-                  gdk_gc_set_foreground(gc, &fgColor);
-
-                  *ch = alnpSeq[i];
-                  drawText(widget, drawable, gc, x, y, ch, NULL, NULL);
+                  drawGlyph(widget, drawable, gc, properties, alnpSeq[i], &fgColor, &bgColor, x, y);
                 }
 
               drawText(widget, drawable, gcText, properties->charWidth, y, alnp->name, NULL, NULL);
@@ -866,28 +983,256 @@ static void drawSelectedColumn(GtkWidget *widget, GdkDrawable *drawable, BelvuAl
 }
 
 
-/* Draw the alignment view */
+/* Return the non-hidden alignments in display order. The result is cached
+ * until the tiles are next invalidated. */
+static GArray* getDisplayLines(BelvuAlignmentProperties *properties)
+{
+  if (!properties->displayLines)
+    {
+      BelvuContext *bc = properties->bc;
+      properties->displayLines = g_array_sized_new(FALSE, FALSE, sizeof(ALN*), bc->alignArr->len);
+
+      int i = 0;
+      for ( ; i < (int)bc->alignArr->len; ++i)
+        {
+          ALN *alnp = g_array_index(bc->alignArr, ALN*, i);
+
+          if (alnp && !alnp->hide)
+            g_array_append_val(properties->displayLines, alnp);
+        }
+    }
+
+  return properties->displayLines;
+}
+
+
+static void destroyAlignmentTile(AlignmentTile *tile)
+{
+  g_object_unref(tile->pixmap);
+  g_free(tile);
+}
+
+
+/* Mark all cached tiles as invalid. Their pixmaps are kept as spares so that
+ * they can be re-used when the tiles are next drawn. This should be called
+ * whenever the appearance of the alignment changes. */
+static void belvuAlignmentInvalidateTiles(BelvuAlignmentProperties *properties)
+{
+  if (!properties)
+    return;
+
+  GHashTableIter iter;
+  gpointer value = NULL;
+  g_hash_table_iter_init(&iter, properties->tiles);
+
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    properties->spareTiles = g_slist_prepend(properties->spareTiles, value);
+
+  g_hash_table_remove_all(properties->tiles);
+
+  if (properties->displayLines)
+    {
+      g_array_free(properties->displayLines, TRUE);
+      properties->displayLines = NULL;
+    }
+}
+
+
+static void destroySpareTiles(BelvuAlignmentProperties *properties)
+{
+  GSList *item = properties->spareTiles;
+
+  for ( ; item; item = item->next)
+    destroyAlignmentTile((AlignmentTile*)(item->data));
+
+  g_slist_free(properties->spareTiles);
+  properties->spareTiles = NULL;
+}
+
+
+/* Draw the given tile's section of the alignment into the tile's pixmap */
+static void renderAlignmentTile(GtkWidget *widget,
+                                BelvuAlignmentProperties *properties,
+                                AlignmentTile *tile,
+                                const int tileRow,
+                                const int tileCol)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "alignmentTile");
+
+  /* Clear the tile to the widget's background color */
+  GdkGC *gc = gdk_gc_new(tile->pixmap);
+  gdk_gc_set_foreground(gc, &widget->style->bg[GTK_STATE_NORMAL]);
+  gdk_draw_rectangle(tile->pixmap, gc, TRUE, 0, 0,
+                     ALIGN_TILE_COLS * properties->charWidth, ALIGN_TILE_ROWS * properties->charHeight);
+  g_object_unref(gc);
+
+  GArray *displayLines = getDisplayLines(properties);
+
+  const int colStart = tileCol * ALIGN_TILE_COLS;
+  const int colEnd = min(properties->bc->maxLen, colStart + ALIGN_TILE_COLS);
+  const int lineStart = tileRow * ALIGN_TILE_ROWS;
+  const int lineEnd = min((int)displayLines->len, lineStart + ALIGN_TILE_ROWS);
+
+  int line = lineStart;
+  for ( ; line < lineEnd; ++line)
+    {
+      ALN *alnp = g_array_index(displayLines, ALN*, line);
+      drawSingleSequence(widget, tile->pixmap, properties, alnp, colStart, colEnd, 0, (line - lineStart) * properties->charHeight);
+    }
+}
+
+
+/* Return the cached tile at the given tile row/column, rendering it first if
+ * it is not in the cache. If the cache is full, the least-recently-used tile
+ * that is not part of the current frame is re-used. */
+static AlignmentTile* getAlignmentTile(GtkWidget *widget,
+                                       GdkDrawable *drawable,
+                                       BelvuAlignmentProperties *properties,
+                                       const int tileRow,
+                                       const int tileCol)
+{
+  const int numTileCols = (properties->bc->maxLen + ALIGN_TILE_COLS - 1) / ALIGN_TILE_COLS;
+  const int tileIdx = tileRow * numTileCols + tileCol;
+
+  AlignmentTile *tile = (AlignmentTile*)g_hash_table_lookup(properties->tiles, GINT_TO_POINTER(tileIdx));
+
+  if (tile)
+    {
+      tile->lastUsed = properties->frameNum;
+      return tile;
+    }
+
+  if ((int)g_hash_table_size(properties->tiles) >= ALIGN_TILE_CACHE_MAX)
+    {
+      /* Find the least-recently-used tile and take it out of the cache */
+      GHashTableIter iter;
+      gpointer key = NULL, value = NULL, lruKey = NULL;
+      g_hash_table_iter_init(&iter, properties->tiles);
+
+      while (g_hash_table_iter_next(&iter, &key, &value))
+        {
+          AlignmentTile *curTile = (AlignmentTile*)value;
+
+          if (curTile->lastUsed < properties->frameNum && (!tile || curTile->lastUsed < tile->lastUsed))
+            {
+              tile = curTile;
+              lruKey = key;
+            }
+        }
+
+      if (tile)
+        g_hash_table_remove(properties->tiles, lruKey);
+    }
+
+  if (!tile && properties->spareTiles)
+    {
+      tile = (AlignmentTile*)(properties->spareTiles->data);
+      properties->spareTiles = g_slist_delete_link(properties->spareTiles, properties->spareTiles);
+    }
+
+  /* Check the pixmap is the right size (it won't be if the font size has changed) */
+  const int width = ALIGN_TILE_COLS * properties->charWidth;
+  const int height = ALIGN_TILE_ROWS * properties->charHeight;
+
+  if (tile)
+    {
+      int tileWidth = 0, tileHeight = 0;
+      gdk_drawable_get_size(tile->pixmap, &tileWidth, &tileHeight);
+
+      if (tileWidth != width || tileHeight != height)
+        {
+          destroyAlignmentTile(tile);
+          tile = NULL;
+        }
+    }
+
+  if (!tile)
+    {
+      tile = g_new0(AlignmentTile, 1);
+      tile->pixmap = gdk_pixmap_new(drawable, width, height, -1);
+      gdk_drawable_set_colormap(tile->pixmap, gdk_colormap_get_system());
+    }
+
+  tile->lastUsed = properties->frameNum;
+  renderAlignmentTile(widget, properties, tile, tileRow, tileCol);
+  g_hash_table_insert(properties->tiles, GINT_TO_POINTER(tileIdx), tile);
+
+  return tile;
+}
+
+
+/* Draw the alignment view. The alignment is drawn in tiles which are cached
+ * so that, when scrolling, only tiles that have not been seen before need to
+ * be rendered. */
 static void drawBelvuSequence(GtkWidget *widget, GdkDrawable *drawable, BelvuAlignmentProperties *properties)
 {
   BelvuContext *bc = properties->bc;
-
-  /* Draw each visible alignment */
   GtkAdjustment *vAdjustment = properties->vAdjustment;
+  GtkAdjustment *hAdjustment = properties->hAdjustment;
 
-  int i = vAdjustment->value;
-  int lineNum = 0;
+  /* The vertical scroll position is an index into the alignment array, which
+   * includes hidden alignments, so find the range of display lines it corresponds to */
+  const int iMin = vAdjustment->value;
   const int iMax = min((int)bc->alignArr->len, (int)vAdjustment->value + (int)vAdjustment->page_size);
+  int firstLine = 0;
+  int numLines = 0;
 
+  int i = 0;
   for ( ; i < iMax; ++i)
     {
       ALN *alnp = g_array_index(bc->alignArr, ALN*, i);
 
       if (alnp && !alnp->hide)
         {
-          drawSingleSequence(widget, drawable, properties, alnp, lineNum);
-          ++lineNum;
+          if (i < iMin)
+            ++firstLine;
+          else
+            ++numLines;
         }
     }
+
+  const int firstCol = hAdjustment->value;
+  const int lastCol = min(bc->maxLen, (int)hAdjustment->value + (int)hAdjustment->page_size); /* exclusive */
+
+  if (numLines < 1 || lastCol <= firstCol)
+    return;
+
+  ++properties->frameNum;
+
+  const int tileRowMin = firstLine / ALIGN_TILE_ROWS;
+  const int tileRowMax = (firstLine + numLines - 1) / ALIGN_TILE_ROWS;
+  const int tileColMin = firstCol / ALIGN_TILE_COLS;
+  const int tileColMax = (lastCol - 1) / ALIGN_TILE_COLS;
+  const int charWidth = properties->charWidth;
+  const int charHeight = properties->charHeight;
+
+  GdkGC *gc = gdk_gc_new(drawable);
+
+  int tileRow = tileRowMin;
+  for ( ; tileRow <= tileRowMax; ++tileRow)
+    {
+      int tileCol = tileColMin;
+      for ( ; tileCol <= tileColMax; ++tileCol)
+        {
+          AlignmentTile *tile = getAlignmentTile(widget, drawable, properties, tileRow, tileCol);
+
+          /* Copy the visible part of the tile */
+          const int line1 = max(firstLine, tileRow * ALIGN_TILE_ROWS);
+          const int line2 = min(firstLine + numLines, (tileRow + 1) * ALIGN_TILE_ROWS);
+          const int col1 = max(firstCol, tileCol * ALIGN_TILE_COLS);
+          const int col2 = min(lastCol, (tileCol + 1) * ALIGN_TILE_COLS);
+
+          gdk_draw_drawable(drawable, gc, tile->pixmap,
+                            (col1 - tileCol * ALIGN_TILE_COLS) * charWidth,
+                            (line1 - tileRow * ALIGN_TILE_ROWS) * charHeight,
+                            properties->seqRect.x + (col1 - firstCol) * charWidth,
+                            properties->seqRect.y + (line1 - firstLine) * charHeight,
+                            (col2 - col1) * charWidth,
+                            (line2 - line1) * charHeight);
+        }
+    }
+
+  g_object_unref(gc);
 }
 
 
@@ -928,6 +1273,8 @@ static gboolean onExposeBelvuColumns(GtkWidget *widget, GdkEventExpose *event, g
 /* Expose handler for the alignment section */
 static gboolean onExposeBelvuSequence(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "alignmentSequences");
+
   GtkWidget *belvuAlignment = GTK_WIDGET(data);
   BelvuAlignmentProperties *properties = belvuAlignmentGetProperties(belvuAlignment);
 
@@ -1063,7 +1410,7 @@ static void onVScrollPosChangedBelvuAlignment(GtkObject *object, gpointer data)
 
   if (properties->wrapWidth == UNSET_INT)
     {
-      belvuAlignmentRedrawAll(belvuAlignment);
+      belvuAlignmentRedrawView(belvuAlignment);
     }
 }
 
@@ -1087,6 +1434,9 @@ static void onHScrollRangeChangedBelvuAlignment(GtkObject *object, gpointer data
   if (properties->hAdjustment->value < properties->hAdjustment->lower)
     properties->hAdjustment->value = properties->hAdjustment->lower;
 
+  /* The range changes when columns are added or removed, so the cached tiles
+   * may no longer be valid */
+  belvuAlignmentInvalidateTiles(properties);
   belvuAlignmentRedrawSequenceArea(belvuAlignment);
 }
 
@@ -505,6 +505,8 @@ static void calculateConsPlotBorders(GtkWidget *consPlot)
 
 static gboolean onExposeConsPlot(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "consPlot");
+
   GtkWidget *consPlot = GTK_WIDGET(data);
   ConsPlotProperties *properties = consPlotGetProperties(consPlot);
 
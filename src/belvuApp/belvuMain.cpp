@@ -114,6 +114,8 @@
   --version   Show package version number\n\
   --abbrev-title-on   Abbreviate window title prefixes\n\
   --abbrev-title-off  Do not abbreviate window title prefixes\n\
+  --trace=<file>      Write timing information to <file> on exit in Chrome\n\
+                      trace-event format (or set SEQTOOLS_TRACE=<file>)\n\
 \n\
 "
 
@@ -281,6 +283,8 @@
   -h, --help  Show this help information\n\
   --compiled  Show package compile date\n\
   --version   Show package version number\n\
+  --trace=<file>  Write timing information to <file> on exit in Chrome\n\
+                  trace-event format (or set SEQTOOLS_TRACE=<file>)\n\
 \
 \
 \
@@ -596,6 +600,7 @@ int main(int argc, char **argv)
   static gboolean showCompiled = FALSE;
   static gboolean showVersion = FALSE;
   static gboolean abbrevTitle = FALSE;
+  char *traceFile = NULL;
 
   gtk_parse_args(&argc, &argv);
 
@@ -606,6 +611,7 @@ int main(int argc, char **argv)
       {"abbrev-title-on",	no_argument,        &abbrevTitle, 1},
       {"compiled",		no_argument,        &showCompiled, 1},
       {"version",	        no_argument,        &showVersion, 1},
+      {"trace",                 required_argument,  0, 0},
 
       {"help",                  no_argument,        0, 'h'},
       {0, 0, 0, 0}
@@ -622,7 +628,10 @@ int main(int argc, char **argv)
       switch (optc)
         {
           case 0:
-            /* we get here if getopt_long set a flag; nothing else to do */
+            if (stringsEqual(long_options[optionIndex].name, "trace", TRUE))
+              traceFile = g_strdup(optarg);
+
+            /* otherwise we get here if getopt_long set a flag; nothing else to do */
             break;
 
           case 'a': show_ann = 1;                                       break;
@@ -749,6 +758,10 @@ int main(int argc, char **argv)
       exit(EXIT_FAILURE);
     }
 
+  /* Enable timing instrumentation, if requested by --trace or the environment */
+  seqtoolsTraceInit(traceFile);
+  g_free(traceFile);
+
   if (!strcmp(argv[optind], "-"))
     {
       pipe = stdin;
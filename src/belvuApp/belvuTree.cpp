@@ -42,6 +42,9 @@
 #include <string.h>
 #include <ctype.h> /* for isspace etc. */
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <algorithm>
 
 using namespace std;
@@ -154,6 +157,24 @@ typedef struct _ClickableRect
 } ClickableRect;
 
 
+/* Callbacks to store/retrieve a pairwise distance, so that the same code can
+ * fill either an in-memory matrix or an on-disk one. Only the half of the matrix
+ * above the diagonal (where j > i) is used. */
+typedef void (*TreeDistSetFunc)(gpointer data, const int i, const int j, const double dist);
+typedef double (*TreeDistGetFunc)(gpointer data, const int i, const int j);
+
+
+/* A pairwise distance matrix held in an unlinked temp file rather than in memory.
+ * Only the half above the diagonal is stored, row by row. The file is mapped, so
+ * the kernel can write pages back to disk and drop them when memory is short. */
+typedef struct _TreeDistFile
+{
+  int nseq;                         /* The number of rows/columns in the matrix */
+  size_t size;                      /* The size of the mapping in bytes */
+  double *dist;                     /* The mapped distances */
+} TreeDistFile;
+
+
 /* Properties specific to the belvu tree */
 class BelvuTreeProperties
 {
@@ -473,6 +494,8 @@ static void treeBootstrapStats(BelvuContext *bc, Tree *tree)
 
 void treeBootstrap(BelvuContext *bc)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_TREE, "treeBootstrap");
+
   separateMarkupLines(bc);
 
   /* We will change the sequence strings in the alignments, so first
@@ -557,6 +580,20 @@ void treeBootstrap(BelvuContext *bc)
  *                   Business logic                        *
  ***********************************************************/
 
+static void pairMtxSetDist(gpointer data, const int i, const int j, const double dist)
+{
+  double **pairmtx = (double**)data;
+  pairmtx[i][j] = dist;
+}
+
+
+static double pairMtxGetDist(gpointer data, const int i, const int j)
+{
+  double **pairmtx = (double**)data;
+  return pairmtx[i][j];
+}
+
+
 /*
  * Expect format:
  *
@@ -565,7 +602,7 @@ void treeBootstrap(BelvuContext *bc)
  * 2-1   2-2   2-3
  * 3-1   3-2   3-3
  */
-static void treeReadDistances(BelvuContext *bc, double **pairmtx)
+static void treeReadDistances(BelvuContext *bc, TreeDistSetFunc setDist, gpointer data)
 {
   char   *p;
   int    i = 0, j = 0 ;
@@ -583,7 +620,11 @@ static void treeReadDistances(BelvuContext *bc, double **pairmtx)
 	{
 	  d = atof(p);
 	  DEBUG_OUT("%d  %d  %f\n", i, j, d);
-	  pairmtx[i][j] = d;
+
+          /* Only the half of the matrix above the diagonal is used */
+          if (j > i)
+            setDist(data, i, j, d);
+
 	  j++;
 	}
 
@@ -1093,8 +1134,10 @@ static TreeNode *treeFindBalance(BelvuContext *bc, TreeNode *node)
 
 
 /* Calculate the pairwise tree distances */
-static void calcPairwiseDistMatrix(BelvuContext *bc, double **pairmtx)
+static void calcPairwiseDistMatrix(BelvuContext *bc, TreeDistSetFunc setDist, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_TREE, "pairwiseDistances");
+
   /* Calculate pairwise distance matrix. Note that this only calculates
    * the portion of the array above the diagonal (where j > i); the other
    * values are left uninitialised and should not be used. */
@@ -1112,23 +1155,25 @@ static void calcPairwiseDistMatrix(BelvuContext *bc, double **pairmtx)
           ALN *aln_j = g_array_index(bc->alignArr, ALN*, j);
           char *alnjSeq = alnGetSeq(aln_j);
 
-          pairmtx[i][j] = 100.0 - percentIdentity(alniSeq, alnjSeq, bc->penalize_gaps);
+          double dist = 100.0 - percentIdentity(alniSeq, alnjSeq, bc->penalize_gaps);
 
           if (bc->treeDistCorr == KIMURA)
-            pairmtx[i][j] = treeKimura(pairmtx[i][j]);
+            dist = treeKimura(dist);
           else if (bc->treeDistCorr == JUKESCANTOR)
-            pairmtx[i][j] = treeJUKESCANTOR(pairmtx[i][j]);
+            dist = treeJUKESCANTOR(dist);
           else if (bc->treeDistCorr == STORMSONN)
-            pairmtx[i][j] = treeSTORMSONN(pairmtx[i][j]);
+            dist = treeSTORMSONN(dist);
           else if (bc->treeDistCorr == SCOREDIST)
-            pairmtx[i][j] = treeSCOREDIST(alniSeq, alnjSeq, bc);
+            dist = treeSCOREDIST(alniSeq, alnjSeq, bc);
+
+          setDist(data, i, j, dist);
         }
     }
 }
 
 
 /* Output the tree distances */
-static void printTreeDistances(BelvuContext *bc, double **pairmtx)
+static void printTreeDistances(BelvuContext *bc, TreeDistGetFunc getDist, gpointer data)
 {
   double dist;
 
@@ -1157,9 +1202,9 @@ static void printTreeDistances(BelvuContext *bc, double **pairmtx)
           if (i == j)
             dist = 0.0;
           else if (i < j)
-            dist = pairmtx[i][j];
+            dist = getDist(data, i, j);
           else
-            dist = pairmtx[j][i];
+            dist = getDist(data, j, i);
 
           g_message("%7.3f\t", dist);
         }
@@ -1350,11 +1395,96 @@ static double treeFindSmallestDist(BelvuContext *bc, double **pairmtx, double **
 }
 
 
+/* Create the leaf node for the given alignment */
+static TreeNode* createLeafTreeNode(BelvuContext *bc, ALN *aln)
+{
+  TreeNode *node = createEmptyTreeNode();
+  node->name =  (char*)g_malloc(strlen(aln->name) + 50);
+
+  if (!bc->treeCoordsOn)
+    sprintf(node->name, "%s", aln->name);
+  else
+    sprintf(node->name, "%s/%d-%d", aln->name, aln->start, aln->end);
+
+  node->aln = aln;
+  node->organism = aln->organism;
+
+  return node;
+}
+
+
+/* Create a new node joining nodes maxi and maxj, which are at distance maxid. The
+ * new node replaces maxi in the nodes array and maxj is set to NULL. avgdist is
+ * only used for NJ trees. isRoot should be true if this is the last join. */
+static TreeNode* treeJoinNodes(BelvuContext *bc,
+                               TreeNode **nodes,
+                               const int maxi,
+                               const int maxj,
+                               const double maxid,
+                               const double *avgdist,
+                               const gboolean isRoot)
+{
+  double llen = 0, rlen = 0;
+  TreeNode *newnode = createEmptyTreeNode();
+
+  if (bc->treeMethod == UPGMA)
+    {
+      /* subtract lower branch lengths from absolute distance
+       Horribly ugly, only to be able to share code UPGMA and NJ */
+      TreeNode *tmpnode = nodes[maxi]->left;
+
+      for (llen = maxid; tmpnode; tmpnode = tmpnode->left)
+        llen -= tmpnode->branchlen;
+
+      tmpnode = nodes[maxj]->right;
+
+      for (rlen = maxid; tmpnode; tmpnode = tmpnode->right)
+        rlen -= tmpnode->branchlen;
+    }
+  else
+    {
+      llen = (maxid + avgdist[maxi] - avgdist[maxj]) / 2.0;
+      rlen = maxid - llen;
+
+      if (isRoot)
+        {
+          /* Not necessary anymore, the tree is re-balanced at the end which calls this too
+           treeBalanceByWeight(node[maxi], node[maxj], &llen, &rlen);*/
+
+          /* Put entire length of root branch in one leg so the rebalancing
+           will work properly (otherwise it is hard to take this branch into account */
+          rlen += llen;
+          llen = 0;
+        }
+
+      DEBUG_OUT("avgdist[left]= %f  avgdist[right]= %f\n\n", avgdist[maxi], avgdist[maxj]);
+    }
+
+  DEBUG_OUT("maxid= %f  llen= %f  rlen= %f\n", maxid, llen, rlen);
+
+  newnode->left = nodes[maxi];
+  newnode->left->branchlen = llen;
+
+  newnode->right = nodes[maxj];
+  newnode->right->branchlen = rlen;
+
+  newnode->organism = (nodes[maxi]->organism == nodes[maxj]->organism ?
+                       nodes[maxi]->organism : NULL);
+
+  nodes[maxi] = newnode;
+  nodes[maxj] = NULL;
+
+  return newnode;
+}
+
+
 /* This does the work to create all the nodes in a tree. All the memory for
  * the nodes etc. is allocated using a BlxHandle which is stored in the tree.
  * To free the memory used by the tree, the handle should be destroyed. */
 Tree* treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean displayFeedback)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_TREE, "treeMake");
+
   /* This can take a long time, so let the user know we're doing something.
    * Only display feedback text if asked, though (e.g. we don't want this each
    * time if calculating a lot of bootstrap trees) */
@@ -1368,8 +1498,7 @@ Tree* treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean disp
   TreeNode *newnode = NULL ;
   int maxi = -1, maxj = -1;
   double maxid = 0.0, **pairmtx, **Dmtx, **curMtx, *src, *trg,
-  *avgdist,		/* vector r in Durbin et al */
-  llen = 0, rlen = 0;
+  *avgdist;		/* vector r in Durbin et al */
   TreeNode **nodes;   /* Array of (primary) nodes.  Value=0 => stale column */
 
   /* Create the tree struct */
@@ -1391,33 +1520,24 @@ Tree* treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean disp
       pairmtx[i] = (double*)handleAlloc(&localHandle, bc->alignArr->len*sizeof(double));
       Dmtx[i] = (double*)handleAlloc(&localHandle, bc->alignArr->len*sizeof(double));
 
-      nodes[i] = createEmptyTreeNode();
-      nodes[i]->name =  (char*)g_malloc(strlen(aln_i->name) + 50);
-
-      if (!bc->treeCoordsOn)
-        sprintf(nodes[i]->name, "%s", aln_i->name);
-      else
-        sprintf(nodes[i]->name, "%s/%d-%d", aln_i->name, aln_i->start, aln_i->end);
-
-      nodes[i]->aln = aln_i;
-      nodes[i]->organism = aln_i->organism;
+      nodes[i] = createLeafTreeNode(bc, aln_i);
     }
 
   /* Get the pairwise tree distances (from file if given, or calculate them) */
   if (bc->treeReadDistancesOn)
-    treeReadDistances(bc, pairmtx);
+    treeReadDistances(bc, pairMtxSetDist, pairmtx);
   else
-    calcPairwiseDistMatrix(bc, pairmtx);
+    calcPairwiseDistMatrix(bc, pairMtxSetDist, pairmtx);
 
   /* If requested (or if debug is on), print the distance matrix */
   if (bc->treePrintDistances)
     {
-      printTreeDistances(bc, pairmtx);
+      printTreeDistances(bc, pairMtxGetDist, pairmtx);
       exit(0);
     }
 
 #ifdef DEBUG
-  printTreeDistances(bc, pairmtx);
+  printTreeDistances(bc, pairMtxGetDist, pairmtx);
 #endif
 
   /* Construct the tree */
@@ -1466,56 +1586,10 @@ Tree* treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean disp
             *trg = (*trg + *src - maxid) / 2.0;
         }
 
-      /* Create node for maxi and maxj */
-      newnode = createEmptyTreeNode();
-
-      if (bc->treeMethod == UPGMA)
-        {
-          /* subtract lower branch lengths from absolute distance
-           Horribly ugly, only to be able to share code UPGMA and NJ */
-          TreeNode *tmpnode = nodes[maxi]->left;
-
-          for (llen = maxid; tmpnode; tmpnode = tmpnode->left)
-            llen -= tmpnode->branchlen;
-
-          tmpnode = nodes[maxj]->right;
-
-          for (rlen = maxid; tmpnode; tmpnode = tmpnode->right)
-            rlen -= tmpnode->branchlen;
-        }
-      else
-        {
-          llen = (maxid + avgdist[maxi] - avgdist[maxj]) / 2.0;
-          rlen = maxid - llen;
-
-          if (iter == (int)bc->alignArr->len - 2)
-            { /* Root node */
-
-              /* Not necessary anymore, the tree is re-balanced at the end which calls this too
-               treeBalanceByWeight(node[maxi], node[maxj], &llen, &rlen);*/
-
-              /* Put entire length of root branch in one leg so the rebalancing
-               will work properly (otherwise it is hard to take this branch into account */
-              rlen += llen;
-              llen = 0;
-            }
-        }
-
       DEBUG_OUT("Iter %d: Merging %d and %d, dist= %f\n", iter, maxi+1, maxj+1, curMtx[maxi][maxj]);
-      DEBUG_OUT("maxid= %f  llen= %f  rlen= %f\n", maxid, llen, rlen);
-      DEBUG_OUT("avgdist[left]= %f  avgdist[right]= %f\n\n", avgdist[maxi], avgdist[maxj]);
-
-      newnode->left = nodes[maxi];
-      newnode->left->branchlen = llen;
 
-      newnode->right = nodes[maxj];
-      newnode->right->branchlen = rlen;
-
-      newnode->organism = (nodes[maxi]->organism == nodes[maxj]->organism ?
-                           nodes[maxi]->organism : NULL);
-
-      nodes[maxi] = newnode;
-      nodes[maxj] = NULL;
+      /* Create node for maxi and maxj */
+      newnode = treeJoinNodes(bc, nodes, maxi, maxj, maxid, avgdist, iter == (int)bc->alignArr->len - 2);
     }
 
   fillParents(newnode, newnode->left);
@@ -1549,6 +1623,251 @@ Tree* treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean disp
 }
 
 
+/***********************************************************
+ *               Low-memory UPGMA tree                     *
+ ***********************************************************/
+
+static double* treeDistFilePtr(TreeDistFile *distFile, const int i, const int j)
+{
+  /* Row i starts after the (nseq-1) + (nseq-2) + ... + (nseq-i) entries of the rows before it */
+  return distFile->dist + ((size_t)i * (2 * distFile->nseq - i - 1)) / 2 + (j - i - 1);
+}
+
+
+static void treeDistFileSetDist(gpointer data, const int i, const int j, const double dist)
+{
+  *treeDistFilePtr((TreeDistFile*)data, i, j) = dist;
+}
+
+
+static double treeDistFileGetDist(gpointer data, const int i, const int j)
+{
+  return *treeDistFilePtr((TreeDistFile*)data, i, j);
+}
+
+
+/* Create a distance matrix for nseq sequences in an unlinked temp file (in
+ * g_get_tmp_dir, i.e. $TMPDIR) and map it. Returns false and sets the error if
+ * there was a problem. */
+static gboolean treeDistFileCreate(TreeDistFile *distFile, const int nseq, GError **error)
+{
+  distFile->nseq = nseq;
+  distFile->size = max((size_t)1, (size_t)nseq * (nseq - 1) / 2) * sizeof(double);
+  distFile->dist = NULL;
+
+  char *filename = NULL;
+  int fd = g_file_open_tmp("belvu-dist-XXXXXX", &filename, error);
+
+  if (fd < 0)
+    return FALSE;
+
+  unlink(filename);
+
+  if (ftruncate(fd, distFile->size) != 0)
+    {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                  "Could not resize distance file '%s': %s\n", filename, g_strerror(errno));
+    }
+  else
+    {
+      void *mapped = mmap(NULL, distFile->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (mapped == MAP_FAILED)
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "Could not map distance file '%s': %s\n", filename, g_strerror(errno));
+      else
+        distFile->dist = (double*)mapped;
+    }
+
+  /* The mapping keeps the file alive */
+  close(fd);
+  g_free(filename);
+
+  return (distFile->dist != NULL);
+}
+
+
+static void treeDistFileDestroy(TreeDistFile *distFile)
+{
+  if (distFile->dist)
+    munmap(distFile->dist, distFile->size);
+
+  distFile->dist = NULL;
+}
+
+
+/* Find the smallest distance in row i to a node that is still in use. Ties go
+ * to the lowest column, as in treeFindSmallestDist. Sets the column to -1 if
+ * there is nothing left in the row. */
+static void treeDistFileRowMin(TreeDistFile *distFile, TreeNode **nodes, const int i, double *rowMin, int *rowMinCol)
+{
+  rowMin[i] = 1000000;
+  rowMinCol[i] = -1;
+
+  if (!nodes[i])
+    return;
+
+  int j = i+1;
+  for ( ; j < distFile->nseq; ++j)
+    {
+      if (!nodes[j])
+        continue;
+
+      const double dist = *treeDistFilePtr(distFile, i, j);
+
+      if (dist < rowMin[i])
+        {
+          rowMin[i] = dist;
+          rowMinCol[i] = j;
+        }
+    }
+}
+
+
+/* Build a UPGMA tree without holding the pairwise distance matrix in memory.
+ *
+ * The distances are written to a file-backed matrix (see TreeDistFile) and only
+ * the smallest distance in each row is kept in memory, so each join just needs
+ * to scan the row minima rather than the whole matrix. The matrix is only
+ * re-read for the merged row and for rows whose minimum was one of the joined
+ * nodes. The joins, and therefore the tree, are identical to those made by
+ * treeMake for UPGMA, including the order in which ties are resolved.
+ *
+ * This is used for the command-line reports (e.g. subfamilies) that do not need
+ * a tree window. Bootstrapping is not supported. If the build method is not UPGMA
+ * or the matrix file cannot be created we fall back to treeMake. */
+Tree* treeMakeBoundedUPGMA(BelvuContext *bc)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_TREE, "treeMakeBoundedUPGMA");
+
+  /* The joins below are only valid for UPGMA */
+  if (bc->treeMethod != UPGMA)
+    return treeMake(bc, FALSE, TRUE);
+
+  const int nseq = bc->alignArr->len;
+  GError *error = NULL;
+  TreeDistFile distFile;
+
+  if (!treeDistFileCreate(&distFile, nseq, &error))
+    {
+      prefixError(error, "Could not create on-disk distance matrix; using in-memory matrix instead. ");
+      reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+
+      return treeMake(bc, FALSE, TRUE);
+    }
+
+  g_message_info("Calculating tree...\n");
+  setBusyCursor(bc, TRUE);
+
+  Tree *tree = createEmptyTree();
+  TreeNode *newnode = NULL;
+  double maxid = 0.0;
+
+  BlxHandle localHandle = handleCreate();
+  TreeNode **nodes = (TreeNode**)handleAlloc(&localHandle, nseq * sizeof(TreeNode *));
+  double *rowMin = (double*)handleAlloc(&localHandle, nseq * sizeof(double));
+  int *rowMinCol = (int*)handleAlloc(&localHandle, nseq * sizeof(int));
+
+  int i = 0;
+  for (i = 0; i < nseq; ++i)
+    nodes[i] = createLeafTreeNode(bc, g_array_index(bc->alignArr, ALN*, i));
+
+  if (bc->treeReadDistancesOn)
+    treeReadDistances(bc, treeDistFileSetDist, &distFile);
+  else
+    calcPairwiseDistMatrix(bc, treeDistFileSetDist, &distFile);
+
+  if (bc->treePrintDistances)
+    {
+      printTreeDistances(bc, treeDistFileGetDist, &distFile);
+      exit(0);
+    }
+
+  for (i = 0; i < nseq; ++i)
+    treeDistFileRowMin(&distFile, nodes, i, rowMin, rowMinCol);
+
+  int iter = 0;
+  for (iter = 0; iter < nseq - 1; ++iter)
+    {
+      /* Find the smallest distance pair. The first row with the smallest
+       * minimum wins, as with the full scan in treeFindSmallestDist. */
+      int maxi = -1;
+      double minDist = 1000000;
+
+      for (i = 0; i < nseq; ++i)
+        {
+          if (rowMinCol[i] >= 0 && rowMin[i] < minDist)
+            {
+              minDist = rowMin[i];
+              maxi = i;
+            }
+        }
+
+      const int maxj = rowMinCol[maxi];
+      maxid = *treeDistFilePtr(&distFile, maxi, maxj);
+
+      /* Merge rows & columns of maxi and maxj into maxi */
+      for (i = 0; i < nseq; ++i)
+        {
+          if (!nodes[i] || i == maxi || i == maxj)
+            continue;
+
+          double *trg = (i < maxi ? treeDistFilePtr(&distFile, i, maxi) : treeDistFilePtr(&distFile, maxi, i));
+          const double *src = (i < maxj ? treeDistFilePtr(&distFile, i, maxj) : treeDistFilePtr(&distFile, maxj, i));
+
+          *trg = (*trg + *src) / 2.0;
+        }
+
+      DEBUG_OUT("Iter %d: Merging %d and %d, dist= %f\n", iter, maxi+1, maxj+1, maxid);
+
+      newnode = treeJoinNodes(bc, nodes, maxi, maxj, maxid, NULL, iter == nseq - 2);
+
+      /* Update the row minima affected by the join. Rows after maxj contain
+       * neither column, and row maxj is no longer in use. */
+      for (i = 0; i < maxj; ++i)
+        {
+          if (!nodes[i])
+            continue;
+
+          if (i == maxi || rowMinCol[i] == maxi || rowMinCol[i] == maxj)
+            {
+              treeDistFileRowMin(&distFile, nodes, i, rowMin, rowMinCol);
+            }
+          else if (i < maxi)
+            {
+              const double dist = *treeDistFilePtr(&distFile, i, maxi);
+
+              if (dist < rowMin[i] || (dist == rowMin[i] && maxi < rowMinCol[i]))
+                {
+                  rowMin[i] = dist;
+                  rowMinCol[i] = maxi;
+                }
+            }
+        }
+
+      rowMin[maxj] = 1000000;
+      rowMinCol[maxj] = -1;
+    }
+
+  fillParents(newnode, newnode->left);
+  fillParents(newnode, newnode->right);
+
+  newnode->branchlen = 100 - maxid ;
+
+  fillOrganism(newnode);
+
+  tree->head = newnode;
+
+  handleDestroy(&localHandle);
+  treeDistFileDestroy(&distFile);
+
+  setBusyCursor(bc, FALSE);
+  g_message_info("Finished calculating tree.\n");
+
+  return tree;
+}
+
+
 /***********************************************************
  *                   Find Orthologs                        *
  ***********************************************************/
@@ -2032,6 +2351,8 @@ static void drawBelvuTree(GtkWidget *widget, GdkDrawable *drawable, BelvuTreePro
  * the user data. */
 static gboolean onExposeBelvuTree(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "tree");
+
   GtkWidget *belvuTree = GTK_WIDGET(data);
   GdkDrawable *window = GTK_LAYOUT(widget)->bin_window;
 
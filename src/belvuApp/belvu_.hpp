@@ -523,6 +523,7 @@ void                                      writeMSF(BelvuContext *bc, FILE *pipe)
 void                                      separateMarkupLines(BelvuContext *bc);
 void                                      reInsertMarkupLines(BelvuContext *bc);
 Tree*                                     treeMake(BelvuContext *bc, const gboolean doBootstrap, const gboolean displayFeedback);
+Tree*                                     treeMakeBoundedUPGMA(BelvuContext *bc);
 
 void                                      outputProbs(BelvuContext *bc, FILE *fil);
 void                                      mksubfamilies(BelvuContext *bc, double cutoff);
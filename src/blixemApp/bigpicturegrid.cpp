@@ -53,6 +53,10 @@ using namespace std;
 #define DEFAULT_MSP_LINE_HEIGHT		3	  /* the height of the MSP lines in the grid */
 #define DEFAULT_GRID_Y_PADDING		5	  /* this provides space between the grid and the edge of the widget */
 #define MIN_MSP_LINE_WIDTH		1	  /* used to make sure that MSP lines never shrink to nothing */
+#define SUMMARY_NUM_LEVELS		4	  /* number of zoom levels in the msp line summary */
+#define SUMMARY_BIN_SIZE		16	  /* number of dna coords per bin in the finest summary level */
+#define SUMMARY_LEVEL_FACTOR		4	  /* each summary level's bins are this many times bigger than the previous level's */
+#define MAX_INDIVIDUAL_MSP_LINES	2000	  /* if more msps than this are in range we draw the summary instead */
 
 typedef struct _DrawGridData
 {
@@ -65,6 +69,32 @@ typedef struct _DrawGridData
 } DrawGridData;
 
 
+/* One bin in the msp line summary: holds the range of ID% values of all MSPs
+ * that overlap the bin. The bin is empty if minId > maxId. */
+typedef struct _GridSummaryBin
+{
+  gdouble minId;
+  gdouble maxId;
+  int numStarts;        /* the number of MSPs that start in this bin */
+} GridSummaryBin;
+
+
+/* The msp line summary for a grid. For each of a few zoom levels, this holds
+ * an array of bins covering the reference sequence range, so that when zoomed
+ * out we can draw the range of ID% values for each pixel column rather than
+ * drawing every MSP line. The summary is rebuilt if the features or the
+ * groups change. */
+struct _GridMspSummary
+{
+  int featuresVersion;                  /* the features version the summary was built from */
+  int groupsVersion;                    /* the groups version the summary was built from */
+  int refMin;                           /* the ref seq coord at the start of the first bin */
+  int binSize[SUMMARY_NUM_LEVELS];      /* number of dna coords per bin at each level */
+  int numBins[SUMMARY_NUM_LEVELS];      /* number of bins at each level */
+  GridSummaryBin *bins[SUMMARY_NUM_LEVELS];
+};
+
+
 
 /* Local function declarations */
 static BlxContext*	    gridGetContext(GtkWidget *grid);
@@ -117,6 +147,35 @@ gint convertValueToGridPos(GtkWidget *grid, const gdouble value)
 }
 
 
+/* Calculates the x position and width in the given grid of the given range of ref seq
+ * coords. dnaDispRange is the grid's display range in dna coords. */
+static void calculateQRangeXPos(GtkWidget *grid,
+                                const IntRange* const qRange,
+                                const IntRange* const dnaDispRange,
+                                int *x,
+                                int *width)
+{
+  BlxContext *bc = gridGetContext(grid);
+  GridProperties *gridProperties = gridGetProperties(grid);
+
+  /* The grid pos for coords gives the left edge of the coord, so draw to max + 1 to be inclusive */
+  const int qMin = qRange->min(true, bc->displayRev);
+  const int qMax = qRange->max(true, bc->displayRev);
+
+  const int x1 = convertBaseIdxToRectPos(qMin, &gridProperties->gridRect, dnaDispRange, TRUE, bc->displayRev, TRUE);
+  const int x2 = convertBaseIdxToRectPos(qMax, &gridProperties->gridRect, dnaDispRange, TRUE, bc->displayRev, TRUE);
+
+  const int xMin = min(x1, x2);
+  const int xMax = max(x1, x2);
+
+  if (x)
+    *x = xMin;
+
+  if (width)
+    *width = max((xMax - xMin), MIN_MSP_LINE_WIDTH);
+}
+
+
 /* Calculates the size and position of an MSP line in the given grid. Return
  * args can be null if not required. */
 static void calculateMspLineDimensions(GtkWidget *grid,
@@ -134,21 +193,7 @@ static void calculateMspLineDimensions(GtkWidget *grid,
   IntRange dnaDispRange;
   convertDisplayRangeToDnaRange(gridGetDisplayRange(grid), bc->seqType, bc->numFrames, bc->displayRev, &bc->refSeqRange, &dnaDispRange);
 
-  /* The grid pos for coords gives the left edge of the coord, so draw to max + 1 to be inclusive */
-  const int mspMin = msp->qRange.min(true, bc->displayRev);
-  const int mspMax = msp->qRange.max(true, bc->displayRev);
-
-  const int x1 = convertBaseIdxToRectPos(mspMin, &gridProperties->gridRect, &dnaDispRange, TRUE, bc->displayRev, TRUE);
-  const int x2 = convertBaseIdxToRectPos(mspMax, &gridProperties->gridRect, &dnaDispRange, TRUE, bc->displayRev, TRUE);
-
-  const int xMin = min(x1, x2);
-  const int xMax = max(x1, x2);
-
-  if (x)
-    *x = xMin;
-
-  if (width)
-    *width = max((xMax - xMin), MIN_MSP_LINE_WIDTH);
+  calculateQRangeXPos(grid, &msp->qRange, &dnaDispRange, x, width);
 
   /* Find where in the y axis we should draw the line, based on the %ID value */
   if (y)
@@ -356,6 +401,243 @@ static void drawGroupedMspLines(gpointer listItemData, gpointer data)
 }
 
 
+/* Free the memory used by the given msp line summary */
+static void destroyMspSummary(GridMspSummary *summary)
+{
+  if (summary)
+    {
+      for (int level = 0; level < SUMMARY_NUM_LEVELS; ++level)
+        g_free(summary->bins[level]);
+
+      g_free(summary);
+    }
+}
+
+
+/* Add the given msp to the finest level of the given summary */
+static void mspSummaryAddMsp(GridMspSummary *summary, const MSP* const msp, const IntRange* const refSeqRange)
+{
+  const int qMin = max(msp->qRange.min(), refSeqRange->min());
+  const int qMax = min(msp->qRange.max(), refSeqRange->max());
+
+  if (qMin > qMax)
+    return;
+
+  const int firstBin = (qMin - summary->refMin) / summary->binSize[0];
+  const int lastBin = (qMax - summary->refMin) / summary->binSize[0];
+  GridSummaryBin *bins = summary->bins[0];
+
+  for (int i = firstBin; i <= lastBin; ++i)
+    {
+      bins[i].minId = min(bins[i].minId, msp->id);
+      bins[i].maxId = max(bins[i].maxId, msp->id);
+    }
+
+  ++bins[firstBin].numStarts;
+}
+
+
+/* Create the msp line summary for the given grid. This includes all MSPs that
+ * are drawn in the base color in drawMspLines, i.e. all MSPs that are shown in
+ * this grid regardless of display range. */
+static GridMspSummary* createMspSummary(GtkWidget *grid)
+{
+  BlxContext *bc = gridGetContext(grid);
+  GridMspSummary *summary = g_new0(GridMspSummary, 1);
+
+  summary->featuresVersion = getFeaturesVersion();
+  summary->groupsVersion = bc->groupsVersion;
+  summary->refMin = bc->refSeqRange.min();
+
+  /* Allocate the bins for each level. Mark all the bins as empty. */
+  for (int level = 0; level < SUMMARY_NUM_LEVELS; ++level)
+    {
+      summary->binSize[level] = level == 0 ? SUMMARY_BIN_SIZE : summary->binSize[level - 1] * SUMMARY_LEVEL_FACTOR;
+      summary->numBins[level] = bc->refSeqRange.length() / summary->binSize[level] + 1;
+      summary->bins[level] = g_new(GridSummaryBin, summary->numBins[level]);
+
+      for (int i = 0; i < summary->numBins[level]; ++i)
+        {
+          summary->bins[level][i].minId = G_MAXDOUBLE;
+          summary->bins[level][i].maxId = -G_MAXDOUBLE;
+          summary->bins[level][i].numStarts = 0;
+        }
+    }
+
+  /* Populate the finest level from the MSPs */
+  GList *seqItem = bc->matchSeqs;
+
+  for ( ; seqItem; seqItem = seqItem->next)
+    {
+      const BlxSequence *seq = (const BlxSequence*)(seqItem->data);
+
+      if (!blxSequenceShownInGrid(seq))
+        continue;
+
+      GList *mspItem = seq->mspList;
+
+      for ( ; mspItem; mspItem = mspItem->next)
+        {
+          const MSP* const msp = (const MSP*)(mspItem->data);
+
+          if (mspShownInGrid(msp, grid, FALSE))
+            mspSummaryAddMsp(summary, msp, &bc->refSeqRange);
+        }
+    }
+
+  /* Populate each coarser level by merging the bins from the level below */
+  for (int level = 1; level < SUMMARY_NUM_LEVELS; ++level)
+    {
+      GridSummaryBin *src = summary->bins[level - 1];
+      GridSummaryBin *dest = summary->bins[level];
+
+      for (int i = 0; i < summary->numBins[level - 1]; ++i)
+        {
+          GridSummaryBin *bin = &dest[i / SUMMARY_LEVEL_FACTOR];
+          bin->minId = min(bin->minId, src[i].minId);
+          bin->maxId = max(bin->maxId, src[i].maxId);
+          bin->numStarts += src[i].numStarts;
+        }
+    }
+
+  return summary;
+}
+
+
+/* Get the msp line summary for the given grid, creating it if it does not exist
+ * or rebuilding it if it is out of date */
+static GridMspSummary* gridGetMspSummary(GtkWidget *grid)
+{
+  GridProperties *properties = gridGetProperties(grid);
+  BlxContext *bc = gridGetContext(grid);
+  GridMspSummary *summary = properties->mspSummary;
+
+  if (summary &&
+      (summary->featuresVersion != getFeaturesVersion() ||
+       summary->groupsVersion != bc->groupsVersion ||
+       summary->refMin != bc->refSeqRange.min()))
+    {
+      destroyMspSummary(summary);
+      summary = NULL;
+    }
+
+  if (!summary)
+    {
+      summary = createMspSummary(grid);
+      properties->mspSummary = summary;
+    }
+
+  return summary;
+}
+
+
+/* If the grid is zoomed out far enough and there are too many MSPs in range to
+ * draw individually, this draws the precomputed summary of the MSP lines instead:
+ * for each pixel column, a bar covering the range of ID% values of all MSPs in
+ * that column. Returns false without drawing anything if the MSP lines should be
+ * drawn individually. */
+static gboolean drawMspSummary(GtkWidget *grid, DrawGridData *drawData)
+{
+  BlxContext *bc = gridGetContext(grid);
+  GridProperties *properties = gridGetProperties(grid);
+  const int gridWidth = properties->gridRect.width;
+
+  if (gridWidth <= 0)
+    return FALSE;
+
+  /* Get the display range in dna coords */
+  IntRange dnaDispRange;
+  convertDisplayRangeToDnaRange(gridGetDisplayRange(grid), bc->seqType, bc->numFrames, bc->displayRev, &bc->refSeqRange, &dnaDispRange);
+
+  /* Find the coarsest level whose bins are no bigger than a pixel. If even the
+   * finest level's bins are bigger than a pixel then draw individual lines. */
+  const gdouble basesPerPixel = (gdouble)dnaDispRange.length() / (gdouble)gridWidth;
+
+  if (basesPerPixel < SUMMARY_BIN_SIZE)
+    return FALSE;
+
+  GridMspSummary *summary = gridGetMspSummary(grid);
+
+  int level = 0;
+  while (level + 1 < SUMMARY_NUM_LEVELS && summary->binSize[level + 1] <= basesPerPixel)
+    ++level;
+
+  const int binSize = summary->binSize[level];
+  GridSummaryBin *bins = summary->bins[level];
+  const int firstBin = max(0, (dnaDispRange.min() - summary->refMin) / binSize);
+  const int lastBin = min(summary->numBins[level] - 1, (dnaDispRange.max() - summary->refMin) / binSize);
+
+  /* Only use the summary if there are a lot of MSPs in range */
+  int numMsps = 0;
+
+  for (int i = firstBin; i <= lastBin; ++i)
+    numMsps += bins[i].numStarts;
+
+  if (numMsps <= MAX_INDIVIDUAL_MSP_LINES)
+    return FALSE;
+
+  /* Merge the bins into pixel columns */
+  gdouble *colMin = g_new(gdouble, gridWidth);
+  gdouble *colMax = g_new(gdouble, gridWidth);
+
+  for (int col = 0; col < gridWidth; ++col)
+    {
+      colMin[col] = G_MAXDOUBLE;
+      colMax[col] = -G_MAXDOUBLE;
+    }
+
+  for (int i = firstBin; i <= lastBin; ++i)
+    {
+      if (bins[i].minId > bins[i].maxId)
+        continue;
+
+      const int binStart = summary->refMin + i * binSize;
+      IntRange binRange(binStart, binStart + binSize - 1);
+
+      int x = 0, width = 0;
+      calculateQRangeXPos(grid, &binRange, &dnaDispRange, &x, &width);
+
+      const int firstCol = max(0, x - properties->gridRect.x);
+      const int lastCol = min(gridWidth - 1, x - properties->gridRect.x + width - 1);
+
+      for (int col = firstCol; col <= lastCol; ++col)
+        {
+          colMin[col] = min(colMin[col], bins[i].minId);
+          colMax[col] = max(colMax[col], bins[i].maxId);
+        }
+    }
+
+  /* Draw the columns. Adjacent columns with the same extent are drawn as a single
+   * rectangle. */
+  gdk_gc_set_subwindow(drawData->gc, GDK_INCLUDE_INFERIORS);
+  gdk_gc_set_foreground(drawData->gc, drawData->color);
+
+  int runStart = 0;
+
+  for (int col = 1; col <= gridWidth; ++col)
+    {
+      if (col < gridWidth && colMin[col] == colMin[runStart] && colMax[col] == colMax[runStart])
+        continue;
+
+      if (colMin[runStart] <= colMax[runStart])
+        {
+          const int y1 = convertValueToGridPos(grid, colMax[runStart]);
+          const int y2 = convertValueToGridPos(grid, colMin[runStart]) + properties->mspLineHeight;
+
+          gdk_draw_rectangle(drawData->drawable, drawData->gc, TRUE,
+                             properties->gridRect.x + runStart, y1, col - runStart, y2 - y1);
+        }
+
+      runStart = col;
+    }
+
+  g_free(colMin);
+  g_free(colMax);
+
+  return TRUE;
+}
+
+
 /* Draw a line for each MSP in the given grid */
 static void drawMspLines(GtkWidget *grid, GdkDrawable *drawable)
 {
@@ -371,8 +653,12 @@ static void drawMspLines(GtkWidget *grid, GdkDrawable *drawable)
     FALSE
   };
 
-  /* Draw all MSPs for this grid */
-  g_list_foreach(bc->matchSeqs, drawSequenceMspLines, &drawData);
+  /* Draw all MSPs for this grid. If we're zoomed out and there are a lot of them
+   * then draw the summary instead of individual lines. This layer has no colinearity
+   * lines; those are drawn for the selected sequences below, which are always drawn
+   * individually. */
+  if (!drawMspSummary(grid, &drawData))
+    g_list_foreach(bc->matchSeqs, drawSequenceMspLines, &drawData);
 
   /* Now draw MSPs that are in groups (to do: it would be good to do this in reverse
    * Sort Order, so that those ordered first get drawn last and therefore appear on top) */
@@ -512,6 +798,8 @@ void calculateGridBorders(GtkWidget *grid)
  * the bitmap first. */
 static gboolean onExposeGrid(GtkWidget *grid, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "bigPictureGrid");
+
   GdkDrawable *window = GTK_LAYOUT(grid)->bin_window;
 
   if (window)
@@ -753,6 +1041,9 @@ static void onDestroyGrid(GtkWidget *widget)
 
   if (properties)
     {
+      destroyMspSummary(properties->mspSummary);
+      properties->mspSummary = NULL;
+
       delete properties;
       properties = NULL;
       g_object_set_data(G_OBJECT(widget), "GridProperties", NULL);
@@ -770,7 +1061,8 @@ GridProperties::GridProperties(GtkWidget *widget_in,
     mspLineHeight(DEFAULT_MSP_LINE_HEIGHT),
     gridYPadding(DEFAULT_GRID_Y_PADDING),
     exposeHandlerId(exposeHandlerId_in),
-    ignoreSizeAlloc(FALSE)
+    ignoreSizeAlloc(FALSE),
+    mspSummary(NULL)
 {
   gridRect.x = 0;
   gridRect.y = 0;
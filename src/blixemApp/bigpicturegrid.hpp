@@ -49,6 +49,8 @@
 
 #define BIG_PICTURE_GRID_NAME		"BigPictureGrid"
 
+typedef struct _GridMspSummary GridMspSummary;
+
 
 class GridProperties
 {
@@ -73,6 +75,8 @@ public:
   GdkRectangle gridRect;
   GdkRectangle displayRect;
   GdkRectangle highlightRect;
+
+  GridMspSummary *mspSummary; /* Cached summary of the msp lines, used to draw the grid when zoomed out (may be null) */
 };
 
 
@@ -97,6 +97,8 @@ class BlxContext;
 
 /* For overall blixem settings. */
 #define BLIXEM_OLD_BULK_FETCH      "default-fetch-mode"      /* for compatibility with old config files (new config files use SEQTOOLS_BULK_FETCH) */
+#define BLIXEM_SEQ_CACHE_DIR       "sequence-cache-dir"      /* directory for the local cache of fetched sequences */
+#define BLIXEM_SEQ_CACHE_SIZE      "sequence-cache-size"     /* max size of the sequence cache in MB (0 disables it) */
 
 /* Fetch settings */
 #define FETCH_MODE_KEY             "fetch-mode"  /* any group with this key is a fetch method, and this specifies what type of fetch to do */
@@ -141,6 +143,7 @@ class BlxContext;
 #define FETCH_SEPARATOR    "separator"   /* separator, when combining multiple sequences */
 #define FETCH_ERRORS       "errors"      /* list of messages that indicate errors */
 #define FETCH_DEBUG        "curl-debug"  /* enable verbose debug output */
+#define FETCH_MAX_PARALLEL "max-parallel" /* max number of fetches of this type to run concurrently */
 
 
 /* For settings */
@@ -450,6 +453,8 @@ public:
   gboolean saveTempFiles;         /* save any temporary files that blixem creates */
   gboolean coverageOn;            /* show the coverage view on start-up */
   gboolean abbrevTitle;           /* if true, use a abbreviated window titles to save space */
+  gboolean profileStartup;        /* if true, report the time taken by each phase of startup */
+  gboolean packRefSeq;            /* if true, store the reference sequence packed rather than as text */
 
   gboolean mspFlagDefaults[MSPFLAG_NUM_FLAGS]; /* default values for MSP flags */
 
@@ -580,14 +585,15 @@ public:
 
 private:
 
-  void regionFetchFeature(const MSP* const msp,
+  gboolean fetchAttempt(GList *seqs, const int attempt);
+  GList* getUncachedSeqs(GList *seqs);
+  void cacheFetchedSeqs(GList *seqs, const BlxFetchMethod* const fetchMethod);
+
+  void regionFetchFeature(const char *output,
                           const BlxFetchMethod* const fetchMethod,
-                          const char *script,
-                          const char *dataset,
-                          const char *tmpDir,
                           GError **error);
 
-  int attempt;
+  int attempt;       /* the highest fetch-method attempt number reached so far */
   gboolean External;
   gboolean saveTempFiles;
   BlxSeqType seqType;
@@ -596,6 +602,8 @@ private:
   GArray *defaultFetchMethods;
   GHashTable *fetchMethods;
   MSP **mspList;
+  MSP *mspListTail;  /* cached last item in mspList, to make merging region-fetch results cheap */
+  GList *seqListTail; /* cached last item in seqList */
   BlxBlastMode *blastMode;
   GArray** featureLists;
   GSList *supportedTypes;
@@ -627,6 +635,21 @@ gboolean                            blxview(CommandLineOptions *options,
                                             GSList *styles,
                                             GHashTable *lookupTable) ;
 
+gboolean                            blxviewFetchSequences(CommandLineOptions *options,
+                                                          GArray* featureLists[],
+                                                          GList **seqList,
+                                                          GSList *supportedTypes,
+                                                          const gboolean External,
+                                                          GHashTable *lookupTable);
+void                                blxviewFinaliseSequences(CommandLineOptions *options,
+                                                             GArray* featureLists[],
+                                                             GList **seqList,
+                                                             GHashTable *lookupTable);
+
+void                                blxProfileStart();
+void                                blxProfilePhase(const char *phaseName);
+void                                blxProfileEnd(const char *description);
+
 BlxColumnInfo*                     getColumnInfo(const GList *columnList, const BlxColumnId columnId);
 int                                getColumnWidth(const GList *columnList, const BlxColumnId columnId);
 const char*                        getColumnTitle(const GList *columnList, const BlxColumnId columnId);
@@ -642,7 +665,11 @@ const IntRange*                    mspGetFullSRange(const MSP* const msp, const
 const IntRange*                    mspGetDisplayRange(const MSP* const msp);
 const IntRange*                    mspGetFullDisplayRange(const MSP* const msp, const gboolean seqSelected, const BlxContext* const bc);
 void                               mspCalculateFullExtents(MSP *msp, const BlxContext* const bc, const int numUnalignedBases);
+gdouble                            calculateMspData(const BlxContext* const bc, MSP *mspList, const int numUnalignedBases, const gboolean allMsps);
 void                               cacheMspDisplayRanges(const BlxContext* const bc, const int numUnalignedBases);
+void                               cacheNewMspDisplayRanges(const BlxContext* const bc, MSP *mspList, const int numUnalignedBases);
+int                                getMspDisplayRangesVersion();
+int                                getFeaturesVersion();
 
 gboolean                           mspGetMatchCoord(const MSP *msp,
                                                     const int qIdx,
@@ -650,6 +677,13 @@ gboolean                           mspGetMatchCoord(const MSP *msp,
                                                     const int numUnalignedBases,
                                                     BlxContext *bc,
                                                     int *result_out);
+void                               mspGetMatchCoordArray(const MSP *msp,
+                                                         const int *qIdxs,
+                                                         const int numIdxs,
+                                                         const gboolean seqSelected,
+                                                         const int numUnalignedBases,
+                                                         BlxContext *bc,
+                                                         int *results_out);
 
 
 void                               drawAssemblyGaps(GtkWidget *widget,
@@ -688,6 +722,7 @@ GString*                           getFetchArgsMultiple(const BlxFetchMethod* co
 void                               finaliseFetch(GList *seqList, GList *columnList);
 void                               sendFetchOutputToFile(GString *command, GKeyFile *keyFile, BlxBlastMode *blastMode,GArray* featureLists[],GSList *supportedTypes, GSList *styles, GList **seqList, MSP **mspListIn,const char *fetchName, const gboolean saveTempFiles, MSP **newMsps, GList **newSeqs, GList *columnList, GHashTable *lookupTable, const int refSeqOffset, const IntRange* const refSeqRange, GError **error);
 const char*                        outputTypeStr(const BlxFetchOutputType outputType);
+void                               blxFetchSetHeadless(const gboolean headless);
 
 void                               fetchSeqsIndividually(GList *seqsToFetch, GtkWidget *blxWindow);
 gboolean                           populateSequenceDataHtml(GList *seqsToFetch, const BlxSeqType seqType, const BlxFetchMethod* const fetchMethod) ;
@@ -698,7 +733,8 @@ void                               blxInitConfig(const char *config_file, Comman
 GKeyFile*                          blxGetConfig(void) ;
 
 void                               loadNativeFile(const char *filename, const char *buffer, GKeyFile *keyFile, BlxBlastMode *blastMode, GArray* featureLists[], GSList *supportedTypes, GSList *styles, MSP **newMsps, GList **newSeqs, GList *columnList, GHashTable *lookupTable, const int refSeqOffset, const IntRange* const refSeqRange, GError **error);
-void                               blxMergeFeatures(MSP *newMsps, GList *newSeqs, MSP **mspList, GList **seqList);
+void                               loadNativeStream(FILE *file, const char *buffer, GKeyFile *keyFile, BlxBlastMode *blastMode, GArray* featureLists[], GSList *supportedTypes, GSList *styles, MSP **newMsps, GList **newSeqs, GList *columnList, GHashTable *lookupTable, const int refSeqOffset, const IntRange* const refSeqRange, GError **error);
+void                               blxMergeFeatures(MSP *newMsps, GList *newSeqs, MSP **mspList, GList **seqList, MSP **mspListTail, GList **seqListTail);
 
 /* Create/destroy sequences and MSPs */
 void                               blviewResetGlobals();
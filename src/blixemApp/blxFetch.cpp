@@ -57,6 +57,7 @@
 #include <blixemApp/detailview.hpp>
 #include <blixemApp/blixem_.hpp>
 #include <blixemApp/blxcontext.hpp>
+#include <blixemApp/blxSeqCache.hpp>
 
 #ifdef PFETCH_HTML
 #include <gbtools/gbtoolsPfetch.hpp>
@@ -114,6 +115,40 @@ typedef ProgressBarStruct *ProgressBar;
 
 enum {RCVBUFSIZE = 256} ;               /* size of receive buffer for socket fetch */
 
+/* Flags for socket send() calls: avoid SIGPIPE per-call where the platform supports it */
+#ifdef MSG_NOSIGNAL
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SOCKET_SEND_FLAGS 0
+#endif
+
+enum {MIN_PARALLEL_FETCH_BATCH = 200} ; /* min number of sequences per connection when splitting a bulk fetch */
+
+
+/* Shared state for a bulk fetch that has been split into batches that are fetched
+ * over several concurrent connections on worker threads */
+typedef struct _ParallelFetchStruct
+{
+  const BlxFetchMethod *fetchMethod;    /* the fetch method that all batches use */
+  GList *columnList;                    /* list of BlxColumnInfo structs (read-only) */
+  BlxSeqType seqType;
+  gboolean External;
+
+  gint numFetched;                      /* total sequences fetched by all batches so far (atomic) */
+  gint cancelled;                       /* set by the main thread if the user cancels (atomic) */
+  GAsyncQueue *doneQueue;               /* each batch pushes its GeneralFetchData here when it completes */
+} ParallelFetchStruct, *ParallelFetch;
+
+
+/* A message from the fetch parser that is saved so that it can be reported by
+ * the main thread (our log handlers use GTK so must not be called from workers) */
+typedef struct _FetchMessage
+{
+  GLogLevelFlags logLevel;
+  char *text;
+} FetchMessage;
+
+
 /* This struct holds general info about a fetch that is in progress */
 typedef struct GeneralFetchDataStructType
 {
@@ -140,6 +175,11 @@ typedef struct GeneralFetchDataStructType
   BlxSeqType seqType;
   BlxSeqParserState parserState;
   gboolean status;                        /* gets set to false if there is a problem */
+
+  ParallelFetch parallel;                 /* non-null if this is one batch of a fetch running on worker threads */
+  GSList *messages;                       /* for worker-thread batches, FetchMessages to report when the batch is done */
+  GList *seqList;                         /* for worker-thread batches, the list of sequences in this batch */
+  GError *error;                          /* for worker-thread batches, any error that occurred */
 } GeneralFetchDataStruct, *GeneralFetchData ;
 
 
@@ -228,6 +268,11 @@ static void                        appendCharToQuotedString(const char curChar,
 
 static void                        socketFetchInit(const BlxFetchMethod* const fetchMethod, GList *seqsToFetch, gboolean External, int *sock, GError **error);
 static void                        checkProgressBar(ProgressBar bar, BlxSeqParserState *parserState, gboolean *status);
+static void                        fetchMainIteration();
+static void                        fetchProcessPendingEvents();
+static void                        checkFetchCancelled(GeneralFetchData fetchData);
+static void                        fetchReportMessage(GeneralFetchData fetchData, const GLogLevelFlags logLevel, const char *formatStr, ...);
+static void                        socketFetchBatch(GeneralFetchData fetchData, GList *seqsToFetch, gboolean External, GError **error);
 
 static int                         socketFetchReceiveBuffer(GeneralFetchData fetchData, const int bufferSize, const int sock);
 
@@ -253,6 +298,10 @@ static long                        configGetIpresolve(GKeyFile *key_file, const
 /* global configuration object for blixem. */
 static GKeyFile *blx_config_G = NULL ;
 
+/* set when running without a display (batch mode): progress is reported to the
+ * console instead of in a progress bar, and we run the main loop without GTK */
+static gboolean fetchHeadless_G = FALSE ;
+
 
 /* Utility to convert a fetch mode enum into a string (used in the config file) */
 const char *fetchModeStr(const BlxFetchMode fetchMode)
@@ -806,8 +855,10 @@ gboolean BulkFetch::httpFetchList(GList *seqsToFetch,
 
   // progress bar is popped up to give user feedback that something is happening.
   fetch_data.fetchData.bar = makeProgressBar(fetch_data.fetchData.numRequested, fetchMethod->mode) ;
-  g_signal_connect(G_OBJECT(fetch_data.fetchData.bar->top_level), "destroy",
-                   G_CALLBACK(sequence_dialog_closed), &fetch_data) ;
+
+  if (fetch_data.fetchData.bar->top_level)
+    g_signal_connect(G_OBJECT(fetch_data.fetchData.bar->top_level), "destroy",
+                     G_CALLBACK(sequence_dialog_closed), &fetch_data) ;
 
   // Make the pfetch object, pipe or html.
   if (fetchMethod->mode == BLXFETCH_MODE_PIPE)
@@ -845,7 +896,7 @@ gboolean BulkFetch::httpFetchList(GList *seqsToFetch,
             {
               checkProgressBar(fetch_data.fetchData.bar,
                                &fetch_data.fetchData.parserState, &fetch_data.fetchData.status);
-              gtk_main_iteration() ;
+              fetchMainIteration() ;
             }
 
           status = fetch_data.fetchData.status ;
@@ -900,6 +951,211 @@ gboolean BulkFetch::httpFetchList(GList *seqsToFetch,
 
 
 
+/* Initialise the given fetch-data struct ready to start parsing results
+ * for the given list of sequences */
+static void initGeneralFetchData(GeneralFetchData fetchData,
+                                 const BlxFetchMethod* const fetchMethod,
+                                 GList *seqsToFetch,
+                                 GList *columnList,
+                                 const BlxSeqType seqType)
+{
+  fetchData->fetchMethod = fetchMethod;
+  fetchData->columnList = columnList;
+  fetchData->buffer = NULL;
+  fetchData->lenReceived = 0;
+  fetchData->currentColumn = NULL;
+  fetchData->currentSeqItem = seqsToFetch;
+  fetchData->currentSeq = seqsToFetch ? (BlxSequence*)(seqsToFetch->data) : NULL;
+  fetchData->bar = NULL;
+  fetchData->numRequested = g_list_length(seqsToFetch);
+  fetchData->numFetched = 0;
+  fetchData->numSucceeded = 0;
+  fetchData->curLine = g_string_new("");
+  fetchData->sectionId[0] = ' ';
+  fetchData->sectionId[1] = ' ';
+  fetchData->sectionId[2] = '\0';
+  fetchData->tagName = g_string_new("");
+  fetchData->currentResult = g_string_new("");
+  fetchData->foundEndQuote = FALSE;
+  fetchData->seqType = seqType;
+  fetchData->parserState = PARSING_NEWLINE;
+  fetchData->status = TRUE;
+  fetchData->parallel = NULL;
+  fetchData->messages = NULL;
+  fetchData->seqList = NULL;
+  fetchData->error = NULL;
+}
+
+
+/* Free the strings allocated by initGeneralFetchData */
+static void clearGeneralFetchData(GeneralFetchData fetchData)
+{
+  if (fetchData->curLine)
+    g_string_free(fetchData->curLine, TRUE);
+
+  if (fetchData->tagName)
+    g_string_free(fetchData->tagName, TRUE);
+
+  if (fetchData->currentResult)
+    g_string_free(fetchData->currentResult, TRUE);
+
+  fetchData->curLine = NULL;
+  fetchData->tagName = NULL;
+  fetchData->currentResult = NULL;
+}
+
+
+/* Report any messages that were saved by a worker-thread fetch batch,
+ * and free the list. Must be called from the main thread. */
+static void reportFetchMessages(GeneralFetchData fetchData)
+{
+  /* Messages were prepended so reverse them to report them in order */
+  fetchData->messages = g_slist_reverse(fetchData->messages);
+
+  for (GSList *item = fetchData->messages; item; item = item->next)
+    {
+      FetchMessage *message = (FetchMessage*)(item->data);
+      g_log(G_LOG_DOMAIN, message->logLevel, "%s", message->text);
+      g_free(message->text);
+      g_free(message);
+    }
+
+  g_slist_free(fetchData->messages);
+  fetchData->messages = NULL;
+}
+
+
+/* Report a warning if the number of sequences the server sent back is
+ * less than the number requested */
+static void reportSocketFetchShortfall(const int numSucceeded, const int numRequested)
+{
+  if (numSucceeded != numRequested)
+    {
+      double proportionOk = (float)numSucceeded / (float)numRequested;
+
+      /* We don't display a critical error message when fetching the full EMBL file because we're
+       * going to re-try fetching just the fasta data anyway. Display a warning, or just an info
+       * message if a small proportion failed */
+      if (proportionOk < 0.5)
+        {
+          g_warning("pfetch sent back %d when %d requested\n", numSucceeded, numRequested) ;
+        }
+      else
+        {
+          g_message("pfetch sent back %d when %d requested\n", numSucceeded, numRequested) ;
+        }
+    }
+}
+
+
+/* Send the request for the given sequences to the socket server and parse the results
+ * back into the sequences. The fetchData must have been initialised with
+ * initGeneralFetchData. This is used both for a single-connection fetch on the main
+ * thread (in which case fetchData->bar is set) and for one batch of a parallel fetch
+ * on a worker thread (in which case fetchData->parallel is set). */
+static void socketFetchBatch(GeneralFetchData fetchData,
+                             GList *seqsToFetch,
+                             gboolean External,
+                             GError **error)
+{
+  const BlxFetchMethod* const fetchMethod = fetchData->fetchMethod;
+  int sock = -1;
+  GError *tmpError = NULL;
+
+  if (fetchMethod->outputType != BLXFETCH_OUTPUT_EMBL && fetchMethod->outputType != BLXFETCH_OUTPUT_RAW)
+    {
+      g_set_error(&tmpError, BLX_ERROR, 1, "Invalid output format for fetch method %s (expected '%s' or '%s')\n",
+                  g_quark_to_string(fetchMethod->name),
+                  outputTypeStr(BLXFETCH_OUTPUT_RAW),
+                  outputTypeStr(BLXFETCH_OUTPUT_EMBL));
+    }
+
+  /* Initialise the connection and send the requests */
+  if (!tmpError)
+    socketFetchInit(fetchMethod, seqsToFetch, External, &sock, &tmpError);
+
+  fetchData->status = (tmpError == NULL);
+
+  /* Get the sequences back. They will be returned in the same order that we asked for them, i.e.
+   * in the order they are in our list. */
+  char buffer[RCVBUFSIZE + 1];
+  fetchData->buffer = buffer;
+
+  while (fetchData->status &&
+         !tmpError &&
+         fetchData->currentSeq &&
+         fetchData->parserState != PARSING_CANCELLED &&
+         fetchData->parserState != PARSING_FINISHED)
+    {
+      /* Receive and parse the next buffer */
+      checkFetchCancelled(fetchData);
+      fetchData->lenReceived = socketFetchReceiveBuffer(fetchData, RCVBUFSIZE, sock);
+
+      if (fetchMethod->outputType == BLXFETCH_OUTPUT_EMBL)
+        parseEmblBuffer(fetchData, &tmpError);
+      else
+        parseRawSequenceBuffer(fetchData, &tmpError);
+    }
+
+  fetchData->buffer = NULL;
+
+  if (sock >= 0)
+    {
+      shutdown(sock, SHUT_RDWR);
+      close(sock);
+    }
+
+  if (tmpError)
+    g_propagate_error(error, tmpError);
+}
+
+
+/* Thread-pool function to fetch one batch of a parallel socket fetch. 'data'
+ * is the GList of sequences in the batch and 'user_data' is the ParallelFetch.
+ * Pushes the GeneralFetchData for the batch onto the done-queue when finished;
+ * the main thread reports its messages and frees it. */
+static void socketFetchBatchThreadFunc(gpointer data, gpointer user_data)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FETCH, "socketFetchBatch");
+
+  GList *batch = (GList*)data;
+  ParallelFetch parallel = (ParallelFetch)user_data;
+
+  GeneralFetchData fetchData = g_new0(GeneralFetchDataStruct, 1);
+  initGeneralFetchData(fetchData, parallel->fetchMethod, batch, parallel->columnList, parallel->seqType);
+  fetchData->parallel = parallel;
+  fetchData->seqList = batch;
+
+  socketFetchBatch(fetchData, batch, parallel->External, &fetchData->error);
+
+  clearGeneralFetchData(fetchData);
+  g_async_queue_push(parallel->doneQueue, fetchData);
+}
+
+
+/* Split the given list into (at most) the given number of batches of roughly equal
+ * size, preserving order. Returns a newly-allocated list of newly-allocated lists. */
+static GList* splitFetchList(GList *seqsToFetch, const int numBatches)
+{
+  GList *result = NULL;
+  const int total = g_list_length(seqsToFetch);
+  const int batchSize = (total + numBatches - 1) / numBatches;
+  GList *item = seqsToFetch;
+
+  while (item)
+    {
+      GList *batch = NULL;
+
+      for (int i = 0; i < batchSize && item; ++i, item = item->next)
+        batch = g_list_prepend(batch, item->data);
+
+      result = g_list_prepend(result, g_list_reverse(batch));
+    }
+
+  return g_list_reverse(result);
+}
+
+
 /* Fetch a list of sequences using sockets.
  *
  * adapted from Tony Cox's code pfetch.c
@@ -911,106 +1167,126 @@ gboolean BulkFetch::httpFetchList(GList *seqsToFetch,
  *    the additional data.
  *  - sequence data will also be ignored for sequences that do not
  *    require sequence data
+ *  - large lists are split into batches that are fetched over up to
+ *    fetchMethod->maxParallel concurrent connections. Each batch is received
+ *    and parsed on a worker thread while this thread keeps the progress
+ *    bar up to date.
  */
 gboolean BulkFetch::socketFetchList(GList *seqsToFetch,
                                     const BlxFetchMethod* const fetchMethod,
                                     GError **error)
 {
-  /* Initialise and send the requests */
-  int sock;
-  GError *tmpError = NULL;
+  const int numRequested = g_list_length(seqsToFetch);
+  const int numBatches = min(fetchMethod->maxParallel, numRequested / MIN_PARALLEL_FETCH_BATCH);
 
-  socketFetchInit(fetchMethod, seqsToFetch, External, &sock, &tmpError);
+  if (numRequested < 1)
+    return TRUE;
 
-  /* Create a struct to pass around data releated to the fetch */
-  GeneralFetchDataStruct fetchData;
-  fetchData.fetchMethod = fetchMethod;
-  fetchData.columnList = columnList;
-  fetchData.currentColumn = NULL;
-  fetchData.seqType = seqType,
-  fetchData.status = (tmpError == NULL);
+  gboolean status = TRUE;
+  GError *tmpError = NULL;
 
-  /* Get the sequences back. They will be returned in the same order that we asked for them, i.e.
-   * in the order they are in our list. */
-  fetchData.currentSeqItem = seqsToFetch;
-  fetchData.currentSeq = (BlxSequence*)(fetchData.currentSeqItem->data);
-
-  if (!tmpError && fetchData.currentSeq)
-    {
-      char buffer[RCVBUFSIZE + 1];
-      fetchData.buffer = buffer;
-      fetchData.numRequested = g_list_length(seqsToFetch); /* total number of sequences requested */
-      fetchData.bar = makeProgressBar(fetchData.numRequested, fetchMethod->mode);
-      fetchData.numFetched = 0;
-      fetchData.numSucceeded = 0;
-      fetchData.parserState = PARSING_NEWLINE;
-      fetchData.curLine = g_string_new("");
-      fetchData.sectionId[0] = ' ';
-      fetchData.sectionId[1] = ' ';
-      fetchData.sectionId[2] = '\0';
-      fetchData.tagName = g_string_new("");
-      fetchData.currentResult = g_string_new("");
-      fetchData.foundEndQuote = FALSE;
-
-      while (fetchData.status &&
-             !tmpError &&
-             fetchData.parserState != PARSING_CANCELLED &&
-             fetchData.parserState != PARSING_FINISHED)
-        {
-          /* Receive and parse the next buffer */
-          checkProgressBar(fetchData.bar, &fetchData.parserState, &fetchData.status);
-          fetchData.lenReceived = socketFetchReceiveBuffer(&fetchData, RCVBUFSIZE, sock);
+  if (numBatches <= 1)
+    {
+      /* Fetch everything over a single connection in this thread */
+      GeneralFetchDataStruct fetchData;
+      initGeneralFetchData(&fetchData, fetchMethod, seqsToFetch, columnList, seqType);
+      fetchData.bar = makeProgressBar(numRequested, fetchMethod->mode);
 
-          if (fetchMethod->outputType == BLXFETCH_OUTPUT_EMBL)
-            {
-              parseEmblBuffer(&fetchData, &tmpError);
-            }
-          else if (fetchMethod->outputType == BLXFETCH_OUTPUT_RAW)
-            {
-              parseRawSequenceBuffer(&fetchData, &tmpError);
-            }
-          else
-            {
-              g_set_error(error, BLX_ERROR, 1, "Invalid output format for fetch method %s (expected '%s' or '%s')\n",
-                          g_quark_to_string(fetchMethod->name),
-                          outputTypeStr(BLXFETCH_OUTPUT_RAW),
-                          outputTypeStr(BLXFETCH_OUTPUT_EMBL));
-            }
-        }
+      socketFetchBatch(&fetchData, seqsToFetch, External, &tmpError);
 
-      /* Finish up */
-      shutdown(sock, SHUT_RDWR);
       destroyProgressBar(fetchData.bar);
       fetchData.bar = NULL ;
 
-      if (fetchData.tagName)
-        g_string_free(fetchData.tagName, TRUE);
+      status = fetchData.status;
 
-      if (fetchData.currentResult)
-        g_string_free(fetchData.currentResult, TRUE);
+      if (fetchData.status && !tmpError)
+        reportSocketFetchShortfall(fetchData.numSucceeded, numRequested);
 
-      if (fetchData.status && !tmpError && fetchData.numSucceeded != fetchData.numRequested)
-        {
-          double proportionOk = (float)fetchData.numSucceeded / (float)fetchData.numRequested;
+      clearGeneralFetchData(&fetchData);
+    }
+  else
+    {
+      ParallelFetchStruct parallel;
+      parallel.fetchMethod = fetchMethod;
+      parallel.columnList = columnList;
+      parallel.seqType = seqType;
+      parallel.External = External;
+      parallel.numFetched = 0;
+      parallel.cancelled = FALSE;
+      parallel.doneQueue = g_async_queue_new();
 
-          /* We don't display a critical error message when fetching the full EMBL file because we're
-           * going to re-try fetching just the fasta data anyway. Display a warning, or just an info
-           * message if a small proportion failed */
-          if (proportionOk < 0.5)
-            {
-              g_warning("pfetch sent back %d when %d requested\n", fetchData.numSucceeded, fetchData.numRequested) ;
-            }
+      GList *batches = splitFetchList(seqsToFetch, numBatches);
+      const int numBatchesActual = g_list_length(batches);
+
+      g_message_info("Fetching %d sequences over %d connections\n", numRequested, numBatchesActual);
+
+      ProgressBar bar = makeProgressBar(numRequested, fetchMethod->mode);
+      GThreadPool *pool = g_thread_pool_new(socketFetchBatchThreadFunc, &parallel, numBatchesActual, FALSE, NULL);
+
+      for (GList *item = batches; item; item = item->next)
+        {
+          if (pool)
+            g_thread_pool_push(pool, item->data, NULL);
           else
+            socketFetchBatchThreadFunc(item->data, &parallel);
+        }
+
+      /* Wait for the batches to complete, keeping the progress bar up to date
+       * and passing on any cancellation from the user */
+      int numDone = 0;
+      int numSucceeded = 0;
+
+      while (numDone < numBatchesActual)
+        {
+          GeneralFetchData fetchData = (GeneralFetchData)g_async_queue_timeout_pop(parallel.doneQueue, 50000);
+
+          if (fetchData)
             {
-              g_message("pfetch sent back %d when %d requested\n", fetchData.numSucceeded, fetchData.numRequested) ;
+              ++numDone;
+              numSucceeded += fetchData->numSucceeded;
+              status &= fetchData->status;
+
+              reportFetchMessages(fetchData);
+
+              if (fetchData->error && tmpError)
+                {
+                  postfixError(tmpError, "%s", fetchData->error->message);
+                  g_error_free(fetchData->error);
+                }
+              else if (fetchData->error)
+                {
+                  tmpError = fetchData->error;
+                }
+
+              g_list_free(fetchData->seqList);
+              g_free(fetchData);
             }
+
+          if (isCancelledProgressBar(bar))
+            g_atomic_int_set(&parallel.cancelled, TRUE);
+
+          if (bar->progress)
+            gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(bar->progress),
+                                          (double)g_atomic_int_get(&parallel.numFetched) / (double)numRequested);
+
+          fetchProcessPendingEvents();
         }
+
+      if (pool)
+        g_thread_pool_free(pool, FALSE, TRUE);
+
+      destroyProgressBar(bar);
+      g_async_queue_unref(parallel.doneQueue);
+      g_list_free(batches);
+
+      if (status && !tmpError)
+        reportSocketFetchShortfall(numSucceeded, numRequested);
     }
 
   if (tmpError)
     g_propagate_error(error, tmpError);
 
-  return fetchData.status ;
+  return status ;
 }
 
 
@@ -1036,6 +1312,32 @@ static gchar* getConfigFileContent(const char *config_file, gsize *len)
 
 
 
+/* Initialise the local sequence cache from the settings in the [blixem]
+ * stanza, if any. The cache is enabled with the default size unless the
+ * config disables it by setting the size to 0. */
+static void initSeqCache(GKeyFile *key_file)
+{
+  int maxSizeMb = BLX_SEQ_CACHE_DEFAULT_SIZE_MB;
+  GError *tmpError = NULL;
+
+  const int size = g_key_file_get_integer(key_file, BLIXEM_GROUP, BLIXEM_SEQ_CACHE_SIZE, &tmpError);
+
+  if (!tmpError)
+    maxSizeMb = size;
+  else if (tmpError->code != G_KEY_FILE_ERROR_GROUP_NOT_FOUND && tmpError->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND)
+    g_warning("Invalid value for '%s' in [%s] stanza: %s\n", BLIXEM_SEQ_CACHE_SIZE, BLIXEM_GROUP, tmpError->message);
+
+  if (tmpError)
+    g_error_free(tmpError);
+
+  char *cacheDir = configGetString(key_file, BLIXEM_GROUP, BLIXEM_SEQ_CACHE_DIR, NULL);
+
+  blxSeqCacheInit(cacheDir, maxSizeMb);
+
+  g_free(cacheDir);
+}
+
+
 /* Set/Get global config, necessary because we don't have some blixem context pointer....
  * To do: we do have a context now, so this should be moved to there.
  * Sets the error if there were any problems. Note that the error is not set if the
@@ -1106,6 +1408,10 @@ void blxInitConfig(const char *config_file, CommandLineOptions *options, GError
     }
 
   g_free(settings_file);
+
+  /* Set up the local sequence cache. This is done even if there is no
+   * config file because the cache is enabled by default. */
+  initSeqCache(key_file);
 }
 
 
@@ -1121,48 +1427,48 @@ GKeyFile *blxGetConfig(void)
  */
 
 
+/* Open a socket connection to the given host and port. Uses getaddrinfo rather than
+ * gethostbyname because this may be called from several fetch threads at once. */
 static int socketConstruct(const char *ipAddress, int port, gboolean External, GError **error)
 {
-  int sock ;                       /* socket descriptor */
-  struct sockaddr_in *servAddr ;   /* echo server address */
-  struct hostent *hp ;
+  int sock = -1 ;                  /* socket descriptor */
+  struct addrinfo hints ;
+  struct addrinfo *addrs = NULL ;
 
+  memset(&hints, 0, sizeof(hints)) ;
+  hints.ai_family = AF_INET ;                               /* Internet address family */
+  hints.ai_socktype = SOCK_STREAM ;                         /* reliable, stream socket using TCP */
 
-  /* Create a reliable, stream socket using TCP */
-  if ((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-    {
-      g_set_error(error, BLX_FETCH_ERROR, BLX_FETCH_ERROR_SOCKET,
-                  "Error creating socket\n") ;
-      return -1 ;
-    }
-
-
-  /* Construct the server address structure */
-  servAddr = new struct sockaddr_in;
-  hp = gethostbyname(ipAddress) ;
+  char *portStr = g_strdup_printf("%d", port) ;
+  const int rc = getaddrinfo(ipAddress, portStr, &hints, &addrs) ;
+  g_free(portStr) ;
 
-  if (!hp)
+  if (rc != 0 || !addrs)
     {
       g_set_error(error, BLX_FETCH_ERROR, BLX_FETCH_ERROR_HOST,
                   "Unknown host \"%s\"\n", ipAddress);
       return -1;
     }
 
-  servAddr->sin_family = AF_INET ;                          /* Internet address family */
-  bcopy((char*)hp->h_addr, (char*) &(servAddr->sin_addr.s_addr), hp->h_length) ;
-                                                            /* Server IP address */
-  servAddr->sin_port = htons ((unsigned short) port) ;      /* Server port */
-
+  /* Create the socket */
+  if ((sock = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol)) < 0)
+    {
+      g_set_error(error, BLX_FETCH_ERROR, BLX_FETCH_ERROR_SOCKET,
+                  "Error creating socket\n") ;
+      freeaddrinfo(addrs) ;
+      return -1 ;
+    }
 
   /* Establish the connection to the server */
-  if (connect(sock, (struct sockaddr *) servAddr, sizeof(struct sockaddr_in)) < 0)
+  if (connect(sock, addrs->ai_addr, addrs->ai_addrlen) < 0)
     {
       g_set_error(error, BLX_FETCH_ERROR, BLX_FETCH_ERROR_CONNECT,
                   "Error connecting socket to host '%s'\n", ipAddress) ;
+      close(sock) ;
       sock = -1 ;
     }
 
-  delete servAddr ;
+  freeaddrinfo(addrs) ;
 
   return sock ;
 }
@@ -1172,7 +1478,9 @@ static void socketSend (int sock, const char *text, GError **error)
 {
   int len, bytes_to_send, bytes_written ;
   char *tmp ;
+#ifndef MSG_NOSIGNAL
   struct sigaction oursigpipe, oldsigpipe ;
+#endif
 
   /* The adding of 0x20 to the end looks wierd but I think it's because the  */
   /* server may not hold strings in the way C does (i.e. terminating '\0'),  */
@@ -1187,13 +1495,17 @@ static void socketSend (int sock, const char *text, GError **error)
 
   /* send() can deliver a SIGPIPE if the socket has been disconnected, by    */
   /* ignoring it we will receive -1 and can look for EPIPE as the errno.     */
+  /* Where possible, do this per-call with MSG_NOSIGNAL, because swapping    */
+  /* the process-wide handler is not safe when fetching on several threads. */
+#ifndef MSG_NOSIGNAL
   oursigpipe.sa_handler = SIG_IGN ;
   sigemptyset(&oursigpipe.sa_mask) ;
   oursigpipe.sa_flags = 0 ;
   if (sigaction(SIGPIPE, &oursigpipe, &oldsigpipe) < 0)
     g_error("Cannot set SIG_IGN for SIGPIPE for socket write operations.\n") ;
+#endif
 
-  bytes_written = send(sock, tmp, bytes_to_send, 0) ;
+  bytes_written = send(sock, tmp, bytes_to_send, SOCKET_SEND_FLAGS) ;
   if (bytes_written == -1)
     {
       if (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN)
@@ -1215,11 +1527,13 @@ static void socketSend (int sock, const char *text, GError **error)
       g_error("send() call should have written %d bytes, but actually wrote %d.\n", bytes_to_send, bytes_written) ;
     }
 
+#ifndef MSG_NOSIGNAL
   /* Reset the old signal handler.                                           */
   if (sigaction(SIGPIPE, &oldsigpipe, NULL) < 0)
     {
       g_error("Cannot reset previous signal handler for signal SIGPIPE for socket write operations.\n") ;
     }
+#endif
 
   g_free(tmp) ;
 }
@@ -1517,7 +1831,41 @@ static gboolean parsePfetchHtmlBuffer(const BlxFetchMethod* const fetchMethod,
 
 
 
-/* Functions to display, update, cancel and remove a progress meter. */
+/* Set whether we are running without a display (see fetchHeadless_G) */
+void blxFetchSetHeadless(const gboolean headless)
+{
+  fetchHeadless_G = headless ;
+}
+
+
+/* Run one iteration of the main loop, waiting for an event if there is none pending */
+static void fetchMainIteration()
+{
+  if (fetchHeadless_G)
+    g_main_context_iteration(NULL, TRUE) ;
+  else
+    gtk_main_iteration() ;
+}
+
+
+/* Process any pending events without waiting */
+static void fetchProcessPendingEvents()
+{
+  if (fetchHeadless_G)
+    {
+      while (g_main_context_pending(NULL))
+        g_main_context_iteration(NULL, FALSE) ;
+    }
+  else
+    {
+      while (gtk_events_pending())
+        gtk_main_iteration() ;
+    }
+}
+
+
+/* Functions to display, update, cancel and remove a progress meter. When running
+ * without a display the progress bar has no widgets and progress is not shown. */
 
 static ProgressBar makeProgressBar(int seq_total, const BlxFetchMode fetch_mode)
 {
@@ -1528,6 +1876,12 @@ static ProgressBar makeProgressBar(int seq_total, const BlxFetchMode fetch_mode)
   bar->widget_destroy_handler_id = 0;
   bar->fetch_mode = fetch_mode;
 
+  if (fetchHeadless_G)
+    {
+      g_message_info("Fetching %d sequences...\n", seq_total) ;
+      return bar ;
+    }
+
   gdk_color_parse("blue", &(bar->blue_bar_fg)) ;
   gdk_color_parse("red", &(bar->red_bar_fg)) ;
 
@@ -1573,10 +1927,7 @@ static ProgressBar makeProgressBar(int seq_total, const BlxFetchMode fetch_mode)
 
   gtk_widget_show_all(bar->top_level) ;
 
-  while (gtk_events_pending())
-    {
-      gtk_main_iteration() ;
-    }
+  fetchProcessPendingEvents() ;
 
   return bar ;
 }
@@ -1585,6 +1936,9 @@ static void updateProgressBar(ProgressBar bar, const char *sequence, int numFetc
 {
   char *label_text ;
 
+  if (!bar->top_level)
+    return ;
+
   if (fetch_ok)
     gtk_widget_modify_fg(bar->progress, GTK_STATE_NORMAL, &(bar->blue_bar_fg)) ;
   else
@@ -1597,8 +1951,7 @@ static void updateProgressBar(ProgressBar bar, const char *sequence, int numFetc
   gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(bar->progress),
                                 (double)((double)numFetched / (double)(bar->seq_total))) ;
 
-  while (gtk_events_pending())
-    gtk_main_iteration();
+  fetchProcessPendingEvents() ;
 
   return ;
 }
@@ -1612,7 +1965,11 @@ static gboolean isCancelledProgressBar(ProgressBar bar)
 
 static void destroyProgressBar(ProgressBar bar)
 {
-  gtk_widget_destroy(bar->top_level) ;
+  /* The bar is deleted by the widget's destroy callback, or directly if it has no widget */
+  if (bar->top_level)
+    gtk_widget_destroy(bar->top_level) ;
+  else
+    delete bar ;
 
   return ;
 }
@@ -1924,6 +2281,15 @@ static void readFetchMethodStanza(GKeyFile *key_file,
         }
     }
 
+  /* Optional keys that apply to all fetch modes */
+  if (!tmpError && result && g_key_file_has_key(key_file, group, FETCH_MAX_PARALLEL, NULL))
+    {
+      result->maxParallel = configGetInteger(key_file, group, FETCH_MAX_PARALLEL, &tmpError);
+
+      if (result->maxParallel < 1)
+        result->maxParallel = 1;
+    }
+
   /* Add result to list */
   if (!tmpError && result)
     {
@@ -2069,7 +2435,7 @@ static void socketFetchInit(const BlxFetchMethod* const fetchMethod,
   if (!tmpError)
     {
       /* send a final newline to flush the socket */
-      if (send(*sock, "\n", 1, 0) != 1)
+      if (send(*sock, "\n", 1, SOCKET_SEND_FLAGS) != 1)
         {
           g_set_error(&tmpError, BLX_FETCH_ERROR, BLX_FETCH_ERROR_SEND,
                       "Failed to send final newline to socket\n") ;
@@ -2093,6 +2459,50 @@ static void checkProgressBar(ProgressBar bar, BlxSeqParserState *parserState, gb
 }
 
 
+/* Check whether the user has cancelled the given fetch. For a fetch on the main thread
+ * this checks the progress bar; for a worker-thread batch the main thread passes on
+ * the cancellation via the shared ParallelFetch. */
+static void checkFetchCancelled(GeneralFetchData fetchData)
+{
+  if (fetchData->parallel)
+    {
+      if (g_atomic_int_get(&fetchData->parallel->cancelled))
+        {
+          fetchData->status = FALSE;
+          fetchData->parserState = PARSING_CANCELLED;
+        }
+    }
+  else if (fetchData->bar)
+    {
+      checkProgressBar(fetchData->bar, &fetchData->parserState, &fetchData->status);
+    }
+}
+
+
+/* Report a message from the fetch parser. Fetch batches that run on worker threads save
+ * their messages to be reported by the main thread because our log handlers use GTK. */
+static void fetchReportMessage(GeneralFetchData fetchData, const GLogLevelFlags logLevel, const char *formatStr, ...)
+{
+  va_list argp;
+  va_start(argp, formatStr);
+  char *text = g_strdup_vprintf(formatStr, argp);
+  va_end(argp);
+
+  if (fetchData->parallel)
+    {
+      FetchMessage *message = g_new(FetchMessage, 1);
+      message->logLevel = logLevel;
+      message->text = text;
+      fetchData->messages = g_slist_prepend(fetchData->messages, message);
+    }
+  else
+    {
+      g_log(G_LOG_DOMAIN, logLevel, "%s", text);
+      g_free(text);
+    }
+}
+
+
 /* Receive the next buffer back from a socket server. Only does anything if the status is ok
  * (i.e. true). Checks the length etc and sets the state to finished if there is no more data
  * to receive. Sets 'status' to false if there was an error. Returns the number of chars received. */
@@ -2113,7 +2523,7 @@ static int socketFetchReceiveBuffer(GeneralFetchData fetchData, const int buffer
       /* Problem with this one - skip to the next */
       fetchData->status = FALSE;
       char *msg = getSystemErrorText();
-      g_critical("Could not retrieve sequence data from pfetch server, error was: %s\n", msg) ;
+      fetchReportMessage(fetchData, G_LOG_LEVEL_CRITICAL, "Could not retrieve sequence data from pfetch server, error was: %s\n", msg) ;
       g_free(msg);
     }
   else if (lenReceived == 0)
@@ -2136,7 +2546,10 @@ static void pfetchGetNextSequence(GeneralFetchData fetchData, const gboolean pfe
       /* Check that another BlxSequence item exists in the list */
       if (fetchData->currentSeqItem->next)
         {
-          updateProgressBar(fetchData->bar, blxSequenceGetName(fetchData->currentSeq), fetchData->numFetched, pfetch_ok) ;
+          if (fetchData->parallel)
+            g_atomic_int_inc(&fetchData->parallel->numFetched);
+          else if (fetchData->bar)
+            updateProgressBar(fetchData->bar, blxSequenceGetName(fetchData->currentSeq), fetchData->numFetched, pfetch_ok) ;
 
           /* Move to the next BlxSequence */
           fetchData->currentSeqItem = fetchData->currentSeqItem->next;
@@ -2145,7 +2558,7 @@ static void pfetchGetNextSequence(GeneralFetchData fetchData, const gboolean pfe
       else
         {
           fetchData->status = FALSE ;
-          g_critical("Unexpected data from pfetch server: received too many lines. (%d sequences were requested.)\n", fetchData->numRequested);
+          fetchReportMessage(fetchData, G_LOG_LEVEL_CRITICAL, "Unexpected data from pfetch server: received too many lines. (%d sequences were requested.)\n", fetchData->numRequested);
         }
     }
 }
@@ -2169,7 +2582,7 @@ static void parseRawSequenceBuffer(GeneralFetchData fetchData, GError **error)
   for ( ; i < fetchData->lenReceived && fetchData->status; ++i)
     {
       /* Check for user cancellation again */
-      checkProgressBar(fetchData->bar, &fetchData->parserState, &fetchData->status);
+      checkFetchCancelled(fetchData);
 
       if (fetchData->parserState == PARSING_CANCELLED)
         {
@@ -2406,7 +2819,7 @@ static void parseEmblBuffer(GeneralFetchData fetchData, GError **error)
 
   for ( ; i < fetchData->lenReceived && fetchData->status; ++i)
     {
-      checkProgressBar(fetchData->bar, &fetchData->parserState, &fetchData->status);
+      checkFetchCancelled(fetchData);
 
       if (fetchData->parserState == PARSING_CANCELLED)
         {
@@ -2444,7 +2857,7 @@ static void parseEmblBuffer(GeneralFetchData fetchData, GError **error)
           else if (stringInArray(fetchData->curLine->str, fetchData->fetchMethod->errors))
             {
               /* The line is an error message. Finish this sequence and move to next. */
-              g_warning("[%s] Error fetching sequence '%s': %s", g_quark_to_string(fetchData->fetchMethod->name), blxSequenceGetName(fetchData->currentSeq), fetchData->curLine->str);
+              fetchReportMessage(fetchData, G_LOG_LEVEL_WARNING, "[%s] Error fetching sequence '%s': %s", g_quark_to_string(fetchData->fetchMethod->name), blxSequenceGetName(fetchData->currentSeq), fetchData->curLine->str);
               fetchData->parserState = PARSING_FINISHED_SEQ;
             }
           else
@@ -2572,7 +2985,7 @@ static gboolean pfetchFinishSequence(GeneralFetchData fetchData)
 {
   /* We issue warnings if a sequence fetch failed but set a limit on the number so we don't end
    * up with pages and pages of terminal output */
-  static int numWarnings = 0;
+  static gint numWarnings = 0;
   const int maxWarnings = 50;
 
   fetchData->numFetched += 1;
@@ -2597,26 +3010,23 @@ static gboolean pfetchFinishSequence(GeneralFetchData fetchData)
     {
       if (!fetchData->currentResult || fetchData->currentResult->len == 0)
         {
-          if (numWarnings < maxWarnings)
+          if (g_atomic_int_add(&numWarnings, 1) < maxWarnings)
             {
-              ++numWarnings;
-              g_warning("No sequence data fetched for '%s'\n", blxSequenceGetName(fetchData->currentSeq));
+              fetchReportMessage(fetchData, G_LOG_LEVEL_WARNING, "No sequence data fetched for '%s'\n", blxSequenceGetName(fetchData->currentSeq));
             }
         }
       else if (stringInArray(fetchData->currentResult->str, fetchData->fetchMethod->errors))
         {
-          if (numWarnings < maxWarnings)
+          if (g_atomic_int_add(&numWarnings, 1) < maxWarnings)
             {
-              ++numWarnings;
-              g_warning("Sequence fetch failed for '%s': %s\n", blxSequenceGetName(fetchData->currentSeq), fetchData->currentResult->str);
+              fetchReportMessage(fetchData, G_LOG_LEVEL_WARNING, "Sequence fetch failed for '%s': %s\n", blxSequenceGetName(fetchData->currentSeq), fetchData->currentResult->str);
             }
         }
       else if (!isValidIupacChar(fetchData->currentResult->str[0], fetchData->seqType))
         {
-          if (numWarnings < maxWarnings)
+          if (g_atomic_int_add(&numWarnings, 1) < maxWarnings)
             {
-              ++numWarnings;
-              g_warning("Sequence fetch failed for '%s': invalid character '%c' found in fetched text: %s\n", blxSequenceGetName(fetchData->currentSeq), fetchData->currentResult->str[0], fetchData->currentResult->str);
+              fetchReportMessage(fetchData, G_LOG_LEVEL_WARNING, "Sequence fetch failed for '%s': invalid character '%c' found in fetched text: %s\n", blxSequenceGetName(fetchData->currentSeq), fetchData->currentResult->str[0], fetchData->currentResult->str);
             }
         }
       else
@@ -2690,6 +3100,31 @@ static gboolean fetchMethodReturnsOptionalColumns(const BlxFetchMethod* const fe
 }
 
 
+/* Returns true if the results of the given fetch method should be saved
+ * in the local sequence cache. Methods that return gff for re-parsing are
+ * excluded because their results are features rather than sequence data,
+ * as are methods that are already local or that don't fetch anything. */
+static gboolean fetchMethodIsCacheable(const BlxFetchMethod* const fetchMethod)
+{
+  gboolean result = FALSE;
+
+  if (fetchMethod)
+    {
+      result =
+        fetchMethod->mode != BLXFETCH_MODE_WWW &&
+        fetchMethod->mode != BLXFETCH_MODE_SQLITE &&
+        fetchMethod->mode != BLXFETCH_MODE_INTERNAL &&
+        fetchMethod->mode != BLXFETCH_MODE_NONE &&
+        (fetchMethod->outputType == BLXFETCH_OUTPUT_RAW ||
+         fetchMethod->outputType == BLXFETCH_OUTPUT_FASTA ||
+         fetchMethod->outputType == BLXFETCH_OUTPUT_EMBL ||
+         fetchMethod->outputType == BLXFETCH_OUTPUT_LIST);
+    }
+
+  return result;
+}
+
+
 static const BlxFetchMethod* findFetchMethod(const BlxFetchMode mode,
                                              const BlxFetchOutputType outputType,
                                              GHashTable *fetchMethods)
@@ -2816,6 +3251,68 @@ static GHashTable* getSeqsToPopulate(GList *inputList,
 }
 
 
+/* Run the given fetch command and capture its standard output in memory. Returns
+ * the output, which should be free'd by the caller with g_free, or NULL if the
+ * command failed. This does not touch any GTK or blixem state (and does not log
+ * any messages, because our log handlers use GTK) so it is safe to call from a
+ * worker thread. */
+static char* getFetchCommandOutput(GString *command, const char *fetchName, GError **error)
+{
+  char *result = NULL;
+  char *argv[] = {(char*)"/bin/sh", (char*)"-c", command->str, NULL};
+  int exitStatus = 0;
+  GError *tmpError = NULL;
+
+  const gboolean ok = g_spawn_sync(NULL, argv, NULL, (GSpawnFlags)0, NULL, NULL,
+                                   &result, NULL, &exitStatus, &tmpError);
+
+  if (!ok || tmpError || exitStatus != 0)
+    {
+      if (tmpError)
+        prefixError(tmpError, "  %s: Command failed: ", fetchName);
+      else
+        g_set_error(&tmpError, BLX_ERROR, 1, "  %s: Command failed.\n", fetchName);
+
+      g_free(result);
+      result = NULL;
+    }
+
+  if (tmpError)
+    g_propagate_error(error, tmpError);
+
+  return result;
+}
+
+
+/* Save the output from a fetch command to a temp file so the user can inspect
+ * it (used when the 'save temp files' option is on). */
+static void saveFetchOutputToTempFile(const char *output, const char *fetchName)
+{
+  const char *tmpDir = getSystemTempDir();
+  char *fileName = g_strdup_printf("%s/%s_%s", tmpDir, MKSTEMP_CONST_CHARS_GFF, MKSTEMP_REPLACEMENT_CHARS);
+  int fileDesc = g_mkstemp(fileName);
+
+  if (fileDesc == -1)
+    {
+      g_warning("%s: Error creating temp file for fetch results (filename=%s)\n", fetchName, fileName);
+    }
+  else
+    {
+      close(fileDesc);
+
+      if (g_file_set_contents(fileName, output, -1, NULL))
+        g_message_info("%s: fetch results saved to '%s'\n", fetchName, fileName);
+      else
+        g_warning("%s: Error writing fetch results to temp file '%s'\n", fetchName, fileName);
+    }
+
+  g_free(fileName);
+}
+
+
+/* Run the given fetch command and parse its (GFF) output into newMsps/newSeqs.
+ * The output is piped straight into the parser; if saveTempFiles is true it
+ * is captured in memory first so that it can also be saved to a temp file. */
 void sendFetchOutputToFile(GString *command,
                            GKeyFile *keyFile,
                            BlxBlastMode *blastMode,
@@ -2834,123 +3331,128 @@ void sendFetchOutputToFile(GString *command,
                            const IntRange* const refSeqRange,
                            GError **error)
 {
-  /* Create a temp file for the results */
-  const char *tmpDir = getSystemTempDir();
-  char *fileName = g_strdup_printf("%s/%s_%s", tmpDir, MKSTEMP_CONST_CHARS_GFF, MKSTEMP_REPLACEMENT_CHARS);
-  int fileDesc = g_mkstemp(fileName);
   GError *tmpError = NULL;
 
-  if (!fileName || fileDesc == -1)
-    {
-      g_set_error(&tmpError, BLX_ERROR, 1, "  %s: Error creating temp file for fetch results (filename=%s)\n", fetchName, fileName);
-    }
+  /* There is no display in headless mode; progress goes to the console only */
+  GtkWidget *dialog = NULL;
 
-  if (fileDesc != -1)
+  if (!fetchHeadless_G)
     {
-      close(fileDesc);
+      dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_MODAL, GTK_MESSAGE_INFO, GTK_BUTTONS_NONE, "Fetching features...");
+      gtk_widget_show_all(dialog);
     }
 
-  if (!tmpError)
-    {
-      /* Send the output to the temp file */
-      g_string_append_printf(command, " > %s", fileName);
-
-      FILE *outputFile = fopen(fileName, "w");
+  g_debug("Fetch command:\n%s\n", command->str);
+  g_message_info("Executing fetch...\n");
 
-      g_debug("Fetch command:\n%s\n", command->str);
-
-      GtkWidget *dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_MODAL, GTK_MESSAGE_INFO, GTK_BUTTONS_NONE, "Fetching features...");
-      gtk_widget_show_all(dialog);
+  if (saveTempFiles)
+    {
+      char *output = getFetchCommandOutput(command, fetchName, &tmpError);
 
-      g_message_info("Executing fetch...\n");
-      const gboolean success = (system(command->str) == 0);
+      if (output)
+        {
+          saveFetchOutputToTempFile(output, fetchName);
+          g_message_info("Parsing fetch results...");
 
-      gtk_widget_destroy(dialog);
+          loadNativeStream(NULL, output, keyFile, blastMode, featureLists,
+                           supportedTypes, styles, newMsps, newSeqs, columnList,
+                           lookupTable, refSeqOffset, refSeqRange, &tmpError);
 
-      fclose(outputFile);
+          g_free(output);
+        }
+    }
+  else
+    {
+      FILE *pipe = popen(command->str, "r");
 
-      if (success)
+      if (pipe)
         {
-          /* Parse the results */
-          g_message_info("... ok.\n");
           g_message_info("Parsing fetch results...");
 
-          loadNativeFile(fileName, NULL, keyFile, blastMode, featureLists,
-                         supportedTypes, styles, newMsps, newSeqs, columnList,
-                         lookupTable, refSeqOffset, refSeqRange, &tmpError);
+          loadNativeStream(pipe, NULL, keyFile, blastMode, featureLists,
+                           supportedTypes, styles, newMsps, newSeqs, columnList,
+                           lookupTable, refSeqOffset, refSeqRange, &tmpError);
 
-          if (!tmpError)
-            {
-              g_message_info("... ok.\n");
-            }
-          else
-            {
-              g_message_info("... failed.\n");
-            }
+          if (pclose(pipe) != 0 && !tmpError)
+            g_set_error(&tmpError, BLX_ERROR, 1, "  %s: Command failed.\n", fetchName);
         }
       else
         {
-          g_message_info("... failed.\n");
-          g_set_error(&tmpError, BLX_ERROR, 1, "  %s: Command failed.\n", fetchName);
+          g_set_error(&tmpError, BLX_ERROR, 1, "  %s: Error executing command: %s\n", fetchName, strerror(errno));
         }
     }
 
-  /* Delete the temp file (unless the 'save temp files' option is on) */
-  if (!saveTempFiles)
+  if (dialog)
+    gtk_widget_destroy(dialog);
+
+  if (!tmpError)
+    {
+      g_message_info("... ok.\n");
+    }
+  else
     {
-      if (unlink(fileName) != 0)
-        g_warning("Error removing temp file '%s'.\n", fileName);
+      g_message_info("... failed.\n");
+      g_propagate_error(error, tmpError);
     }
+}
 
-  g_free(fileName);
 
-  if (tmpError)
-    g_propagate_error(error, tmpError);
+/* The result of a single region fetch, passed back from the worker thread
+ * that ran the fetch command to the thread that parses the results */
+typedef struct _RegionFetchResult
+{
+  char *output;                 /* the command output, or NULL if it failed */
+  GError *error;                /* set if the command failed */
+} RegionFetchResult;
+
+
+/* Shared data for the region-fetch thread pool */
+typedef struct _RegionFetchPoolData
+{
+  GAsyncQueue *resultQueue;     /* completed RegionFetchResults are pushed onto this queue */
+  const char *fetchName;        /* the fetch method name (for error messages) */
+} RegionFetchPoolData;
+
+
+/* Thread-pool function for concurrent region fetches. 'data' is the
+ * command to run (which is free'd here) and 'user_data' is the
+ * RegionFetchPoolData. */
+static void regionFetchThreadFunc(gpointer data, gpointer user_data)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FETCH, "regionFetch");
+
+  GString *command = (GString*)data;
+  RegionFetchPoolData *poolData = (RegionFetchPoolData*)user_data;
+  RegionFetchResult *result = g_new0(RegionFetchResult, 1);
+
+  result->output = getFetchCommandOutput(command, poolData->fetchName, &result->error);
+
+  g_string_free(command, TRUE);
+  g_async_queue_push(poolData->resultQueue, result);
 }
 
 
-/* Called by regionFetchList. Fetches the sequences for a specific region.
- *   tmpDir is the directory in which to place the temporary files
- *   script is the script to call to do the fetch
- *   dataset will be passed as the -dataset argument to the script if it is not null */
-void BulkFetch::regionFetchFeature(const MSP* const msp,
+/* Called by regionFetchList for each region. Parses the given GFF output from
+ * the fetch command and merges the resulting features into our lists. This
+ * must be called from the main thread because the parser updates the shared
+ * feature lists and lookup table and may report messages via GTK. */
+void BulkFetch::regionFetchFeature(const char *output,
                                    const BlxFetchMethod* const fetchMethod,
-                                   const char *script,
-                                   const char *dataset,
-                                   const char *tmpDir,
                                    GError **error)
 {
   GKeyFile *keyFile = blxGetConfig();
   const char *fetchName = g_quark_to_string(fetchMethod->name);
-  GError *tmpError = NULL;
+  MSP *newMsps  = NULL;
+  GList *newSeqs = NULL;
 
-  /* Get the command string, including the args */
-  GString *command = getFetchCommand(fetchMethod, NULL,
-                                     msp, mspGetRefName(msp),
-                                     refSeqOffset, refSeqRange,
-                                     dataset, &tmpError);
+  if (saveTempFiles)
+    saveFetchOutputToTempFile(output, fetchName);
 
-  if (tmpError)
-    prefixError(tmpError, "  %s: Error constructing fetch command:\n", fetchName);
+  loadNativeStream(NULL, output, keyFile, blastMode, featureLists,
+                   supportedTypes, styles, &newMsps, &newSeqs, columnList,
+                   lookupTable, refSeqOffset, refSeqRange, error);
 
-  if (!tmpError)
-    {
-      MSP *newMsps  = NULL;
-      GList *newSeqs = NULL;
-
-      sendFetchOutputToFile(command, keyFile, blastMode,
-                            featureLists, supportedTypes, styles,
-                            seqList, mspList, fetchName, saveTempFiles,
-                            &newMsps, &newSeqs, columnList, lookupTable, refSeqOffset, refSeqRange, &tmpError);
-
-      blxMergeFeatures(newMsps, newSeqs, mspList, seqList);
-    }
-
-  if (command)
-    g_string_free(command, TRUE);
-
-  if (tmpError)
-    g_propagate_error(error, tmpError);
+  blxMergeFeatures(newMsps, newSeqs, mspList, seqList, &mspListTail, &seqListTail);
 }
 
 
@@ -2958,9 +3460,10 @@ void BulkFetch::regionFetchFeature(const MSP* const msp,
  * script and arguments to call to fetch the sequences.
  * The input GList contains a list of BlxSequences that are parent objects for
  * MSPs that identify regions. For each region, the script is called to fetch
- * all sequences that lie within that region, and the results are placed in
- * a temporary GFF file, which is then parsed to get the results. The GFF file
- * is deleted when finished, unless the saveTempFiles argument is true. */
+ * all sequences that lie within that region and its GFF output is parsed to
+ * get the results. Up to fetchMethod->maxParallel fetch commands are run at
+ * once on a thread pool; their output is collected in memory and handed back
+ * through a queue, and parsed here as each one completes. */
 void BulkFetch::regionFetchList(GList *regionsToFetch,
                                 const BlxFetchMethod* const fetchMethod,
                                 GError **error)
@@ -2974,9 +3477,11 @@ void BulkFetch::regionFetchList(GList *regionsToFetch,
       return;
     }
 
-  const char *tmpDir = getSystemTempDir();
+  const char *fetchName = g_quark_to_string(fetchMethod->name);
 
-  /* Loop through each region, creating a GFF file with the results for each region */
+  /* Compile the list of commands for all regions that are at least
+   * partly inside our display range */
+  GList *commands = NULL;
   GList *regionItem = regionsToFetch;
   GError *tmpError = NULL;
 
@@ -2985,18 +3490,116 @@ void BulkFetch::regionFetchList(GList *regionsToFetch,
       BlxSequence *blxSeq = (BlxSequence*)(regionItem->data);
       GList *mspItem = blxSeq->mspList;
 
-      for ( ; mspItem; mspItem = mspItem->next)
+      for ( ; mspItem && !tmpError; mspItem = mspItem->next)
         {
           const MSP* const msp = (const MSP*)(mspItem->data);
 
-          /* Only fetch regions that are at least partly inside our display range */
           if (!rangesOverlap(&msp->qRange, refSeqRange))
             continue;
 
-          regionFetchFeature(msp, fetchMethod, script, dataset, tmpDir, &tmpError);
+          GString *command = getFetchCommand(fetchMethod, NULL,
+                                             msp, mspGetRefName(msp),
+                                             refSeqOffset, refSeqRange,
+                                             dataset, &tmpError);
+
+          if (tmpError)
+            prefixError(tmpError, "  %s: Error constructing fetch command:\n", fetchName);
+          else if (command)
+            commands = g_list_append(commands, command);
         }
     }
 
+  const int numCommands = g_list_length(commands);
+
+  if (numCommands > 0)
+    {
+      /* There is no display in headless mode; progress goes to the console only */
+      GtkWidget *dialog = NULL;
+
+      if (!fetchHeadless_G)
+        {
+          dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_MODAL, GTK_MESSAGE_INFO, GTK_BUTTONS_NONE, "Fetching features...");
+          gtk_widget_show_all(dialog);
+        }
+
+      const int numThreads = min(fetchMethod->maxParallel, numCommands);
+      g_message_info("Executing %d fetches using method '%s' (max %d at once)...\n", numCommands, fetchName, numThreads);
+
+      RegionFetchPoolData poolData = {g_async_queue_new(), fetchName};
+      GThreadPool *pool = g_thread_pool_new(regionFetchThreadFunc, &poolData, numThreads, FALSE, NULL);
+
+      for (GList *item = commands; item; item = item->next)
+        {
+          GString *command = (GString*)(item->data);
+          g_debug("Fetch command:\n%s\n", command->str);
+
+          /* Run in this thread if we couldn't create a thread pool (the result is
+           * queued either way). The commands are free'd by regionFetchThreadFunc. */
+          if (pool)
+            g_thread_pool_push(pool, command, NULL);
+          else
+            regionFetchThreadFunc(command, &poolData);
+        }
+
+      /* Parse the results as they arrive. Wait with a timeout so that we can
+       * keep processing events (otherwise the UI freezes and the dialog is
+       * never drawn) */
+      int numFailed = 0;
+      int i = 0;
+
+      while (i < numCommands)
+        {
+          RegionFetchResult *result = (RegionFetchResult*)g_async_queue_timeout_pop(poolData.resultQueue, 50000);
+
+          fetchProcessPendingEvents();
+
+          if (!result)
+            continue;
+
+          ++i;
+          GError *fetchError = result->error;
+
+          if (result->output)
+            regionFetchFeature(result->output, fetchMethod, &fetchError);
+
+          if (fetchError)
+            {
+              ++numFailed;
+
+              /* Compile all errors into a single error */
+              if (tmpError)
+                {
+                  postfixError(tmpError, "%s", fetchError->message);
+                  g_error_free(fetchError);
+                }
+              else
+                {
+                  tmpError = fetchError;
+                }
+            }
+
+          g_free(result->output);
+          g_free(result);
+
+          if (fetchHeadless_G)
+            g_message_info("  %d of %d fetches complete\n", i, numCommands);
+        }
+
+      if (pool)
+        g_thread_pool_free(pool, FALSE, TRUE);
+
+      g_async_queue_unref(poolData.resultQueue);
+      g_list_free(commands);
+
+      if (dialog)
+        gtk_widget_destroy(dialog);
+
+      if (numFailed > 0)
+        g_message_info("... %d of %d fetches failed.\n", numFailed, numCommands);
+      else
+        g_message_info("... ok.\n");
+    }
+
   if (tmpError)
     g_propagate_error(error, tmpError);
 }
@@ -3120,6 +3723,8 @@ UserFetch::UserFetch(const BlxSequence *blxSeq_in,
  * they should remain as NULL in all other cases. */
 void UserFetch::performFetch()
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FETCH, "userFetch");
+
   BlxContext *bc = blxWindowGetContext(blxWindow);
   g_return_if_fail(blxSeq && bc);
 
@@ -3564,6 +4169,8 @@ BulkFetch::BulkFetch(gboolean External_in,
   defaultFetchMethods = defaultFetchMethods_in;
   fetchMethods = fetchMethods_in;
   mspList = mspList_in;
+  mspListTail = NULL;
+  seqListTail = NULL;
   blastMode = blastMode_in;
   featureLists = featureLists_in;
   supportedTypes = supportedTypes_in;
@@ -3586,22 +4193,142 @@ BulkFetch::BulkFetch(gboolean External_in,
 /* Find out if we need to fetch any sequences (they may all be
  * contained in the input files so there might not be anything to
  * fetch). If we do need to, then fetch them by the preferred method.
- * If the preferred fetch method fails, recusively try any other
- * fetch methods set up for each sequence until we have either fetched
- * everything or run out of fetch methods to try.
- * 'attempt' should be passed as 0 for the first call. */
+ * If the preferred fetch method fails, try any other fetch methods set
+ * up for each sequence until we have either fetched everything or run
+ * out of fetch methods to try. */
 gboolean BulkFetch::performFetch()
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FETCH, "bulkFetch");
+
+  attempt = 0;
+
+  /* Fill in what we can from the local cache first and only fetch the rest */
+  GList *seqsToFetch = getUncachedSeqs(*seqList);
+
+  gboolean success = fetchAttempt(seqsToFetch, 0);
+
+  g_list_free(seqsToFetch);
+
+  blxSeqCacheEvict();
+  blxSeqCacheReportStats();
+
+  return success;
+}
+
+
+/* Look up the given sequences in the local sequence cache, trying each of
+ * the fetch methods that would be used to fetch them in turn. Returns a new
+ * list of the sequences that still need to be fetched (which should be
+ * free'd by the caller with g_list_free). */
+GList* BulkFetch::getUncachedSeqs(GList *seqs)
+{
+  if (!blxSeqCacheEnabled())
+    return g_list_copy(seqs);
+
+  GList *result = NULL;
+  GList *item = seqs;
+
+  for ( ; item; item = item->next)
+    {
+      BlxSequence *blxSeq = (BlxSequence*)(item->data);
+
+      const gboolean needSeq = blxSequenceRequiresSeqData(blxSeq) && !blxSequenceGetSequence(blxSeq);
+      const gboolean needOptional = blxSequenceRequiresOptionalData(blxSeq);
+
+      if (!needSeq && !needOptional)
+        {
+          /* Nothing to look up; getSeqsToPopulate will exclude it */
+          result = g_list_prepend(result, blxSeq);
+          continue;
+        }
+
+      gboolean found = FALSE;
+      gboolean hasOptional = FALSE;
+      const BlxFetchMethod *preferredMethod = NULL;
+      int i = 0;
+      GQuark fetchMethodQuark = blxSequenceGetFetchMethod(blxSeq, TRUE, optionalColumns, i, defaultFetchMethods);
+
+      for ( ; fetchMethodQuark && !found; fetchMethodQuark = blxSequenceGetFetchMethod(blxSeq, TRUE, optionalColumns, ++i, defaultFetchMethods))
+        {
+          const BlxFetchMethod *fetchMethod = getFetchMethodDetails(fetchMethodQuark, fetchMethods);
+
+          if (!preferredMethod)
+            preferredMethod = fetchMethod;
+
+          /* If we're forcing optional data to be loaded then the fetch is
+           * done with an embl method of the same mode (see getSeqsToPopulate),
+           * so the data will have been cached under that method */
+          if (fetchMethod && needOptional && optionalColumns && !fetchMethodReturnsOptionalColumns(fetchMethod))
+            fetchMethod = findFetchMethod(fetchMethod->mode, BLXFETCH_OUTPUT_EMBL, fetchMethods);
+
+          if (fetchMethodIsCacheable(fetchMethod))
+            found = blxSeqCacheLookup(fetchMethod->name, blxSeq, &hasOptional);
+        }
+
+      /* The sequence is done with if we now have the sequence data and the
+       * optional data, or if the optional data would not have been fetched
+       * anyway */
+      const gboolean haveSeq = !blxSequenceRequiresSeqData(blxSeq) || blxSequenceGetSequence(blxSeq);
+      const gboolean haveOptional = !needOptional || hasOptional ||
+        (!optionalColumns && !fetchMethodReturnsOptionalColumns(preferredMethod));
+
+      if (!found || !haveSeq || !haveOptional)
+        result = g_list_prepend(result, blxSeq);
+    }
+
+  return g_list_reverse(result);
+}
+
+
+/* Save the data we've fetched for the given sequences using the given
+ * fetch method to the local sequence cache */
+void BulkFetch::cacheFetchedSeqs(GList *seqs, const BlxFetchMethod* const fetchMethod)
+{
+  if (!blxSeqCacheEnabled() || !fetchMethodIsCacheable(fetchMethod))
+    return;
+
+  GList *item = seqs;
+
+  for ( ; item; item = item->next)
+    {
+      const BlxSequence *blxSeq = (const BlxSequence*)(item->data);
+
+      /* Don't cache sequences that the fetch failed to find (we can't tell
+       * that apart from a failed fetch if nothing at all was returned) */
+      if (blxSequenceRequiresSeqData(blxSeq) && !blxSequenceGetSequence(blxSeq))
+        continue;
+
+      if (!blxSequenceGetSequence(blxSeq) && !blxSequenceGetOrganism(blxSeq) && !blxSequenceGetGeneName(blxSeq) &&
+          !blxSequenceGetTissueType(blxSeq) && !blxSequenceGetStrain(blxSeq))
+        continue;
+
+      const gboolean hasOptional = blxSequenceRequiresOptionalData(blxSeq) && fetchMethodReturnsOptionalColumns(fetchMethod);
+
+      blxSeqCacheStore(fetchMethod->name, blxSeq, hasOptional);
+    }
+}
+
+
+/* Fetch the given sequences using the fetch method for the given attempt
+ * number (0 for the preferred method, 1 for the first fallback etc.).
+ * Sequences are grouped by fetch method; as soon as a group has been
+ * fetched, any of its sequences that still need data cascade straight on
+ * to their next fetch method rather than waiting for every other group to
+ * finish this attempt first. Any new sequences that the fetch added to the
+ * main sequence list (e.g. from a region fetch) cascade on with them. */
+gboolean BulkFetch::fetchAttempt(GList *seqs, const int attemptIn)
 {
   gboolean success = FALSE; /* will get set to true if any of the fetch methods succeed */
 
-  ++attempt;
+  if (attemptIn > attempt)
+    attempt = attemptIn;
 
   /* Fetch any sequences that do not have their sequence data
    * already populated. If this is a re-try attempt, then use
    * a secondary fetch method, if one is given; otherwise, exclude
    * from the list (i.e. when we run out of fetch methods or everything
    * has been successfully fetched, then this table will be empty). */
-  GHashTable *seqsTable = getSeqsToPopulate(*seqList, defaultFetchMethods, attempt, fetchMethods, optionalColumns);
+  GHashTable *seqsTable = getSeqsToPopulate(seqs, defaultFetchMethods, attemptIn, fetchMethods, optionalColumns);
 
   if (g_hash_table_size(seqsTable) < 1)
     {
@@ -3614,68 +4341,70 @@ gboolean BulkFetch::performFetch()
       GHashTableIter iter;
       g_hash_table_iter_init(&iter, seqsTable);
       gpointer key, value;
+      gboolean fetched = FALSE; /* true if any fetch in this attempt succeeded */
       GError *error = NULL;
 
       while (g_hash_table_iter_next(&iter, &key, &value))
         {
           GList *seqsToFetch = (GList*)value;
           GQuark fetchMethodQuark = GPOINTER_TO_INT(key);
+          const BlxFetchMethod* const fetchMethod = fetchMethodQuark ? getFetchMethodDetails(fetchMethodQuark, fetchMethods) : NULL;
 
-          if (!fetchMethodQuark)
-            continue;
-
-          g_message_info("Fetching %d items using method '%s' (attempt %d)\n", g_list_length(seqsToFetch), g_quark_to_string(fetchMethodQuark), attempt + 1);
-
-          const BlxFetchMethod* const fetchMethod = getFetchMethodDetails(fetchMethodQuark, fetchMethods);
-
-          if (!fetchMethod)
+          if (fetchMethod)
             {
-              g_warning("Fetch method '%s' not found\n", g_quark_to_string(fetchMethodQuark));
-              continue;
-            }
+              g_message_info("Fetching %d items using method '%s' (attempt %d)\n", g_list_length(seqsToFetch), g_quark_to_string(fetchMethodQuark), attemptIn + 1);
 
-          GError *tmpError = NULL;
+              GError *tmpError = NULL;
+              GList *lastSeq = g_list_last(*seqList);
 
-          if (fetchList(seqsToFetch, fetchMethod, &tmpError))
-            {
-              success = TRUE;
+              if (fetchList(seqsToFetch, fetchMethod, &tmpError))
+                fetched = TRUE;
+
+              cacheFetchedSeqs(seqsToFetch, fetchMethod);
 
               /* Compile all errors into a single error */
               if (error && tmpError)
                 {
-                  prefixError(error, tmpError->message);
+                  postfixError(error, "%s", tmpError->message);
                   g_error_free(tmpError);
-                  tmpError = NULL;
                 }
               else if (tmpError)
                 {
                   error = tmpError;
                 }
+
+              /* New sequences are appended to the main list (see blxMergeFeatures).
+               * Add any of these that are not in the cache to the sequences to
+               * try again. */
+              GList *newSeqs = getUncachedSeqs(lastSeq ? lastSeq->next : *seqList);
+              seqsToFetch = g_list_concat(seqsToFetch, newSeqs);
             }
+          else if (fetchMethodQuark)
+            {
+              g_warning("Fetch method '%s' not found\n", g_quark_to_string(fetchMethodQuark));
+            }
+
+          /* Cascade any that failed (or that were skipped this time round)
+           * on to their next fetch method. This returns straight away if
+           * everything was fetched successfully, or if there are no more
+           * fetch methods to try. */
+          success = fetchAttempt(seqsToFetch, attemptIn + 1) || success;
 
           /* We're done with this list now, so free the memory. Don't delete it from
            * the table yet, though, because that will invalidate the iterators. */
           g_list_free(seqsToFetch);
         }
 
-      if (success && error)
-        {
-          /* Some fetches succeeded, so just issue a warning */
-          prefixError(error, "Error fetching sequences:\n");
-          reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
-        }
-      else if (error)
+      if (fetched)
+        success = TRUE;
+
+      if (error)
         {
-          /* All failed, so issue a critical warning */
+          /* If some fetches succeeded just issue a warning; if all failed
+           * then issue a critical warning */
           prefixError(error, "Error fetching sequences:\n");
-          reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+          reportAndClearIfError(&error, fetched ? G_LOG_LEVEL_WARNING : G_LOG_LEVEL_CRITICAL);
         }
-
-
-      /* Recurse to re-try any that failed. This returns straight
-       * away everything was fetched successfully, or if there are
-       * no more fetch methods to try. */
-      success = performFetch();
     }
 
   /* Clean up */
@@ -60,6 +60,7 @@ typedef struct _SqliteFetchData
 {
   GList *seqList;
   GList *columnList;
+  GHashTable *seqTable;         /* optional lookup of lower-case sequence name to BlxSequence */
 } SqliteFetchData;
 
 
@@ -152,7 +153,15 @@ static int populateResultsListCB(void *data, int argc, char **argv, char **azCol
 
       if (column == nameCol)
         {
-          blxSeq = findBlxSequence(argv[i], fetchData->seqList);
+          if (fetchData->seqTable && argv[i])
+            {
+              /* Names are compared case-insensitively */
+              char *key = g_ascii_strdown(argv[i], -1);
+              blxSeq = (BlxSequence*)g_hash_table_lookup(fetchData->seqTable, key);
+              g_free(key);
+            }
+          else
+            blxSeq = findBlxSequence(argv[i], fetchData->seqList);
         }
     }
 
@@ -250,7 +259,28 @@ void sqliteFetchSequences(GList *seqsToFetch,
       query = getFetchArgsMultiple(fetchMethod, seqsToFetch, &tmpError);
     }
 
-  SqliteFetchData fetchData = {seqsToFetch, columnList};
+  /* Look up result rows by name in a hash table rather than searching the
+   * list for every row, which is quadratic for large fetches */
+  GHashTable *seqTable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (GList *item = seqsToFetch; item; item = item->next)
+    {
+      BlxSequence *blxSeq = (BlxSequence*)(item->data);
+      const char *seqName = blxSequenceGetName(blxSeq);
+
+      /* Keep the first sequence with a given name, as the list search did */
+      if (seqName)
+        {
+          char *key = g_ascii_strdown(seqName, -1);
+
+          if (!g_hash_table_lookup(seqTable, key))
+            g_hash_table_insert(seqTable, key, blxSeq);
+          else
+            g_free(key);
+        }
+    }
+
+  SqliteFetchData fetchData = {seqsToFetch, columnList, seqTable};
 
   if (query && !tmpError)
     {
@@ -261,7 +291,10 @@ void sqliteFetchSequences(GList *seqsToFetch,
                     &tmpError);
     }
 
-  g_string_free(query, TRUE);
+  if (query)
+    g_string_free(query, TRUE);
+
+  g_hash_table_unref(seqTable);
 
   if (tmpError)
     g_propagate_error(error, tmpError);
@@ -0,0 +1,349 @@
+/*  File: blxRefSeqCache.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See blxRefSeqCache.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <blixemApp/blxRefSeqCache.hpp>
+
+using namespace std;
+
+
+#define NUM_ORIENTATIONS        4       /* forward, complement, reverse, reverse-complement */
+#define NUM_CODON_FRAMES        3       /* number of translation frames for each orientation */
+#define TRANSLATION_BLOCK_SIZE  8192    /* number of codons translated at a time */
+
+
+/* The orientations are a combination of these flags */
+#define ORIENTATION_COMPLEMENT  1
+#define ORIENTATION_REVERSE     2
+
+
+/* The translation of one frame of one orientation. The full-length string is allocated
+ * when it is first needed but the blocks are only filled in when requested. */
+typedef struct _RefSeqTranslation
+{
+  char *seq;                    /* translated sequence (one char per codon) */
+  int len;                      /* number of codons */
+  volatile gint *blockBuilt;    /* whether each block has been translated */
+} RefSeqTranslation;
+
+
+struct _BlxRefSeqCache
+{
+  const char *refSeq;           /* the reference sequence (forward strand; not owned), or NULL if packed */
+  const BlxPackedSeq *packedSeq;/* the packed reference sequence (not owned), or NULL if not packed */
+  int refSeqLen;
+  IntRange refSeqRange;
+  char **geneticCode;           /* the genetic code the translations were made with */
+
+  char *seqs[NUM_ORIENTATIONS]; /* the ref seq in each orientation; seqs[0] is refSeq itself */
+  RefSeqTranslation *translations[NUM_ORIENTATIONS][NUM_CODON_FRAMES];
+
+  GMutex mutex;                 /* protects building of seqs and translations */
+};
+
+
+/* Create a cache for the given reference sequence, which may be given either as plain
+ * text or packed */
+BlxRefSeqCache* blxRefSeqCacheCreate(const char *refSeq,
+                                     const BlxPackedSeq *packedSeq,
+                                     const IntRange* const refSeqRange,
+                                     char **geneticCode)
+{
+  BlxRefSeqCache *cache = g_new0(BlxRefSeqCache, 1);
+
+  cache->refSeq = refSeq;
+  cache->packedSeq = packedSeq;
+  cache->refSeqLen = packedSeq ? blxPackedSeqGetLength(packedSeq) : refSeq ? strlen(refSeq) : 0;
+  cache->refSeqRange.set(refSeqRange->min(), refSeqRange->max());
+  cache->geneticCode = geneticCode;
+  cache->seqs[0] = (char*)refSeq;
+
+  g_mutex_init(&cache->mutex);
+
+  return cache;
+}
+
+
+void blxRefSeqCacheDestroy(BlxRefSeqCache *cache)
+{
+  if (!cache)
+    return;
+
+  for (int orientation = 0; orientation < NUM_ORIENTATIONS; ++orientation)
+    {
+      if (orientation > 0)
+        g_free(cache->seqs[orientation]);
+
+      for (int frame = 0; frame < NUM_CODON_FRAMES; ++frame)
+        {
+          RefSeqTranslation *translation = cache->translations[orientation][frame];
+
+          if (translation)
+            {
+              g_free(translation->seq);
+              g_free((gpointer)translation->blockBuilt);
+              g_free(translation);
+            }
+        }
+    }
+
+  g_mutex_clear(&cache->mutex);
+  g_free(cache);
+}
+
+
+/* Per-thread buffer that nucleotide segments of a packed ref seq are decoded into */
+static GPrivate g_segmentBuffer = G_PRIVATE_INIT((GDestroyNotify)g_byte_array_unref);
+
+
+static char* getSegmentBuffer(const int len)
+{
+  GByteArray *buffer = (GByteArray*)g_private_get(&g_segmentBuffer);
+
+  if (!buffer)
+    {
+      buffer = g_byte_array_new();
+      g_private_set(&g_segmentBuffer, buffer);
+    }
+
+  g_byte_array_set_size(buffer, len + 1);
+
+  return (char*)buffer->data;
+}
+
+
+/* Get the ref seq in the given orientation, creating it if it doesn't exist yet. Not
+ * used if the ref seq is packed. */
+static const char* getOrientedSeq(BlxRefSeqCache *cache, const int orientation)
+{
+  char *result = (char*)g_atomic_pointer_get(&cache->seqs[orientation]);
+
+  if (!result)
+    {
+      g_mutex_lock(&cache->mutex);
+
+      result = cache->seqs[orientation];
+
+      if (!result)
+        {
+          result = g_strdup(cache->refSeq);
+
+          if (orientation & ORIENTATION_COMPLEMENT)
+            blxComplement(result);
+
+          if (orientation & ORIENTATION_REVERSE)
+            g_strreverse(result);
+
+          g_atomic_pointer_set(&cache->seqs[orientation], result);
+        }
+
+      g_mutex_unlock(&cache->mutex);
+    }
+
+  return result;
+}
+
+
+/* Get the translation of the given frame of the given orientation, making sure the
+ * codons in the range [startCodon, endCodon] have been translated */
+static const char* getTranslation(BlxRefSeqCache *cache, const int orientation, const int frame,
+                                  const int startCodon, const int endCodon)
+{
+  RefSeqTranslation *translation = (RefSeqTranslation*)g_atomic_pointer_get(&cache->translations[orientation][frame]);
+
+  if (!translation)
+    {
+      /* Get the source sequence before taking the lock, because this may also need to lock */
+      if (!cache->packedSeq)
+        getOrientedSeq(cache, orientation);
+
+      g_mutex_lock(&cache->mutex);
+
+      translation = cache->translations[orientation][frame];
+
+      if (!translation)
+        {
+          translation = g_new0(RefSeqTranslation, 1);
+          translation->len = max(0, (cache->refSeqLen - frame) / 3);
+
+          const int numBlocks = (translation->len + TRANSLATION_BLOCK_SIZE - 1) / TRANSLATION_BLOCK_SIZE;
+          translation->seq = (char*)g_malloc(translation->len + 1);
+          translation->seq[translation->len] = '\0';
+          translation->blockBuilt = g_new0(gint, max(numBlocks, 1));
+
+          g_atomic_pointer_set(&cache->translations[orientation][frame], translation);
+        }
+
+      g_mutex_unlock(&cache->mutex);
+    }
+
+  const int startBlock = startCodon / TRANSLATION_BLOCK_SIZE;
+  const int endBlock = endCodon / TRANSLATION_BLOCK_SIZE;
+
+  for (int block = startBlock; block <= endBlock && endCodon < translation->len; ++block)
+    {
+      if (g_atomic_int_get(&translation->blockBuilt[block]))
+        continue;
+
+      g_mutex_lock(&cache->mutex);
+
+      if (!translation->blockBuilt[block])
+        {
+          /* Translate the nucleotides for this block of codons. The genetic code is only
+           * ever single-letter in Blixem, so the translation has one char per codon. */
+          const int blockStart = block * TRANSLATION_BLOCK_SIZE;
+          const int blockLen = min(TRANSLATION_BLOCK_SIZE, translation->len - blockStart);
+          const int dnaStart = frame + blockStart * 3;
+          const int dnaLen = blockLen * 3;
+          char *dna = NULL;
+
+          if (cache->packedSeq)
+            {
+              /* Decode the block's bases in this orientation. A reversed block starting at
+               * dnaStart comes from the forward-strand bases ending at refSeqLen - 1 - dnaStart. */
+              const int fwdStart = (orientation & ORIENTATION_REVERSE) ? cache->refSeqLen - dnaStart - dnaLen : dnaStart;
+
+              dna = blxPackedSeqDecodeNew(cache->packedSeq, fwdStart, dnaLen,
+                                          orientation & ORIENTATION_COMPLEMENT, orientation & ORIENTATION_REVERSE);
+            }
+          else
+            {
+              dna = g_strndup(cache->seqs[orientation] + dnaStart, dnaLen);
+            }
+
+          char *peptide = blxTranslate(dna, cache->geneticCode);
+
+          memcpy(translation->seq + blockStart, peptide, blockLen);
+
+          g_free(peptide);
+          g_free(dna);
+
+          g_atomic_int_set(&translation->blockBuilt[block], TRUE);
+        }
+
+      g_mutex_unlock(&cache->mutex);
+    }
+
+  return translation->seq;
+}
+
+
+/* Get a view of a segment of the reference sequence. This gives the same result as
+ * getSequenceSegment for the context's reference sequence and genetic code (and sets
+ * the same errors), but returns a pointer into the cache rather than a new string.
+ * The length of the segment is returned in len_out; the result is not nul-terminated
+ * at that length. */
+const char* blxRefSeqCacheGetSegment(BlxRefSeqCache *cache,
+                                     const IntRange* const qRangeIn,
+                                     const BlxStrand strand,
+                                     const BlxSeqType destSeqType,
+                                     const int numFrames,
+                                     const BlxBlastMode blastMode,
+                                     const gboolean reverseResult,
+                                     const gboolean allowComplement,
+                                     int *len_out,
+                                     GError **error)
+{
+  const IntRange* const refSeqRange = &cache->refSeqRange;
+  IntRange qRange(qRangeIn->min(), qRangeIn->max());
+  GError *tmpError = NULL;
+
+  *len_out = 0;
+
+  if (qRange.min() < refSeqRange->min() || qRange.max() > refSeqRange->max())
+    {
+      /* As for getSequenceSegment, clip to the ref seq range and warn if we are more
+       * than a triplet out */
+      if (!rangesOverlap(qRangeIn, refSeqRange))
+        return NULL;
+
+      if (qRange.min() < refSeqRange->min() - (numFrames + 1) || qRange.max() > refSeqRange->max() + (numFrames + 1))
+        {
+          g_set_error(&tmpError, SEQTOOLS_ERROR, SEQTOOLS_ERROR_SEQ_SEGMENT, "Requested query sequence %d - %d out of available range: %d - %d.\n", qRange.min(), qRange.max(), refSeqRange->min(), refSeqRange->max());
+        }
+
+      qRange.set(max(qRange.min(), refSeqRange->min()), min(qRange.max(), refSeqRange->max()));
+    }
+
+  /* Get 0-based indices into the sequence */
+  const int idx1 = qRange.min() - refSeqRange->min();
+  const int idx2 = qRange.max() - refSeqRange->min();
+  const int segmentLen = idx2 - idx1 + 1;
+
+  int orientation = 0;
+
+  if (strand == BLXSTRAND_REVERSE && allowComplement && blastMode != BLXMODE_TBLASTN && blastMode != BLXMODE_BLASTP)
+    orientation |= ORIENTATION_COMPLEMENT;
+
+  if (reverseResult)
+    orientation |= ORIENTATION_REVERSE;
+
+  /* Find where the segment starts in the oriented sequence */
+  const int start = (orientation & ORIENTATION_REVERSE) ? cache->refSeqLen - 1 - idx2 : idx1;
+  const char *result = NULL;
+
+  if (destSeqType == BLXSEQ_PEPTIDE)
+    {
+      /* The segment's codons are consecutive codons of the translation in the frame
+       * the segment starts in */
+      const int frame = start % NUM_CODON_FRAMES;
+      const int startCodon = start / NUM_CODON_FRAMES;
+      const int numCodons = segmentLen / NUM_CODON_FRAMES;
+
+      result = getTranslation(cache, orientation, frame, startCodon, startCodon + max(numCodons - 1, 0)) + startCodon;
+      *len_out = numCodons;
+    }
+  else if (cache->packedSeq)
+    {
+      char *buffer = getSegmentBuffer(segmentLen);
+      blxPackedSeqDecode(cache->packedSeq, idx1, segmentLen,
+                         orientation & ORIENTATION_COMPLEMENT, orientation & ORIENTATION_REVERSE, buffer);
+
+      result = buffer;
+      *len_out = segmentLen;
+    }
+  else
+    {
+      result = getOrientedSeq(cache, orientation) + start;
+      *len_out = segmentLen;
+    }
+
+  if (tmpError)
+    g_propagate_error(error, tmpError);
+
+  return result;
+}
@@ -0,0 +1,82 @@
+/*  File: blxRefSeqCache.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Cache of the reference sequence in each orientation and
+ *              reading frame.
+ *
+ *              The detail-view headers, the alignment renderer and the %ID
+ *              calculation all need segments of the reference sequence that
+ *              are complemented, reversed and/or translated. Rather than
+ *              building a new string for every request, this holds the
+ *              complemented, reversed and reverse-complemented reference and
+ *              the three frame translations of each, and returns views into
+ *              them. The nucleotide copies are built the first time they are
+ *              needed; translations are built in blocks as they are first
+ *              requested. Views are not nul-terminated and must not be freed.
+ *              It is safe to request segments from multiple threads.
+ *
+ *              If the reference sequence is packed (see blxPackedSeq.hpp), no
+ *              plain-text copies are made: nucleotide segments are decoded
+ *              into a per-thread buffer, so a nucleotide view is only valid
+ *              until the next request from the same thread, and translation
+ *              blocks are decoded from the packed sequence as they are built.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_ref_seq_cache_included_
+#define _blx_ref_seq_cache_included_
+
+#include <glib.h>
+#include <seqtoolsUtils/utilities.hpp>
+#include <seqtoolsUtils/blxPackedSeq.hpp>
+
+
+typedef struct _BlxRefSeqCache BlxRefSeqCache;
+
+
+BlxRefSeqCache*         blxRefSeqCacheCreate(const char *refSeq,
+                                             const BlxPackedSeq *packedSeq,
+                                             const IntRange* const refSeqRange,
+                                             char **geneticCode);
+void                    blxRefSeqCacheDestroy(BlxRefSeqCache *cache);
+
+const char*             blxRefSeqCacheGetSegment(BlxRefSeqCache *cache,
+                                                 const IntRange* const qRangeIn,
+                                                 const BlxStrand strand,
+                                                 const BlxSeqType destSeqType,
+                                                 const int numFrames,
+                                                 const BlxBlastMode blastMode,
+                                                 const gboolean reverseResult,
+                                                 const gboolean allowComplement,
+                                                 int *len_out,
+                                                 GError **error);
+
+
+#endif /* _blx_ref_seq_cache_included_ */
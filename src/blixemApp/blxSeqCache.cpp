@@ -0,0 +1,514 @@
+/*  File: blxSeqCache.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Persistent on-disk cache of fetched sequence data.
+ *
+ *              Sequence data and optional EMBL columns (organism, gene
+ *              name, tissue type, strain) that are fetched by BulkFetch
+ *              are saved to disk so that later Blixem sessions can use
+ *              them without fetching them again. Entries are keyed on
+ *              the fetch method, sequence name and sequence version.
+ *----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <blixemApp/blxSeqCache.hpp>
+
+
+#define CACHE_MAGIC                 "BLXC"
+#define CACHE_FORMAT_VERSION        1
+#define CACHE_FLAG_OPTIONAL_DATA    0x1      /* set if the entry holds the optional (EMBL) columns */
+#define CACHE_EVICT_TARGET          0.9      /* when over the limit, evict down to this fraction of it */
+
+
+/* The fields stored in each cache entry, in the order they appear in the file */
+typedef enum
+  {
+    CACHE_FIELD_KEY,
+    CACHE_FIELD_SEQUENCE,
+    CACHE_FIELD_ORGANISM,
+    CACHE_FIELD_GENE_NAME,
+    CACHE_FIELD_TISSUE_TYPE,
+    CACHE_FIELD_STRAIN,
+
+    CACHE_NUM_FIELDS
+  } CacheField;
+
+
+/* The BlxSequence column that each field is read from / written to */
+static const BlxColumnId cacheFieldColumn[CACHE_NUM_FIELDS] =
+  {
+    BLXCOL_NONE,
+    BLXCOL_SEQUENCE,
+    BLXCOL_ORGANISM,
+    BLXCOL_GENE_NAME,
+    BLXCOL_TISSUE_TYPE,
+    BLXCOL_STRAIN
+  };
+
+
+/* Fixed-size header at the start of each cache file. The fields follow
+ * directly after it as nul-terminated strings, so the strings can be used
+ * in place in a mapped file without any further parsing. */
+typedef struct _CacheFileHeader
+{
+  char magic[4];
+  guint32 formatVersion;
+  guint32 flags;
+  guint32 fieldLen[CACHE_NUM_FIELDS];   /* length of each field, excluding its terminating nul */
+} CacheFileHeader;
+
+
+/* Details about a file in the cache, used when evicting entries */
+typedef struct _CacheFileInfo
+{
+  char *path;
+  time_t lastUsed;
+  gint64 size;
+} CacheFileInfo;
+
+
+/* Local state. The cache is only used from the main thread. */
+static char *cacheDir_G = NULL;              /* directory containing the cache; null if disabled */
+static gint64 cacheMaxSize_G = 0;            /* max size of the cache in bytes */
+static BlxSeqCacheStats cacheStats_G = {0, 0, 0, 0};
+static int storesSinceEvict_G = 0;
+
+
+/********************/
+/* Local functions */
+/********************/
+
+/* Create the key for the given sequence and fetch method. The key is made
+ * up of the fetch method, the sequence name and the sequence version (the
+ * numeric suffix after the last '.' in the name, if any) so that a new
+ * version of a sequence does not pick up old cached data. Returns null if
+ * there is not enough information to create a key. The result should be
+ * free'd with g_free. */
+static char* cacheCreateKey(const GQuark fetchMethod, const BlxSequence *blxSeq)
+{
+  char *result = NULL;
+  const char *name = blxSequenceGetName(blxSeq);
+
+  if (fetchMethod && name && *name)
+    {
+      const char *version = "";
+      int nameLen = strlen(name);
+      const char *dot = strrchr(name, '.');
+
+      if (dot && *(dot + 1))
+        {
+          const char *cp = dot + 1;
+
+          while (g_ascii_isdigit(*cp))
+            ++cp;
+
+          if (*cp == '\0')
+            {
+              version = dot + 1;
+              nameLen = dot - name;
+            }
+        }
+
+      result = g_strdup_printf("%s\t%.*s\t%s", g_quark_to_string(fetchMethod), nameLen, name, version);
+    }
+
+  return result;
+}
+
+
+/* Get the path of the cache file for the given key. Files are spread over
+ * subdirectories named after the first two characters of the key's
+ * checksum to keep directory sizes down. If createDir is true, the
+ * subdirectory is created if it does not already exist. The result should
+ * be free'd with g_free. */
+static char* cacheGetFilePath(const char *key, const gboolean createDir)
+{
+  char *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+  char subdir[3] = {checksum[0], checksum[1], '\0'};
+
+  char *dirPath = g_build_filename(cacheDir_G, subdir, NULL);
+
+  if (createDir)
+    g_mkdir_with_parents(dirPath, 0755);
+
+  char *result = g_build_filename(dirPath, checksum, NULL);
+
+  g_free(dirPath);
+  g_free(checksum);
+
+  return result;
+}
+
+
+/* Check the given file contents are a valid cache entry and, if so, fill in
+ * the header and set the field pointers to point to the strings in the
+ * contents. Returns false if the contents are invalid. */
+static gboolean cacheParseContents(const char *contents,
+                                   const gsize len,
+                                   CacheFileHeader *header,
+                                   const char *fields[])
+{
+  if (!contents || len < sizeof(CacheFileHeader))
+    return FALSE;
+
+  /* Copy the header out rather than casting in case the data is not aligned */
+  memcpy(header, contents, sizeof(CacheFileHeader));
+
+  if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->formatVersion != CACHE_FORMAT_VERSION)
+    {
+      return FALSE;
+    }
+
+  gsize offset = sizeof(CacheFileHeader);
+  int i = 0;
+
+  for ( ; i < CACHE_NUM_FIELDS; ++i)
+    {
+      const gsize fieldLen = header->fieldLen[i];
+
+      if (offset + fieldLen + 1 > len || contents[offset + fieldLen] != '\0')
+        return FALSE;
+
+      fields[i] = contents + offset;
+      offset += fieldLen + 1;
+    }
+
+  return TRUE;
+}
+
+
+/* Get the total size of the cache and, optionally, details of every file
+ * in it. The list should be free'd by the caller. */
+static gint64 cacheScan(GArray *files)
+{
+  gint64 result = 0;
+  GDir *dir = g_dir_open(cacheDir_G, 0, NULL);
+
+  if (!dir)
+    return result;
+
+  const char *subdirName = NULL;
+
+  while ((subdirName = g_dir_read_name(dir)))
+    {
+      char *subdirPath = g_build_filename(cacheDir_G, subdirName, NULL);
+      GDir *subdir = g_dir_open(subdirPath, 0, NULL);
+
+      if (subdir)
+        {
+          const char *fileName = NULL;
+
+          while ((fileName = g_dir_read_name(subdir)))
+            {
+              char *filePath = g_build_filename(subdirPath, fileName, NULL);
+              struct stat statBuf;
+
+              if (g_stat(filePath, &statBuf) == 0 && S_ISREG(statBuf.st_mode))
+                {
+                  result += statBuf.st_size;
+
+                  if (files)
+                    {
+                      CacheFileInfo info = {filePath, statBuf.st_mtime, statBuf.st_size};
+                      g_array_append_val(files, info);
+                      filePath = NULL;
+                    }
+                }
+
+              g_free(filePath);
+            }
+
+          g_dir_close(subdir);
+        }
+
+      g_free(subdirPath);
+    }
+
+  g_dir_close(dir);
+
+  return result;
+}
+
+
+/* Sort function to sort cache files with the least-recently-used first */
+static gint cacheFileCompareFunc(gconstpointer a, gconstpointer b)
+{
+  const CacheFileInfo *info1 = (const CacheFileInfo*)a;
+  const CacheFileInfo *info2 = (const CacheFileInfo*)b;
+
+  if (info1->lastUsed < info2->lastUsed)
+    return -1;
+  else if (info1->lastUsed > info2->lastUsed)
+    return 1;
+  else
+    return 0;
+}
+
+
+/********************/
+/* Public functions */
+/********************/
+
+/* Set up the cache. If cacheDir is null the default location in the user's
+ * cache directory is used. The cache is disabled if maxSizeMb is zero or
+ * less, or if the cache directory cannot be created. */
+void blxSeqCacheInit(const char *cacheDir, const int maxSizeMb)
+{
+  g_free(cacheDir_G);
+  cacheDir_G = NULL;
+  cacheMaxSize_G = 0;
+
+  if (maxSizeMb <= 0)
+    return;
+
+  char *dirPath = NULL;
+
+  if (cacheDir && *cacheDir)
+    dirPath = g_strdup(cacheDir);
+  else
+    dirPath = g_build_filename(g_get_user_cache_dir(), "blixem", "sequences", NULL);
+
+  if (g_mkdir_with_parents(dirPath, 0755) == 0)
+    {
+      cacheDir_G = dirPath;
+      cacheMaxSize_G = (gint64)maxSizeMb * 1024 * 1024;
+    }
+  else
+    {
+      g_warning("Sequence cache is disabled: could not create directory '%s': %s\n", dirPath, g_strerror(errno));
+      g_free(dirPath);
+    }
+}
+
+
+gboolean blxSeqCacheEnabled()
+{
+  return (cacheDir_G != NULL);
+}
+
+
+/* Look up the given sequence in the cache for the given fetch method. If
+ * found, any values from the cache entry that are not already set in the
+ * sequence are filled in. Returns true if an entry was found. On success,
+ * hasOptionalData is set to true if the entry contains the optional
+ * (EMBL) columns, i.e. if they were requested when the entry was stored;
+ * note that the values themselves may still be empty if the fetch method
+ * did not find them. */
+gboolean blxSeqCacheLookup(const GQuark fetchMethod, BlxSequence *blxSeq, gboolean *hasOptionalData)
+{
+  gboolean found = FALSE;
+
+  if (!blxSeqCacheEnabled())
+    return found;
+
+  char *key = cacheCreateKey(fetchMethod, blxSeq);
+
+  if (!key)
+    return found;
+
+  ++cacheStats_G.lookups;
+
+  char *path = cacheGetFilePath(key, FALSE);
+  GMappedFile *mappedFile = g_mapped_file_new(path, FALSE, NULL);
+
+  if (mappedFile)
+    {
+      CacheFileHeader header;
+      const char *fields[CACHE_NUM_FIELDS];
+
+      if (cacheParseContents(g_mapped_file_get_contents(mappedFile), g_mapped_file_get_length(mappedFile), &header, fields) &&
+          stringsEqual(fields[CACHE_FIELD_KEY], key, TRUE))
+        {
+          int i = CACHE_FIELD_KEY + 1;
+
+          for ( ; i < CACHE_NUM_FIELDS; ++i)
+            {
+              if (*fields[i] && !blxSequenceGetValueAsString(blxSeq, cacheFieldColumn[i]))
+                blxSequenceSetValueFromString(blxSeq, cacheFieldColumn[i], fields[i]);
+            }
+
+          if (hasOptionalData)
+            *hasOptionalData = (header.flags & CACHE_FLAG_OPTIONAL_DATA) != 0;
+
+          found = TRUE;
+          ++cacheStats_G.hits;
+
+          /* Update the modification time so that the least-recently-used
+           * entries are the ones that get evicted */
+          utime(path, NULL);
+        }
+
+      g_mapped_file_unref(mappedFile);
+    }
+
+  g_free(path);
+  g_free(key);
+
+  return found;
+}
+
+
+/* Save the sequence data for the given sequence to the cache. Any existing
+ * entry for the same fetch method and sequence is replaced. hasOptionalData
+ * should be true if the fetch method was asked for the optional columns. */
+void blxSeqCacheStore(const GQuark fetchMethod, const BlxSequence *blxSeq, const gboolean hasOptionalData)
+{
+  if (!blxSeqCacheEnabled())
+    return;
+
+  /* Nothing worth saving if we have neither the sequence nor the optional data */
+  if (!blxSequenceGetSequence(blxSeq) && !hasOptionalData)
+    return;
+
+  char *key = cacheCreateKey(fetchMethod, blxSeq);
+
+  if (!key)
+    return;
+
+  const char *fields[CACHE_NUM_FIELDS];
+  CacheFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.formatVersion = CACHE_FORMAT_VERSION;
+  header.flags = hasOptionalData ? CACHE_FLAG_OPTIONAL_DATA : 0;
+
+  gsize totalLen = sizeof(header);
+  int i = 0;
+
+  for ( ; i < CACHE_NUM_FIELDS; ++i)
+    {
+      if (i == CACHE_FIELD_KEY)
+        fields[i] = key;
+      else
+        fields[i] = blxSequenceGetValueAsString(blxSeq, cacheFieldColumn[i]);
+
+      if (!fields[i])
+        fields[i] = "";
+
+      header.fieldLen[i] = strlen(fields[i]);
+      totalLen += header.fieldLen[i] + 1;
+    }
+
+  GString *contents = g_string_sized_new(totalLen);
+  g_string_append_len(contents, (const char*)&header, sizeof(header));
+
+  for (i = 0; i < CACHE_NUM_FIELDS; ++i)
+    g_string_append_len(contents, fields[i], header.fieldLen[i] + 1); /* include the terminating nul */
+
+  /* g_file_set_contents writes to a temp file and renames it, so readers
+   * never see a partially-written entry */
+  char *path = cacheGetFilePath(key, TRUE);
+  GError *error = NULL;
+
+  if (g_file_set_contents(path, contents->str, contents->len, &error))
+    {
+      ++cacheStats_G.stores;
+      ++storesSinceEvict_G;
+    }
+  else
+    {
+      /* Not fatal: we just won't have this entry next time */
+      g_debug("Failed to save sequence '%s' to cache: %s\n", blxSequenceGetName(blxSeq), error->message);
+      g_error_free(error);
+    }
+
+  g_free(path);
+  g_string_free(contents, TRUE);
+  g_free(key);
+}
+
+
+/* If the cache has grown over its size limit, delete the least-recently
+ * used entries until it is back under the limit. Only does anything if
+ * entries have been stored since the last time it was called. */
+void blxSeqCacheEvict()
+{
+  if (!blxSeqCacheEnabled() || storesSinceEvict_G < 1)
+    return;
+
+  storesSinceEvict_G = 0;
+
+  GArray *files = g_array_new(FALSE, FALSE, sizeof(CacheFileInfo));
+  gint64 totalSize = cacheScan(files);
+
+  if (totalSize > cacheMaxSize_G)
+    {
+      const gint64 targetSize = (gint64)(cacheMaxSize_G * CACHE_EVICT_TARGET);
+      g_array_sort(files, cacheFileCompareFunc);
+
+      guint i = 0;
+
+      for ( ; i < files->len && totalSize > targetSize; ++i)
+        {
+          CacheFileInfo *info = &g_array_index(files, CacheFileInfo, i);
+
+          if (g_unlink(info->path) == 0)
+            {
+              totalSize -= info->size;
+              ++cacheStats_G.evictions;
+            }
+        }
+    }
+
+  guint i = 0;
+
+  for ( ; i < files->len; ++i)
+    g_free(g_array_index(files, CacheFileInfo, i).path);
+
+  g_array_free(files, TRUE);
+}
+
+
+const BlxSeqCacheStats* blxSeqCacheGetStats()
+{
+  return &cacheStats_G;
+}
+
+
+/* Report the cache activity for this session to the user */
+void blxSeqCacheReportStats()
+{
+  if (!blxSeqCacheEnabled() || cacheStats_G.lookups < 1)
+    return;
+
+  g_message_info("Sequence cache: found %d of %d items looked up (%d%%); %d items saved, %d evicted\n",
+                 cacheStats_G.hits, cacheStats_G.lookups,
+                 (int)(100.0 * cacheStats_G.hits / cacheStats_G.lookups),
+                 cacheStats_G.stores, cacheStats_G.evictions);
+}
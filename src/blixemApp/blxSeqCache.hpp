@@ -0,0 +1,72 @@
+/*  File: blxSeqCache.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Persistent on-disk cache of fetched sequence data.
+ *
+ *              Sequence data and optional EMBL columns (organism, gene
+ *              name, tissue type, strain) that are fetched by BulkFetch
+ *              are saved to disk so that later Blixem sessions can use
+ *              them without fetching them again. Entries are keyed on
+ *              the fetch method, sequence name and sequence version.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_seq_cache_included_
+#define _blx_seq_cache_included_
+
+#include <glib.h>
+#include <seqtoolsUtils/blxmsp.hpp>
+
+
+#define BLX_SEQ_CACHE_DEFAULT_SIZE_MB    1024     /* default max size of the cache on disk */
+
+
+/* Running totals of cache activity for this session */
+typedef struct _BlxSeqCacheStats
+{
+  int lookups;                  /* number of sequences looked up */
+  int hits;                     /* number found in the cache */
+  int stores;                   /* number of entries written */
+  int evictions;                /* number of entries removed to keep under the size limit */
+} BlxSeqCacheStats;
+
+
+void                    blxSeqCacheInit(const char *cacheDir, const int maxSizeMb);
+gboolean                blxSeqCacheEnabled();
+
+gboolean                blxSeqCacheLookup(const GQuark fetchMethod, BlxSequence *blxSeq, gboolean *hasOptionalData);
+void                    blxSeqCacheStore(const GQuark fetchMethod, const BlxSequence *blxSeq, const gboolean hasOptionalData);
+void                    blxSeqCacheEvict();
+
+const BlxSeqCacheStats* blxSeqCacheGetStats();
+void                    blxSeqCacheReportStats();
+
+
+#endif /* _blx_seq_cache_included_ */
@@ -0,0 +1,459 @@
+/*  File: blxSeqIndex.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See blxSeqIndex.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <blixemApp/blxSeqIndex.hpp>
+
+using namespace std;
+
+
+#define TRIGRAM_LEN             3       /* length of the substrings held in the trigram index */
+#define MAX_VALUES_PER_SEQ      2       /* max number of indexed values per sequence (name + name without variant) */
+
+
+/* One entry in a column's sorted array of values */
+typedef struct _SeqIndexEntry
+{
+  string key;                           /* the column value, upper-cased (as compared by wildcardSearch) */
+  guint32 seqIdx;                       /* index of the sequence in the BlxSeqIndex's sequence array */
+} SeqIndexEntry;
+
+
+/* The index for a single column */
+typedef struct _ColumnIndex
+{
+  vector<SeqIndexEntry> entries;        /* sorted entries, followed by any entries added since the last sort */
+  size_t numSorted;                     /* number of entries at the start of the array that are sorted */
+  unordered_map<guint32, vector<guint32> > trigrams; /* the indices (ascending) of the seqs containing each trigram */
+} ColumnIndex;
+
+
+struct _BlxSeqIndex
+{
+  vector<BlxSequence*> seqs;            /* all indexed sequences, in the order they were added */
+  map<int, ColumnIndex*> columns;       /* the index for each column that has been indexed so far, keyed on column id */
+};
+
+
+/* Sort entries on their key */
+struct SeqIndexEntryCompare
+{
+  bool operator()(const SeqIndexEntry &a, const SeqIndexEntry &b) const
+  {
+    return a.key < b.key;
+  }
+
+  bool operator()(const SeqIndexEntry &a, const string &key) const
+  {
+    return a.key < key;
+  }
+
+  bool operator()(const string &key, const SeqIndexEntry &b) const
+  {
+    return key < b.key;
+  }
+};
+
+
+/***********************************************************
+ *                      Building the index                 *
+ ***********************************************************/
+
+/* Get the values to index for the given sequence. For most columns this is just the
+ * column value, but sequence names have a variant number postfix which the search
+ * ignores if the full name does not match, so we also index the name without this.
+ * The values are upper-cased. Returns the number of values. */
+static int getSeqValues(const BlxSequence *blxSeq, const BlxColumnId columnId, string values[MAX_VALUES_PER_SEQ])
+{
+  int numValues = 0;
+  const char *data = blxSequenceGetColumn(blxSeq, columnId);
+
+  if (data)
+    {
+      values[numValues++] = data;
+
+      const char *cutPoint = (columnId == BLXCOL_SEQNAME ? strchr(data, '.') : NULL);
+
+      if (cutPoint)
+        values[numValues++] = string(data, cutPoint - data);
+
+      for (int i = 0; i < numValues; ++i)
+        {
+          for (string::iterator c = values[i].begin(); c != values[i].end(); ++c)
+            *c = toupper(*c);
+        }
+    }
+
+  return numValues;
+}
+
+
+/* Pack the three chars at the given position into a trigram key */
+static guint32 trigramKey(const char *text)
+{
+  return ((guint32)(guchar)text[0] << 16) | ((guint32)(guchar)text[1] << 8) | (guint32)(guchar)text[2];
+}
+
+
+/* Add the given sequence to a column index. The new entries are appended unsorted;
+ * they are merged into place next time the column is searched. Sequences must be
+ * added in order of seqIdx so that the trigram postings stay sorted. */
+static void columnIndexAddSeq(ColumnIndex *column, const BlxSequence *blxSeq, const BlxColumnId columnId, const guint32 seqIdx)
+{
+  string values[MAX_VALUES_PER_SEQ];
+  const int numValues = getSeqValues(blxSeq, columnId, values);
+
+  vector<guint32> seqTrigrams;
+
+  for (int i = 0; i < numValues; ++i)
+    {
+      SeqIndexEntry entry = {values[i], seqIdx};
+      column->entries.push_back(entry);
+
+      for (size_t pos = 0; pos + TRIGRAM_LEN <= values[i].size(); ++pos)
+        seqTrigrams.push_back(trigramKey(values[i].c_str() + pos));
+    }
+
+  sort(seqTrigrams.begin(), seqTrigrams.end());
+  seqTrigrams.erase(unique(seqTrigrams.begin(), seqTrigrams.end()), seqTrigrams.end());
+
+  for (vector<guint32>::iterator t = seqTrigrams.begin(); t != seqTrigrams.end(); ++t)
+    column->trigrams[*t].push_back(seqIdx);
+}
+
+
+/* Merge any entries that have been added since the last sort into their sorted positions */
+static void columnIndexSort(ColumnIndex *column)
+{
+  if (column->numSorted < column->entries.size())
+    {
+      vector<SeqIndexEntry>::iterator mid = column->entries.begin() + column->numSorted;
+
+      stable_sort(mid, column->entries.end(), SeqIndexEntryCompare());
+      inplace_merge(column->entries.begin(), mid, column->entries.end(), SeqIndexEntryCompare());
+
+      column->numSorted = column->entries.size();
+    }
+}
+
+
+/* Get the index for the given column, creating it from all of the sequences if it
+ * doesn't exist yet. */
+static ColumnIndex* seqIndexGetColumn(BlxSeqIndex *index, const BlxColumnId columnId)
+{
+  ColumnIndex *column = NULL;
+  map<int, ColumnIndex*>::iterator iter = index->columns.find(columnId);
+
+  if (iter != index->columns.end())
+    {
+      column = iter->second;
+    }
+  else
+    {
+      column = new ColumnIndex;
+      column->numSorted = 0;
+
+      for (guint32 seqIdx = 0; seqIdx < index->seqs.size(); ++seqIdx)
+        columnIndexAddSeq(column, index->seqs[seqIdx], columnId, seqIdx);
+
+      index->columns[columnId] = column;
+    }
+
+  columnIndexSort(column);
+
+  return column;
+}
+
+
+/* Create an index of the given sequences. Only the sequence name column is indexed
+ * initially; other columns are indexed the first time they are searched. */
+BlxSeqIndex* blxSeqIndexCreate(GList *seqList)
+{
+  BlxSeqIndex *index = new BlxSeqIndex;
+
+  ColumnIndex *nameColumn = new ColumnIndex;
+  nameColumn->numSorted = 0;
+  index->columns[BLXCOL_SEQNAME] = nameColumn;
+
+  blxSeqIndexAddSeqs(index, seqList);
+  columnIndexSort(nameColumn);
+
+  return index;
+}
+
+
+void blxSeqIndexDestroy(BlxSeqIndex *index)
+{
+  if (index)
+    {
+      for (map<int, ColumnIndex*>::iterator iter = index->columns.begin(); iter != index->columns.end(); ++iter)
+        delete iter->second;
+
+      delete index;
+    }
+}
+
+
+/* Add newly-loaded sequences to the index. They are added to all of the columns that
+ * have been indexed so far. */
+void blxSeqIndexAddSeqs(BlxSeqIndex *index, GList *newSeqs)
+{
+  for (GList *seqItem = newSeqs; seqItem; seqItem = seqItem->next)
+    {
+      BlxSequence *blxSeq = (BlxSequence*)(seqItem->data);
+      const guint32 seqIdx = index->seqs.size();
+
+      index->seqs.push_back(blxSeq);
+
+      for (map<int, ColumnIndex*>::iterator iter = index->columns.begin(); iter != index->columns.end(); ++iter)
+        columnIndexAddSeq(iter->second, blxSeq, (BlxColumnId)(iter->first), seqIdx);
+    }
+}
+
+
+/* Discard the indexes for all columns other than the sequence name, e.g. because
+ * the optional column data has been loaded. They will be rebuilt when next searched. */
+void blxSeqIndexInvalidateColumns(BlxSeqIndex *index)
+{
+  map<int, ColumnIndex*>::iterator iter = index->columns.begin();
+
+  while (iter != index->columns.end())
+    {
+      if (iter->first == BLXCOL_SEQNAME)
+        {
+          ++iter;
+        }
+      else
+        {
+          delete iter->second;
+          index->columns.erase(iter++);
+        }
+    }
+}
+
+
+/***********************************************************
+ *                         Searching                       *
+ ***********************************************************/
+
+/* Returns true if the given column can be searched via the index. The group column
+ * is not a property of the sequence so is not supported. */
+gboolean blxSeqIndexSupportsColumn(const BlxColumnId columnId)
+{
+  return (columnId > BLXCOL_NONE && columnId != BLXCOL_GROUP);
+}
+
+
+/* Check whether the given sequence's data for the given column matches the search
+ * string. Sequence names have a variant number postfix; if the full name doesn't match
+ * we also try to match the name without this postfix. */
+static gboolean seqMatchesSearch(const BlxSequence *blxSeq, const BlxColumnId columnId, const char *searchStr)
+{
+  const char *dataToCompare = blxSequenceGetColumn(blxSeq, columnId);
+  gboolean found = wildcardSearch(dataToCompare, searchStr);
+
+  if (!found && dataToCompare && columnId == BLXCOL_SEQNAME)
+    {
+      const char *cutPoint = strchr(dataToCompare, '.');
+
+      if (cutPoint)
+        {
+          char *seqName = g_strndup(dataToCompare, cutPoint - dataToCompare);
+          found = wildcardSearch(seqName, searchStr);
+          g_free(seqName);
+        }
+    }
+
+  return found;
+}
+
+
+/* Add the sequences of all entries whose key starts with the given prefix to the result */
+static void columnIndexFindPrefix(ColumnIndex *column, const string &prefix, vector<guint32> &result)
+{
+  vector<SeqIndexEntry>::iterator entry = lower_bound(column->entries.begin(), column->entries.end(), prefix, SeqIndexEntryCompare());
+
+  for ( ; entry != column->entries.end() && entry->key.compare(0, prefix.size(), prefix) == 0; ++entry)
+    result.push_back(entry->seqIdx);
+}
+
+
+/* Sort posting lists by length, shortest first */
+struct PostingSizeCompare
+{
+  bool operator()(const vector<guint32> *a, const vector<guint32> *b) const
+  {
+    return a->size() < b->size();
+  }
+};
+
+
+/* Add the sequences that contain all of the given trigrams to the result. Starts
+ * from the shortest posting list and looks up each of its items in the others. */
+static void columnIndexFindTrigrams(ColumnIndex *column, const vector<guint32> &trigrams, vector<guint32> &result)
+{
+  vector<const vector<guint32>*> postings;
+
+  for (vector<guint32>::const_iterator t = trigrams.begin(); t != trigrams.end(); ++t)
+    {
+      unordered_map<guint32, vector<guint32> >::const_iterator iter = column->trigrams.find(*t);
+
+      if (iter == column->trigrams.end())
+        return; /* nothing contains this trigram */
+
+      postings.push_back(&iter->second);
+    }
+
+  sort(postings.begin(), postings.end(), PostingSizeCompare());
+
+  for (vector<guint32>::const_iterator seqIdx = postings[0]->begin(); seqIdx != postings[0]->end(); ++seqIdx)
+    {
+      gboolean inAll = TRUE;
+
+      for (size_t i = 1; i < postings.size() && inAll; ++i)
+        inAll = binary_search(postings[i]->begin(), postings[i]->end(), *seqIdx);
+
+      if (inAll)
+        result.push_back(*seqIdx);
+    }
+}
+
+
+/* Get the trigrams in the literal (i.e. non-wildcard) parts of the given search
+ * pattern. Any text matching the pattern must contain all of these. */
+static void getPatternTrigrams(const string &pattern, vector<guint32> &trigrams)
+{
+  size_t runStart = 0;
+
+  while (runStart < pattern.size())
+    {
+      size_t runEnd = pattern.find_first_of("*?", runStart);
+
+      if (runEnd == string::npos)
+        runEnd = pattern.size();
+
+      for (size_t pos = runStart; pos + TRIGRAM_LEN <= runEnd; ++pos)
+        trigrams.push_back(trigramKey(pattern.c_str() + pos));
+
+      runStart = runEnd + 1;
+    }
+
+  sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+
+/* Find all sequences whose data in the given column matches the given search string
+ * (which may contain wildcards - see wildcardSearch). Searches with no wildcards or
+ * only trailing '*'s are looked up in the sorted values; other searches use the
+ * trigram index to find candidates, or the literal prefix if the pattern has no
+ * trigrams, and only fall back to checking every sequence if there is neither. The
+ * result is the same as checking every sequence with wildcardSearch. Returns a
+ * list of BlxSequences, which should be free'd by the caller with g_list_free. */
+GList* blxSeqIndexFind(BlxSeqIndex *index, const char *searchStr, const BlxColumnId columnId)
+{
+  GList *result = NULL;
+
+  if (!index || !searchStr || !blxSeqIndexSupportsColumn(columnId))
+    return result;
+
+  ColumnIndex *column = seqIndexGetColumn(index, columnId);
+
+  string pattern(searchStr);
+  for (string::iterator c = pattern.begin(); c != pattern.end(); ++c)
+    *c = toupper(*c);
+
+  const size_t prefixLen = min(pattern.find_first_of("*?"), pattern.size());
+  const string prefix = pattern.substr(0, prefixLen);
+
+  const gboolean hasWildcards = (prefixLen < pattern.size());
+  const gboolean isPrefixSearch = (hasWildcards && pattern.find_first_not_of('*', prefixLen) == string::npos);
+
+  vector<guint32> candidates;
+
+  if (!hasWildcards)
+    {
+      pair<vector<SeqIndexEntry>::iterator, vector<SeqIndexEntry>::iterator> range =
+        equal_range(column->entries.begin(), column->entries.end(), pattern, SeqIndexEntryCompare());
+
+      for (vector<SeqIndexEntry>::iterator entry = range.first; entry != range.second; ++entry)
+        candidates.push_back(entry->seqIdx);
+    }
+  else if (isPrefixSearch)
+    {
+      columnIndexFindPrefix(column, prefix, candidates);
+    }
+  else
+    {
+      vector<guint32> trigrams;
+      getPatternTrigrams(pattern, trigrams);
+
+      if (!trigrams.empty())
+        {
+          columnIndexFindTrigrams(column, trigrams, candidates);
+        }
+      else if (prefixLen > 0)
+        {
+          columnIndexFindPrefix(column, prefix, candidates);
+        }
+      else
+        {
+          for (guint32 seqIdx = 0; seqIdx < index->seqs.size(); ++seqIdx)
+            candidates.push_back(seqIdx);
+        }
+    }
+
+  /* A sequence may have more than one matching entry, so remove duplicates. Then
+   * check each candidate against the actual search. */
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+  for (vector<guint32>::iterator seqIdx = candidates.begin(); seqIdx != candidates.end(); ++seqIdx)
+    {
+      BlxSequence *blxSeq = index->seqs[*seqIdx];
+
+      if (seqMatchesSearch(blxSeq, columnId, searchStr))
+        result = g_list_prepend(result, blxSeq);
+    }
+
+  return result;
+}
@@ -0,0 +1,67 @@
+/*  File: blxSeqIndex.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Search index over the match sequences' column data.
+ *
+ *              Used by the Find and Groups dialogs to look up sequences by
+ *              name or by the value of another searchable column. Each
+ *              column is indexed by a sorted array of (upper-cased) values,
+ *              which answers exact and prefix searches by binary search,
+ *              plus a trigram index, which narrows down the candidates for
+ *              general wildcard searches. Candidates are always checked
+ *              with wildcardSearch, so results are the same as a full scan.
+ *
+ *              The sequence-name column is indexed up front; other columns
+ *              are indexed the first time they are searched. New sequences
+ *              can be added incrementally when features are loaded.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_seq_index_included_
+#define _blx_seq_index_included_
+
+#include <glib.h>
+#include <seqtoolsUtils/blxmsp.hpp>
+
+
+typedef struct _BlxSeqIndex BlxSeqIndex;
+
+
+BlxSeqIndex*            blxSeqIndexCreate(GList *seqList);
+void                    blxSeqIndexDestroy(BlxSeqIndex *index);
+
+void                    blxSeqIndexAddSeqs(BlxSeqIndex *index, GList *newSeqs);
+void                    blxSeqIndexInvalidateColumns(BlxSeqIndex *index);
+
+gboolean                blxSeqIndexSupportsColumn(const BlxColumnId columnId);
+GList*                  blxSeqIndexFind(BlxSeqIndex *index, const char *searchStr, const BlxColumnId columnId);
+
+
+#endif /* _blx_seq_index_included_ */
@@ -0,0 +1,474 @@
+/*  File: blxbatch.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See blxbatch.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <blixemApp/blxbatch.hpp>
+#include <blixemApp/blxcontext.hpp>
+#include <blixemApp/blxwindow.hpp>
+#include <blixemApp/detailview.hpp>
+#include <seqtoolsUtils/utilities.hpp>
+#include <seqtoolsUtils/blxmsp.hpp>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using namespace std;
+
+
+#define FASTA_LINE_LEN          60      /* number of bases per line in the FASTA output */
+
+
+/* Error codes and domain */
+#define BLX_BATCH_ERROR g_quark_from_string("Blixem batch")
+
+typedef enum {
+  BLX_BATCH_ERROR_OPENING_FILE,         /* error opening an output file */
+  BLX_BATCH_ERROR_WRITING_FILE          /* error writing to an output file */
+} BlxBatchError;
+
+
+/* Set the list of sources to filter on from the given comma-separated list of source names */
+void blxBatchSetSources(BlxBatchOptions *batchOptions, const char *sourcesStr)
+{
+  g_return_if_fail(batchOptions && sourcesStr);
+
+  char **tokens = g_strsplit(sourcesStr, ",", -1);
+
+  for (char **token = tokens; token && *token; ++token)
+    {
+      g_strstrip(*token);
+
+      if (**token)
+        batchOptions->sources = g_slist_prepend(batchOptions->sources, GINT_TO_POINTER(g_quark_from_string(*token)));
+    }
+
+  g_strfreev(tokens);
+}
+
+
+/* Returns true if the given source passes the source filter, if there is one */
+static gboolean sourcePassesFilter(const char *source, const BlxBatchOptions* const batchOptions)
+{
+  gboolean result = TRUE;
+
+  if (batchOptions->sources)
+    {
+      const GQuark quark = source ? g_quark_try_string(source) : 0;
+      result = (quark && g_slist_find(batchOptions->sources, GINT_TO_POINTER(quark)));
+    }
+
+  return result;
+}
+
+
+/* Returns true if the given range passes the range filter, if there is one */
+static gboolean rangePassesFilter(const IntRange* const range, const BlxBatchOptions* const batchOptions)
+{
+  return (!batchOptions->range.isSet() || rangesOverlap(range, &batchOptions->range));
+}
+
+
+/* Open the given file for writing */
+static FILE* openOutputFile(const char *filename, GError **error)
+{
+  FILE *file = fopen(filename, "w");
+
+  if (!file)
+    {
+      char *errText = getSystemErrorText();
+      g_set_error(error, BLX_BATCH_ERROR, BLX_BATCH_ERROR_OPENING_FILE,
+                  "Error opening file '%s' for writing: %s\n", filename, errText);
+      g_free(errText);
+    }
+
+  return file;
+}
+
+
+/* Close the given file, setting the error if there was a problem writing it */
+static void closeOutputFile(FILE *file, const char *filename, GError **error)
+{
+  const gboolean writeFailed = ferror(file);
+
+  if (fclose(file) != 0 || writeFailed)
+    {
+      char *errText = getSystemErrorText();
+      g_set_error(error, BLX_BATCH_ERROR, BLX_BATCH_ERROR_WRITING_FILE,
+                  "Error writing file '%s': %s\n", filename, errText);
+      g_free(errText);
+    }
+}
+
+
+/***********************************************************
+ *                      Depth output                       *
+ ***********************************************************/
+
+/* Write the read depth to the given file in bedGraph format (0-based, half-open coords).
+ * Adjacent bases with the same depth are merged into a single line. */
+static void writeDepth(BlxContext *bc, const BlxBatchOptions* const batchOptions, GError **error)
+{
+  if (bc->seqType == BLXSEQ_PEPTIDE)
+    {
+      g_warning("Depth output is not supported for protein matches; '%s' will not be written.\n", batchOptions->depthFile);
+      return;
+    }
+
+  FILE *file = openOutputFile(batchOptions->depthFile, error);
+
+  if (!file)
+    return;
+
+  bc->calculateDepth(DEFAULT_NUM_UNALIGNED_BASES);
+
+  /* Limit to the requested range, if given */
+  int startCoord = bc->fullDisplayRange.min();
+  int endCoord = bc->fullDisplayRange.max();
+
+  if (batchOptions->range.isSet())
+    {
+      startCoord = max(startCoord, batchOptions->range.min());
+      endCoord = min(endCoord, batchOptions->range.max());
+    }
+
+  fprintf(file, "track type=bedGraph name=\"%s depth\"\n", bc->refSeqName);
+
+  if (startCoord <= endCoord)
+    {
+      int runStart = startCoord;
+      int runDepth = bc->getDepth(runStart);
+
+      for (int coord = startCoord + 1; coord <= endCoord + 1; ++coord)
+        {
+          const int depth = (coord <= endCoord ? bc->getDepth(coord) : UNSET_INT);
+
+          if (depth != runDepth)
+            {
+              fprintf(file, "%s\t%d\t%d\t%d\n", bc->refSeqName, runStart - 1, coord - 1, runDepth);
+              runStart = coord;
+              runDepth = depth;
+            }
+        }
+    }
+
+  closeOutputFile(file, batchOptions->depthFile, error);
+}
+
+
+/***********************************************************
+ *                      GFF output                         *
+ ***********************************************************/
+
+/* Get the SO term to use in the GFF output for the given MSP, or NULL if this type of
+ * feature should not be output */
+static const char* getGffTypeName(const MSP* const msp, const BlxBlastMode blastMode)
+{
+  const char *result = NULL;
+
+  switch (msp->type)
+    {
+    case BLXMSP_MATCH:
+      result = (blastMode == BLXMODE_BLASTN ? "nucleotide_match" : "protein_match");
+      break;
+
+    case BLXMSP_CDS:            result = "CDS";                    break;
+    case BLXMSP_UTR:            result = "UTR";                    break;
+    case BLXMSP_EXON:           result = "exon";                   break;
+    case BLXMSP_INTRON:         result = "intron";                 break;
+    case BLXMSP_POLYA_SITE:     result = "polyA_site";             break;
+    case BLXMSP_POLYA_SIGNAL:   result = "polyA_signal_sequence";  break;
+    case BLXMSP_VARIATION:      result = "sequence_alteration";    break;
+    case BLXMSP_REGION:         result = "region";                 break;
+    case BLXMSP_GAP:            result = "gap";                    break;
+    case BLXMSP_BASIC:          result = "sequence_feature";       break;
+
+    default:
+      /* Other types are either internal or obsolete, so are not output */
+      break;
+    };
+
+  return result;
+}
+
+
+static char getGffStrandChar(const BlxStrand strand)
+{
+  char result = '.';
+
+  if (strand == BLXSTRAND_FORWARD)
+    result = '+';
+  else if (strand == BLXSTRAND_REVERSE)
+    result = '-';
+
+  return result;
+}
+
+
+/* Write a single feature as a GFF v3 line */
+static void writeGffFeature(FILE *file, const MSP* const msp, const char *typeName, BlxContext *bc)
+{
+  const char *source = mspGetSource(msp);
+  const char *name = msp->sSequence ? blxSequenceGetName(msp->sSequence) : mspGetSName(msp);
+
+  fprintf(file, "%s\t%s\t%s\t%d\t%d\t",
+          bc->refSeqName, (source ? source : "."), typeName, msp->qRange.min(), msp->qRange.max());
+
+  if (msp->type == BLXMSP_MATCH)
+    fprintf(file, "%g", msp->score);
+  else
+    fprintf(file, ".");
+
+  fprintf(file, "\t%c\t", getGffStrandChar(msp->qStrand));
+
+  if (msp->type == BLXMSP_CDS && msp->phase != UNSET_INT)
+    fprintf(file, "%d\t", msp->phase);
+  else
+    fprintf(file, ".\t");
+
+  if (msp->type == BLXMSP_MATCH)
+    {
+      fprintf(file, "Target=%s %d %d %c;percentID=%g",
+              (name ? name : "."), msp->sRange.min(), msp->sRange.max(),
+              getGffStrandChar(mspGetMatchStrand(msp)), msp->id);
+
+      /* Write the gapped alignment, if any, as an acedb-style "gaps" string
+       * (i.e. sStart sEnd qStart qEnd for each ungapped block) */
+      if (msp->gaps)
+        {
+          fprintf(file, ";gaps=");
+
+          for (GSList *gapItem = msp->gaps; gapItem; gapItem = gapItem->next)
+            {
+              const CoordRange* const gap = (const CoordRange*)(gapItem->data);
+
+              fprintf(file, "%s%d %d %d %d", (gapItem == msp->gaps ? "" : " "),
+                      gap->sStart, gap->sEnd, gap->qStart, gap->qEnd);
+            }
+        }
+    }
+  else if (name)
+    {
+      fprintf(file, "Name=%s", name);
+    }
+
+  fprintf(file, "\n");
+}
+
+
+/* Write all features that pass the filters to the given file in GFF v3 format */
+static void writeGff(BlxContext *bc, const BlxBatchOptions* const batchOptions, GError **error)
+{
+  FILE *file = openOutputFile(batchOptions->gffFile, error);
+
+  if (!file)
+    return;
+
+  fprintf(file, "##gff-version 3\n");
+  fprintf(file, "##sequence-region %s %d %d\n", bc->refSeqName, bc->refSeqRange.min(), bc->refSeqRange.max());
+
+  int numWritten = 0;
+
+  for (int mspType = 0; mspType < BLXMSP_NUM_TYPES; ++mspType)
+    {
+      int i = 0;
+      const MSP *msp = mspArrayIdx(bc->featureLists[mspType], i);
+
+      for ( ; msp; msp = mspArrayIdx(bc->featureLists[mspType], ++i))
+        {
+          const char *typeName = getGffTypeName(msp, bc->blastMode);
+
+          if (typeName &&
+              rangePassesFilter(&msp->qRange, batchOptions) &&
+              sourcePassesFilter(mspGetSource(msp), batchOptions))
+            {
+              writeGffFeature(file, msp, typeName, bc);
+              ++numWritten;
+            }
+        }
+    }
+
+  closeOutputFile(file, batchOptions->gffFile, error);
+
+  g_message_info("Wrote %d features to '%s'\n", numWritten, batchOptions->gffFile);
+}
+
+
+/***********************************************************
+ *                      FASTA output                       *
+ ***********************************************************/
+
+/* Write the spliced sequence of each transcript that passes the filters to the given
+ * file in FASTA format. Reverse-strand transcripts are reverse-complemented so that
+ * the sequence reads in the direction of transcription. */
+static void writeFasta(BlxContext *bc, const BlxBatchOptions* const batchOptions, GError **error)
+{
+  FILE *file = openOutputFile(batchOptions->fastaFile, error);
+
+  if (!file)
+    return;
+
+  int numWritten = 0;
+
+  for (GList *seqItem = bc->matchSeqs; seqItem; seqItem = seqItem->next)
+    {
+      const BlxSequence* const seq = (const BlxSequence*)(seqItem->data);
+
+      if (seq->type != BLXSEQUENCE_TRANSCRIPT || !sourcePassesFilter(blxSequenceGetSource(seq), batchOptions))
+        continue;
+
+      const IntRange seqRange(blxSequenceGetStart(seq, seq->strand), blxSequenceGetEnd(seq, seq->strand));
+
+      if (!rangePassesFilter(&seqRange, batchOptions))
+        continue;
+
+      GError *tmpError = NULL;
+      char *splicedSeq = bc->getSplicedSequence(seq, &tmpError);
+
+      if (tmpError)
+        {
+          prefixError(tmpError, "Transcript '%s': ", blxSequenceGetName(seq));
+          reportAndClearIfError(&tmpError, G_LOG_LEVEL_WARNING);
+        }
+
+      if (!splicedSeq)
+        continue;
+
+      if (seq->strand == BLXSTRAND_REVERSE)
+        {
+          char *tmp = (char*)g_malloc(strlen(splicedSeq) + 1);
+          revComplement(tmp, splicedSeq);
+          g_free(splicedSeq);
+          splicedSeq = tmp;
+        }
+
+      fprintf(file, ">%s\n", blxSequenceGetName(seq));
+
+      const int len = strlen(splicedSeq);
+
+      for (int i = 0; i < len; i += FASTA_LINE_LEN)
+        fprintf(file, "%.*s\n", FASTA_LINE_LEN, splicedSeq + i);
+
+      g_free(splicedSeq);
+      ++numWritten;
+    }
+
+  closeOutputFile(file, batchOptions->fastaFile, error);
+
+  g_message_info("Wrote %d transcript sequences to '%s'\n", numWritten, batchOptions->fastaFile);
+}
+
+
+/***********************************************************
+ *                      Main entry point                   *
+ ***********************************************************/
+
+/* Run blixem in batch mode, i.e. fetch and process the sequence data as normal but,
+ * rather than displaying the results, write the requested output files. Returns the
+ * exit status for the program. */
+int blxBatchRun(CommandLineOptions *options,
+                BlxBatchOptions *batchOptions,
+                GArray* featureLists[],
+                GList *seqList,
+                GSList *supportedTypes,
+                GHashTable *lookupTable)
+{
+  /* There is no display, so progress must be reported to the terminal */
+  blxFetchSetHeadless(TRUE);
+
+  if (!blxviewFetchSequences(options, featureLists, &seqList, supportedTypes, TRUE, lookupTable))
+    {
+      g_critical("Failed to fetch sequences\n");
+      return EXIT_FAILURE;
+    }
+
+  blxviewFinaliseSequences(options, featureLists, &seqList, lookupTable);
+
+  /* Create the context without a widget. This calculates the same data that is
+   * calculated when the window is created. */
+  IntRange refSeqRange;
+  IntRange fullDisplayRange;
+  calculateRefSeqRange(options, refSeqRange, fullDisplayRange);
+
+  BlxContext *bc = new BlxContext(options, &refSeqRange, &fullDisplayRange, NULL,
+                                  featureLists, seqList, supportedTypes,
+                                  NULL, NULL, TRUE, NULL);
+
+  calculateMspData(bc, bc->mspList, DEFAULT_NUM_UNALIGNED_BASES, TRUE);
+  blxProfilePhase("calculate MSP data");
+
+  /* Write the output files. Carry on if one fails so that we write as much as we can. */
+  int result = EXIT_SUCCESS;
+  GError *error = NULL;
+
+  if (batchOptions->depthFile)
+    {
+      writeDepth(bc, batchOptions, &error);
+      blxProfilePhase("write depth");
+    }
+
+  if (error)
+    {
+      result = EXIT_FAILURE;
+      reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
+    }
+
+  if (batchOptions->gffFile)
+    {
+      writeGff(bc, batchOptions, &error);
+      blxProfilePhase("write GFF");
+    }
+
+  if (error)
+    {
+      result = EXIT_FAILURE;
+      reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
+    }
+
+  if (batchOptions->fastaFile)
+    {
+      writeFasta(bc, batchOptions, &error);
+      blxProfilePhase("write FASTA");
+    }
+
+  if (error)
+    {
+      result = EXIT_FAILURE;
+      reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
+    }
+
+  delete bc;
+
+  blxProfileEnd("total");
+
+  return result;
+}
@@ -0,0 +1,72 @@
+/*  File: blxbatch.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Batch (headless) mode for Blixem.
+ *
+ *              In batch mode Blixem loads the features and fetches the
+ *              sequence data as normal but does not create a window, so it
+ *              can run without an X server. Instead it writes any of the
+ *              following to file: the read depth as a bedGraph, the
+ *              features as GFF v3, and the spliced sequences of
+ *              transcripts as FASTA. The output can be restricted to a range
+ *              of the reference sequence and/or to features from given
+ *              sources. The time taken by each phase is reported.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_batch_included_
+#define _blx_batch_included_
+
+#include <blixemApp/blixem_.hpp>
+
+
+/* Batch-mode options, as given on the command line */
+typedef struct _BlxBatchOptions
+{
+  gboolean enabled;             /* run in batch mode, i.e. without a display */
+  char *depthFile;              /* if set, write the read depth to this file as a bedGraph */
+  char *gffFile;                /* if set, write the features to this file as GFF v3 */
+  char *fastaFile;              /* if set, write the spliced transcript sequences to this file as FASTA */
+  IntRange range;               /* if set, only output data that overlaps this range (in Blixem's coords, i.e. after any offset) */
+  GSList *sources;              /* if not null, only output features from these sources (as GQuarks) */
+} BlxBatchOptions;
+
+
+void                    blxBatchSetSources(BlxBatchOptions *batchOptions, const char *sourcesStr);
+
+int                     blxBatchRun(CommandLineOptions *options,
+                                    BlxBatchOptions *batchOptions,
+                                    GArray* featureLists[],
+                                    GList *seqList,
+                                    GSList *supportedTypes,
+                                    GHashTable *lookupTable);
+
+
+#endif /* _blx_batch_included_ */
@@ -216,6 +216,7 @@ BlxContext::BlxContext(CommandLineOptions *options,
   statusBar = statusBar_in;
 
   refSeq = options->refSeq;
+  refSeqPacked = NULL;
   refSeqName = options->refSeqName ? g_strdup(options->refSeqName) : g_strdup("Blixem-seq");
   refSeqRange.set(refSeqRange_in);
   fullDisplayRange.set(fullDisplayRange_in);
@@ -243,6 +244,14 @@ BlxContext::BlxContext(CommandLineOptions *options,
   fetchMethods = options->fetchMethods;
   dataset = g_strdup(options->dataset);
   matchSeqs = seqList_in;
+  mspListTail = NULL;
+  matchSeqsTail = NULL;
+  seqIndex = blxSeqIndexCreate(matchSeqs);
+
+  if (options->packRefSeq)
+    packRefSeq(options);
+
+  refSeqCache = blxRefSeqCacheCreate(refSeq, refSeqPacked, &refSeqRange, geneticCode);
   supportedTypes = supportedTypes_in;
 
   displayRev = FALSE;
@@ -250,6 +259,7 @@ BlxContext::BlxContext(CommandLineOptions *options,
 
   selectedSeqs = NULL;
   sequenceGroups = NULL;
+  groupsVersion = 0;
 
   dotterRefType = BLXDOTTER_REF_AUTO;
   dotterMatchType = BLXDOTTER_MATCH_SELECTED;
@@ -264,7 +274,10 @@ BlxContext::BlxContext(CommandLineOptions *options,
   usePrintColors = FALSE;
   windowColor = options->windowColor;
 
-  createColors(widget_in);
+  /* Colors are only needed for drawing, so there are none if we have no widget (i.e.
+   * when running in batch mode without a display) */
+  if (widget_in)
+    createColors(widget_in);
 
   initialiseFlags(options);
 
@@ -296,6 +309,9 @@ BlxContext::BlxContext(CommandLineOptions *options,
 #endif
 
   /* Calculate the font size */
+  m_charWidth = 0.0;
+  m_charHeight = 0.0;
+
   if (widget_in)
     getFontCharSize(widget_in, widget_in->style->font_desc, &m_charWidth, &m_charHeight);
 
@@ -321,6 +337,15 @@ BlxContext::~BlxContext()
 
   deleteAllSequenceGroups();
 
+  blxSeqIndexDestroy(seqIndex);
+  seqIndex = NULL;
+
+  blxRefSeqCacheDestroy(refSeqCache);
+  refSeqCache = NULL;
+
+  blxPackedSeqDestroy(refSeqPacked);
+  refSeqPacked = NULL;
+
   /* Free the color array */
   if (defaultColors)
     {
@@ -343,6 +368,8 @@ BlxContext::~BlxContext()
 
   destroyMspList(&(mspList));
   destroyBlxSequenceList(&(matchSeqs));
+  mspListTail = NULL;
+  matchSeqsTail = NULL;
   blxDestroyGffTypeList(&(supportedTypes));
   killAllSpawned();
 }
@@ -465,6 +492,7 @@ void BlxContext::destroySequenceGroup(SequenceGroup **seqGroup)
     {
       /* Remove it from the list of groups */
       sequenceGroups = g_list_remove(sequenceGroups, *seqGroup);
+      ++groupsVersion;
 
       /* Free the memory used by the group name */
       if ((*seqGroup)->groupName)
@@ -509,6 +537,7 @@ void BlxContext::deleteAllSequenceGroups()
 void BlxContext::disableAllGroups()
 {
   GList *groupItem = sequenceGroups;
+  ++groupsVersion;
 
   while (groupItem)
     {
@@ -531,6 +560,7 @@ void BlxContext::disableAllGroups()
 void BlxContext::disableAllQuickGroups()
 {
   GList *groupItem = sequenceGroups;
+  ++groupsVersion;
 
   while (groupItem)
     {
@@ -730,6 +760,34 @@ void BlxContext::loadSettings()
 }
 
 
+/* Replace the plain-text reference sequence with a packed copy, if it is a nucleotide
+ * sequence, and put the packed copy in shared memory so that Dotter can map it rather
+ * than being sent its own copy */
+void BlxContext::packRefSeq(CommandLineOptions *options)
+{
+  if (!refSeq || blastMode == BLXMODE_BLASTP)
+    return;
+
+  refSeqPacked = blxPackedSeqCreate(refSeq, strlen(refSeq));
+
+  if (!refSeqPacked)
+    {
+      g_warning("The reference sequence cannot be packed; it will be stored as text.\n");
+      return;
+    }
+
+  /* If this fails we can still use the packed sequence; we just can't share it */
+  GError *error = NULL;
+
+  if (!blxPackedSeqShare(refSeqPacked, &error))
+    reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+
+  g_free(refSeq);
+  refSeq = NULL;
+  options->refSeq = NULL;
+}
+
+
 /* Called by saveBlixemSettings; does the work to save the boolean flags */
 void BlxContext::saveSettingsFlags(GKeyFile *key_file)
 {
@@ -769,6 +827,8 @@ void BlxContext::killAllSpawned()
  * depthArray must be the same length as displayRange. */
 void BlxContext::calculateDepth(const int numUnalignedBases)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_DEPTH, "calculateDepth");
+
   /* Allocate the depth array, if null */
   const int displayLen = fullDisplayRange.length();
 
@@ -812,6 +872,11 @@ void BlxContext::calculateDepth(const int numUnalignedBases)
       depthArray[DEPTHCOUNTER_N_R][i] = 0;
     }
 
+  /* Buffers for the ref seq coords of each MSP and the equivalent match coords */
+  int bufferLen = 0;
+  int *qIdxs = NULL;
+  int *sIdxs = NULL;
+
   /* Loop through all MSP lists */
   int mspType = 0;
 
@@ -830,11 +895,27 @@ void BlxContext::calculateDepth(const int numUnalignedBases)
 
       for ( ; msp; msp = mspArrayIdx(mspArray, ++i))
         {
+          /* Find the match sequence base at each ref-seq coord that this alignment
+           * spans. This is done in one pass for the whole alignment. */
+          const int mspLen = msp->displayRange.length();
+
+          if (mspLen > bufferLen)
+            {
+              bufferLen = mspLen;
+              qIdxs = g_renew(int, qIdxs, bufferLen);
+              sIdxs = g_renew(int, sIdxs, bufferLen);
+            }
+
+          for (int j = 0; j < mspLen; ++j)
+            qIdxs[j] = msp->qRange.min() + j;
+
+          mspGetMatchCoordArray(msp, qIdxs, mspLen, TRUE, numUnalignedBases, this, sIdxs);
+
           /* For each ref-seq coord that this alignment spans, increment the depth */
+          const char *seq = mspGetMatchSeq(msp);
           int alignIdx = msp->displayRange.min();
-          int qIdx = msp->qRange.min();
 
-          for ( ; alignIdx <= msp->displayRange.max(); ++alignIdx, ++qIdx)
+          for (int j = 0; alignIdx <= msp->displayRange.max(); ++alignIdx, ++j)
             {
               /* Convert the msp coord to a zero-based coord. Note that parts of the
                * msp range may be outside the ref seq range. */
@@ -848,11 +929,9 @@ void BlxContext::calculateDepth(const int numUnalignedBases)
                   else
                     depthArray[DEPTHCOUNTER_ALL_F][displayIdx] += 1;
 
-                  /* Find the match sequence base at this coord */
-                  int sIdx = 0;
-                  const char *seq = mspGetMatchSeq(msp);
+                  const int sIdx = sIdxs[j];
 
-                  if (mspGetMatchCoord(msp, qIdx, TRUE, numUnalignedBases, this, &sIdx))
+                  if (sIdx != UNSET_INT)
                     {
                       /* Check we have the sequence. If not then don't do anything (this will
                        * show up as "unknown" in the read depth display) */
@@ -877,6 +956,9 @@ void BlxContext::calculateDepth(const int numUnalignedBases)
         }
     }
 
+  g_free(qIdxs);
+  g_free(sIdxs);
+
   /* Find the max and min depth (total depth over both strands) */
   minDepth = depthArray[DEPTHCOUNTER_ALL_F][0] + depthArray[DEPTHCOUNTER_ALL_R][0];
   maxDepth = minDepth;
@@ -1166,6 +1248,83 @@ GList* BlxContext::getFeaturesInSourceList(std::set<GQuark> sources) const
 }
 
 
+/* Get the base at the given coord of the reference sequence (complemented if requested).
+ * This gives the same result as getSequenceIndex on the plain reference sequence. */
+char BlxContext::getRefSeqBase(const int coord, const gboolean complement) const
+{
+  if (!refSeqPacked)
+    return getSequenceIndex(refSeq, coord, complement, &refSeqRange, BLXSEQ_DNA);
+
+  char result = ' ';
+
+  if (coord >= refSeqRange.min() && coord <= refSeqRange.max())
+    {
+      result = convertBaseToCorrectCase(blxPackedSeqGetBase(refSeqPacked, coord - refSeqRange.min()), BLXSEQ_DNA);
+
+      if (complement)
+        result = complementChar(result, NULL);
+    }
+
+  return result;
+}
+
+
+/* Get the forward-strand reference sequence for the given range of coords, clipped to the
+ * reference sequence range. The clipped range is returned in range_out. The result is a
+ * new string that should be free'd with g_free, or NULL if the range does not overlap
+ * the reference sequence. */
+char* BlxContext::getRefSeqSegment(const IntRange* const range, IntRange *range_out) const
+{
+  if ((!refSeq && !refSeqPacked) || !rangesOverlap(range, &refSeqRange))
+    return NULL;
+
+  range_out->set(max(range->min(), refSeqRange.min()), min(range->max(), refSeqRange.max()));
+  const int idx = range_out->min() - refSeqRange.min();
+
+  if (refSeqPacked)
+    return blxPackedSeqDecodeNew(refSeqPacked, idx, range_out->length(), FALSE, FALSE);
+  else
+    return g_strndup(refSeq + idx, range_out->length());
+}
+
+
+/* Get the spliced sequence for the given transcript from the reference sequence. The
+ * result should be free'd with g_free. */
+char* BlxContext::getSplicedSequence(const BlxSequence* const transcript, GError **error) const
+{
+  if (!refSeqPacked)
+    return blxSequenceGetSplicedSequence(transcript, refSeq, &refSeqRange, error);
+
+  /* Only decode the part of the ref seq that the transcript covers. Note that
+   * blxSequenceGetSplicedSequence never uses the first base of the sequence it is given,
+   * so start one base early to get the same result as for the whole ref seq. */
+  IntRange range;
+
+  for (GList *mspItem = transcript->mspList; mspItem; mspItem = mspItem->next)
+    {
+      const MSP* const msp = (const MSP*)(mspItem->data);
+
+      if (mspItem == transcript->mspList)
+        range.set(msp->qRange);
+      else
+        range.set(min(range.min(), msp->qRange.min()), max(range.max(), msp->qRange.max()));
+    }
+
+  range.setMin(range.min() - 1);
+
+  IntRange segmentRange;
+  char *segment = transcript->mspList ? getRefSeqSegment(&range, &segmentRange) : NULL;
+  char *result = NULL;
+
+  if (segment)
+    result = blxSequenceGetSplicedSequence(transcript, segment, &segmentRange, error);
+
+  g_free(segment);
+
+  return result;
+}
+
+
 void BlxContext::highlightBoxCalcBorders(GdkRectangle *drawingRect,
                                          GdkRectangle *highlightRect,
                                          const IntRange *fullRange,
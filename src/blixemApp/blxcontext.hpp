@@ -39,6 +39,9 @@
 
 #include <gtk/gtk.h>
 #include <blixemApp/blixem_.hpp>
+#include <blixemApp/blxSeqIndex.hpp>
+#include <blixemApp/blxRefSeqCache.hpp>
+#include <seqtoolsUtils/blxPackedSeq.hpp>
 #include <set>
 
 
@@ -78,6 +81,10 @@ public:
   std::set<GQuark> getSelectedSources() const;
   GList* getFeaturesInSourceList(std::set<GQuark> sources) const;
 
+  char getRefSeqBase(const int coord, const gboolean complement) const;
+  char* getRefSeqSegment(const IntRange* const range, IntRange *range_out) const;
+  char* getSplicedSequence(const BlxSequence* const transcript, GError **error) const;
+
   void highlightBoxCalcBorders(GdkRectangle *drawingRect, GdkRectangle *highlightRect,
                                const IntRange *fullRange, const IntRange *highlightRange,
                                const int yPadding);
@@ -103,11 +110,13 @@ public:
 
   GtkWidget *statusBar;                   /* The Blixem window's status bar */
 
-  char *refSeq;                           /* The reference sequence (always forward strand, always DNA sequence) */
+  char *refSeq;                           /* The reference sequence (always forward strand, always DNA sequence); NULL if it is packed */
+  BlxPackedSeq *refSeqPacked;             /* The reference sequence packed at 2 or 4 bits per base, if the packed-ref option is on */
   const char *refSeqName;                 /* The name of the reference sequence */
   IntRange refSeqRange;                   /* The range of the reference sequence */
   IntRange fullDisplayRange;              /* The range of the displayed sequence */
   int refSeqOffset;                       /* how much the coordinate system has been offset from the input coords */
+  BlxRefSeqCache *refSeqCache;            /* Complemented/reversed/translated copies of the reference sequence */
 
   BlxBlastMode blastMode;                 /* The type of blast matching that was used */
   BlxSeqType seqType;                     /* The type of the match sequences, e.g. DNA or peptide */
@@ -127,6 +136,9 @@ public:
   GArray* featureLists[BLXMSP_NUM_TYPES]; /* Array indexed by the BlxMspType enum. Each array entry contains a zero-terminated array of all the MSPs of that type. */
 
   GList *matchSeqs;                       /* List of all match sequences (as BlxSequences). */
+  MSP *mspListTail;                       /* Cached last item in mspList (may be NULL), used when merging in new features */
+  GList *matchSeqsTail;                   /* Cached last item in matchSeqs (may be NULL), used when merging in new features */
+  BlxSeqIndex *seqIndex;                  /* Search index of the match sequences, used to find sequences by name/column value */
   GSList *supportedTypes;                 /* List of supported GFF types */
   const char *paddingSeq;                 /* A sequence of padding characters, used if the real sequence could not be found. All padded MSPs
                                            * use this same padding sequence - it is constructed to be long enough for the longest required seq. */
@@ -136,6 +148,7 @@ public:
 
   GList *selectedSeqs;                    /* A list of sequences that are selected (as BlxSequences) */
   GList *sequenceGroups;                  /* A list of SequenceGroups */
+  int groupsVersion;                      /* Incremented whenever groups are added/deleted or their members or settings change */
 
   DotterRefType dotterRefType;            /* Whether to dotter a ref seq range or a transcript */
   DotterMatchType dotterMatchType;        /* Saved type of match to call dotter on */
@@ -175,6 +188,7 @@ private:
   void createColors(GtkWidget *widget);
   void initialiseFlags(CommandLineOptions *options);
   void loadSettings();
+  void packRefSeq(CommandLineOptions *options);
 
   double m_charWidth;
   double m_charHeight;
@@ -44,6 +44,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <algorithm>
 
 using namespace std;
@@ -1645,7 +1646,7 @@ static char* getDotterRefSeq(GtkWidget *blxWindow,
 
       if (transcriptSeq)
         {
-          result = blxSequenceGetSplicedSequence(transcriptSeq, bc->refSeq, &bc->refSeqRange, &tmpError);
+          result = bc->getSplicedSequence(transcriptSeq, &tmpError);
 
           if (refSeqName_out)
             *refSeqName_out = blxSequenceGetName(transcriptSeq);
@@ -1665,21 +1666,31 @@ static char* getDotterRefSeq(GtkWidget *blxWindow,
     }
   else
     {
-      /* Get the sequence for a range */
-      result = getSequenceSegment(bc->refSeq,
-                                  dotterRange,
-                                  BLXSTRAND_FORWARD,   /* always pass forward strand to dotter */
-                                  BLXSEQ_DNA,	  /* calculated dotter coords are always nucleotide coords */
-                                  BLXSEQ_DNA,          /* required sequence is in nucleotide coords */
-                                  frame,
-                                  bc->numFrames,
-                                  &bc->refSeqRange,
-                                  bc->blastMode,
-                                  bc->geneticCode,
-                                  FALSE,		  /* input coords are always left-to-right, even if display reversed */
-                                  FALSE,               /* always pass forward strand to dotter */
-                                  FALSE,               /* always pass forward strand to dotter */
-                                  &tmpError);
+      /* Get the sequence for a range. We only extract the part of the ref seq that the
+       * range overlaps; getSequenceSegment clips the range (and warns) as it would for
+       * the whole ref seq. */
+      IntRange segmentRange;
+      char *refSeqSegment = bc->getRefSeqSegment(dotterRange, &segmentRange);
+
+      if (refSeqSegment)
+        {
+          result = getSequenceSegment(refSeqSegment,
+                                      dotterRange,
+                                      BLXSTRAND_FORWARD,   /* always pass forward strand to dotter */
+                                      BLXSEQ_DNA,	      /* calculated dotter coords are always nucleotide coords */
+                                      BLXSEQ_DNA,          /* required sequence is in nucleotide coords */
+                                      frame,
+                                      bc->numFrames,
+                                      &segmentRange,
+                                      bc->blastMode,
+                                      bc->geneticCode,
+                                      FALSE,		      /* input coords are always left-to-right, even if display reversed */
+                                      FALSE,               /* always pass forward strand to dotter */
+                                      FALSE,               /* always pass forward strand to dotter */
+                                      &tmpError);
+
+          g_free(refSeqSegment);
+        }
 
       if (refSeqName_out)
         *refSeqName_out = bc->refSeqName;
@@ -1794,7 +1805,20 @@ static void textViewGetSeqDetails(GtkWidget *textView, char **sequence, char **s
  *		      Functions to call dotter                     *
  *******************************************************************/
 
-/* This actually executes the dotter child process */
+/* Called in the dotter child process just before exec: makes sure the shared memory
+ * segments (if any) are inherited by dotter. The data is an array of file descriptors
+ * terminated by -1. Must be async-signal-safe. */
+static void dotterChildSetup(gpointer data)
+{
+  for (const int *fd = (const int*)data; *fd >= 0; ++fd)
+    fcntl(*fd, F_SETFD, 0);
+}
+
+
+/* This actually executes the dotter child process. If sharedDataFd is a valid file
+ * descriptor it is passed to dotter, which will read the sequences and features from
+ * it rather than from the pipe. If sharedRefFd is also valid, dotter takes seq1 from
+ * the packed reference sequence in that segment, starting at index sharedRefOffset. */
 static GIOChannel* callDotterChildProcess(GtkWidget *blxWindow,
                                           const char *dotterBinary,
                                           const int dotterZoom,
@@ -1809,6 +1833,9 @@ static GIOChannel* callDotterChildProcess(GtkWidget *blxWindow,
                                           const BlxStrand seq2Strand,
                                           const gboolean seq2DisplayRev,
                                           BlxContext *bc,
+                                          const int sharedDataFd,
+                                          const int sharedRefFd,
+                                          const int sharedRefOffset,
                                           GPid *childPid,
                                           GError **error)
 {
@@ -1854,6 +1881,12 @@ static GIOChannel* callDotterChildProcess(GtkWidget *blxWindow,
   if (sleep)				    argList = g_slist_append(argList, g_strdup("--sleep=30"));
   if (bc->flags[BLXFLAG_NEGATE_COORDS])	    argList = g_slist_append(argList, g_strdup("-N"));
 
+  if (sharedDataFd >= 0)
+    argList = g_slist_append(argList, g_strdup_printf("--shared-data=%d", sharedDataFd));
+
+  if (sharedDataFd >= 0 && sharedRefFd >= 0)
+    argList = g_slist_append(argList, g_strdup_printf("--shared-ref=%d:%d", sharedRefFd, sharedRefOffset));
+
   /* now tell Dotter that we're calling it internally from another SeqTools
    * program, so that it knows to expect piped data */
   argList = g_slist_append(argList, g_strdup("-S"));
@@ -1900,12 +1933,25 @@ static GIOChannel* callDotterChildProcess(GtkWidget *blxWindow,
 
   int standard_input = 0;
 
+  int inheritFds[3];
+  int numInheritFds = 0;
+
+  if (sharedDataFd >= 0)
+    {
+      inheritFds[numInheritFds++] = sharedDataFd;
+
+      if (sharedRefFd >= 0)
+        inheritFds[numInheritFds++] = sharedRefFd;
+    }
+
+  inheritFds[numInheritFds] = -1;
+
   gboolean ok = g_spawn_async_with_pipes(NULL, //inherit parent' working directory
                                          argv,
                                          NULL, //inherit parent's environment
                                          (GSpawnFlags)0,
-                                         NULL,
-                                         NULL,
+                                         dotterChildSetup,
+                                         inheritFds,
                                          childPid,
                                          &standard_input,
                                          NULL,
@@ -1919,7 +1965,50 @@ static GIOChannel* callDotterChildProcess(GtkWidget *blxWindow,
 }
 
 
-/* Call dotter as an external process */
+/* Pack the sequences and features we want to pass to dotter into a shared memory
+ * segment. seq1 is omitted if dotter will take it from the shared reference sequence.
+ * Returns the segment's file descriptor, or -1 if it could not be created. */
+static int createDotterSharedData(BlxContext *bc,
+                                  IntRange *seq1Range,
+                                  const char *seq1,
+                                  const gboolean omitSeq1,
+                                  IntRange *seq2Range,
+                                  const char *seq2,
+                                  const IntRange* const refSeqRange,
+                                  const BlxSequence *transcriptSeq)
+{
+  BlxPackedData *data = blxPackedDataCreate(seq1, omitSeq1 ? 0 : seq1Range->length(), seq2, seq2Range->length());
+
+  if (transcriptSeq)
+    {
+      blxPackedDataAddTranscript(data, transcriptSeq, refSeqRange);
+    }
+  else
+    {
+      GList *seqItem = bc->matchSeqs;
+      for ( ; seqItem; seqItem = seqItem->next)
+        {
+          BlxSequence *blxSeq = (BlxSequence*)(seqItem->data);
+          blxPackedDataAddBlxSequence(data, blxSeq, seq1Range, seq2Range);
+        }
+    }
+
+  GError *tmpError = NULL;
+  const int fd = blxPackedDataWriteToSharedMemory(data, &tmpError);
+  blxPackedDataDestroy(data);
+
+  if (tmpError)
+    {
+      g_debug("%sFalling back to piping data to Dotter.\n", tmpError->message);
+      g_error_free(tmpError);
+    }
+
+  return fd;
+}
+
+
+/* Call dotter as an external process. seq1FromRefSeq should be true if seq1 is the
+ * forward-strand reference sequence for seq1Range (rather than e.g. a transcript). */
 gboolean callDotterExternal(GtkWidget *blxWindow,
                             BlxContext *bc,
                             int dotterZoom,
@@ -1936,6 +2025,7 @@ gboolean callDotterExternal(GtkWidget *blxWindow,
 			    const BlxStrand seq2Strand,
 			    const gboolean seq2DisplayRev,
                             const gboolean clipRange,
+                            const gboolean seq1FromRefSeq,
                             const IntRange* const refSeqRange,
                             const BlxSequence *transcriptSeq,
                             GError **error)
@@ -1961,6 +2051,17 @@ gboolean callDotterExternal(GtkWidget *blxWindow,
 
   g_debug("Calling %s with region: %d,%d - %d,%d\n", dotterBinary, seq1Range->min(), seq2Range->min(), seq1Range->max(), seq2Range->max());
 
+  /* If the reference sequence is packed in shared memory, dotter can map it and take
+   * seq1 from it rather than being sent a copy */
+  const int sharedRefFd = seq1FromRefSeq ? blxPackedSeqGetSharedFd(bc->refSeqPacked) : -1;
+  const gboolean shareRef = (sharedRefFd >= 0 &&
+                             seq1Range->min() >= bc->refSeqRange.min() &&
+                             seq1Range->max() <= bc->refSeqRange.max());
+
+  /* Pack the sequences and features into a shared memory segment for dotter to map. If
+   * that fails for any reason we fall back to piping them as text. */
+  int sharedDataFd = createDotterSharedData(bc, seq1Range, seq1, shareRef, seq2Range, seq2, refSeqRange, transcriptSeq);
+
   /* Create the child process */
   GPid childPid = 0;
   gsize bytes_written = 0;
@@ -1969,7 +2070,13 @@ gboolean callDotterExternal(GtkWidget *blxWindow,
   GIOChannel *ioChannel = callDotterChildProcess(blxWindow, dotterBinary, dotterZoom, hspsOnly, sleep,
                                                  seq1Name, seq1Range, seq1Strand, seq1DisplayRev,
                                                  seq2Name, seq2Range, seq2Strand, seq2DisplayRev,
-                                                 bc, &childPid, &tmpError);
+                                                 bc, sharedDataFd, shareRef ? sharedRefFd : -1,
+                                                 seq1Range->min() - bc->refSeqRange.min(),
+                                                 &childPid, &tmpError);
+
+  /* The child has its own copy of the descriptor now (if it was started) */
+  if (sharedDataFd >= 0)
+    close(sharedDataFd);
 
   if (ioChannel)
     {
@@ -1984,7 +2091,7 @@ gboolean callDotterExternal(GtkWidget *blxWindow,
         g_set_error(error, BLX_DOTTER_ERROR, BLX_DOTTER_ERROR_NO_EXE, "Error creating child process for Dotter.\n");
     }
 
-  if (!tmpError)
+  if (!tmpError && sharedDataFd < 0)
     {
       /* Pass the sequences */
       DEBUG_OUT("Piping sequences to dotter...\n");
@@ -1997,7 +2104,7 @@ gboolean callDotterExternal(GtkWidget *blxWindow,
       DEBUG_OUT("...done\n");
     }
 
-  if (!tmpError)
+  if (!tmpError && sharedDataFd < 0)
     {
       /* Pass the features */
       DEBUG_OUT("Piping features to dotter...\n");
@@ -2167,7 +2274,7 @@ gboolean callDotterOnSelectedSeq(GtkWidget *blxWindow,
   return callDotterExternal(blxWindow, bc, dotterZoom, hspsOnly, sleep,
                             refSeqName, &dotterRange, refSeqSegment, refSeqStrand, revHozScale,
                             dotterSName, &sRange, dotterSSeq, selectedSeq->strand, revVertScale,
-                            clipRange, &bc->refSeqRange, transcriptSeq, error);
+                            clipRange, !transcript, &bc->refSeqRange, transcriptSeq, error);
 }
 
 
@@ -2314,7 +2421,7 @@ gboolean callDotterOnAdhocSeq(DotterDialogData *dialogData, GError **error)
   result = callDotterExternal(blxWindow, bc, dotterZoom, FALSE, dialogData->sleep,
                               refSeqName, &dotterRange, refSeqSegment, refSeqStrand, revHozScale,
                               dotterSName, &sRange, dotterSSeq, qStrand, revVertScale,
-                              clipRange, &bc->refSeqRange, transcriptSeq, error);
+                              clipRange, !transcript, &bc->refSeqRange, transcriptSeq, error);
 
   /* dotter takes ownership of dotterSSeq but not dotterSName, so free it */
   g_free(dotterSName);
@@ -2392,7 +2499,7 @@ static gboolean callDotterOnSelf(DotterDialogData *dialogData, GError **error)
   callDotterExternal(blxWindow, bc, dotterZoom, FALSE, dialogData->sleep,
                      refSeqName, &qRange, refSeqSegment, qStrand, revScale,
                      refSeqName, &qRange, dotterSSeq, qStrand, revScale,
-                     FALSE, &bc->refSeqRange, transcriptSeq, error);
+                     FALSE, !transcript, &bc->refSeqRange, transcriptSeq, error);
 
   return TRUE;
 }
@@ -40,9 +40,12 @@
 #include <unistd.h>
 
 #include <blixemApp/blixem_.hpp>
+#include <blixemApp/blxbatch.hpp>
 #include <seqtoolsUtils/utilities.hpp>
 #include <seqtoolsUtils/blxparser.hpp>
 #include <seqtoolsUtils/blxGff3Parser.hpp>
+#include <seqtoolsUtils/blxIndexedSeq.hpp>
+#include <seqtoolsUtils/seqtoolsTrace.hpp>
 
 
 /* Some globals.... */
@@ -88,6 +91,26 @@ gboolean blixem_debug_G = FALSE ;
 \n\
   --abbrev-title-off\n\
     Do not abbreviate window title prefixes\n\
+\n\
+  --batch\n\
+    Run without a display: load the features, fetch the sequence data and write\n\
+    the output files given by the --batch-* options, then exit. Coordinates are\n\
+    as displayed by Blixem, i.e. after applying any --offset or --map-coords.\n\
+\n\
+  --batch-depth=<file>\n\
+    In batch mode, write the read depth to <file> in bedGraph format.\n\
+\n\
+  --batch-fasta=<file>\n\
+    In batch mode, write the spliced sequences of transcripts to <file> in FASTA format.\n\
+\n\
+  --batch-gff=<file>\n\
+    In batch mode, write the features to <file> in GFF v3 format.\n\
+\n\
+  --batch-range=<start:end>\n\
+    In batch mode, only output features that overlap the given range.\n\
+\n\
+  --batch-sources=<sources>\n\
+    In batch mode, only output features from the given comma-separated list of sources.\n\
 \n\
   --compiled\n\
     Show package compile date.\n\
@@ -136,6 +159,17 @@ gboolean blixem_debug_G = FALSE ;
 \n\
   --optional-data\n\
     Parse additional data such as organism and tissue-type on start-up.\n\
+\n\
+  --packed-ref\n\
+    Store the reference sequence packed at 2 or 4 bits per base rather than as text, and\n\
+    share it with Dotter, to reduce memory use for large nucleotide reference sequences.\n\
+\n\
+  --profile-startup\n\
+    Report the time taken by each phase of start-up on the console.\n\
+\n\
+  --ref-region=<name>[:<start>-<end>]\n\
+    Load only the given region of the reference sequence. The <sequence_file> must be\n\
+    a FASTA file with a .fai index or a .2bit file; only the requested bases are read.\n\
 \n\
   --remove-input-files\n\
     Delete the input files after they have been parsed.\n\
@@ -160,6 +194,11 @@ gboolean blixem_debug_G = FALSE ;
 \n\
   --start-next-match\n\
     Start with the display centred on the first match to the right of the default start coord.\n\
+\n\
+  --trace=<file>\n\
+    Record the time taken by parsing, fetching, drawing etc. and write it to <file> on exit\n\
+    in Chrome trace-event format, with a summary on the console. Tracing can also be enabled\n\
+    by setting the SEQTOOLS_TRACE environment variable to the file name.\n\
 \n\
   -y <file>, --styles-file=<file>\n\
     Read color options from a key-value file. Use --help option to see details.\n\
@@ -293,6 +332,8 @@ static void initCommandLineOptions(CommandLineOptions *options, char *refSeqName
   options->saveTempFiles = FALSE;
   options->coverageOn = FALSE;
   options->abbrevTitle = FALSE;
+  options->profileStartup = FALSE;
+  options->packRefSeq = FALSE;
 
   options->blastMode = BLXMODE_UNSET;
   options->seqType = BLXSEQ_NONE;
@@ -466,6 +507,8 @@ int main(int argc, char **argv)
   char *align_types = NULL ;        /* string containing alignment types, to display in the title */
   char *config_file = NULL ;        /* optional blixem config file (usually "blixemrc") */
   char *key_file = NULL ;           /* optional keyword file for passing style information */
+  char *refRegion = NULL ;          /* optional region of an indexed reference sequence file to load */
+  char *traceFile = NULL ;          /* optional file to write timing trace to */
   GError *error = NULL ;
 
   char refSeqName[FULLNAMESIZE+1] = "";
@@ -473,6 +516,8 @@ int main(int argc, char **argv)
   static CommandLineOptions options;
   initCommandLineOptions(&options, refSeqName);
 
+  static BlxBatchOptions batchOptions;      /* options for running in batch mode (i.e. without a display) */
+
   /* Set up the GLib message handlers
    *
    * There are two handlers: the default one for all non-critical messages, which will just log
@@ -495,6 +540,12 @@ int main(int argc, char **argv)
     {
       {"abbrev-title-off",      no_argument,        &options.abbrevTitle, 0},
       {"abbrev-title-on",       no_argument,        &options.abbrevTitle, 1},
+      {"batch",                 no_argument,        &batchOptions.enabled, 1},
+      {"batch-depth",           required_argument,  NULL, 0},
+      {"batch-fasta",           required_argument,  NULL, 0},
+      {"batch-gff",             required_argument,  NULL, 0},
+      {"batch-range",           required_argument,  NULL, 0},
+      {"batch-sources",         required_argument,  NULL, 0},
       {"compiled",              no_argument,        &showCompiled, 1},
       {"dataset",               required_argument,  NULL, 0},
       {"dotter-first-match",    no_argument,        &options.dotterFirst, 1},
@@ -504,12 +555,16 @@ int main(int argc, char **argv)
       {"highlight-diffs",       no_argument,        &options.highlightDiffs, 1},
       {"invert-sort",           no_argument,        &options.sortInverted, 1},
       {"optional-data",         no_argument,        &options.optionalColumns, 1},
+      {"packed-ref",            no_argument,        &options.packRefSeq, 1},
+      {"profile-startup",       no_argument,        &options.profileStartup, 1},
+      {"ref-region",            required_argument,  NULL, 0},
       {"remove-input-files",    no_argument,        &rm_input_files, 1},
       {"save-temp-files",       no_argument,        &options.saveTempFiles, 1},
       {"show-coverage",         no_argument,        &options.coverageOn, 1},
       {"sort-mode",             required_argument,  NULL, 0},
       {"squash-matches",        no_argument,        &options.squashMatches, 1},
       {"start-next-match",      no_argument,        &options.startNextMatch, 1},
+      {"trace",                 required_argument,  NULL, 0},
       {"version",               no_argument,        &showVersion, 1},
       {"zoom-whole",            no_argument,        &options.zoomWhole, 1},
 
@@ -564,6 +619,39 @@ int main(int argc, char **argv)
               {
                 options.dataset = g_strdup(optarg);
               }
+            else if (stringsEqual(long_options[optionIndex].name, "batch-depth", TRUE))
+              {
+                batchOptions.depthFile = g_strdup(optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "batch-fasta", TRUE))
+              {
+                batchOptions.fastaFile = g_strdup(optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "batch-gff", TRUE))
+              {
+                batchOptions.gffFile = g_strdup(optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "batch-range", TRUE))
+              {
+                const char *cp = strchr(optarg, ':');
+
+                if (cp)
+                  batchOptions.range.set(atoi(optarg), atoi(cp + 1));
+                else
+                  g_warning("Invalid parameters for --batch-range argument; expected <start:end> but got '%s'. Range will be ignored.\n", optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "batch-sources", TRUE))
+              {
+                blxBatchSetSources(&batchOptions, optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "ref-region", TRUE))
+              {
+                refRegion = g_strdup(optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "trace", TRUE))
+              {
+                traceFile = g_strdup(optarg);
+              }
           break;
 
         case '?':
@@ -682,6 +770,25 @@ int main(int argc, char **argv)
 
   validateOptions(&options);
 
+  /* Enable timing instrumentation, if requested by --trace or the environment */
+  seqtoolsTraceInit(traceFile);
+  g_free(traceFile);
+
+  if (batchOptions.enabled)
+    {
+      if (!batchOptions.depthFile && !batchOptions.gffFile && !batchOptions.fastaFile)
+        g_error("Batch mode requires at least one of the --batch-depth, --batch-gff or --batch-fasta arguments.\n");
+
+      /* There is no display in batch mode, so send critical messages to the console
+       * rather than to a pop-up */
+      g_log_set_handler(NULL, (GLogLevelFlags)(G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION),
+                        defaultMessageHandler, &options.msgData);
+    }
+
+  /* Time each phase of startup, if requested. In batch mode the phases are always reported. */
+  if (options.profileStartup || batchOptions.enabled)
+    blxProfileStart();
+
   /* Update the list of supported GFF types, filtering matches by the sequence type.
    * (It's quick and dirty to destroy recreate this but it's a small list and only done once.) */
   blxDestroyGffTypeList(&supportedTypes);
@@ -689,11 +796,15 @@ int main(int argc, char **argv)
 
   const int numFiles = argc - optind;
 
-  /* Add -install for private colormaps */
-  if (install)
-    argvAdd(&argc, &argv, "-install");
+  /* Don't initialise gtk in batch mode because we may not have a display */
+  if (!batchOptions.enabled)
+    {
+      /* Add -install for private colormaps */
+      if (install)
+        argvAdd(&argc, &argv, "-install");
 
-  gtk_init(&argc, &argv);
+      gtk_init(&argc, &argv);
+    }
 
   /* mapCoords essentially does the same thing as offset, so we shouldn't be
    * given both.  Get the offset from mapCoords, if given. */
@@ -709,9 +820,20 @@ int main(int argc, char **argv)
   blxInitConfig(config_file, &options, &error);
   reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
 
-  /* Read in the key file, if there is one */
-  GSList *styles = blxReadStylesFile(key_file, &error);
-  reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+  /* Read in the key file, if there is one. Styles are only used for drawing (and
+   * allocating their colors requires a display) so they are not needed in batch mode. */
+  GSList *styles = NULL;
+
+  if (batchOptions.enabled)
+    {
+      if (key_file)
+        g_warning("Styles file '%s' is not used in batch mode\n", key_file);
+    }
+  else
+    {
+      styles = blxReadStylesFile(key_file, &error);
+      reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+    }
 
   /* Get the file names */
   if (numFiles == 1)
@@ -798,9 +920,32 @@ int main(int argc, char **argv)
   if (options.seqType == BLXSEQ_NONE && options.blastMode != BLXMODE_UNSET)
     options.seqType = (options.blastMode == BLXMODE_BLASTN ? BLXSEQ_DNA : BLXSEQ_PEPTIDE);
 
+  /* The region option only applies when the reference sequence is read from an
+   * indexed file, so tell the user if it can't be used */
+  if (refRegion && options.refSeq)
+    g_warning("Ignoring --ref-region because the reference sequence was given in the features file\n");
+  else if (refRegion && (!seqfilename || !strcmp(seqfilename, "-")))
+    g_warning("Ignoring --ref-region because the reference sequence is not being read from a file (random access requires an indexed FASTA or .2bit file)\n");
+
   /* Parse the reference sequence, if we have a separate sequence file (and it was
    * not already specified in the features file) */
-  if (!options.refSeq && seqfilename)
+  if (!options.refSeq && seqfilename && strcmp(seqfilename, "-") &&
+      (refRegion || indexedSeqFileIsTwoBit(seqfilename)))
+    {
+      /* Random-access load of the requested region from an indexed file */
+      if (!indexedSeqFileIsIndexed(seqfilename))
+        g_error("--ref-region requires an indexed sequence file (FASTA with a .fai index, or .2bit) but '%s' is not indexed\n", seqfilename);
+
+      options.refSeq = readIndexedSeq(seqfilename, refRegion, options.refSeqName, FULLNAMESIZE + 1,
+                                      &options.refSeqRange, options.seqType, &error);
+
+      if (!options.refSeq)
+        {
+          prefixError(error, "Error reading reference sequence from '%s': ", seqfilename);
+          reportAndClearIfError(&error, G_LOG_LEVEL_ERROR);
+        }
+    }
+  else if (!options.refSeq && seqfilename)
     {
       /* Open the file (or stdin) */
       if (!strcmp(seqfilename, "-"))
@@ -881,10 +1026,27 @@ int main(int argc, char **argv)
   if (FSfilename)
     g_free(FSfilename);
 
+  g_free(refRegion);
+
+  blxProfilePhase("parse input");
+
+  if (batchOptions.enabled)
+    {
+      /* Write the requested output files rather than displaying anything */
+      const int result = blxBatchRun(&options, &batchOptions, featureLists, seqList, supportedTypes, lookupTable);
+
+      g_free(key_file);
+      g_free(config_file);
+      g_hash_table_unref(lookupTable);
+
+      return result;
+    }
+
   /* Now display the alignments. (Note that TRUE signals blxview() that it is being called from
    * this standalone blixem program instead of as part of acedb. */
   if (blxview(&options, featureLists, seqList, supportedTypes, pfetch, align_types, TRUE, styles, lookupTable))
     {
+      blxProfileEnd("total");
       gtk_main();
     }
 
@@ -90,6 +90,10 @@ static void            processOrganism(BlxSequence *blxSeq);
 
 GtkWidget *blixemWindow = NULL ;
 static char *padseq = 0;
+static int g_mspDisplayRangesVersion = 0;  /* incremented whenever all msp display ranges are recalculated */
+static int g_featuresVersion = 0;          /* incremented whenever new features are merged into the main lists */
+static GTimer *g_profilePhaseTimer = NULL; /* if set, the time taken by each startup phase is reported */
+static GTimer *g_profileTotalTimer = NULL;
 
 
 
@@ -274,12 +278,21 @@ static void validateInput(CommandLineOptions *options)
 
 
 /* Utility to get the parent sequence of the given variant, if it is not already set.
- * returns true if the returned parent is not null. */
-static gboolean getParent(BlxSequence *variant, BlxSequence **parent, GList *allSeqs)
+ * The parent is looked up in the given table of sequences keyed on their lower-case
+ * name. Returns true if the returned parent is not null. */
+static gboolean getParent(BlxSequence *variant, BlxSequence **parent, GHashTable *seqsByName)
 {
   if (*parent == NULL)
     {
-      *parent = blxSequenceGetVariantParent(variant, allSeqs);
+      char *parentName = blxSequenceGetVariantParentName(variant);
+
+      if (parentName)
+        {
+          char *key = g_ascii_strdown(parentName, -1);
+          *parent = (BlxSequence*)g_hash_table_lookup(seqsByName, key);
+          g_free(key);
+          g_free(parentName);
+        }
     }
 
   return (*parent != NULL);
@@ -288,7 +301,7 @@ static gboolean getParent(BlxSequence *variant, BlxSequence **parent, GList *all
 
 /* This function checks if the given sequence is missing its optional data (such as organism
  * and gene name) and, if so, looks for the parent sequence and copies the data from there. */
-static void populateMissingDataFromParent(BlxSequence *curSeq, GList *seqList, GList *columnList)
+static void populateMissingDataFromParent(BlxSequence *curSeq, GHashTable *seqsByName, GList *columnList)
 {
   BlxSequence *parent = NULL;
   GList *item = columnList;
@@ -300,7 +313,7 @@ static void populateMissingDataFromParent(BlxSequence *curSeq, GList *seqList, G
 
       if (!value)
         {
-          getParent(curSeq, &parent, seqList);
+          getParent(curSeq, &parent, seqsByName);
           GValue *parentValue = blxSequenceGetValue(parent, columnInfo->columnId);
           blxSequenceSetValue(curSeq, columnInfo->columnId, parentValue);
         }
@@ -309,20 +322,34 @@ static void populateMissingDataFromParent(BlxSequence *curSeq, GList *seqList, G
 
 
 /* Merge new features into our existing context: merges the newMsps list into mspList and newSeqs
- * list into seqList. Takes ownership of the contents of both newMsps and newSeqs. */
-void blxMergeFeatures(MSP *newMsps, GList *newSeqs, MSP **mspList, GList **seqList)
+ * list into seqList. Takes ownership of the contents of both newMsps and newSeqs.
+ *
+ * mspListTail and seqListTail are optional caches of the last items in mspList and seqList. If
+ * given, the search for the end of each list starts from the cached item rather than from the
+ * start of the list, and the caches are updated to the new ends of the lists, so the cost of a
+ * merge depends only on the number of new features rather than on the number already loaded.
+ * A cached item that is no longer last (e.g. because the list has been sorted since) is fine as
+ * long as it is still in the list; the caches must be reset to NULL if the list is destroyed. */
+void blxMergeFeatures(MSP *newMsps, GList *newSeqs, MSP **mspList, GList **seqList,
+                      MSP **mspListTail, GList **seqListTail)
 {
   g_return_if_fail(mspList && seqList);
 
-  if (mspList && *mspList)
+  /* Anything that summarises the features needs to be updated */
+  ++g_featuresVersion;
+
+  if (*mspList)
     {
       /* Append new MSPs to MSP list */
-      MSP *lastMsp = *mspList;
+      MSP *lastMsp = (mspListTail && *mspListTail) ? *mspListTail : *mspList;
 
       while (lastMsp->next)
         lastMsp = lastMsp->next;
 
       lastMsp->next = newMsps;
+
+      if (mspListTail)
+        *mspListTail = lastMsp;
     }
   else
     {
@@ -330,8 +357,34 @@ void blxMergeFeatures(MSP *newMsps, GList *newSeqs, MSP **mspList, GList **seqLi
       *mspList = newMsps;
     }
 
+  if (mspListTail && newMsps)
+    {
+      MSP *lastMsp = newMsps;
+
+      while (lastMsp->next)
+        lastMsp = lastMsp->next;
+
+      *mspListTail = lastMsp;
+    }
+
   /* Append new sequences to sequence list */
-  *seqList = g_list_concat(*seqList, newSeqs);
+  if (*seqList && newSeqs)
+    {
+      GList *lastSeq = (seqListTail && *seqListTail) ? *seqListTail : *seqList;
+
+      while (lastSeq->next)
+        lastSeq = lastSeq->next;
+
+      lastSeq->next = newSeqs;
+      newSeqs->prev = lastSeq;
+    }
+  else if (newSeqs)
+    {
+      *seqList = newSeqs;
+    }
+
+  if (seqListTail && newSeqs)
+    *seqListTail = g_list_last(newSeqs);
 }
 
 
@@ -361,6 +414,54 @@ void loadNativeFile(const char *filename,
       return;
     }
 
+  if (filename)
+    {
+      /* Open the file for reading */
+      FILE *file = fopen(filename, "r");
+
+      if (!file)
+        {
+          g_set_error(error, BLX_ERROR, 1, "Error opening file '%s' for reading.\n", filename);
+        }
+      else
+        {
+          loadNativeStream(file, NULL, keyFile, blastMode, featureLists, supportedTypes, styles,
+                           newMsps, newSeqs, columnList, lookupTable, refSeqOffset, refSeqRange, error);
+
+          fclose(file);
+        }
+    }
+  else
+    {
+      loadNativeStream(NULL, buffer, keyFile, blastMode, featureLists, supportedTypes, styles,
+                       newMsps, newSeqs, columnList, lookupTable, refSeqOffset, refSeqRange, error);
+    }
+}
+
+
+/* As loadNativeFile but reads from an already-open stream (e.g. the output
+ * pipe of a fetch command) or from a buffer. The caller owns the stream. */
+void loadNativeStream(FILE *file,
+                      const char *buffer,
+                      GKeyFile *keyFile,
+                      BlxBlastMode *blastMode,
+                      GArray* featureLists[],
+                      GSList *supportedTypes,
+                      GSList *styles,
+                      MSP **newMsps,
+                      GList **newSeqs,
+                      GList *columnList,
+                      GHashTable *lookupTable,
+                      const int refSeqOffset,
+                      const IntRange* const refSeqRange,
+                      GError **error)
+{
+  if (!file && !buffer)
+    {
+      g_set_error(error, BLX_ERROR, 1, "No stream or buffer provided.");
+      return;
+    }
+
   char *dummyseq1 = NULL;    /* Needed for blxparser to handle both dotter and blixem */
   char dummyseqname1[FULLNAMESIZE+1] = "";
   char *dummyseq2 = NULL;    /* Needed for blxparser to handle both dotter and blixem */
@@ -376,22 +477,10 @@ void loadNativeFile(const char *filename,
       toplevelRange.set(refSeqRange->min() - refSeqOffset, refSeqRange->max() - refSeqOffset);
     }
 
-  if (filename)
+  if (file)
     {
-      /* Open the file for reading */
-      FILE *file = fopen(filename, "r");
-
-      if (!file)
-        {
-          g_set_error(error, BLX_ERROR, 1, "Error opening file '%s' for reading.\n", filename);
-        }
-      else
-        {
-          parseFS(newMsps, file, blastMode, featureLists, newSeqs, columnList, supportedTypes, styles,
-                  &dummyseq1, dummyseqname1, &toplevelRange, &dummyseq2, dummyseqname2, keyFile, lookupTable, NULL, error) ;
-
-          fclose(file);
-        }
+      parseFS(newMsps, file, blastMode, featureLists, newSeqs, columnList, supportedTypes, styles,
+              &dummyseq1, dummyseqname1, &toplevelRange, &dummyseq2, dummyseqname2, keyFile, lookupTable, NULL, error) ;
     }
   else if (buffer)
     {
@@ -416,11 +505,34 @@ void finaliseFetch(GList *seqList, GList *columnList)
       processOrganism(blxSeq);
     }
 
+  /* Create a table of the sequences keyed on their (case-insensitive) name, so that
+   * we can look up variants' parents without searching the whole list each time. If
+   * names clash, the first sequence in the list takes precedence. */
+  GHashTable *seqsByName = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (seqItem = seqList; seqItem; seqItem = seqItem->next)
+    {
+      BlxSequence *blxSeq = (BlxSequence*)(seqItem->data);
+      const char *seqName = blxSequenceGetName(blxSeq);
+
+      if (seqName)
+        {
+          char *key = g_ascii_strdown(seqName, -1);
+
+          if (g_hash_table_lookup(seqsByName, key))
+            g_free(key);
+          else
+            g_hash_table_insert(seqsByName, key, blxSeq);
+        }
+    }
+
   for (seqItem = seqList; seqItem; seqItem = seqItem->next)
     {
       BlxSequence *blxSeq = (BlxSequence*)(seqItem->data);
-      populateMissingDataFromParent(blxSeq, seqList, columnList);
+      populateMissingDataFromParent(blxSeq, seqsByName, columnList);
     }
+
+  g_hash_table_destroy(seqsByName);
 }
 
 
@@ -490,14 +602,41 @@ gboolean blxview(CommandLineOptions *options,
       reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
     }
 
+  gboolean status = blxviewFetchSequences(options, featureLists, &seqList, supportedTypes, External, lookupTable);
+
+  if (status)
+    blxviewFinaliseSequences(options, featureLists, &seqList, lookupTable);
+
+  /* Note that we create a blxview even if MSPlist is empty.
+   * But only if it's an internal call.  If external & anything's wrong, we die. */
+  if (status || !External)
+    {
+      blviewCreate(align_types, padseq, featureLists, seqList, supportedTypes, options, External, styles) ;
+    }
+
+  return status;
+}
+
+
+/* Validate the input and fetch any missing sequence data for the given features. This
+ * does the data processing that blxview needs before it creates the window, so it can
+ * also be used without a display (see blxbatch.cpp). Returns false if the fetch failed. */
+gboolean blxviewFetchSequences(CommandLineOptions *options,
+                               GArray* featureLists[],
+                               GList **seqList,
+                               GSList *supportedTypes,
+                               const gboolean External,
+                               GHashTable *lookupTable)
+{
   validateInput(options);
 
   /* Find any assembly gaps (i.e. gaps in the reference sequence) */
   findAssemblyGaps(options->refSeq, featureLists, &options->mspList, &options->refSeqRange);
+  blxProfilePhase("find assembly gaps");
 
   /* offset has not been applied yet, so pass offset=0 */
   BulkFetch bulk_fetch(External, options->saveTempFiles, options->seqType,
-                       &seqList, options->columnList,
+                       seqList, options->columnList,
                        options->bulkFetchDefault, options->fetchMethods, &options->mspList, &options->blastMode,
                        featureLists, supportedTypes, NULL, 0, &options->refSeqRange,
                        options->dataset, FALSE, lookupTable,
@@ -507,27 +646,66 @@ gboolean blxview(CommandLineOptions *options,
 #endif
                        options->fetch_debug);
 
-  gboolean status = bulk_fetch.performFetch();
+  const gboolean result = bulk_fetch.performFetch();
+  blxProfilePhase("fetch sequences");
 
-  if (status)
-    {
-      finaliseFetch(seqList, options->columnList);
+  return result;
+}
 
-      /* Construct missing data and do any other required processing now we have all the sequence data */
-      finaliseBlxSequences(featureLists, &options->mspList, &seqList, options->columnList,
-                           options->refSeqOffset, options->seqType,
-                           options->numFrames, &options->refSeqRange, TRUE, lookupTable);
 
+/* Once the sequences have been fetched, construct missing data and do any other
+ * required processing now we have all the sequence data */
+void blxviewFinaliseSequences(CommandLineOptions *options,
+                              GArray* featureLists[],
+                              GList **seqList,
+                              GHashTable *lookupTable)
+{
+  finaliseFetch(*seqList, options->columnList);
+
+  finaliseBlxSequences(featureLists, &options->mspList, seqList, options->columnList,
+                       options->refSeqOffset, options->seqType,
+                       options->numFrames, &options->refSeqRange, TRUE, lookupTable);
+
+  blxProfilePhase("finalise sequences");
+}
+
+
+/* Start timing the startup phases. Once started, the time taken by each phase is
+ * reported to the console by blxProfilePhase until blxProfileEnd is called. */
+void blxProfileStart()
+{
+  if (!g_profilePhaseTimer)
+    {
+      g_profilePhaseTimer = g_timer_new();
+      g_profileTotalTimer = g_timer_new();
     }
+}
 
-  /* Note that we create a blxview even if MSPlist is empty.
-   * But only if it's an internal call.  If external & anything's wrong, we die. */
-  if (status || !External)
+
+/* Report the time taken by the given phase (i.e. since the last phase finished) and
+ * start timing the next phase. Does nothing if profiling was not started. */
+void blxProfilePhase(const char *phaseName)
+{
+  if (g_profilePhaseTimer)
     {
-      blviewCreate(align_types, padseq, featureLists, seqList, supportedTypes, options, External, styles) ;
+      g_message_info("%-24s %8.3f seconds\n", phaseName, g_timer_elapsed(g_profilePhaseTimer, NULL));
+      g_timer_start(g_profilePhaseTimer);
     }
+}
 
-  return status;
+
+/* Report the total time since profiling was started and stop profiling */
+void blxProfileEnd(const char *description)
+{
+  if (g_profilePhaseTimer)
+    {
+      g_message_info("%-24s %8.3f seconds\n", description, g_timer_elapsed(g_profileTotalTimer, NULL));
+
+      g_timer_destroy(g_profilePhaseTimer);
+      g_timer_destroy(g_profileTotalTimer);
+      g_profilePhaseTimer = NULL;
+      g_profileTotalTimer = NULL;
+    }
 }
 
 
@@ -915,8 +1093,9 @@ static void mspCalcFullQRange(const MSP* const msp,
 
 /* Calculate the full extent of the match sequence to display, in display coords,
  * and cache the result in the msp. Includes any portions of unaligned sequence that we're
- * displaying */
-void mspCalculateFullExtents(MSP *msp, const BlxContext* const bc, const int numUnalignedBases)
+ * displaying. Returns the length of the full extent if the msp is shown in the detail-view,
+ * or 0 otherwise. */
+static int mspCalcFullExtents(MSP *msp, const BlxContext* const bc, const int numUnalignedBases)
 {
   mspCalcFullSRange(msp, bc->flags, numUnalignedBases, bc->featureLists[BLXMSP_POLYA_SITE], &msp->fullSRange);
   mspCalcFullQRange(msp, bc->flags, numUnalignedBases, bc->featureLists[BLXMSP_POLYA_SITE], bc->numFrames, &msp->fullSRange, &msp->fullRange);
@@ -927,11 +1106,17 @@ void mspCalculateFullExtents(MSP *msp, const BlxContext* const bc, const int num
   const int coord2 = convertDnaIdxToDisplayIdx(msp->fullRange.max(), bc->seqType, frame, bc->numFrames, bc->displayRev, &bc->refSeqRange, NULL);
   msp->fullRange.set(coord1, coord2);
 
-  /* Remember the max len of all the MSPs in the detail-view */
-  if (typeShownInDetailView(msp->type) && msp->fullRange.length() > getMaxMspLen())
-    {
-      setMaxMspLen(msp->fullRange.length());
-    }
+  return typeShownInDetailView(msp->type) ? msp->fullRange.length() : 0;
+}
+
+
+/* As mspCalcFullExtents but also updates the max len of all the MSPs in the detail-view */
+void mspCalculateFullExtents(MSP *msp, const BlxContext* const bc, const int numUnalignedBases)
+{
+  const int len = mspCalcFullExtents(msp, bc, numUnalignedBases);
+
+  if (len > getMaxMspLen())
+    setMaxMspLen(len);
 }
 
 
@@ -945,67 +1130,358 @@ static void mspCalculateDisplayRange(MSP *msp, const BlxContext* const bc)
 }
 
 
-/* This caches the display range (in display coords rather than dna coords,
- * and inverted if the display is inverted) for each MSP */
-void cacheMspDisplayRanges(const BlxContext* const bc, const int numUnalignedBases)
+/* Results of calculating the derived data for one chunk of MSPs. The chunks may be
+ * processed on worker threads, so messages are saved here and reported by the caller. */
+typedef struct _MspDataChunkResult
 {
-  /* This also calculates the max msp len */
-  setMaxMspLen(0);
+  gdouble lowestId;             /* lowest ID of any blast match in the chunk, or -1 if none */
+  int maxLen;                   /* max full-extent length of the chunk's detail-view MSPs */
+  GSList *errors;               /* GErrors from failed ID calculations (in reverse order) */
+  gboolean outOfRange;          /* true if an ID was calculated for a match that extends out of the ref seq range */
+  gboolean notImplemented;      /* true if an ID could not be calculated because it's not supported for this blast mode */
+} MspDataChunkResult;
+
+
+/* Data for calculating the derived data for chunks of MSPs */
+typedef struct _MspDataChunkData
+{
+  const BlxContext *bc;
+  int numUnalignedBases;
+  gboolean calcIds;             /* whether to calculate the IDs as well as the display ranges */
+  MspDataChunkResult *results;  /* array of results, one per chunk */
+} MspDataChunkData;
+
+
+/* calcID: caculated percent identity of an MSP
+ *
+ * There seems to be a general problem with this routine for protein
+ * alignments, the existing code certainly does not do the right thing.
+ * I have fixed this routine for gapped sequence alignments but not for
+ * protein stuff at all.
+ *
+ * To be honest I think this routine is a _waste_ of time, the alignment
+ * programs that feed data to blixem produce an identity anyway so why
+ * not use that...why reinvent the wheel......
+ *
+ * */
+static void calcID(MSP *msp, const BlxContext* const bc, MspDataChunkResult *result)
+{
+  const gboolean sForward = (mspGetMatchStrand(msp) == BLXSTRAND_FORWARD);
+  const gboolean qForward = (mspGetRefStrand(msp) == BLXSTRAND_FORWARD);
+
+  if (mspIsBlastMatch(msp) && msp->id < 0) /* Only calculate if ID is not already set */
+    {
+      msp->id = 0.0;
+
+      /* If there is no sequence data, leave the ID as zero */
+      const char *matchSeq = mspGetMatchSeq(msp);
+
+      if (matchSeq)
+        {
+          /* Note that this will reverse complement the ref seq if it is the reverse
+           * strand. This means that where there is no gaps array the comparison is trivial
+           * as coordinates can be ignored and the two sequences just whipped through. */
+          GError *error = NULL;
+          IntRange qRange(msp->qRange);
+          int qLen = 0;
+
+          const char *refSeqSegment = blxRefSeqCacheGetSegment(bc->refSeqCache,
+                                                               &qRange,
+                                                               mspGetRefStrand(msp),
+                                                               bc->seqType,       /* required seq type is the display seq type */
+                                                               bc->numFrames,
+                                                               bc->blastMode,
+                                                               !qForward,
+                                                               TRUE,
+                                                               &qLen,
+                                                               &error);
+
+          if (!refSeqSegment)
+            {
+              prefixError(error, "Failed to calculate ID for sequence '%s' (match coords = %d - %d). ", mspGetSName(msp), msp->sRange.min(), msp->sRange.max());
+              result->errors = g_slist_prepend(result->errors, error);
+              return;
+            }
+          else
+            {
+              /* If there's an error but the sequence was still returned it's
+               * a non-critical warning. Only one warning is issued (by the caller)
+               * because we can get many thousands and it can fill up the terminal
+               * if we output them all. */
+              if (error)
+                {
+                  result->outOfRange = TRUE;
+                  g_error_free(error);
+                  error = NULL;
+                }
+            }
+
+          /* We need to find the number of characters that match out of the total number */
+          int numMatchingChars = 0;
+          int totalNumChars = 0;
+          const int numGaps = msp->gaps ? g_slist_length(msp->gaps) : 0;
+
+          if (numGaps == 0)
+            {
+              /* Ungapped alignments. */
+              totalNumChars = qRange.length() / bc->numFrames;
+
+              /* The segment may be shorter than the msp if it was clipped to the ref seq range */
+              const int numChars = min(totalNumChars, qLen);
+
+              if (bc->blastMode == BLXMODE_TBLASTN || bc->blastMode == BLXMODE_TBLASTX)
+                {
+                  int i = 0;
+                  for ( ; i < numChars; i++)
+                    {
+                      if (toupper(matchSeq[i]) == toupper(refSeqSegment[i]))
+                        {
+                          numMatchingChars++;
+                        }
+                    }
+                }
+              else                                                  /* blastn, blastp & blastx */
+                {
+                  int i = 0;
+                  for ( ; i < numChars; i++)
+                    {
+                      int sIndex = sForward ? msp->sRange.min() + i - 1 : msp->sRange.max() - i - 1;
+                      if (toupper(matchSeq[sIndex]) == toupper(refSeqSegment[i]))
+                        {
+                          numMatchingChars++;
+                        }
+                    }
+                }
+            }
+          else
+            {
+              /* Gapped alignments. */
+
+              /* To do tblastn and tblastx is not imposssible but would like to work from
+               * examples to get it right.... */
+              if (bc->blastMode == BLXMODE_TBLASTN || bc->blastMode == BLXMODE_TBLASTX)
+                {
+                  result->notImplemented = TRUE;
+                }
+              else
+                {
+                  /* blastn and blastp remain simple but blastx is more complex since the query
+                   * coords are nucleic not protein. */
+                  GSList *rangeItem = msp->gaps;
+
+                  for ( ; rangeItem; rangeItem = rangeItem->next)
+                    {
+                      CoordRange *range = (CoordRange*)(rangeItem->data);
+
+                      int qRangeMin = 0, qRangeMax = 0, sRangeMin = 0, sRangeMax = 0;
+                      getCoordRangeExtents(range, &qRangeMin, &qRangeMax, &sRangeMin, &sRangeMax);
+
+                      totalNumChars += sRangeMax - sRangeMin + 1;
+
+                      /* Note that refSeqSegment is just the section of the ref seq relating to this msp.
+                       * We need to translate the first coord in the range (which is in terms of the full
+                       * reference sequence) into coords in the cut-down ref sequence. */
+                      int q_start = qForward ? (qRangeMin - qRange.min()) / bc->numFrames : (qRange.max() - qRangeMax) / bc->numFrames;
+
+                      /* We can index sseq directly (but we need to adjust by 1 for zero-indexing). We'll loop forwards
+                       * through sseq if we have the forward strand or backwards if we have the reverse strand,
+                       * so start from the lower or upper end accordingly. */
+                      int s_start = sForward ? sRangeMin - 1 : sRangeMax - 1 ;
+
+                      int sIdx = s_start, qIdx = q_start ;
+                      while (((sForward && sIdx < sRangeMax) || (!sForward && sIdx >= sRangeMin - 1)) && qIdx < qLen)
+                        {
+                          /* Check that qIdx is not less that 0, which could happen if we have somehow got duff data. */
+                          if (qIdx >= 0 && toupper(matchSeq[sIdx]) == toupper(refSeqSegment[qIdx]))
+                            {
+                              numMatchingChars++ ;
+                            }
+
+                          /* Move to the next base. The refSeqSegment is always forward, but we might have to
+                           * traverse the s sequence in reverse. */
+                          ++qIdx ;
+                          if (sForward) ++sIdx ;
+                          else --sIdx ;
+                        }
+                    }
+                }
+            }
+
+          msp->id = (100.0 * numMatchingChars / totalNumChars);
+        }
+    }
+
+  return ;
+}
+
+
+
+/* Calculate the derived data for a chunk of MSPs. This does everything that needs
+ * to be calculated for each MSP in a single pass, so that each MSP only needs to be
+ * visited once. */
+static void calcMspDataChunk(MSP **msps, const int numMsps, const int chunk, gpointer data)
+{
+  MspDataChunkData *chunkData = (MspDataChunkData*)data;
+  MspDataChunkResult *result = &chunkData->results[chunk];
 
-  MSP *msp = bc->mspList;
-  for ( ; msp; msp = msp->next)
+  for (int i = 0; i < numMsps; ++i)
     {
-      mspCalculateDisplayRange(msp, bc);
-      mspCalculateFullExtents(msp, bc, numUnalignedBases);
+      MSP *msp = msps[i];
+
+      if (chunkData->calcIds && mspIsBlastMatch(msp))
+        {
+          calcID(msp, chunkData->bc, result);
+
+          if (result->lowestId == -1.0 || msp->id < result->lowestId)
+            result->lowestId = msp->id;
+        }
+
+      mspCalculateDisplayRange(msp, chunkData->bc);
+      result->maxLen = max(result->maxLen, mspCalcFullExtents(msp, chunkData->bc, chunkData->numUnalignedBases));
     }
 }
 
 
-/* Return the match-sequence coord of an MSP at the given reference-sequence coord,
- * where the MSP is a gapped MSP and the ref-seq coord is known to lie within the
- * MSP's alignment range. */
-static gboolean mspGetGappedAlignmentCoord(const MSP *msp, const int qIdx, const BlxContext *bc, int *result_out)
+/* Calculate the derived data for the given list of MSPs, i.e. the display range, the full
+ * extents (including any unaligned sequence/polyA tails that we're showing) and, if calcIds
+ * is true, the percent ID. The MSPs are processed in parallel chunks. The max msp len is
+ * updated to include these MSPs. If allMsps is true then the list must contain all MSPs;
+ * the max msp len is then reset and anything that indexes MSPs by display range is flagged
+ * as out of date. Returns the lowest ID of any blast match, or -1 if there are none (or if
+ * calcIds is false). */
+static gdouble calcMspData(const BlxContext* const bc,
+                           MSP *mspList,
+                           const int numUnalignedBases,
+                           const gboolean calcIds,
+                           const gboolean allMsps)
 {
-  gboolean success = FALSE;
-  int result = UNSET_INT;
+  GPtrArray *msps = mspListToArray(mspList);
+  const int numChunks = mspArrayGetNumChunks(msps);
 
-  const gboolean qForward = (mspGetRefStrand(msp) == BLXSTRAND_FORWARD);
-  const gboolean sameDirection = (mspGetRefStrand(msp) == mspGetMatchStrand(msp));
+  MspDataChunkData chunkData = {bc, numUnalignedBases, calcIds, g_new0(MspDataChunkResult, numChunks)};
 
-  /* Gapped alignment. Look to see if x lies inside one of the "gaps" ranges. */
-  GSList *rangeItem = msp->gaps;
+  for (int chunk = 0; chunk < numChunks; ++chunk)
+    chunkData.results[chunk].lowestId = -1.0;
 
-  for ( ; rangeItem ; rangeItem = rangeItem->next)
-    {
-      CoordRange *curRange = (CoordRange*)(rangeItem->data);
+  mspArrayProcessChunks(msps, calcMspDataChunk, &chunkData);
 
-      int qRangeMin, qRangeMax, sRangeMin, sRangeMax;
-      getCoordRangeExtents(curRange, &qRangeMin, &qRangeMax, &sRangeMin, &sRangeMax);
+  /* Combine the results from each chunk and report any errors */
+  gdouble lowestId = -1.0;
+  int maxLen = allMsps ? 0 : getMaxMspLen();
+  gboolean outOfRange = FALSE;
+  gboolean notImplemented = FALSE;
 
-      /* We've "found" the value if it's in or before this range. Note that the
-       * the range values are in decreasing order if the q strand is reversed. */
-      gboolean found = qForward ? qIdx <= qRangeMax : qIdx >= qRangeMin;
+  for (int chunk = 0; chunk < numChunks; ++chunk)
+    {
+      MspDataChunkResult *result = &chunkData.results[chunk];
 
-      if (found)
-        {
-          gboolean inRange = (qForward ? qIdx >= qRangeMin : qIdx <= qRangeMax);
+      if (result->lowestId != -1.0 && (lowestId == -1.0 || result->lowestId < lowestId))
+        lowestId = result->lowestId;
 
-          if (inRange)
-            {
-              /* It's inside this range. Calculate the actual index. */
-              int offset = (qIdx - qRangeMin) / bc->numFrames;
-              result = sameDirection ? sRangeMin + offset : sRangeMax - offset;
-              success = TRUE;
-            }
+      maxLen = max(maxLen, result->maxLen);
+      outOfRange |= result->outOfRange;
+      notImplemented |= result->notImplemented;
 
-          break;
+      result->errors = g_slist_reverse(result->errors);
+
+      for (GSList *item = result->errors; item; item = item->next)
+        {
+          GError *error = (GError*)(item->data);
+          reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
         }
+
+      g_slist_free(result->errors);
     }
 
-  if (success && result_out)
-    *result_out = result;
+  if (outOfRange)
+    g_warning("There were errors calculating the percent ID for some sequences because the match extends out of the reference sequence range; some IDs may be incorrect.\n");
 
-  return success;
+  if (notImplemented)
+    g_message("not implemented yet\n") ;
+
+  setMaxMspLen(maxLen);
+
+  /* Anything that indexes MSPs by their display range needs to be updated */
+  if (allMsps)
+    ++g_mspDisplayRangesVersion;
+
+  g_free(chunkData.results);
+  g_ptr_array_free(msps, TRUE);
+
+  return lowestId;
+}
+
+
+/* Calculate the ID and the display ranges etc. for the given MSPs (see calcMspData).
+ * Returns the lowest ID of any blast match. */
+gdouble calculateMspData(const BlxContext* const bc, MSP *mspList, const int numUnalignedBases, const gboolean allMsps)
+{
+  return calcMspData(bc, mspList, numUnalignedBases, TRUE, allMsps);
+}
+
+
+/* This caches the display range (in display coords rather than dna coords,
+ * and inverted if the display is inverted) for each MSP */
+void cacheMspDisplayRanges(const BlxContext* const bc, const int numUnalignedBases)
+{
+  /* This also calculates the max msp len */
+  calcMspData(bc, bc->mspList, numUnalignedBases, FALSE, TRUE);
+}
+
+
+/* Returns a number that changes whenever the display ranges of all MSPs are
+ * recalculated, so that indexes based on the display ranges can tell whether
+ * they are out of date */
+int getMspDisplayRangesVersion()
+{
+  return g_mspDisplayRangesVersion;
+}
+
+
+/* Returns a number that changes whenever new features are merged into the
+ * feature lists, so that summaries of the features can tell whether they are
+ * out of date */
+int getFeaturesVersion()
+{
+  return g_featuresVersion;
+}
+
+
+/* As cacheMspDisplayRanges but only for the given list of MSPs, e.g. those that have
+ * just been loaded. The max msp len is extended to include these MSPs but is not reset,
+ * so existing MSPs are still accounted for. */
+void cacheNewMspDisplayRanges(const BlxContext* const bc, MSP *mspList, const int numUnalignedBases)
+{
+  calcMspData(bc, mspList, numUnalignedBases, FALSE, FALSE);
+}
+
+
+/* Return the match-sequence coord of an MSP at the given reference-sequence coord,
+ * where the MSP is a gapped MSP and the ref-seq coord is known to lie within the
+ * MSP's alignment range. blockIdx is the index of the gap block that the previous
+ * coord was found in (or -1 if unknown); it is updated to the block that this coord
+ * is in, if found. This makes it quick to look up consecutive coords. */
+static gboolean mspGetGappedAlignmentCoord(const MSP *msp, const int qIdx, const BlxContext *bc, int *blockIdx, int *result_out)
+{
+  /* Look to see if x lies inside one of the "gaps" ranges (if not, it's in a deletion). */
+  const int idx = mspFindGapBlock(msp, qIdx, *blockIdx);
+
+  if (idx < 0)
+    return FALSE;
+
+  *blockIdx = idx;
+
+  if (result_out)
+    {
+      /* Calculate the actual index. */
+      const MspGapBlock* const block = &msp->gapBlocks[idx];
+      const gboolean sameDirection = (mspGetRefStrand(msp) == mspGetMatchStrand(msp));
+      const int offset = (qIdx - block->qMin) / bc->numFrames;
+
+      *result_out = sameDirection ? block->sMin + offset : block->sMax - offset;
+    }
+
+  return TRUE;
 }
 
 
@@ -1103,14 +1579,15 @@ static gboolean mspGetUnalignedCoord(const MSP *msp,
 
 
 
-/* Given a base index on the reference sequence, find the corresonding base
- * in the match sequence. Returns TRUE and sets the result if successful. */
-gboolean mspGetMatchCoord(const MSP *msp,
-                          const int qIdx,
-                          const gboolean seqSelected,
-                          const int numUnalignedBases,
-                          BlxContext *bc,
-                          int *result_out)
+/* Does the work for mspGetMatchCoord. blockIdx is used for gapped alignments to remember
+ * which gap block the last coord was in (see mspGetGappedAlignmentCoord). */
+static gboolean mspGetMatchCoordFromBlock(const MSP *msp,
+                                          const int qIdx,
+                                          const gboolean seqSelected,
+                                          const int numUnalignedBases,
+                                          BlxContext *bc,
+                                          int *blockIdx,
+                                          int *result_out)
 {
   gboolean success = FALSE;
 
@@ -1118,9 +1595,9 @@ gboolean mspGetMatchCoord(const MSP *msp,
     {
       const gboolean inMspRange = valueWithinRange(qIdx, &msp->qRange);
 
-      if (msp->gaps && g_slist_length(msp->gaps) >= 1 && inMspRange)
+      if (msp->numGapBlocks >= 1 && inMspRange)
         {
-          success = mspGetGappedAlignmentCoord(msp, qIdx, bc, result_out);
+          success = mspGetGappedAlignmentCoord(msp, qIdx, bc, blockIdx, result_out);
         }
       else if (!inMspRange && mspIsBlastMatch(msp))
         {
@@ -1138,6 +1615,45 @@ gboolean mspGetMatchCoord(const MSP *msp,
 }
 
 
+/* Given a base index on the reference sequence, find the corresonding base
+ * in the match sequence. Returns TRUE and sets the result if successful. */
+gboolean mspGetMatchCoord(const MSP *msp,
+                          const int qIdx,
+                          const gboolean seqSelected,
+                          const int numUnalignedBases,
+                          BlxContext *bc,
+                          int *result_out)
+{
+  int blockIdx = UNSET_INT;
+  return mspGetMatchCoordFromBlock(msp, qIdx, seqSelected, numUnalignedBases, bc, &blockIdx, result_out);
+}
+
+
+/* Find the corresponding match sequence base for each of the given reference sequence
+ * bases. This gives the same results as calling mspGetMatchCoord for each base, but
+ * for gapped alignments it is much quicker when the bases are in order (e.g. when
+ * processing all of the bases in a display range) because it steps through the gap
+ * blocks rather than searching for each base. The result for each base is placed in
+ * the corresponding element of results_out, which must be at least numIdxs long; it is
+ * set to UNSET_INT if there is no corresponding match base. */
+void mspGetMatchCoordArray(const MSP *msp,
+                           const int *qIdxs,
+                           const int numIdxs,
+                           const gboolean seqSelected,
+                           const int numUnalignedBases,
+                           BlxContext *bc,
+                           int *results_out)
+{
+  int blockIdx = UNSET_INT;
+
+  for (int i = 0; i < numIdxs; ++i)
+    {
+      if (!mspGetMatchCoordFromBlock(msp, qIdxs[i], seqSelected, numUnalignedBases, bc, &blockIdx, &results_out[i]))
+        results_out[i] = UNSET_INT;
+    }
+}
+
+
 
 /***********************************************************
  *               General
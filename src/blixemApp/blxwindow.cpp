@@ -35,6 +35,7 @@
 
 #include <blixemApp/blxwindow.hpp>
 #include <blixemApp/blxcontext.hpp>
+#include <blixemApp/blxSeqIndex.hpp>
 #include <blixemApp/detailview.hpp>
 #include <blixemApp/detailviewtree.hpp>
 #include <blixemApp/bigpicture.hpp>
@@ -166,7 +167,6 @@ static GList*                     findSeqsFromList(GtkWidget *blxWindow, const c
 static int                        getSearchStartCoord(GtkWidget *blxWindow, const gboolean startBeginning, const gboolean searchLeft);
 static GList*                     findSeqsFromColumn(GtkWidget *blxWindow, const char *inputText, const BlxColumnId searchCol, const gboolean rememberSearch, const gboolean findAgain, GError **error);
 static GtkWidget*                 dialogChildGetBlxWindow(GtkWidget *child);
-static gdouble                    calculateMspData(MSP *mspList, BlxContext *bc);
 
 static gboolean                   setFlagFromButton(GtkWidget *button, gpointer data);
 static void                       copySelectedSeqDataToClipboard(GtkWidget *blxWindow);
@@ -898,21 +898,30 @@ static void dynamicLoadFeaturesFile(GtkWidget *blxWindow, const char *filename,
       finaliseBlxSequences(bc->featureLists, &newMsps, &newSeqs, bc->columnList, bc->refSeqOffset, bc->seqType,
                            bc->numFrames, &bc->refSeqRange, TRUE, lookupTable);
 
-      double lowestId = calculateMspData(newMsps, bc);
+      /* Calculate the IDs and cache the display ranges for the new msps. This must be done
+       * before they are added to the trees because the tree filters use the display ranges. */
+      GtkWidget *detailView = blxWindowGetDetailView(blxWindow);
+      const int numUnalignedBases = detailViewGetNumUnalignedBases(detailView);
+      const gdouble lowestId = calculateMspData(bc, newMsps, numUnalignedBases, FALSE);
       bigPictureSetMinPercentId(blxWindowGetBigPicture(blxWindow), lowestId);
 
-      /* Add the msps/sequences to the tree data models (must be done after finalise because
-       * finalise populates the child msp lists for parent features) */
-      detailViewAddMspData(blxWindowGetDetailView(blxWindow), newMsps, newSeqs);
+      /* Merge the new msps into the main list (takes ownership of the temp list). The new
+       * msps stay linked together at the end of the main list so we can still use newMsps. */
+      blxMergeFeatures(newMsps, NULL, &bc->mspList, &bc->matchSeqs, &bc->mspListTail, NULL);
 
-      /* Merge the temporary lists into the main lists (takes ownership of the temp lists) */
-      blxMergeFeatures(newMsps, newSeqs, &bc->mspList, &bc->matchSeqs);
+      /* Add the new sequences to the search index. Must be done before merging because
+       * the merge re-links the newSeqs list items into the main list. */
+      blxSeqIndexAddSeqs(bc->seqIndex, newSeqs);
 
-      /* Cache the new msp display ranges and sort and filter the trees. */
-      GtkWidget *detailView = blxWindowGetDetailView(blxWindow);
-      const int numUnalignedBases = detailViewGetNumUnalignedBases(detailView);
-      cacheMspDisplayRanges(bc, numUnalignedBases);
-      detailViewResortTrees(detailView);
+      /* Merge the new sequences into the main sorted list (takes ownership of the temp list) */
+      detailViewMergeSeqs(detailView, newSeqs);
+
+      /* Add the msps to the tree data models (must be done after finalise because finalise
+       * populates the child msp lists for parent features). The new rows are held as pending
+       * in each model and merged into their sorted positions when the trees are refiltered.
+       * The squashed data models are rebuilt from the full sequence list (in the background,
+       * unless they are in use). */
+      detailViewAddMspData(detailView, newMsps);
       callFuncOnAllDetailViewTrees(detailView, refilterTree, NULL);
 
       /* Recalculate the coverage */
@@ -1311,13 +1320,16 @@ static GList* findSeqsFromColumn(GtkWidget *blxWindow, const char *inputText, co
       return NULL;
     }
 
-  /* Loop through all the sequences and see if the sequence data for this column
-   * matches the search string */
+  /* Find the sequences whose data for this column matches the search string. Use
+   * the search index if the column supports it; otherwise loop through them all. */
   GList *seqList = blxWindowGetAllMatchSeqs(blxWindow);
   BlxContext *bc = blxWindowGetContext(blxWindow);
   SeqSearchData searchData = {searchStr, searchCol, bc, NULL, NULL};
 
-  g_list_foreach(seqList, getSequencesThatMatch, &searchData);
+  if (blxSeqIndexSupportsColumn(searchCol))
+    searchData.matchList = blxSeqIndexFind(bc->seqIndex, searchStr, searchCol);
+  else
+    g_list_foreach(seqList, getSequencesThatMatch, &searchData);
 
   if (g_list_length(searchData.matchList) < 1)
     {
@@ -1571,7 +1583,7 @@ static void blxWindowFindDnaString(GtkWidget *blxWindow,
 
   while (refSeqIdx >= bc->refSeqRange.min() && refSeqIdx <= bc->refSeqRange.max() && searchStrIdx >= 0 && searchStrIdx <= searchStrMax)
     {
-      const char refSeqBase = getSequenceIndex(bc->refSeq, refSeqIdx, complement, &bc->refSeqRange, BLXSEQ_DNA);
+      const char refSeqBase = bc->getRefSeqBase(refSeqIdx, complement);
       char searchStrBase = convertBaseToCorrectCase(searchStr[searchStrIdx], BLXSEQ_DNA);
 
       if (refSeqBase == searchStrBase)
@@ -1952,9 +1964,13 @@ static void blxWindowDeleteAllSequenceGroups(GtkWidget *blxWindow)
  * or sequences have been added to or removed from a group */
 static void blxWindowGroupsChanged(GtkWidget *blxWindow)
 {
+  BlxContext *bc = blxWindowGetContext(blxWindow);
   GtkWidget *detailView = blxWindowGetDetailView(blxWindow);
   GtkWidget *bigPicture = blxWindowGetBigPicture(blxWindow);
 
+  /* Anything cached that depends on the groups is now out of date */
+  ++bc->groupsVersion;
+
   /* Re-sort all trees, because grouping affects sort order */
   detailViewResortTrees(detailView);
 
@@ -2421,7 +2437,16 @@ static GList* getSeqStructsFromSearchStringList(GList *searchStringList,
       /* Compare this name to all names in the sequence list. If it matches,
        * add it to the result list. */
       searchData.searchStr = (const char*)(nameItem->data);
-      g_list_foreach(seqList, getSequencesThatMatch, &searchData);
+
+      if (blxSeqIndexSupportsColumn(searchCol))
+        {
+          GList *found = blxSeqIndexFind(bc->seqIndex, searchData.searchStr, searchCol);
+          searchData.matchList = g_list_concat(found, searchData.matchList);
+        }
+      else
+        {
+          g_list_foreach(seqList, getSequencesThatMatch, &searchData);
+        }
 
       if (searchData.error)
         break;
@@ -3146,6 +3171,9 @@ static void onButtonClickedLoadOptional(GtkWidget *button, gpointer data)
 
   finaliseFetch(bc->matchSeqs, bc->columnList);
 
+  /* The optional columns have changed, so they need to be re-indexed next time they are searched */
+  blxSeqIndexInvalidateColumns(bc->seqIndex);
+
   if (error)
     {
       prefixError(error, "Error loading optional data. ");
@@ -4501,7 +4529,7 @@ static void getStats(GtkWidget *blxWindow, GString *result, MSP *MSPlist)
 
 
   /* Other data */
-  int refSeqLen = strlen(blxWindowGetRefSeq(blxWindow));
+  int refSeqLen = blxWindowGetRefSeqRange(blxWindow)->length();
 
 
   /* Create the text based on the results */
@@ -5543,12 +5571,6 @@ BlxBlastMode blxWindowGetBlastMode(GtkWidget *blxWindow)
   return blxContext ? blxContext->blastMode : (BlxBlastMode)0;
 }
 
-char * blxWindowGetRefSeq(GtkWidget *blxWindow)
-{
-  BlxContext *blxContext = blxWindowGetContext(blxWindow);
-  return blxContext ? blxContext->refSeq : NULL;
-}
-
 const char * blxWindowGetRefSeqName(GtkWidget *blxWindow)
 {
   BlxContext *blxContext = blxWindowGetContext(blxWindow);
@@ -5976,23 +5998,19 @@ static char* getRefSeqSegment(GtkWidget *blxWindow, const int fromIdx_in, const
 
   char *result = NULL;
 
-  const char *refSeq = blxWindowGetRefSeq(blxWindow);
   BlxContext *bc = blxWindowGetContext(blxWindow);
 
-  if (refSeq)
+  if (bc->refSeq || bc->refSeqPacked)
     {
-      /* Need to get 0-based indices */
-      const IntRange* const refSeqRange = blxWindowGetRefSeqRange(blxWindow);
-
-      const int fromIdx = min(fromIdx_in, toIdx_in) - refSeqRange->min();
-      const int toIdx = max(fromIdx_in, toIdx_in) - refSeqRange->min();
-      const int len = toIdx - fromIdx + 1;
+      const IntRange range(min(fromIdx_in, toIdx_in), max(fromIdx_in, toIdx_in));
+      const int len = range.length();
 
       /* Warn user if they're about to copy a large sequence */
       if (len <= MAX_RECOMMENDED_COPY_LENGTH ||
           runConfirmationBox(blxWindow, "Copy sequence", "You are about to copy a large amount of text to the clipboard\n\nAre you sure you want to continue?") == GTK_RESPONSE_ACCEPT)
         {
-          result = g_strndup(refSeq + fromIdx, toIdx - fromIdx + 1);
+          IntRange segmentRange;
+          result = bc->getRefSeqSegment(&range, &segmentRange);
 
           if (result)
             {
@@ -6365,220 +6383,11 @@ static void createMainMenu(GtkWidget *window,
 }
 
 
-/* calcID: caculated percent identity of an MSP
- *
- * There seems to be a general problem with this routine for protein
- * alignments, the existing code certainly does not do the right thing.
- * I have fixed this routine for gapped sequence alignments but not for
- * protein stuff at all.
- *
- * To be honest I think this routine is a _waste_ of time, the alignment
- * programs that feed data to blixem produce an identity anyway so why
- * not use that...why reinvent the wheel......
- *
- * */
-static void calcID(MSP *msp, BlxContext *bc)
-{
-  const gboolean sForward = (mspGetMatchStrand(msp) == BLXSTRAND_FORWARD);
-  const gboolean qForward = (mspGetRefStrand(msp) == BLXSTRAND_FORWARD);
-
-  if (mspIsBlastMatch(msp) && msp->id < 0) /* Only calculate if ID is not already set */
-    {
-      msp->id = 0.0;
-
-      /* If there is no sequence data, leave the ID as zero */
-      const char *matchSeq = mspGetMatchSeq(msp);
-
-      if (matchSeq)
-        {
-          /* Note that this will reverse complement the ref seq if it is the reverse
-           * strand. This means that where there is no gaps array the comparison is trivial
-           * as coordinates can be ignored and the two sequences just whipped through. */
-          GError *error = NULL;
-          IntRange qRange(msp->qRange); /* make a copy because it will be updated */
-
-          char *refSeqSegment = getSequenceSegment(bc->refSeq,
-                                                   &qRange,
-                                                   mspGetRefStrand(msp),
-                                                   BLXSEQ_DNA,        /* msp q coords are always nucleotide coords */
-                                                   bc->seqType,       /* required seq type is the display seq type */
-                                                   mspGetRefFrame(msp, bc->seqType),
-                                                   bc->numFrames,
-                                                   &bc->refSeqRange,
-                                                   bc->blastMode,
-                                                   bc->geneticCode,
-                                                   bc->displayRev,
-                                                   !qForward,
-                                                   TRUE,
-                                                   &error);
-
-          if (!refSeqSegment)
-            {
-              prefixError(error, "Failed to calculate ID for sequence '%s' (match coords = %d - %d). ", mspGetSName(msp), msp->sRange.min(), msp->sRange.max());
-              reportAndClearIfError(&error, G_LOG_LEVEL_CRITICAL);
-              return;
-            }
-          else
-            {
-              /* If there's an error but the sequence was still returned it's
-               * a non-critical warning. Only issue one warning because we can
-               * get many thousands and it can fill up the terminal if we output
-               * them all. */
-              if (error)
-                {
-                  static gboolean done = FALSE;
-
-                  if (!done)
-                    {
-                      g_warning("There were errors calculating the percent ID for some sequences because the match extends out of the reference sequence range; some IDs may be incorrect.\n");
-                      done = TRUE;
-                    }
-
-                  g_error_free(error);
-                  error = NULL;
-                }
-            }
-
-          /* We need to find the number of characters that match out of the total number */
-          int numMatchingChars = 0;
-          int totalNumChars = 0;
-          const int numGaps = msp->gaps ? g_slist_length(msp->gaps) : 0;
-
-          if (numGaps == 0)
-            {
-              /* Ungapped alignments. */
-              totalNumChars = qRange.length() / bc->numFrames;
-
-              if (bc->blastMode == BLXMODE_TBLASTN || bc->blastMode == BLXMODE_TBLASTX)
-                {
-                  int i = 0;
-                  for ( ; i < totalNumChars; i++)
-                    {
-                      if (toupper(matchSeq[i]) == toupper(refSeqSegment[i]))
-                        {
-                          numMatchingChars++;
-                        }
-                    }
-                }
-              else                                                  /* blastn, blastp & blastx */
-                {
-                  int i = 0;
-                  for ( ; i < totalNumChars; i++)
-                    {
-                      int sIndex = sForward ? msp->sRange.min() + i - 1 : msp->sRange.max() - i - 1;
-                      if (toupper(matchSeq[sIndex]) == toupper(refSeqSegment[i]))
-                        {
-                          numMatchingChars++;
-                        }
-                    }
-                }
-            }
-          else
-            {
-              /* Gapped alignments. */
-
-              /* To do tblastn and tblastx is not imposssible but would like to work from
-               * examples to get it right.... */
-              if (bc->blastMode == BLXMODE_TBLASTN)
-                {
-                  g_message("not implemented yet\n") ;
-                }
-              else if (bc->blastMode == BLXMODE_TBLASTX)
-                {
-                  g_message("not implemented yet\n") ;
-                }
-              else
-                {
-                  /* blastn and blastp remain simple but blastx is more complex since the query
-                   * coords are nucleic not protein. */
-                  GSList *rangeItem = msp->gaps;
-
-                  for ( ; rangeItem; rangeItem = rangeItem->next)
-                    {
-                      CoordRange *range = (CoordRange*)(rangeItem->data);
-
-                      int qRangeMin = 0, qRangeMax = 0, sRangeMin = 0, sRangeMax = 0;
-                      getCoordRangeExtents(range, &qRangeMin, &qRangeMax, &sRangeMin, &sRangeMax);
-
-                      totalNumChars += sRangeMax - sRangeMin + 1;
-
-                      /* Note that refSeqSegment is just the section of the ref seq relating to this msp.
-                       * We need to translate the first coord in the range (which is in terms of the full
-                       * reference sequence) into coords in the cut-down ref sequence. */
-                      int q_start = qForward ? (qRangeMin - qRange.min()) / bc->numFrames : (qRange.max() - qRangeMax) / bc->numFrames;
-                      const int qLen = strlen(refSeqSegment);
-
-                      /* We can index sseq directly (but we need to adjust by 1 for zero-indexing). We'll loop forwards
-                       * through sseq if we have the forward strand or backwards if we have the reverse strand,
-                       * so start from the lower or upper end accordingly. */
-                      int s_start = sForward ? sRangeMin - 1 : sRangeMax - 1 ;
-
-                      int sIdx = s_start, qIdx = q_start ;
-                      while (((sForward && sIdx < sRangeMax) || (!sForward && sIdx >= sRangeMin - 1)) && qIdx < qLen)
-                        {
-                          /* Check that qIdx is not less that 0, which could happen if we have somehow got duff data. */
-                          if (qIdx >= 0 && toupper(matchSeq[sIdx]) == toupper(refSeqSegment[qIdx]))
-                            {
-                              numMatchingChars++ ;
-                            }
-
-                          /* Move to the next base. The refSeqSegment is always forward, but we might have to
-                           * traverse the s sequence in reverse. */
-                          ++qIdx ;
-                          if (sForward) ++sIdx ;
-                          else --sIdx ;
-                        }
-                    }
-                }
-            }
-
-          msp->id = (100.0 * numMatchingChars / totalNumChars);
-
-          g_free(refSeqSegment);
-        }
-    }
-
-  return ;
-}
-
-
-/* Calculate the ID and q frame for the given MSP and store
- * them in the MSP struct. Returns the calculated ID (or UNSET_INT if this msp
- * is not a blast match). */
-static void calcMspData(MSP *msp, BlxContext *bc)
-{
-  /* Calculate the ID */
-  if (mspIsBlastMatch(msp))
-    {
-      calcID(msp, bc);
-    }
-}
-
-
-static gdouble calculateMspData(MSP *mspList, BlxContext *bc)
-{
-  MSP *msp = mspList;
-  gdouble lowestId = -1.0;
-
-  for ( ; msp; msp = msp->next)
-    {
-      calcMspData(msp, bc);
-
-      if (mspIsBlastMatch(msp) && (lowestId == -1.0 || msp->id < lowestId))
-        {
-          lowestId = msp->id;
-        }
-    }
-
-  return lowestId;
-}
-
-
 /* Calculate the reference sequence range from the range and offset given in
  * the option. Also translate this to display coords. */
-static void calculateRefSeqRange(CommandLineOptions *options,
-                                 IntRange &refSeqRange,
-                                 IntRange &fullDisplayRange)
+void calculateRefSeqRange(CommandLineOptions *options,
+                          IntRange &refSeqRange,
+                          IntRange &fullDisplayRange)
 {
 
   /* Offset the reference sequence range, if an offset was specified. */
@@ -6602,7 +6411,7 @@ static void calculateRefSeqRange(CommandLineOptions *options,
           offset -= options->numFrames;
 
       refSeqRange.setMin(refSeqRange.min() + offset);
-      options->refSeq = options->refSeq + offset;
+      memmove(options->refSeq, options->refSeq + offset, strlen(options->refSeq + offset) + 1);
 
       /* Now do the same for when the ref seq is reversed */
       convertDnaIdxToDisplayIdx(refSeqRange.max(), options->seqType, 1, options->numFrames, TRUE, &refSeqRange, &base);
@@ -6708,7 +6517,11 @@ GtkWidget* createBlxWindow(CommandLineOptions *options,
   GtkActionGroup *actionGroup = NULL;
   createMainMenu(window, blxContext, &mainmenu, &seqHeaderMenu, &toolbar, &actionGroup);
 
-  const gdouble lowestId = calculateMspData(options->mspList, blxContext);
+  /* Calculate the ID, display ranges etc. of all the MSPs. This must be done before
+   * the big picture is created because it needs the lowest ID. */
+  const int numUnalignedBases = detailViewGetDefaultNumUnalignedBases();
+  const gdouble lowestId = calculateMspData(blxContext, options->mspList, numUnalignedBases, TRUE);
+  blxProfilePhase("calculate MSP data");
 
   GtkWidget *fwdStrandGrid = NULL, *revStrandGrid = NULL;
 
@@ -6774,13 +6587,13 @@ GtkWidget* createBlxWindow(CommandLineOptions *options,
   g_signal_connect(G_OBJECT(window), "key-press-event", G_CALLBACK(onKeyPressBlxWindow), NULL);
 
 
-  const int numUnalignedBases = detailViewGetNumUnalignedBases(detailView);
-  cacheMspDisplayRanges(blxContext, numUnalignedBases);
-
   /* Add the MSP's to the trees and sort them by the initial sort mode. This must
-   * be done after all widgets have been created, because it accesses their properties.*/
-  detailViewAddMspData(detailView, options->mspList, seqList);
-  detailViewUpdateMspLengths(detailView, numUnalignedBases);
+   * be done after all widgets have been created, because it accesses their properties.
+   * (The MSP lengths have already been calculated, so we just need to sort and filter.) */
+  detailViewAddMspData(detailView, options->mspList);
+  detailViewResortTrees(detailView);
+  callFuncOnAllDetailViewTrees(detailView, refilterTree, NULL);
+  detailViewRedrawAll(detailView);
 
   /* Updated the cached display range and full extents of the MSPs */
   if (blxContext)
@@ -6791,6 +6604,8 @@ GtkWidget* createBlxWindow(CommandLineOptions *options,
   /* Set the detail view font (again, this accesses the widgets' properties). */
   updateDetailViewFontDesc(detailView);
 
+  blxProfilePhase("create window");
+
   /* Calculate the number of vertical cells in the grids (again, requires properties) */
   calculateNumVCells(bigPicture);
 
@@ -64,7 +64,6 @@ IntRange*		  blxWindowGetRefSeqRange(GtkWidget *blxWindow);
 const char*		  blxWindowGetRefSeqName(GtkWidget *blxWindow);
 BlxSeqType		  blxWindowGetSeqType(GtkWidget *blxWindow);
 char**			  blxWindowGetGeneticCode(GtkWidget *blxWindow);
-char*			  blxWindowGetRefSeq(GtkWidget *blxWindow);
 int			  blxWindowGetNumFrames(GtkWidget *blxWindow);
 int			  blxWindowGetDotterStart(GtkWidget *blxWindow);
 int			  blxWindowGetDotterEnd(GtkWidget *blxWindow);
@@ -115,5 +114,7 @@ GtkWidget*                createBlxWindow(CommandLineOptions *options,
                                           const gboolean External,
                                           GSList *styles);
 
+void                      calculateRefSeqRange(CommandLineOptions *options, IntRange &refSeqRange, IntRange &fullDisplayRange);
+
 
 #endif /* _blxwindow_included_ */
@@ -483,6 +483,8 @@ void CoverageViewProperties::prepareForPrinting()
 /* Expose handler. */
 static gboolean onExposeCoverageView(GtkWidget *coverageView, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "coverageView");
+
   gboolean result = TRUE;
   CoverageViewProperties *properties = coverageViewGetProperties(coverageView);
 
@@ -37,6 +37,7 @@
 #include <blixemApp/blxcontext.hpp>
 #include <blixemApp/detailview.hpp>
 #include <blixemApp/detailviewtree.hpp>
+#include <blixemApp/detailviewmodel.hpp>
 #include <blixemApp/blxwindow.hpp>
 #include <blixemApp/bigpicture.hpp>
 #include <blixemApp/exonview.hpp>
@@ -48,6 +49,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <algorithm>
+#include <map>
 #include <string>
 #include <sstream>
 
@@ -78,11 +80,11 @@ using namespace std;
 #define MULTIPLE_POLYA_SIGNALS_TEXT     "<multiple polyA signals>"
 #define MULTIPLE_POLYA_SITES_TEXT       "<multiple polyA sites>"
 #define DEFAULT_SNP_CONNECTOR_HEIGHT    0
-#define DEFAULT_NUM_UNALIGNED_BASES     5     /* the default number of additional bases to show if displaying unaligned parts of the match sequence */
 #define POLYA_SIG_BASES_UPSTREAM        50    /* the number of bases upstream from a polyA tail to search for polyA signals */
 #define POLYA_SIGNAL                    "aataaa"
 
 #define SETTING_NAME_NUM_UNALIGNED_BASES "num-unaligned-bases"
+#define SORT_STRING_KEY_SPACING         1024.0 /* gap between the sort keys of adjacent values when a string column's key table is (re)numbered */
 
 
 typedef struct
@@ -145,6 +147,7 @@ static const char*            spliceSiteGetBases(const BlxSpliceSite *spliceSite
 static int                    getNumSnpTrackRows(const BlxContext *bc, DetailViewProperties *properties, const BlxStrand strand, const int frame);
 static int                    getVariationRowNumber(const IntRange* const rangeIn, const int numRows, GSList **rows);
 static void                   freeRowsList(GSList *rows);
+static void                   destroySortStringKeys(SortStringKeys *sortStringKeys);
 
 static gboolean               coordAffectedByVariation(const int dnaIdx,
                                                        const BlxStrand strand,
@@ -216,30 +219,24 @@ DetailViewProperties::DetailViewProperties(GtkWidget *detailView_in,
   adjustment = adjustment_in;
   fontDesc = fontDesc_in;
   snpConnectorHeight = DEFAULT_SNP_CONNECTOR_HEIGHT;
-  numUnalignedBases = DEFAULT_NUM_UNALIGNED_BASES;
+  numUnalignedBases = detailViewGetDefaultNumUnalignedBases();
 
   selectedIndex = NULL;
   setDetailViewIndex(&selectedRangeInit, FALSE, UNSET_INT, UNSET_INT, UNSET_INT, UNSET_INT);
   setDetailViewIndex(&selectedRangeStart, FALSE, UNSET_INT, UNSET_INT, UNSET_INT, UNSET_INT);
   setDetailViewIndex(&selectedRangeEnd, FALSE, UNSET_INT, UNSET_INT, UNSET_INT, UNSET_INT);
 
-  /* The numunalignedbases may be set in the config file; if so, override the default */
-  GKeyFile *key_file = blxGetConfig();
-  if (key_file)
-    {
-      GError *error = NULL;
-      int numUnaligned = g_key_file_get_integer(key_file, SETTINGS_GROUP, SETTING_NAME_NUM_UNALIGNED_BASES, &error);
-
-      if (!error) /* we don't care if it wasn't found */
-        numUnalignedBases = numUnaligned;
-    }
-
   /* Add the splice sites that we want Blixem to identify as canonical */
   spliceSites = NULL;
   addBlxSpliceSite(&spliceSites, "GT", "AG", FALSE);
   addBlxSpliceSite(&spliceSites, "GC", "AG", FALSE);
   addBlxSpliceSite(&spliceSites, "AT", "AC", TRUE);
 
+  squashedModelsIdleId = 0;
+
+  sortStringKeys = NULL;
+  sortKeysVersion = 0;
+
   /* We don't know the display range yet, so set an arbitrary range centred
    * on the start coord. Set the adjustment value to be unset so that we know
    * we need to calculated it first time round. */
@@ -291,6 +288,12 @@ DetailViewProperties::~DetailViewProperties()
   /* N.B. Don't free the cell renderer, or it causes memory corruption. I'm not
    * sure what owns it - the columns it is added to? */
 
+  if (squashedModelsIdleId)
+    {
+      g_source_remove(squashedModelsIdleId);
+      squashedModelsIdleId = 0;
+    }
+
   if (fwdStrandTrees)
     {
       g_list_free(fwdStrandTrees);
@@ -315,6 +318,9 @@ DetailViewProperties::~DetailViewProperties()
       g_slist_free(spliceSites);
       spliceSites = NULL;
     }
+
+  destroySortStringKeys(sortStringKeys);
+  sortStringKeys = NULL;
 }
 
 double DetailViewProperties::charWidth() const
@@ -1924,70 +1930,411 @@ gint sortByColumnCompareFunc(GList *mspGList1,
 }
 
 
-/* This is the main sort comparison function for comparing two BlxSequences.
- * The sort criteria are specified in the detailView properties;
- * we may sort by multiple columns.
- *
- * Returns a negative value if the first row appears before the second,
- * positive if the second appears before the first, or 0 if they are
- * equivalent. */
-static gint detailViewSortByColumns(gconstpointer a, gconstpointer b)
+/* Compares strings case-insensitively */
+struct StringCaseLess
+{
+  bool operator()(const char *str1, const char *str2) const
+  {
+    return g_ascii_strcasecmp(str1, str2) < 0;
+  }
+};
+
+
+static bool stringCaseEqual(const char *str1, const char *str2)
 {
-  gint result = UNSET_INT;
+  return g_ascii_strcasecmp(str1, str2) == 0;
+}
 
-  const BlxSequence *seq1 = (const BlxSequence*)a;
-  const BlxSequence *seq2 = (const BlxSequence*)b;
 
-  GtkWidget *blxWindow = getBlixemWindow();
-  GtkWidget *detailView = blxWindowGetDetailView(blxWindow);
-  GList *columnList = detailViewGetColumnList(detailView);
-  const int numColumns = g_list_length(columnList);
+/* The sort keys for the values in a string column. Each distinct value (ignoring
+ * case) has a key, and the keys are in the same order as the values. The table owns
+ * its copies of the values. */
+typedef map<const char*, gdouble, StringCaseLess> SortStringKeyTable;
+
+struct _SortStringKeys
+{
+  map<int, SortStringKeyTable*> columns;       /* the key table for each string column, keyed on column id */
+};
+
+
+static void destroySortStringKeys(SortStringKeys *sortStringKeys)
+{
+  if (!sortStringKeys)
+    return;
+
+  for (map<int, SortStringKeyTable*>::iterator iter = sortStringKeys->columns.begin(); iter != sortStringKeys->columns.end(); ++iter)
+    {
+      SortStringKeyTable *table = iter->second;
+
+      for (SortStringKeyTable::iterator item = table->begin(); item != table->end(); ++item)
+        g_free((char*)item->first);
+
+      delete table;
+    }
+
+  delete sortStringKeys;
+}
+
+
+/* Add the given values to a string column's key table. The values must be sorted and
+ * must not already be in the table. New values are given keys in between the keys of
+ * their neighbours, so that the existing keys stay valid: each run of values that goes
+ * between the same two existing values is spread evenly between their keys. If there
+ * is not enough room between two keys then all of the keys are renumbered, which
+ * invalidates any keys that were calculated previously, so the keys version is bumped. */
+static void sortStringKeysAdd(DetailViewProperties *properties,
+                              SortStringKeyTable *table,
+                              const char **values,
+                              const int numValues)
+{
+  gboolean renumber = FALSE;
+  int runStart = 0;
+
+  while (runStart < numValues)
+    {
+      /* Find the run of values that go before the same existing value */
+      SortStringKeyTable::iterator next = table->lower_bound(values[runStart]);
+      int runEnd = runStart + 1;
+
+      while (runEnd < numValues && (next == table->end() || table->key_comp()(values[runEnd], next->first)))
+        ++runEnd;
+
+      const int runLen = runEnd - runStart;
+
+      /* Find the keys either side of the run. At the ends of the table, leave the
+       * standard spacing between keys. */
+      SortStringKeyTable::iterator prev = next;
+      const gboolean hasPrev = (next != table->begin());
+      const gboolean hasNext = (next != table->end());
+
+      if (hasPrev)
+        --prev;
+
+      gdouble minKey = 0.0;
+      gdouble maxKey = 0.0;
+
+      if (hasPrev && hasNext)
+        {
+          minKey = prev->second;
+          maxKey = next->second;
+        }
+      else if (hasPrev)
+        {
+          minKey = prev->second;
+          maxKey = minKey + SORT_STRING_KEY_SPACING * (runLen + 1);
+        }
+      else if (hasNext)
+        {
+          maxKey = next->second;
+          minKey = maxKey - SORT_STRING_KEY_SPACING * (runLen + 1);
+        }
+      else
+        {
+          maxKey = SORT_STRING_KEY_SPACING * (runLen + 1);
+        }
+
+      const gdouble step = (maxKey - minKey) / (runLen + 1);
+      gdouble key = minKey;
+
+      for (int i = 0; i < runLen; ++i)
+        {
+          const gdouble newKey = minKey + step * (i + 1);
+
+          if (newKey <= key || newKey >= maxKey)
+            renumber = TRUE;
+
+          key = newKey;
+          table->insert(next, make_pair((const char*)g_strdup(values[runStart + i]), key));
+        }
+
+      runStart = runEnd;
+    }
+
+  if (renumber)
+    {
+      gdouble key = 0.0;
+
+      for (SortStringKeyTable::iterator item = table->begin(); item != table->end(); ++item)
+        {
+          item->second = key;
+          key += SORT_STRING_KEY_SPACING;
+        }
+
+      ++properties->sortKeysVersion;
+    }
+}
+
+
+/* Compares rows (given by index) on their packed sort keys, i.e. on each key in turn */
+struct SortKeyCompare
+{
+  const gdouble *keys;
+  int numKeys;
+
+  SortKeyCompare(const gdouble *keys_in, const int numKeys_in) : keys(keys_in), numKeys(numKeys_in)
+  {
+  }
+
+  bool operator()(const int row1, const int row2) const
+  {
+    const gdouble *keys1 = keys + row1 * numKeys;
+    const gdouble *keys2 = keys + row2 * numKeys;
+
+    for (int i = 0; i < numKeys; ++i)
+      {
+        if (keys1[i] != keys2[i])
+          return keys1[i] < keys2[i];
+      }
+
+    return false;
+  }
+};
+
+
+/* Set the sort key for a string column for each row. The key is the value's key in
+ * the column's key table (any values that are not in the table yet are added), so
+ * comparing keys is equivalent to a case-insensitive comparison of the strings, even
+ * for keys calculated in different calls. Null values are sorted after non-null values. */
+static void calcStringSortKeys(DetailViewProperties *properties,
+                               MSP **msps,
+                               const int numRows,
+                               const BlxColumnId sortColumn,
+                               const gdouble sign,
+                               gdouble *keys,
+                               const int numKeys,
+                               const int keyIdx)
+{
+  if (!properties->sortStringKeys)
+    properties->sortStringKeys = new SortStringKeys;
+
+  SortStringKeyTable *&table = properties->sortStringKeys->columns[sortColumn];
 
-  /* Sort by each requested column in order of priority */
+  if (!table)
+    table = new SortStringKeyTable;
+
+  /* Find the values that are not in the table yet */
+  const char **strs = g_new(const char*, numRows);
+  const char **newValues = g_new(const char*, numRows);
+  int numNewValues = 0;
+
+  for (int i = 0; i < numRows; ++i)
+    {
+      strs[i] = msps[i] ? mspGetColumn(msps[i], sortColumn) : NULL;
+
+      if (strs[i] && table->find(strs[i]) == table->end())
+        newValues[numNewValues++] = strs[i];
+    }
+
+  if (numNewValues > 0)
+    {
+      sort(newValues, newValues + numNewValues, StringCaseLess());
+      numNewValues = unique(newValues, newValues + numNewValues, stringCaseEqual) - newValues;
+
+      sortStringKeysAdd(properties, table, newValues, numNewValues);
+    }
+
+  for (int i = 0; i < numRows; ++i)
+    {
+      if (strs[i])
+        keys[i * numKeys + keyIdx] = sign * table->find(strs[i])->second;
+      else if (msps[i])
+        keys[i * numKeys + keyIdx] = sign * G_MAXDOUBLE;
+    }
+
+  g_free(newValues);
+  g_free(strs);
+}
+
+
+/* Calculate packed sort keys for the given rows (each given as a list of MSPs) from
+ * the current sort columns. Returns an array of numRows * numKeys values, which the
+ * caller should free with g_free. Rows are ordered by comparing each of their keys in
+ * turn. Working out the keys once for each row is much quicker than resolving the
+ * column values on every comparison. Keys from different calls can be compared as
+ * long as the keys version (returned in keysVersionOut, if not null) is the same.
+ *
+ * The order is the same as for sortByColumnCompareFunc except that string columns
+ * are compared on the whole string, scores are compared exactly, and rows with
+ * multiple MSPs are placed after rows with single MSPs when sorting by score or ID
+ * (rather than comparing equal to everything, which does not give a consistent order). */
+gdouble* detailViewCalcSortKeys(GtkWidget *detailView, GList **mspLists, const int numRows, int *numKeysOut, int *keysVersionOut)
+{
+  DetailViewProperties *properties = detailViewGetProperties(detailView);
+  BlxContext *bc = detailViewGetContext(detailView);
+  GtkWidget *blxWindow = detailViewGetBlxWindow(detailView);
   BlxColumnId *sortColumns = detailViewGetSortColumns(detailView);
+  const int numColumns = g_list_length(detailViewGetColumnList(detailView));
+
+  /* Find the number of sort columns. Start gets an extra key for the secondary sort
+   * by length. There is also an initial key that puts unsortable rows first. */
+  int numSortColumns = 0;
+  int numKeys = 1;
+
+  for ( ; sortColumns && numSortColumns < numColumns && sortColumns[numSortColumns] != BLXCOL_NONE; ++numSortColumns)
+    numKeys += (sortColumns[numSortColumns] == BLXCOL_START ? 2 : 1);
+
+  /* Unsortable rows have all keys zero */
+  gdouble *keys = g_new0(gdouble, numRows * numKeys);
+  MSP **msps = g_new(MSP*, numRows);
 
-  if (sortColumns)
+  for (int i = 0; i < numRows; ++i)
     {
-      int priority = 0;
+      MSP *msp = mspLists[i] ? (MSP*)(mspLists[i]->data) : NULL;
+      msps[i] = mspIsSortable(msp) ? msp : NULL;
+      keys[i * numKeys] = msps[i] ? 1.0 : 0.0;
+    }
+
+  int keyIdx = 1;
 
-      for ( ; priority < numColumns; ++priority)
+  for (int col = 0; col < numSortColumns; ++col)
+    {
+      const BlxColumnId sortColumn = sortColumns[col];
+      const gdouble sign = (getColumnSortOrder(bc, sortColumn) == GTK_SORT_DESCENDING) ? -1.0 : 1.0;
+
+      if (sortColumn != BLXCOL_SCORE && sortColumn != BLXCOL_ID && sortColumn != BLXCOL_START && sortColumn != BLXCOL_GROUP)
         {
-          BlxColumnId sortColumn = sortColumns[priority];
+          /* Generic string column */
+          calcStringSortKeys(properties, msps, numRows, sortColumn, sign, keys, numKeys, keyIdx);
+          ++keyIdx;
+          continue;
+        }
 
-          /* NONE indicates an unused entry in the priority array; if we reach
-           * an unset value, there should be no more values after it */
-          if (sortColumn == BLXCOL_NONE)
-            break;
+      for (int i = 0; i < numRows; ++i)
+        {
+          const MSP* const msp = msps[i];
 
-          /* Extract the MSPs for the two rows that we're comparing */
-          GList *mspGList1 = seq1->mspList;
-          GList *mspGList2 = seq2->mspList;
+          if (!msp)
+            continue;
 
-          /* Do the comparison on this column */
-          result = sortByColumnCompareFunc(mspGList1, mspGList2, detailView, sortColumn);
+          gdouble *rowKeys = keys + i * numKeys + keyIdx;
+          const gboolean multipleMsps = (mspLists[i]->next != NULL);
 
-          /* If rows are equal, continue to sort; otherwise we're done */
-          if (result != 0)
-            break;
+          switch (sortColumn)
+            {
+              case BLXCOL_SCORE:
+                rowKeys[0] = multipleMsps ? G_MAXDOUBLE : sign * msp->score;
+                break;
+
+              case BLXCOL_ID:
+                rowKeys[0] = multipleMsps ? G_MAXDOUBLE : sign * msp->id;
+                break;
+
+              case BLXCOL_START:
+                /* If the display is reversed, sort by the max coord descending. Single
+                 * MSPs have a secondary sort by alignment length. */
+                if (multipleMsps)
+                  {
+                    const int coord = findMspListQExtent(mspLists[i], !bc->displayRev, BLXSTRAND_NONE);
+                    rowKeys[0] = sign * (bc->displayRev ? -coord : coord);
+                  }
+                else
+                  {
+                    rowKeys[0] = sign * (bc->displayRev ? -msp->qRange.max() : msp->qRange.min());
+                    rowKeys[1] = sign * msp->qRange.length();
+                  }
+                break;
+
+              case BLXCOL_GROUP:
+                {
+                  /* Sequences that are not in a group go after those that are */
+                  const int order = sequenceGetGroupOrder(blxWindow, msp->sSequence);
+                  rowKeys[0] = sign * (order == UNSET_INT ? G_MAXDOUBLE : order);
+                  break;
+                }
+
+              default:
+                break;
+            };
         }
+
+      keyIdx += (sortColumn == BLXCOL_START ? 2 : 1);
     }
 
-  return result;
+  g_free(msps);
+
+  if (numKeysOut)
+    *numKeysOut = numKeys;
+
+  if (keysVersionOut)
+    *keysVersionOut = properties->sortKeysVersion;
+
+  return keys;
 }
 
 
+/* Sort the given list of BlxSequences by the current sort columns. The first numSorted
+ * items must already be sorted: only the rest are sorted, and they are then merged in.
+ * The list items are relinked in their new order. Returns the new start of the list
+ * and sets the new end of the list in 'tail' (if not null). */
+static GList* detailViewSortSeqList(GtkWidget *detailView, GList *seqList, const int numSorted, GList **tail)
+{
+  const int numItems = g_list_length(seqList);
+  GList **items = g_new(GList*, numItems);
+  GList **mspLists = g_new(GList*, numItems);
+  int *order = g_new(int, numItems);
+
+  GList *item = seqList;
+
+  for (int i = 0; item; item = item->next, ++i)
+    {
+      items[i] = item;
+      mspLists[i] = ((BlxSequence*)(item->data))->mspList;
+      order[i] = i;
+    }
+
+  int numKeys = 0;
+  gdouble *keys = detailViewCalcSortKeys(detailView, mspLists, numItems, &numKeys, NULL);
+  SortKeyCompare compare(keys, numKeys);
+
+  stable_sort(order + numSorted, order + numItems, compare);
+  inplace_merge(order, order + numSorted, order + numItems, compare);
+
+  /* Relink the list items in the new order */
+  GList *result = NULL;
+  GList *lastItem = NULL;
+
+  for (int i = 0; i < numItems; ++i)
+    {
+      item = items[order[i]];
+      item->prev = lastItem;
+      item->next = NULL;
+
+      if (lastItem)
+        lastItem->next = item;
+      else
+        result = item;
+
+      lastItem = item;
+    }
+
+  if (tail)
+    *tail = lastItem;
+
+  g_free(keys);
+  g_free(order);
+  g_free(mspLists);
+  g_free(items);
+
+  return result;
+}
+
 
 /* Re-sort all trees */
 void detailViewResortTrees(GtkWidget *detailView)
 {
   DEBUG_ENTER("detailViewResortTrees()");
 
+  /* The sort settings may have changed, so sort keys calculated before now can't be
+   * compared with new ones */
+  DetailViewProperties *properties = detailViewGetProperties(detailView);
+  ++properties->sortKeysVersion;
+
   /* Sort the data for each tree */
   callFuncOnAllDetailViewTrees(detailView, resortTree, NULL);
 
   /* Sort the list of BlxSequences (uesd by the exon view) */
   BlxContext *bc = detailViewGetContext(detailView);
-  bc->matchSeqs = g_list_sort(bc->matchSeqs, detailViewSortByColumns);
+  bc->matchSeqs = detailViewSortSeqList(detailView, bc->matchSeqs, 0, &bc->matchSeqsTail);
 
   bigPictureRedrawAll(detailViewGetBigPicture(detailView));
 
@@ -1995,6 +2342,20 @@ void detailViewResortTrees(GtkWidget *detailView)
 }
 
 
+/* Merge a list of newly-loaded BlxSequences into the context's list of all sequences,
+ * which is assumed to be sorted already. Only the new sequences are sorted; they are then
+ * merged in with a single linear pass, which is much cheaper than re-sorting the whole
+ * list. Takes ownership of newSeqs. */
+void detailViewMergeSeqs(GtkWidget *detailView, GList *newSeqs)
+{
+  BlxContext *bc = detailViewGetContext(detailView);
+  const int numSorted = g_list_length(bc->matchSeqs);
+
+  bc->matchSeqs = g_list_concat(bc->matchSeqs, newSeqs);
+  bc->matchSeqs = detailViewSortSeqList(detailView, bc->matchSeqs, numSorted, &bc->matchSeqsTail);
+}
+
+
 /* Set the value of the 'invert sort order' flag */
 void detailViewUpdateSortInverted(GtkWidget *detailView, const gboolean invert)
 {
@@ -2029,15 +2390,8 @@ void detailViewUpdateMspLengths(GtkWidget *detailView, const int numUnalignedBas
   DEBUG_ENTER("detailViewUpdateMspLengths()");
 
   /* Re-calculate the full extent of all MSPs, and the max msp length */
-  setMaxMspLen(0);
-
   BlxContext *bc = detailViewGetContext(detailView);
-  MSP *msp = bc->mspList;
-
-  for ( ; msp; msp = msp->next)
-    {
-      mspCalculateFullExtents(msp, bc, numUnalignedBases);
-    }
+  cacheMspDisplayRanges(bc, numUnalignedBases);
 
   /* Do a full re-sort and re-filter because the lengths of the displayed match
    * sequences may have changed (and we need to make sure they're sorted by start pos) */
@@ -2291,14 +2645,14 @@ static void mspGetAdjacentBases(const MSP* const msp, char *bases, const gboolea
 {
   if (start)
     {
-      bases[0] = getSequenceIndex(bc->refSeq, msp->qRange.min() - 2, revStrand, &bc->refSeqRange, BLXSEQ_DNA);
-      bases[1] = getSequenceIndex(bc->refSeq, msp->qRange.min() - 1, revStrand, &bc->refSeqRange, BLXSEQ_DNA);
+      bases[0] = bc->getRefSeqBase(msp->qRange.min() - 2, revStrand);
+      bases[1] = bc->getRefSeqBase(msp->qRange.min() - 1, revStrand);
       bases[2] = '\0';
     }
   else
     {
-      bases[0] = getSequenceIndex(bc->refSeq, msp->qRange.max() + 1, revStrand, &bc->refSeqRange, BLXSEQ_DNA);
-      bases[1] = getSequenceIndex(bc->refSeq, msp->qRange.max() + 2, revStrand, &bc->refSeqRange, BLXSEQ_DNA);
+      bases[0] = bc->getRefSeqBase(msp->qRange.max() + 1, revStrand);
+      bases[1] = bc->getRefSeqBase(msp->qRange.max() + 2, revStrand);
       bases[2] = '\0';
     }
 }
@@ -2853,21 +3207,18 @@ static void drawDnaTrack(GtkWidget *dnaTrack, GtkWidget *detailView, const BlxSt
   IntRange qRange = {min(qIdx1, qIdx2), max(qIdx1, qIdx2)};
 
   GError *error = NULL;
-
-  gchar *segmentToDisplay = getSequenceSegment(bc->refSeq,
-                                               &qRange,
-                                               strand,
-                                               BLXSEQ_DNA,      /* ref seq is always in nucleotide coords */
-                                               BLXSEQ_DNA,      /* required segment is in nucleotide coords */
-                                               frame,
-                                               bc->numFrames,
-                                               &bc->refSeqRange,
-                                               bc->blastMode,
-                                               bc->geneticCode,
-                                               bc->displayRev,
-                                               bc->displayRev,
-                                               bc->displayRev,
-                                               &error);
+  int segmentLen = 0;
+
+  const char *segmentToDisplay = blxRefSeqCacheGetSegment(bc->refSeqCache,
+                                                          &qRange,
+                                                          strand,
+                                                          BLXSEQ_DNA,      /* required segment is in nucleotide coords */
+                                                          bc->numFrames,
+                                                          bc->blastMode,
+                                                          bc->displayRev,
+                                                          bc->displayRev,
+                                                          &segmentLen,
+                                                          &error);
 
   if (!segmentToDisplay)
     {
@@ -2927,7 +3278,7 @@ static void drawDnaTrack(GtkWidget *dnaTrack, GtkWidget *detailView, const BlxSt
   while (qIdx >= qRange.min() && qIdx <= qRange.max())
     {
       /* Get the character to display at this index, and its position */
-      displayText[displayTextPos] = getSequenceIndex(bc->refSeq, qIdx, bc->displayRev, &bc->refSeqRange, BLXSEQ_DNA);
+      displayText[displayTextPos] = bc->getRefSeqBase(qIdx, bc->displayRev);
       const int x = (int)((gdouble)displayTextPos * properties->charWidth());
 
       baseData.dnaIdx = qIdx;
@@ -2960,7 +3311,6 @@ static void drawDnaTrack(GtkWidget *dnaTrack, GtkWidget *detailView, const BlxSt
   drawColumnSeparatorLine(dnaTrack, drawable, gc, bc);
 
   g_hash_table_unref(basesToHighlight);
-  g_free(segmentToDisplay);
   g_object_unref(gc);
 }
 
@@ -3828,238 +4178,16 @@ static void updateCellRendererFont(GtkWidget *detailView, PangoFontDescription *
 }
 
 
-/* Refilter the tree row that this msp is in */
-static void refilterMspRow(MSP *msp, GtkWidget *detailView, BlxContext *bc)
-{
-  //DEBUG_ENTER("refilterMspRow(msp=[%d,%d])", msp->fullRange.min, msp->fullRange.max);
-
-  /* Find the tree row that this MSP is in and force that row to update
-   * its visibility status. */
-  gchar *pathStr = mspGetTreePath(msp, bc->modelId);
-
-  if (pathStr)
-    {
-      GtkTreePath *path = gtk_tree_path_new_from_string(pathStr);
-
-      if (path)
-        {
-          GtkWidget *tree = detailViewGetTree(detailView, mspGetRefStrand(msp), mspGetRefFrame(msp, bc->seqType));
-          GtkTreeModel *model = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
-          GtkTreeIter iter;
-
-          if (gtk_tree_model_get_iter(model, &iter, path))
-            {
-              gtk_tree_model_row_changed(model, path, &iter);
-            }
-        }
-
-      gtk_tree_path_free(path);
-    }
-
-  //DEBUG_EXIT("refilterMspRow returning ");
-}
-
-
-/* Utility to see if the start value of the first range is within the second
- * range. If 'rev' is true, the 'start' of range1 is the max value rather than
- * the min value of this range. */
-static gboolean startValueWithinRange(const IntRange* const range1,
-                                      const IntRange* const range2,
-                                      const gboolean rev)
-{
-  gboolean result = FALSE;
-
-  if (rev)
-    result = valueWithinRange(range1->max(), range2);
-  else
-    result = valueWithinRange(range1->min(), range2);
-
-  return result;
-}
-
-
-/* Quick search to find any MSP in the given array that whose start coord
- * lies within the given range. Sets the found array index in 'idx' or returns
- * FALSE if no MSP was found in this range. */
-static gboolean getAnyMspInRange(GArray *mspArray,
-                                 const IntRange* const range,
-                                 const gboolean displayRev,
-                                 int *idx)
-{
-  gboolean result = FALSE;
-
-  /* Do a binary search based on start coord until we find a start coord
-   * that lies within the given range. */
-  int iMax = mspArray->len - 1;
-  int iMin = 0;
-
-  while (1)
-    {
-      const int i = iMin + (iMax - iMin) / 2;
-      const MSP *msp = mspArrayIdx(mspArray, i);
-
-      if (!msp)
-        break;
-
-      if (startValueWithinRange(&msp->displayRange, range, displayRev))
-        {
-          result = TRUE;
-          *idx = i;
-          break;
-        }
-
-      if (iMax - iMin < 1)
-        break;
-
-      if ((msp->displayRange.min() < range->min()) != displayRev)
-        {
-          iMin = i + 1;
-        }
-      else
-        {
-          iMax = i - 1;
-        }
-    }
-
-  return result;
-}
-
-
-/* Refilter the tree rows for all MSPs in the given array whose start coords
- * lie within the given range. 'startIdx' should be an index in the array that
- * gives the position of an MSP that is known to lie within this range (i.e.
- * it gives us a rough starting point so that we don't have to search through
- * the entire array; it does not necessarily have to be the FIRST MSP that lies
- * within range). */
-static void refilterMspList(const int startIdx,
-                            GArray *array,
-                            const IntRange* const range,
-                            GtkWidget *detailView,
-                            BlxContext *bc)
-{
-  DEBUG_ENTER("refilterMspList(startIdx=%d, range=[%d,%d])", startIdx, range->min(), range->max());
-
-  /* Loop forwards through the array from the start index, refiltering the rows
-   * for each MSP until we find an MSP that is out of range. */
-  int i = startIdx;
-  MSP *msp = mspArrayIdx(array, i);
-
-  for ( ; msp; msp = mspArrayIdx(array, ++i))
-    {
-      if (!startValueWithinRange(&msp->displayRange, range, bc->displayRev))
-        break;
-
-      refilterMspRow(msp, detailView, bc);
-    }
-
-  /* Also loop backwards from the start index, because startIdx may not have
-   * been the very first MSP in the array that was in range. */
-  i = startIdx - 1;
-  msp = mspArrayIdx(array, i);
-
-  for ( ; msp; msp = mspArrayIdx(array, --i))
-    {
-      if (!startValueWithinRange(&msp->displayRange, range, bc->displayRev))
-        break;
-
-      refilterMspRow(msp, detailView, bc);
-    }
-
-  DEBUG_EXIT("refilterMspList returning ");
-}
-
-
-/* Refilter rows in the detail-view trees for MSPs of the given type. Only filter
- * the rows of MSPs that lie within the given display range. */
-static void refilterMspArrayByRange(BlxMspType mspType,
-                                   BlxContext *bc,
-                                   const IntRange* const displayRange,
-                                   GtkWidget *detailView)
-{
-  //DEBUG_ENTER("refilterMspArrayByRange(mspType=%d)", mspType);
-
-  if (!displayRange)
-    return;
-
-  /* We only want to update MSPs that are within the given display range.
-   *
-   * We want to avoid searching through the entire MSP array, because it may
-   * contain many thousands of MSPs. However, it is difficult to do a quick
-   * search to find an item from the list based on two values (i.e. the start and
-   * end of its range).
-   * What we do is extend the start of the display range by the maximum MSP
-   * length so that we can do a binary search just on the start coord of the MSP
-   * to check that it lies within the extended range. For any MSP that lies within
-   * the display range, it must be true that its start coord lies within this
-   * extended range.
-   * Because the extended range is based on the maximum MSP length, it is likely
-   * to include some MSPs that do not actually lie within the display range.
-   * However, there is no harm in filtering a few extra rows, and this should
-   * still be more efficient that searching through the entire array of MSPs. */
-
-  const int maxLen = getMaxMspLen();
-
-  /* If the display is reversed, the 'start' is the maximum coord end
-   * rather than the minimum coord */
-  IntRange extendedRange;
-
-  if (bc->displayRev)
-    {
-      extendedRange.set(displayRange->min(), displayRange->max() + maxLen);
-    }
-  else
-    {
-      extendedRange.set(displayRange->min() - maxLen, displayRange->max());
-    }
-
-  int startIdx = 0;
-
-  if (getAnyMspInRange(bc->featureLists[mspType], &extendedRange, bc->displayRev, &startIdx))
-    {
-      refilterMspList(startIdx, bc->featureLists[mspType], &extendedRange, detailView, bc);
-    }
-
-  //DEBUG_EXIT("refilterMspArrayByRange returning ");
-}
-
-
-/* Refilter the rows in the detail-view trees. Only updates the rows in the
- * current display range and (if given) the old display range. */
+/* Refilter the rows in the detail-view trees. The tree models index their rows by
+ * position, so this only needs to look at rows in the current display range and the
+ * rows that were previously visible (i.e. those in the old display range), so the
+ * oldRange argument is no longer needed but is kept for information. */
 void refilterDetailView(GtkWidget *detailView, const IntRange* const oldRange)
 {
   DEBUG_ENTER("refilterDetailView(oldRange=[%d,%d])", oldRange ? oldRange->min() : 0, oldRange ? oldRange->max() : 0);
 
-  BlxContext *bc = detailViewGetContext(detailView);
-
-  if (bc->flags[BLXFLAG_SHOW_POLYA_SITE] || bc->flags[BLXFLAG_SHOW_UNALIGNED])
-    {
-      /* If these options are enabled, then determining which rows need to be
-       * refiltered becomes much more complex because visible alignments lengths
-       * may differ from the actual alignment coords, and may differ depending
-       * on whether the sequence is selected or not. For now, play safe and
-       * refilter everything. */
-      callFuncOnAllDetailViewTrees(detailView, refilterTree, NULL);
-    }
-  else
-    {
-      /* We only want to update MSPs that are in the old detail-view range
-       * and the new detail-view range. (Because updating every row in all
-       * trees can be very slow if there are a lot of MSPs.) */
-      const IntRange* const newRange = detailViewGetDisplayRange(detailView);
-
-      /* Only consider MSPs that are shwon in the detail-view */
-      int mspType = 0;
-      for ( ; mspType < BLXMSP_NUM_TYPES; ++mspType)
-        {
-          if (typeShownInDetailView((BlxMspType)mspType))
-            {
-              refilterMspArrayByRange((BlxMspType)mspType, bc, oldRange, detailView);
-              refilterMspArrayByRange((BlxMspType)mspType, bc, newRange, detailView);
-            }
-        }
-
-      detailViewRedrawAll(detailView);
-    }
+  callFuncOnAllDetailViewTrees(detailView, refilterTree, NULL);
+  detailViewRedrawAll(detailView);
 
   DEBUG_EXIT("refilterDetailView returning ");
 }
@@ -4399,6 +4527,30 @@ int detailViewGetNumUnalignedBases(GtkWidget *detailView)
 }
 
 
+/* Get the initial number of unaligned bases to show. This is the default unless it is set
+ * in the config file. This does not require the detail view to exist so it can be used
+ * when calculating MSP data before the detail view is created. */
+int detailViewGetDefaultNumUnalignedBases()
+{
+  int result = DEFAULT_NUM_UNALIGNED_BASES;
+
+  /* The numunalignedbases may be set in the config file; if so, override the default */
+  GKeyFile *key_file = blxGetConfig();
+  if (key_file)
+    {
+      GError *error = NULL;
+      int numUnaligned = g_key_file_get_integer(key_file, SETTINGS_GROUP, SETTING_NAME_NUM_UNALIGNED_BASES, &error);
+
+      if (!error) /* we don't care if it wasn't found */
+        result = numUnaligned;
+      else
+        g_error_free(error);
+    }
+
+  return result;
+}
+
+
 static int detailViewGetSnpConnectorHeight(GtkWidget *detailView)
 {
   DetailViewProperties *properties = detailViewGetProperties(detailView);
@@ -5751,9 +5903,11 @@ void detailViewSetSortColumn(GtkWidget *detailView, const BlxColumnId sortColumn
 }
 
 
-/* Find the next MSP (out the MSPs in this tree) whose start/end is the next closest to the
+/* Find the next MSP (out the MSPs in this tree row) whose start/end is the next closest to the
  * current start position of the display, searching only in the direction specified by the
- * search criteria passed in the user data. Updates the searchData with the offset found. */
+ * search criteria passed in the user data. Updates the searchData with the offset found.
+ * This is called for all rows in the model, including those outside the display range,
+ * so the path is not set. */
 static gboolean findNextMatchInTree(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
 {
   MatchSearchData *searchData = (MatchSearchData*)data;
@@ -5853,7 +6007,7 @@ static MSP* goToNextMatch(GtkWidget *detailView,
       if (GTK_WIDGET_VISIBLE(tree) && gtk_widget_get_parent(treeContainer)) /* ignore if not currently included in view */
         {
           GtkTreeModel *model = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
-          gtk_tree_model_foreach(model, findNextMatchInTree, &searchData);
+          detailViewModelForeachRow(DETAIL_VIEW_MODEL(model), findNextMatchInTree, &searchData);
         }
 
       treeContainer = detailViewGetTreeContainer(detailView, BLXSTRAND_REVERSE, frame);
@@ -5862,7 +6016,7 @@ static MSP* goToNextMatch(GtkWidget *detailView,
       if (GTK_WIDGET_VISIBLE(tree) && gtk_widget_get_parent(treeContainer)) /* ignore if not currently included in view */
         {
           GtkTreeModel *model = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
-          gtk_tree_model_foreach(model, findNextMatchInTree, &searchData);
+          detailViewModelForeachRow(DETAIL_VIEW_MODEL(model), findNextMatchInTree, &searchData);
         }
     }
 
@@ -6308,7 +6462,7 @@ static void createDetailViewPanes(GtkWidget *detailView,
  * out of all the blast matches. modelId specifies which tree data model should
  * be active at the start. If create is true, the tree data stores are created;
  * otherwise we assume they already exist. */
-void detailViewAddMspData(GtkWidget *detailView, MSP *mspList, GList *seqList)
+void detailViewAddMspData(GtkWidget *detailView, MSP *mspList)
 {
   BlxContext *bc = detailViewGetContext(detailView);
 
@@ -6332,8 +6486,7 @@ void detailViewAddMspData(GtkWidget *detailView, MSP *mspList, GList *seqList)
 
           if (tree)
             {
-              GtkListStore *store = GTK_LIST_STORE(treeGetBaseDataModel(GTK_TREE_VIEW(tree)));
-              addMspToTree(msp, tree, store);
+              addMspToTree(msp, tree);
             }
           else
             {
@@ -6342,15 +6495,10 @@ void detailViewAddMspData(GtkWidget *detailView, MSP *mspList, GList *seqList)
         }
     }
 
-  /* Finally, create a custom-filtered version of the data store for each tree. We do
-   * this AFTER adding the data so that it doesn't try to re-filter every time we add a row.
-   * To do: Note that if we're calling this function a second time to add additional rows, the filter
-   * will already exist so this may be slow and we may need to look into improving this. */
-  callFuncOnAllDetailViewTrees(detailView, treeCreateFilteredDataModel, NULL);
-
   /* Also create a second data store that will store one sequence per row (as opposed to one
-   * MSP per row). This data store will be switched in when the user selects 'squash matches'. */
-  callFuncOnAllDetailViewTrees(detailView, addSequencesToTree, seqList);
+   * MSP per row). This data store will be switched in when the user selects 'squash matches'.
+   * Unless it's needed now, it is created in the background. */
+  queueCreateSquashedTreeModels(detailView);
 }
 
 
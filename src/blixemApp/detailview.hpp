@@ -60,6 +60,7 @@ class CoverageViewProperties;
 #define SNP_TRACK_SCROLL_WIN_NAME       "SNP scroll window"
 #define SNP_TRACK_CONTAINER_NAME        "SNP track container"
 #define DNA_TRACK_HEADER_NAME           "DNA track header"
+#define DEFAULT_NUM_UNALIGNED_BASES     5     /* the default number of additional bases to show if displaying unaligned parts of the match sequence */
 #define DETAIL_VIEW_STATUSBAR_CONTEXT   "statusBarCtx"
 
 
@@ -89,6 +90,10 @@ typedef struct _BlxSpliceSite
   } BlxSpliceSite;
 
 
+/* Sort keys for the values of string columns (opaque; see detailview.cpp) */
+typedef struct _SortStringKeys SortStringKeys;
+
+
 /* Info about a particular coord (used for recording which coordinates are selected). */
 typedef struct _DetailViewIndex
 {
@@ -165,6 +170,13 @@ public:
   GSList *spliceSites;           /* List of splice sites that can be found and highlighted by
                                     Blixem */
 
+  guint squashedModelsIdleId;    /* Source id of the pending idle call to create the squashed
+                                    tree models, or 0 if none is pending */
+
+  SortStringKeys *sortStringKeys; /* Sort keys for the values of string columns (NULL until needed) */
+  int sortKeysVersion;            /* Incremented whenever sort keys calculated previously become
+                                     invalid, e.g. when the sort settings change */
+
 private:
   double m_charWidth;
   double m_charHeight;
@@ -221,6 +233,7 @@ GtkWidget*              detailViewGetBlxWindow(GtkWidget *detailView);
 gdouble                 detailViewGetCharWidth(GtkWidget *detailView);
 gdouble                 detailViewGetCharHeight(GtkWidget *detailView);
 int                     detailViewGetNumUnalignedBases(GtkWidget *detailView);
+int                     detailViewGetDefaultNumUnalignedBases();
 BlxColumnId*            detailViewGetSortColumns(GtkWidget *detailView);
 GList*                  detailViewGetColumnList(GtkWidget *detailView);
 GType*                  columnListGetTypes(GList *columnList);
@@ -283,13 +296,14 @@ gboolean                detailViewIsDnaIdxSelected(GtkWidget *detailView, const
 void                    detailViewUnsetSelectedBaseIdx(GtkWidget *detailView);
 void                    detailViewSetActiveFrame(GtkWidget *detailView, const int frame);
 void                    detailViewResortTrees(GtkWidget *detailView);
+void                    detailViewMergeSeqs(GtkWidget *detailView, GList *newSeqs);
 
 void                    updateFeedbackBox(GtkWidget *detailView);
 void                    clearFeedbackArea(GtkWidget *detailView);
 void                    updateFeedbackAreaNucleotide(GtkWidget *detailView, const int dnaIdx, const BlxStrand strand);
 void                    toggleStrand(GtkWidget *detailView);
 
-void                    detailViewAddMspData(GtkWidget *detailView, MSP *mspList, GList *seqList);
+void                    detailViewAddMspData(GtkWidget *detailView, MSP *mspList);
 
 void                    updateDetailViewFontDesc(GtkWidget *detailView);
 void                    updateDetailViewRange(GtkWidget *detailView);
@@ -330,6 +344,11 @@ gint                    sortByColumnCompareFunc(GList *mspGList1,
                                                 GList *mspGList2,
                                                 GtkWidget *detailView,
                                                 const BlxColumnId sortColumn);
+gdouble*                detailViewCalcSortKeys(GtkWidget *detailView,
+                                               GList **mspLists,
+                                               const int numRows,
+                                               int *numKeysOut,
+                                               int *keysVersionOut);
 
 void                    drawHeaderChar(BlxContext *bc,
                                        DetailViewProperties *properties,
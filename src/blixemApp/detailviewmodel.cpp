@@ -0,0 +1,1125 @@
+/*  File: detailviewmodel.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ * Description: See detailviewmodel.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <blixemApp/detailviewmodel.hpp>
+#include <blixemApp/blixem_.hpp>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+#define VISIBLE_ROWS_MIN_CAPACITY     256   /* initial size of the buffer of visible rows */
+
+
+/* One row in the model. The column values are calculated from these on demand. */
+struct _DetailViewRow
+{
+  GList *mspList;              /* the MSP(s) shown in this row */
+  gboolean ownsList;           /* true if the row owns the mspList and must free it */
+
+  gdouble score;               /* values for the score, %ID, start and end columns */
+  gdouble id;
+  int start;
+  int end;
+
+  int sortIdx;                 /* position of this row in the sorted list of all rows */
+  int keyIdx;                  /* index of this row's keys in the model's cached sort keys */
+  int extentMin;               /* extent of all of the row's MSPs in display coords */
+  int extentMax;
+  gboolean indexed;            /* false if the row's extent is not known, i.e. it can never be shown */
+
+  int filterGeneration;        /* the refilter pass in which this row was last checked */
+  gboolean passed;             /* whether the row passed the visible function in that pass */
+  gboolean visible;            /* whether the row is currently one of the visible rows */
+};
+
+
+/* A sort function for a column */
+struct _DetailViewSortFunc
+{
+  GtkTreeIterCompareFunc func;
+  gpointer data;
+  GDestroyNotify destroy;
+};
+
+
+/* Some boring function declarations: GObject type system stuff */
+static void     detail_view_model_init              (DetailViewModel *model);
+static void     detail_view_model_class_init        (DetailViewModelClass *klass);
+static void     detail_view_model_tree_model_init   (GtkTreeModelIface *iface);
+static void     detail_view_model_tree_sortable_init(GtkTreeSortableIface *iface);
+static void     detail_view_model_finalize          (GObject *object);
+
+static void     sortRows(DetailViewModel *model);
+
+static gpointer parent_class;
+
+
+/***************************************************************************
+ *                          Utility functions                              *
+ ***************************************************************************/
+
+static void setIter(DetailViewModel *model, GtkTreeIter *iter, DetailViewRow *row, const int idx)
+{
+  iter->stamp = model->stamp;
+  iter->user_data = row;
+  iter->user_data2 = GINT_TO_POINTER(idx);
+  iter->user_data3 = NULL;
+}
+
+
+static DetailViewRow* iterGetRow(DetailViewModel *model, GtkTreeIter *iter)
+{
+  g_return_val_if_fail(iter && iter->stamp == model->stamp, NULL);
+  return (DetailViewRow*)(iter->user_data);
+}
+
+
+/* Return the sort function for the current sort column, or NULL if the model
+ * is unsorted */
+static DetailViewSortFunc* modelGetSortFunc(DetailViewModel *model)
+{
+  DetailViewSortFunc *result = NULL;
+
+  if (model->sortColumnId == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID)
+    result = &model->sortFuncs[model->numColumns];
+  else if (model->sortColumnId >= 0 && model->sortColumnId < model->numColumns)
+    result = &model->sortFuncs[model->sortColumnId];
+
+  if (result && !result->func)
+    result = NULL;
+
+  return result;
+}
+
+
+/* Compares two rows using the model's current sort function. Note that the
+ * sort functions are not guaranteed to give a strict weak ordering, so this
+ * should only be used with the merge-based algorithms (stable_sort, merge etc.) */
+struct RowSortCompare
+{
+  DetailViewModel *model;
+  DetailViewSortFunc *sortFunc;
+
+  RowSortCompare(DetailViewModel *model_in, DetailViewSortFunc *sortFunc_in)
+    : model(model_in), sortFunc(sortFunc_in)
+  {
+  }
+
+  bool operator()(DetailViewRow *row1, DetailViewRow *row2) const
+  {
+    GtkTreeIter iter1, iter2;
+    setIter(model, &iter1, row1, UNSET_INT);
+    setIter(model, &iter2, row2, UNSET_INT);
+
+    gint result = sortFunc->func(GTK_TREE_MODEL(model), &iter1, &iter2, sortFunc->data);
+
+    if (model->sortOrder == GTK_SORT_DESCENDING)
+      result = -result;
+
+    return result < 0;
+  }
+};
+
+
+/* Compares two rows on their packed sort keys, which are indexed by the rows' key index */
+struct RowSortKeyCompare
+{
+  const gdouble *keys;
+  int numKeys;
+  gboolean descending;
+
+  RowSortKeyCompare(const gdouble *keys_in, const int numKeys_in, const gboolean descending_in)
+    : keys(keys_in), numKeys(numKeys_in), descending(descending_in)
+  {
+  }
+
+  bool operator()(const DetailViewRow *row1, const DetailViewRow *row2) const
+  {
+    const gdouble *keys1 = keys + row1->keyIdx * numKeys;
+    const gdouble *keys2 = keys + row2->keyIdx * numKeys;
+
+    for (int i = 0; i < numKeys; ++i)
+      {
+        if (keys1[i] != keys2[i])
+          return descending ? keys1[i] > keys2[i] : keys1[i] < keys2[i];
+      }
+
+    return false;
+  }
+};
+
+
+static bool rowSortIdxLessThan(const DetailViewRow *row1, const DetailViewRow *row2)
+{
+  return row1->sortIdx < row2->sortIdx;
+}
+
+
+static bool rowExtentLessThan(const DetailViewRow *row1, const DetailViewRow *row2)
+{
+  return row1->extentMin < row2->extentMin;
+}
+
+
+static bool rowExtentLessThanValue(const DetailViewRow *row, const int value)
+{
+  return row->extentMin < value;
+}
+
+
+/* Calculate the extent of the given row in display coords from its MSPs. Uses the
+ * full range (which includes any unaligned sequence/polyA tails) as well as the
+ * display range so that we get the max extent the row could ever be shown at.
+ * Returns false if the extent is not known. */
+static gboolean rowCalcExtent(DetailViewRow *row)
+{
+  row->indexed = FALSE;
+
+  for (GList *item = row->mspList; item; item = item->next)
+    {
+      const MSP* const msp = (const MSP*)(item->data);
+      const IntRange *ranges[] = {&msp->displayRange, &msp->fullRange};
+
+      for (int i = 0; i < 2; ++i)
+        {
+          if (!ranges[i]->isSet())
+            continue;
+
+          if (!row->indexed || ranges[i]->min() < row->extentMin)
+            row->extentMin = ranges[i]->min();
+
+          if (!row->indexed || ranges[i]->max() > row->extentMax)
+            row->extentMax = ranges[i]->max();
+
+          row->indexed = TRUE;
+        }
+    }
+
+  return row->indexed;
+}
+
+
+/* Add the given rows to the index, which must already be sorted. The rows are
+ * sorted and then merged in, so this is linear in the size of the index. */
+static void indexAddRows(DetailViewModel *model, DetailViewRow **rows, const int numRows)
+{
+  const int oldLen = model->index->len;
+
+  for (int i = 0; i < numRows; ++i)
+    {
+      DetailViewRow *row = rows[i];
+
+      if (rowCalcExtent(row))
+        {
+          g_ptr_array_add(model->index, row);
+          model->maxRowLen = max(model->maxRowLen, row->extentMax - row->extentMin + 1);
+        }
+    }
+
+  DetailViewRow **index = (DetailViewRow**)(model->index->pdata);
+  const int newLen = model->index->len;
+
+  stable_sort(index + oldLen, index + newLen, rowExtentLessThan);
+  inplace_merge(index, index + oldLen, index + newLen, rowExtentLessThan);
+}
+
+
+/* Rebuild the index of rows by extent. This must be done whenever the MSP display
+ * ranges have been recalculated, e.g. if the display has been reversed. */
+static void rebuildIndex(DetailViewModel *model)
+{
+  g_ptr_array_set_size(model->index, 0);
+  model->maxRowLen = 0;
+
+  indexAddRows(model, (DetailViewRow**)(model->rows->pdata), model->rows->len);
+  model->indexVersion = getMspDisplayRangesVersion();
+}
+
+
+/* Set the sort index of each row from its position in the row list */
+static void renumberRows(DetailViewModel *model)
+{
+  DetailViewRow **rows = (DetailViewRow**)(model->rows->pdata);
+  const int numRows = model->rows->len;
+
+  for (int i = 0; i < numRows; ++i)
+    rows[i]->sortIdx = i;
+}
+
+
+/* Calculate the sort keys for the given rows using the model's sort key function.
+ * The rows' key indexes are set to their position in the given array plus firstKeyIdx.
+ * The result should be freed with g_free. */
+static gdouble* modelCalcSortKeys(DetailViewModel *model,
+                                  DetailViewRow **rows,
+                                  const int numRows,
+                                  const int firstKeyIdx,
+                                  int *numKeys,
+                                  int *keysVersion)
+{
+  GList **mspLists = g_new(GList*, numRows);
+
+  for (int i = 0; i < numRows; ++i)
+    {
+      mspLists[i] = rows[i]->mspList;
+      rows[i]->keyIdx = firstKeyIdx + i;
+    }
+
+  gdouble *keys = model->sortKeyFunc(mspLists, numRows, numKeys, keysVersion, model->sortKeyData);
+
+  g_free(mspLists);
+  return keys;
+}
+
+
+/* Forget the cached sort keys, e.g. because rows have been added without them */
+static void modelClearSortKeys(DetailViewModel *model)
+{
+  g_free(model->sortKeys);
+  model->sortKeys = NULL;
+  model->numSortKeys = 0;
+}
+
+
+/* Merge any newly-added rows into the sorted list of rows and into the index.
+ * Only the new rows are sorted (and only their sort keys are calculated); merging
+ * them in is linear. */
+static void flushNewRows(DetailViewModel *model)
+{
+  const int numNew = model->newRows->len;
+
+  if (numNew < 1)
+    return;
+
+  const int oldLen = model->rows->len;
+  g_ptr_array_set_size(model->rows, oldLen + numNew);
+
+  DetailViewRow **rows = (DetailViewRow**)(model->rows->pdata);
+  memcpy(rows + oldLen, model->newRows->pdata, numNew * sizeof(DetailViewRow*));
+
+  DetailViewSortFunc *sortFunc = modelGetSortFunc(model);
+
+  if (sortFunc && model->sortKeyFunc)
+    {
+      /* Calculate the keys for the new rows and add them to the cached keys of the
+       * existing rows. If the cached keys can't be compared with the new ones (e.g.
+       * because the sort settings have changed) then recalculate the keys for all rows. */
+      if (model->sortKeys)
+        {
+          int numKeys = 0;
+          int keysVersion = UNSET_INT;
+          gdouble *newKeys = modelCalcSortKeys(model, rows + oldLen, numNew, oldLen, &numKeys, &keysVersion);
+
+          if (numKeys == model->numSortKeys && keysVersion == model->sortKeysVersion)
+            {
+              model->sortKeys = g_renew(gdouble, model->sortKeys, (oldLen + numNew) * numKeys);
+              memcpy(model->sortKeys + oldLen * numKeys, newKeys, numNew * numKeys * sizeof(gdouble));
+            }
+          else
+            {
+              modelClearSortKeys(model);
+            }
+
+          g_free(newKeys);
+        }
+
+      if (!model->sortKeys)
+        model->sortKeys = modelCalcSortKeys(model, rows, oldLen + numNew, 0, &model->numSortKeys, &model->sortKeysVersion);
+
+      RowSortKeyCompare compare(model->sortKeys, model->numSortKeys, model->sortOrder == GTK_SORT_DESCENDING);
+      stable_sort(rows + oldLen, rows + oldLen + numNew, compare);
+      inplace_merge(rows, rows + oldLen, rows + oldLen + numNew, compare);
+    }
+  else if (sortFunc)
+    {
+      modelClearSortKeys(model);
+
+      RowSortCompare compare(model, sortFunc);
+      stable_sort(rows + oldLen, rows + oldLen + numNew, compare);
+      inplace_merge(rows, rows + oldLen, rows + oldLen + numNew, compare);
+    }
+  else
+    {
+      modelClearSortKeys(model);
+    }
+
+  renumberRows(model);
+
+  /* If the index is out of date it will be rebuilt in full on the next refilter anyway */
+  if (model->indexVersion == getMspDisplayRangesVersion())
+    indexAddRows(model, (DetailViewRow**)(model->newRows->pdata), numNew);
+
+  g_ptr_array_set_size(model->newRows, 0);
+}
+
+
+/***************************************************************************
+ *             Visible rows. These are stored in a gap buffer so that
+ *             the inserts/removals we do when refiltering, which always
+ *             move in one direction through the list, are cheap.
+ ***************************************************************************/
+
+static DetailViewRow* visibleRowAt(DetailViewModel *model, const int idx)
+{
+  return idx < model->gapStart ? model->visibleRows[idx] : model->visibleRows[idx + model->gapLen];
+}
+
+
+/* Move the start of the gap to the given position in the list */
+static void visibleRowsMoveGap(DetailViewModel *model, const int pos)
+{
+  if (pos < model->gapStart)
+    {
+      memmove(model->visibleRows + pos + model->gapLen,
+              model->visibleRows + pos,
+              (model->gapStart - pos) * sizeof(DetailViewRow*));
+    }
+  else if (pos > model->gapStart)
+    {
+      memmove(model->visibleRows + model->gapStart,
+              model->visibleRows + model->gapStart + model->gapLen,
+              (pos - model->gapStart) * sizeof(DetailViewRow*));
+    }
+
+  model->gapStart = pos;
+}
+
+
+static void visibleRowsInsert(DetailViewModel *model, const int pos, DetailViewRow *row)
+{
+  if (model->gapLen < 1)
+    {
+      /* Buffer is full: move the gap to the end and extend the buffer */
+      visibleRowsMoveGap(model, model->numVisibleRows);
+
+      const int capacity = max(VISIBLE_ROWS_MIN_CAPACITY, model->numVisibleRows * 2);
+      model->visibleRows = g_renew(DetailViewRow*, model->visibleRows, capacity);
+      model->gapLen = capacity - model->numVisibleRows;
+    }
+
+  visibleRowsMoveGap(model, pos);
+
+  model->visibleRows[model->gapStart] = row;
+  ++model->gapStart;
+  --model->gapLen;
+  ++model->numVisibleRows;
+}
+
+
+static void visibleRowsRemove(DetailViewModel *model, const int pos)
+{
+  visibleRowsMoveGap(model, pos + 1);
+
+  --model->gapStart;
+  ++model->gapLen;
+  --model->numVisibleRows;
+}
+
+
+/* Compares visible row positions by the sort index of the row at that position */
+struct VisiblePosCompare
+{
+  DetailViewRow **rows;
+
+  VisiblePosCompare(DetailViewRow **rows_in) : rows(rows_in)
+  {
+  }
+
+  bool operator()(const int pos1, const int pos2) const
+  {
+    return rows[pos1]->sortIdx < rows[pos2]->sortIdx;
+  }
+};
+
+
+/* Put the visible rows into the order given by their sort index (e.g. after the
+ * rows have been re-sorted) and tell the tree view about the new order */
+static void reorderVisibleRows(DetailViewModel *model)
+{
+  const int numRows = model->numVisibleRows;
+
+  if (numRows < 1)
+    return;
+
+  /* Close up the gap so that the rows are contiguous */
+  visibleRowsMoveGap(model, numRows);
+
+  DetailViewRow **oldRows = g_new(DetailViewRow*, numRows);
+  memcpy(oldRows, model->visibleRows, numRows * sizeof(DetailViewRow*));
+
+  /* newOrder[newPos] gives the old position of the row that is now at newPos */
+  gint *newOrder = g_new(gint, numRows);
+
+  for (int i = 0; i < numRows; ++i)
+    newOrder[i] = i;
+
+  stable_sort(newOrder, newOrder + numRows, VisiblePosCompare(oldRows));
+
+  for (int i = 0; i < numRows; ++i)
+    model->visibleRows[i] = oldRows[newOrder[i]];
+
+  ++model->stamp;
+
+  GtkTreePath *path = gtk_tree_path_new();
+  gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, newOrder);
+  gtk_tree_path_free(path);
+
+  g_free(newOrder);
+  g_free(oldRows);
+}
+
+
+/* Sort all of the rows using the current sort function */
+static void sortRows(DetailViewModel *model)
+{
+  DetailViewSortFunc *sortFunc = modelGetSortFunc(model);
+
+  if (!sortFunc)
+    return;
+
+  flushNewRows(model);
+
+  DetailViewRow **rows = (DetailViewRow**)(model->rows->pdata);
+
+  if (model->sortKeyFunc)
+    {
+      /* Work out the keys once for each row rather than on every comparison. Keep
+       * them so that rows added later can be merged in without recalculating them. */
+      modelClearSortKeys(model);
+      model->sortKeys = modelCalcSortKeys(model, rows, model->rows->len, 0, &model->numSortKeys, &model->sortKeysVersion);
+
+      stable_sort(rows, rows + model->rows->len,
+                  RowSortKeyCompare(model->sortKeys, model->numSortKeys, model->sortOrder == GTK_SORT_DESCENDING));
+    }
+  else
+    {
+      modelClearSortKeys(model);
+      stable_sort(rows, rows + model->rows->len, RowSortCompare(model, sortFunc));
+    }
+
+  renumberRows(model);
+  reorderVisibleRows(model);
+}
+
+
+/***************************************************************************
+ *                          GtkTreeModel interface                         *
+ ***************************************************************************/
+
+static GtkTreeModelFlags detail_view_model_get_flags(GtkTreeModel *treeModel)
+{
+  return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+
+static gint detail_view_model_get_n_columns(GtkTreeModel *treeModel)
+{
+  return DETAIL_VIEW_MODEL(treeModel)->numColumns;
+}
+
+
+static GType detail_view_model_get_column_type(GtkTreeModel *treeModel, gint index)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+  g_return_val_if_fail(index >= 0 && index < model->numColumns, G_TYPE_INVALID);
+
+  return model->columnTypes[index];
+}
+
+
+static gboolean detail_view_model_get_iter(GtkTreeModel *treeModel, GtkTreeIter *iter, GtkTreePath *path)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+  g_return_val_if_fail(gtk_tree_path_get_depth(path) == 1, FALSE);
+
+  const int idx = gtk_tree_path_get_indices(path)[0];
+
+  if (idx < 0 || idx >= model->numVisibleRows)
+    return FALSE;
+
+  setIter(model, iter, visibleRowAt(model, idx), idx);
+  return TRUE;
+}
+
+
+static GtkTreePath* detail_view_model_get_path(GtkTreeModel *treeModel, GtkTreeIter *iter)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+  g_return_val_if_fail(iter->stamp == model->stamp, NULL);
+
+  const int idx = GPOINTER_TO_INT(iter->user_data2);
+  g_return_val_if_fail(idx >= 0 && idx < model->numVisibleRows, NULL);
+
+  return gtk_tree_path_new_from_indices(idx, -1);
+}
+
+
+static void detail_view_model_get_value(GtkTreeModel *treeModel, GtkTreeIter *iter, gint column, GValue *value)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+  g_return_if_fail(column >= 0 && column < model->numColumns);
+
+  g_value_init(value, model->columnTypes[column]);
+
+  DetailViewRow *row = iterGetRow(model, iter);
+
+  if (!row)
+    return;
+
+  switch (model->columnIds[column])
+    {
+      case BLXCOL_SCORE:
+        g_value_set_double(value, row->score);
+        break;
+
+      case BLXCOL_ID:
+        g_value_set_double(value, row->id);
+        break;
+
+      case BLXCOL_START:
+        g_value_set_int(value, row->start);
+        break;
+
+      case BLXCOL_END:
+        g_value_set_int(value, row->end);
+        break;
+
+      case BLXCOL_SEQUENCE:
+        g_value_set_pointer(value, row->mspList);
+        break;
+
+      default:
+        {
+          /* Other columns come from the sequence (all MSPs in a row are from the same sequence,
+           * apart from in the compact tree, where we just use the first) */
+          const MSP* const msp = row->mspList ? (const MSP*)(row->mspList->data) : NULL;
+          GValue *val = (msp && msp->sSequence) ? blxSequenceGetValue(msp->sSequence, model->columnIds[column]) : NULL;
+
+          if (val)
+            g_value_transform(val, value);
+
+          break;
+        }
+    }
+}
+
+
+static gboolean detail_view_model_iter_next(GtkTreeModel *treeModel, GtkTreeIter *iter)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+  g_return_val_if_fail(iter->stamp == model->stamp, FALSE);
+
+  const int idx = GPOINTER_TO_INT(iter->user_data2) + 1;
+
+  if (idx < 1 || idx >= model->numVisibleRows)
+    return FALSE;
+
+  setIter(model, iter, visibleRowAt(model, idx), idx);
+  return TRUE;
+}
+
+
+static gboolean detail_view_model_iter_nth_child(GtkTreeModel *treeModel, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(treeModel);
+
+  /* This is a list so only the root has children */
+  if (parent || n < 0 || n >= model->numVisibleRows)
+    return FALSE;
+
+  setIter(model, iter, visibleRowAt(model, n), n);
+  return TRUE;
+}
+
+
+static gboolean detail_view_model_iter_children(GtkTreeModel *treeModel, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+  return detail_view_model_iter_nth_child(treeModel, iter, parent, 0);
+}
+
+
+static gboolean detail_view_model_iter_has_child(GtkTreeModel *treeModel, GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+
+static gint detail_view_model_iter_n_children(GtkTreeModel *treeModel, GtkTreeIter *iter)
+{
+  return iter ? 0 : DETAIL_VIEW_MODEL(treeModel)->numVisibleRows;
+}
+
+
+static gboolean detail_view_model_iter_parent(GtkTreeModel *treeModel, GtkTreeIter *iter, GtkTreeIter *child)
+{
+  return FALSE;
+}
+
+
+static void detail_view_model_tree_model_init(GtkTreeModelIface *iface)
+{
+  iface->get_flags       = detail_view_model_get_flags;
+  iface->get_n_columns   = detail_view_model_get_n_columns;
+  iface->get_column_type = detail_view_model_get_column_type;
+  iface->get_iter        = detail_view_model_get_iter;
+  iface->get_path        = detail_view_model_get_path;
+  iface->get_value       = detail_view_model_get_value;
+  iface->iter_next       = detail_view_model_iter_next;
+  iface->iter_children   = detail_view_model_iter_children;
+  iface->iter_has_child  = detail_view_model_iter_has_child;
+  iface->iter_n_children = detail_view_model_iter_n_children;
+  iface->iter_nth_child  = detail_view_model_iter_nth_child;
+  iface->iter_parent     = detail_view_model_iter_parent;
+}
+
+
+/***************************************************************************
+ *                        GtkTreeSortable interface                        *
+ ***************************************************************************/
+
+static gboolean detail_view_model_get_sort_column_id(GtkTreeSortable *sortable, gint *sortColumnId, GtkSortType *order)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(sortable);
+
+  if (sortColumnId)
+    *sortColumnId = model->sortColumnId;
+
+  if (order)
+    *order = model->sortOrder;
+
+  return (model->sortColumnId != GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID &&
+          model->sortColumnId != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID);
+}
+
+
+static void detail_view_model_set_sort_column_id(GtkTreeSortable *sortable, gint sortColumnId, GtkSortType order)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(sortable);
+
+  if (model->sortColumnId == sortColumnId && model->sortOrder == order)
+    return;
+
+  model->sortColumnId = sortColumnId;
+  model->sortOrder = order;
+
+  gtk_tree_sortable_sort_column_changed(sortable);
+  sortRows(model);
+}
+
+
+static void setSortFunc(DetailViewSortFunc *sortFunc, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+  if (sortFunc->destroy)
+    sortFunc->destroy(sortFunc->data);
+
+  sortFunc->func = func;
+  sortFunc->data = data;
+  sortFunc->destroy = destroy;
+}
+
+
+static void detail_view_model_set_sort_func(GtkTreeSortable *sortable, gint sortColumnId, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(sortable);
+  g_return_if_fail(sortColumnId >= 0 && sortColumnId < model->numColumns);
+
+  setSortFunc(&model->sortFuncs[sortColumnId], func, data, destroy);
+
+  if (model->sortColumnId == sortColumnId)
+    sortRows(model);
+}
+
+
+static void detail_view_model_set_default_sort_func(GtkTreeSortable *sortable, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(sortable);
+  setSortFunc(&model->sortFuncs[model->numColumns], func, data, destroy);
+
+  if (model->sortColumnId == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID)
+    sortRows(model);
+}
+
+
+static gboolean detail_view_model_has_default_sort_func(GtkTreeSortable *sortable)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(sortable);
+  return model->sortFuncs[model->numColumns].func != NULL;
+}
+
+
+static void detail_view_model_tree_sortable_init(GtkTreeSortableIface *iface)
+{
+  iface->get_sort_column_id    = detail_view_model_get_sort_column_id;
+  iface->set_sort_column_id    = detail_view_model_set_sort_column_id;
+  iface->set_sort_func         = detail_view_model_set_sort_func;
+  iface->set_default_sort_func = detail_view_model_set_default_sort_func;
+  iface->has_default_sort_func = detail_view_model_has_default_sort_func;
+}
+
+
+/***************************************************************************
+ *                          GObject type system                            *
+ ***************************************************************************/
+
+GType detail_view_model_get_type(void)
+{
+  static GType detail_view_model_type = 0;
+
+  if (detail_view_model_type == 0)
+    {
+      static const GTypeInfo detail_view_model_info =
+      {
+        sizeof (DetailViewModelClass),
+        NULL,                                                     /* base_init */
+        NULL,                                                     /* base_finalize */
+        (GClassInitFunc) detail_view_model_class_init,
+        NULL,                                                     /* class_finalize */
+        NULL,                                                     /* class_data */
+        sizeof (DetailViewModel),
+        0,                                                        /* n_preallocs */
+        (GInstanceInitFunc) detail_view_model_init,
+      };
+
+      static const GInterfaceInfo tree_model_info =
+      {
+        (GInterfaceInitFunc) detail_view_model_tree_model_init,
+        NULL,                                                     /* interface_finalize */
+        NULL                                                      /* interface_data */
+      };
+
+      static const GInterfaceInfo tree_sortable_info =
+      {
+        (GInterfaceInitFunc) detail_view_model_tree_sortable_init,
+        NULL,                                                     /* interface_finalize */
+        NULL                                                      /* interface_data */
+      };
+
+      detail_view_model_type = g_type_register_static(G_TYPE_OBJECT, "DetailViewModel", &detail_view_model_info, (GTypeFlags)0);
+
+      g_type_add_interface_static(detail_view_model_type, GTK_TYPE_TREE_MODEL, &tree_model_info);
+      g_type_add_interface_static(detail_view_model_type, GTK_TYPE_TREE_SORTABLE, &tree_sortable_info);
+    }
+
+  return detail_view_model_type;
+}
+
+
+static void detail_view_model_init(DetailViewModel *model)
+{
+  model->stamp = g_random_int();
+
+  model->numColumns = 0;
+  model->columnTypes = NULL;
+  model->columnIds = NULL;
+
+  model->rows = g_ptr_array_new();
+  model->newRows = g_ptr_array_new();
+  model->index = g_ptr_array_new();
+  model->maxRowLen = 0;
+  model->indexVersion = UNSET_INT;
+  model->filterGeneration = 0;
+
+  model->visibleRows = NULL;
+  model->numVisibleRows = 0;
+  model->gapStart = 0;
+  model->gapLen = 0;
+
+  model->visibleFunc = NULL;
+  model->visibleData = NULL;
+
+  model->sortColumnId = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+  model->sortOrder = GTK_SORT_ASCENDING;
+  model->sortFuncs = NULL;
+  model->sortKeyFunc = NULL;
+  model->sortKeyData = NULL;
+  model->sortKeys = NULL;
+  model->numSortKeys = 0;
+  model->sortKeysVersion = UNSET_INT;
+}
+
+
+static void detail_view_model_class_init(DetailViewModelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+  parent_class           = g_type_class_peek_parent(klass);
+  object_class->finalize = detail_view_model_finalize;
+}
+
+
+static void destroyRows(GPtrArray *rows)
+{
+  for (int i = 0; i < (int)rows->len; ++i)
+    {
+      DetailViewRow *row = (DetailViewRow*)g_ptr_array_index(rows, i);
+
+      if (row->ownsList)
+        g_list_free(row->mspList);
+
+      g_slice_free(DetailViewRow, row);
+    }
+
+  g_ptr_array_free(rows, TRUE);
+}
+
+
+static void detail_view_model_finalize(GObject *object)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(object);
+
+  /* The index and visible rows just point to rows in the main lists */
+  destroyRows(model->rows);
+  destroyRows(model->newRows);
+  g_ptr_array_free(model->index, TRUE);
+  g_free(model->visibleRows);
+  g_free(model->sortKeys);
+
+  if (model->sortFuncs)
+    {
+      for (int i = 0; i <= model->numColumns; ++i)
+        setSortFunc(&model->sortFuncs[i], NULL, NULL, NULL);
+
+      g_free(model->sortFuncs);
+    }
+
+  g_free(model->columnTypes);
+  g_free(model->columnIds);
+
+  (* G_OBJECT_CLASS (parent_class)->finalize) (object);
+}
+
+
+/***************************************************************************
+ *                              Public API                                 *
+ ***************************************************************************/
+
+/* Create a new model with the given columns (a list of BlxColumnInfo) */
+DetailViewModel* detail_view_model_new(GList *columnList)
+{
+  DetailViewModel *model = DETAIL_VIEW_MODEL(g_object_new(DETAIL_VIEW_MODEL_TYPE, NULL));
+
+  model->numColumns = g_list_length(columnList);
+  model->columnTypes = g_new(GType, model->numColumns);
+  model->columnIds = g_new(BlxColumnId, model->numColumns);
+
+  /* One sort function per column, plus the default sort function at the end */
+  model->sortFuncs = g_new0(DetailViewSortFunc, model->numColumns + 1);
+
+  GList *item = columnList;
+
+  for (int i = 0; item; item = item->next, ++i)
+    {
+      BlxColumnInfo *columnInfo = (BlxColumnInfo*)(item->data);
+      model->columnTypes[i] = columnInfo->type;
+      model->columnIds[i] = columnInfo->columnId;
+    }
+
+  return model;
+}
+
+
+/* Set the function that determines whether a row should be visible. This should
+ * only return true for rows whose MSPs overlap the display range. */
+void detailViewModelSetVisibleFunc(DetailViewModel *model, GtkTreeModelFilterVisibleFunc func, gpointer data)
+{
+  g_return_if_fail(IS_DETAIL_VIEW_MODEL(model));
+
+  model->visibleFunc = func;
+  model->visibleData = data;
+}
+
+
+/* Set a function that calculates packed sort keys for the rows. If set, this is
+ * used to sort the rows instead of the column sort functions (which are still
+ * required to say whether the model is sorted). */
+void detailViewModelSetSortKeyFunc(DetailViewModel *model, DetailViewSortKeyFunc func, gpointer data)
+{
+  g_return_if_fail(IS_DETAIL_VIEW_MODEL(model));
+
+  model->sortKeyFunc = func;
+  model->sortKeyData = data;
+
+  modelClearSortKeys(model);
+}
+
+
+/* Add a row containing the given MSP(s) to the model. If ownsList is true the
+ * model takes ownership of the list. The row is not shown until the next refilter;
+ * if the model is sorted, it will be merged into its sorted position then. */
+void detailViewModelAddRow(DetailViewModel *model,
+                           GList *mspList,
+                           const gboolean ownsList,
+                           const gdouble score,
+                           const gdouble id,
+                           const int start,
+                           const int end)
+{
+  g_return_if_fail(IS_DETAIL_VIEW_MODEL(model));
+
+  DetailViewRow *row = g_slice_new0(DetailViewRow);
+
+  row->mspList = mspList;
+  row->ownsList = ownsList;
+  row->score = score;
+  row->id = id;
+  row->start = start;
+  row->end = end;
+  row->sortIdx = UNSET_INT;
+  row->keyIdx = UNSET_INT;
+
+  g_ptr_array_add(model->newRows, row);
+}
+
+
+/* Update which rows are visible. Only rows whose extent overlaps the given display
+ * range are checked (along with any rows that are currently visible), so the cost
+ * of this depends on the number of rows near the display range rather than on the
+ * total number of rows. The tree view is told about any rows that have been hidden
+ * or shown. */
+void detailViewModelRefilter(DetailViewModel *model, const IntRange* const displayRange)
+{
+  g_return_if_fail(IS_DETAIL_VIEW_MODEL(model));
+
+  flushNewRows(model);
+
+  if (model->indexVersion != getMspDisplayRangesVersion())
+    rebuildIndex(model);
+
+  const int generation = ++model->filterGeneration;
+  GPtrArray *shownRows = g_ptr_array_new();
+
+  if (displayRange && displayRange->isSet() && model->visibleFunc)
+    {
+      /* Find the first row that could overlap the display range: no row
+       * starts earlier than the max row length before the range start. */
+      DetailViewRow **index = (DetailViewRow**)(model->index->pdata);
+      DetailViewRow **indexEnd = index + model->index->len;
+      DetailViewRow **item = lower_bound(index, indexEnd, displayRange->min() - model->maxRowLen, rowExtentLessThanValue);
+
+      for ( ; item < indexEnd && (*item)->extentMin <= displayRange->max(); ++item)
+        {
+          DetailViewRow *row = *item;
+
+          if (row->extentMax < displayRange->min())
+            continue;
+
+          GtkTreeIter iter;
+          setIter(model, &iter, row, UNSET_INT);
+
+          row->filterGeneration = generation;
+          row->passed = model->visibleFunc(GTK_TREE_MODEL(model), &iter, model->visibleData);
+
+          if (row->passed && !row->visible)
+            g_ptr_array_add(shownRows, row);
+        }
+    }
+
+  /* Remove rows that are no longer visible. Any rows that were not checked
+   * above are outside the display range. Work backwards so that the paths of
+   * the rows still to be checked do not change. */
+  for (int i = model->numVisibleRows - 1; i >= 0; --i)
+    {
+      DetailViewRow *row = visibleRowAt(model, i);
+
+      if (row->filterGeneration != generation || !row->passed)
+        {
+          visibleRowsRemove(model, i);
+          row->visible = FALSE;
+          ++model->stamp;
+
+          GtkTreePath *path = gtk_tree_path_new_from_indices(i, -1);
+          gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+          gtk_tree_path_free(path);
+        }
+    }
+
+  /* Insert the newly-visible rows in sort order */
+  DetailViewRow **rows = (DetailViewRow**)(shownRows->pdata);
+  const int numShown = shownRows->len;
+  stable_sort(rows, rows + numShown, rowSortIdxLessThan);
+
+  int pos = 0;
+
+  for (int i = 0; i < numShown; ++i)
+    {
+      DetailViewRow *row = rows[i];
+
+      while (pos < model->numVisibleRows && visibleRowAt(model, pos)->sortIdx < row->sortIdx)
+        ++pos;
+
+      visibleRowsInsert(model, pos, row);
+      row->visible = TRUE;
+      ++model->stamp;
+
+      GtkTreeIter iter;
+      setIter(model, &iter, row, pos);
+
+      GtkTreePath *path = gtk_tree_path_new_from_indices(pos, -1);
+      gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+      gtk_tree_path_free(path);
+
+      ++pos;
+    }
+
+  g_ptr_array_free(shownRows, TRUE);
+}
+
+
+/* Call the given function on every row in the model, including rows that are not
+ * currently visible. Note that the path passed to the function is always NULL. The
+ * function should return TRUE to stop iterating. */
+void detailViewModelForeachRow(DetailViewModel *model, GtkTreeModelForeachFunc func, gpointer data)
+{
+  g_return_if_fail(IS_DETAIL_VIEW_MODEL(model));
+
+  flushNewRows(model);
+
+  for (int i = 0; i < (int)model->rows->len; ++i)
+    {
+      GtkTreeIter iter;
+      setIter(model, &iter, (DetailViewRow*)g_ptr_array_index(model->rows, i), UNSET_INT);
+
+      if (func(GTK_TREE_MODEL(model), NULL, &iter, data))
+        break;
+    }
+}
+
+
+/* Return the total number of rows in the model (visible or not) */
+int detailViewModelGetNumRows(DetailViewModel *model)
+{
+  g_return_val_if_fail(IS_DETAIL_VIEW_MODEL(model), 0);
+  return model->rows->len + model->newRows->len;
+}
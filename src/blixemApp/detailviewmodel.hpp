@@ -0,0 +1,126 @@
+/*  File: detailviewmodel.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ * Description: A custom GtkTreeModel for the detail-view trees.
+ *
+ *              The model holds one small row structure per row (i.e. per
+ *              MSP, or per sequence when matches are squashed) rather than
+ *              a full set of column values, and the column values are
+ *              computed on demand from the MSPs. Rows are indexed by their
+ *              extent in display coords so that refiltering only needs to
+ *              look at rows near the display range. Only the rows that
+ *              overlap the display range are exposed to the tree view, and
+ *              row paths are computed on demand from their position in
+ *              the list of visible rows.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _detail_view_model_included_
+#define _detail_view_model_included_
+
+#include <gtk/gtk.h>
+#include <seqtoolsUtils/blxmsp.hpp>
+
+
+/* Some boilerplate GObject type check and type cast macros. */
+#define DETAIL_VIEW_MODEL_TYPE             (detail_view_model_get_type())
+#define DETAIL_VIEW_MODEL(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),  DETAIL_VIEW_MODEL_TYPE, DetailViewModel))
+#define DETAIL_VIEW_MODEL_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass),  DETAIL_VIEW_MODEL_TYPE, DetailViewModelClass))
+#define IS_DETAIL_VIEW_MODEL(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), DETAIL_VIEW_MODEL_TYPE))
+#define IS_DETAIL_VIEW_MODEL_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE ((klass),  DETAIL_VIEW_MODEL_TYPE))
+#define DETAIL_VIEW_MODEL_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS ((obj),  DETAIL_VIEW_MODEL_TYPE, DetailViewModelClass))
+
+
+typedef struct _DetailViewRow DetailViewRow;
+typedef struct _DetailViewSortFunc DetailViewSortFunc;
+
+/* A function that calculates packed sort keys for the given rows (each given as a
+ * list of MSPs). It should return an array of numRows * numKeys values (which the
+ * model frees with g_free) and set the number of keys per row in numKeys. Rows are
+ * sorted by comparing each of their keys in turn. It should also set keysVersion to
+ * a value that only changes when keys from earlier calls can no longer be compared
+ * with the new ones (e.g. if the sort settings have changed), so that the model can
+ * keep the keys of existing rows and calculate keys just for new rows. */
+typedef gdouble* (*DetailViewSortKeyFunc)(GList **mspLists, const int numRows, int *numKeys, int *keysVersion, gpointer data);
+
+
+/* DetailViewModel: our custom tree model */
+typedef struct _DetailViewModel
+{
+  GObject parent;
+
+  gint stamp;                         /* random stamp used to validate iters; changed whenever the visible rows change */
+
+  int numColumns;                     /* number of columns in the model */
+  GType *columnTypes;                 /* type of data in each column, indexed by column index */
+  BlxColumnId *columnIds;             /* the column id for each column, indexed by column index */
+
+  GPtrArray *rows;                    /* all of the rows, in the current sort order */
+  GPtrArray *newRows;                 /* rows that have been added but not merged into the sorted row list and index yet */
+  GPtrArray *index;                   /* all of the rows, sorted by the start of their extent in display coords */
+  int maxRowLen;                      /* the max extent of any row in the index, in display coords */
+  int indexVersion;                   /* the version of the msp display ranges that the index was built from */
+  int filterGeneration;               /* incremented on each refilter so we can tell which rows were checked */
+
+  DetailViewRow **visibleRows;        /* the visible rows, in sort order, stored as a gap buffer */
+  int numVisibleRows;                 /* the number of visible rows */
+  int gapStart;                       /* the index in the buffer of the start of the gap */
+  int gapLen;                         /* the length of the gap */
+
+  GtkTreeModelFilterVisibleFunc visibleFunc; /* function that says whether a row should be visible */
+  gpointer visibleData;               /* user data for the visible function */
+
+  gint sortColumnId;                  /* the current sort column */
+  GtkSortType sortOrder;              /* the current sort order */
+  DetailViewSortFunc *sortFuncs;      /* the sort function for each column */
+  DetailViewSortKeyFunc sortKeyFunc;  /* if set, this is used to sort the rows instead of the sort functions */
+  gpointer sortKeyData;               /* user data for the sort key function */
+  gdouble *sortKeys;                  /* cached sort keys for all of the sorted rows, indexed by the rows' key index (NULL if not known) */
+  int numSortKeys;                    /* the number of sort keys per row */
+  int sortKeysVersion;                /* the keys version returned by the sort key function when the cached keys were calculated */
+} DetailViewModel;
+
+
+typedef struct _DetailViewModelClass
+{
+  GObjectClass parent_class;
+} DetailViewModelClass;
+
+
+GType                detail_view_model_get_type(void);
+DetailViewModel*     detail_view_model_new(GList *columnList);
+
+void                 detailViewModelSetVisibleFunc(DetailViewModel *model, GtkTreeModelFilterVisibleFunc func, gpointer data);
+void                 detailViewModelSetSortKeyFunc(DetailViewModel *model, DetailViewSortKeyFunc func, gpointer data);
+void                 detailViewModelAddRow(DetailViewModel *model, GList *mspList, const gboolean ownsList, const gdouble score, const gdouble id, const int start, const int end);
+void                 detailViewModelRefilter(DetailViewModel *model, const IntRange* const displayRange);
+void                 detailViewModelForeachRow(DetailViewModel *model, GtkTreeModelForeachFunc func, gpointer data);
+int                  detailViewModelGetNumRows(DetailViewModel *model);
+
+#endif /* _detail_view_model_included_ */
@@ -38,6 +38,7 @@
 #include <blixemApp/detailview.hpp>
 #include <blixemApp/bigpicturegrid.hpp>
 #include <blixemApp/sequencecellrenderer.hpp>
+#include <blixemApp/detailviewmodel.hpp>
 #include <blixemApp/blxwindow.hpp>
 #include <seqtoolsUtils/utilities.hpp>
 #include <seqtoolsUtils/blxmsp.hpp>
@@ -59,6 +60,7 @@ static gboolean g_mouse_drag_mode = FALSE;
 static GtkWidget*	treeGetDetailView(GtkWidget *tree);
 static gboolean		onSelectionChangedTree(GObject *selection, gpointer data);
 static gint		sortColumnCompareFunc(GtkTreeModel *model, GtkTreeIter *iter1, GtkTreeIter *iter2, gpointer data);
+static gdouble*		treeCalcSortKeys(GList **mspLists, const int numRows, int *numKeys, gpointer data);
 static int		calculateColumnWidth(TreeColumnHeaderInfo *headerInfo, GtkWidget *tree);
 static gboolean		isTreeRowVisible(GtkTreeModel *model, GtkTreeIter *iter, gpointer data);
 static gboolean		onExposeRefSeqHeader(GtkWidget *headerWidget, GdkEventExpose *event, gpointer data);
@@ -66,6 +68,9 @@ static GList*		treeGetSequenceRows(GtkWidget *tree, const BlxSequence *clickedSe
 static BlxSequence*	treeGetSequence(GtkTreeModel *model, GtkTreeIter *iter);
 static void             destroyTreePathList(GList **list);
 static int              treeHeaderGetCoordAtPos(GtkWidget *header, GtkWidget *tree, const int x, const int y);
+static DetailViewModel* treeCreateDataModel(GtkWidget *tree);
+static void             addMspToModel(MSP *msp, DetailViewModel *model);
+static void             sortTreeModel(GtkWidget *tree, GtkTreeModel *model);
 
 /***********************************************************
  *                Tree - utility functions                 *
@@ -235,35 +240,209 @@ void callFuncOnAllDetailViewTrees(GtkWidget *detailView, GtkCallback func, gpoin
 }
 
 
-/* Add the msps in the given BlxSequence to a single row in the given tree store */
-static void addSequenceMspsToSingleRow(BlxSequence *blxSeq, GtkWidget *tree, GtkListStore *store)
+/* Hash function for finding identical alignments. Alignments are identical if they
+ * are on the same ref seq strand and have the same start position, length, score,
+ * ID, gaps and match sequence (see mspIdenticalEqual). */
+static guint mspIdenticalHash(gconstpointer key)
 {
-  /* Only add msps that are in the correct strand for this tree (since the same
-   * sequence may have matches against both ref seq strands) */
-  GList *mspsToAdd = NULL;
-  GList *mspItem = blxSeq->mspList;
-  const BlxStrand treeStrand = treeGetStrand(tree);
+  const MSP* const msp = (const MSP*)key;
+  guint hash = mspGetRefStrand(msp);
 
-  for ( ; mspItem; mspItem = mspItem->next)
+  const char *sequence = mspGetMatchSeq(msp);
+
+  /* Alignments with no sequence are all treated as identical to each other */
+  if (!sequence)
+    return hash;
+
+  hash = hash * 31 + msp->qRange.min();
+  hash = hash * 31 + msp->sRange.length();
+  hash = hash * 31 + g_double_hash(&msp->score);
+  hash = hash * 31 + g_double_hash(&msp->id);
+
+  for (GSList *gapItem = msp->gaps; gapItem; gapItem = gapItem->next)
     {
-      MSP *msp  = (MSP*)(mspItem->data);
-      if (typeShownInDetailView(msp->type) && msp->qStrand == treeStrand && msp->qFrame == treeGetFrame(tree))
+      const CoordRange* const range = (const CoordRange*)(gapItem->data);
+      hash = hash * 31 + range->qStart;
+      hash = hash * 31 + range->qEnd;
+      hash = hash * 31 + range->sStart;
+      hash = hash * 31 + range->sEnd;
+    }
+
+  const char *cp = sequence + msp->sRange.min() - 1;
+  const char *seqEnd = cp + msp->sRange.length();
+
+  for ( ; cp < seqEnd && *cp; ++cp)
+    hash = hash * 31 + *cp;
+
+  return hash;
+}
+
+
+/* Returns true if the gapped alignment blocks of the two MSPs are the same */
+static gboolean mspGapsEqual(const MSP* const msp1, const MSP* const msp2)
+{
+  GSList *item1 = msp1->gaps;
+  GSList *item2 = msp2->gaps;
+
+  for ( ; item1 && item2; item1 = item1->next, item2 = item2->next)
+    {
+      const CoordRange* const range1 = (const CoordRange*)(item1->data);
+      const CoordRange* const range2 = (const CoordRange*)(item2->data);
+
+      if (range1->qStart != range2->qStart || range1->qEnd != range2->qEnd ||
+          range1->sStart != range2->sStart || range1->sEnd != range2->sEnd)
         {
-          mspsToAdd = g_list_append(mspsToAdd, msp);
+          return FALSE;
         }
     }
 
-  /* Now add a row to the tree store, if there is anything to add */
-  if (g_list_length(mspsToAdd) > 0)
+  return (item1 == NULL && item2 == NULL);
+}
+
+
+/* Equality function for finding identical alignments (see mspIdenticalHash) */
+static gboolean mspIdenticalEqual(gconstpointer a, gconstpointer b)
+{
+  const MSP* const msp1 = (const MSP*)a;
+  const MSP* const msp2 = (const MSP*)b;
+
+  if (mspGetRefStrand(msp1) != mspGetRefStrand(msp2))
+    return FALSE;
+
+  const char *sequence1 = mspGetMatchSeq(msp1);
+  const char *sequence2 = mspGetMatchSeq(msp2);
+
+  if (!sequence1 || !sequence2)
+    return (sequence1 == sequence2);
+
+  return (msp1->qRange.min() == msp2->qRange.min() &&
+          msp1->sRange.length() == msp2->sRange.length() &&
+          msp1->score == msp2->score &&
+          msp1->id == msp2->id &&
+          mspGapsEqual(msp1, msp2) &&
+          strncmp(sequence1 + msp1->sRange.min() - 1, sequence2 + msp2->sRange.min() - 1, msp1->sRange.length()) == 0);
+}
+
+
+/* For matches that should be squashed if identical, group together the ones that are
+ * identical to each other. Returns an array of groups, each of which is a GList of MSPs;
+ * the caller should free the lists and the array. Identical alignments are found by
+ * hashing, so this is linear in the number of matches. */
+static GPtrArray* findIdenticalMatchGroups(BlxContext *bc)
+{
+  GArray *matchArray = bc->featureLists[BLXMSP_MATCH];
+  GPtrArray *groups = g_ptr_array_new();
+
+  /* Maps the first MSP in each group to the index of the group (plus one, so that
+   * we can distinguish it from not-found) */
+  GHashTable *groupIdxs = g_hash_table_new(mspIdenticalHash, mspIdenticalEqual);
+
+  for (int i = 0; i < (int)matchArray->len; ++i)
     {
-      GtkWidget *detailView = treeGetDetailView(tree);
-      GList *columnList = detailViewGetColumnList(detailView);
+      MSP *msp = g_array_index(matchArray, MSP*, i);
+
+      if (!msp || !mspGetFlag(msp, MSPFLAG_SQUASH_IDENTICAL_FEATURES))
+        continue;
+
+      const int groupIdx = GPOINTER_TO_INT(g_hash_table_lookup(groupIdxs, msp)) - 1;
+
+      if (groupIdx >= 0)
+        {
+          GList *group = (GList*)g_ptr_array_index(groups, groupIdx);
+          g_ptr_array_index(groups, groupIdx) = g_list_prepend(group, msp);
+        }
+      else
+        {
+          g_ptr_array_add(groups, g_list_prepend(NULL, msp));
+          g_hash_table_insert(groupIdxs, msp, GINT_TO_POINTER(groups->len));
+        }
+    }
+
+  g_hash_table_destroy(groupIdxs);
+
+  return groups;
+}
+
+
+/* Holds the trees in the detail view, indexed by strand and frame, and the new
+ * squashed data model for each of them, while we create the squashed models */
+class SquashedModels
+{
+public:
+  SquashedModels(GtkWidget *detailView_in) : detailView(detailView_in)
+  {
+    numFrames = detailViewGetNumFrames(detailView);
+    trees = g_new0(GtkWidget*, numFrames * 2);
+    models = g_new0(DetailViewModel*, numFrames * 2);
+    rowMsps = g_new0(GList*, numFrames * 2);
+
+    for (int frame = 1; frame <= numFrames; ++frame)
+      {
+        trees[treeIdx(BLXSTRAND_FORWARD, frame)] = detailViewGetTree(detailView, BLXSTRAND_FORWARD, frame);
+        trees[treeIdx(BLXSTRAND_REVERSE, frame)] = detailViewGetTree(detailView, BLXSTRAND_REVERSE, frame);
+      }
+
+    for (int i = 0; i < numFrames * 2; ++i)
+      {
+        if (trees[i])
+          models[i] = treeCreateDataModel(trees[i]);
+      }
+  }
+
+  ~SquashedModels()
+  {
+    g_free(trees);
+    g_free(models);
+    g_free(rowMsps);
+  }
+
+  /* Get the index into our arrays for the given strand and frame, or -1 if there
+   * is no such tree */
+  int treeIdx(const BlxStrand strand, const int frame) const
+  {
+    if (frame < 1 || frame > numFrames || (strand != BLXSTRAND_FORWARD && strand != BLXSTRAND_REVERSE))
+      return -1;
+
+    return (strand == BLXSTRAND_FORWARD ? 0 : numFrames) + frame - 1;
+  }
+
+  GtkWidget *detailView;
+  int numFrames;
+  GtkWidget **trees;       /* the trees, indexed by treeIdx */
+  DetailViewModel **models; /* the new squashed model for each tree */
+  GList **rowMsps;         /* temporary storage for the msps in the current sequence that go in each tree */
+};
 
-      GtkTreeIter iter;
-      gtk_list_store_append(store, &iter);
+
+/* Add the msps in the given BlxSequence to a single row in each tree that they
+ * belong in */
+static void addSequenceMspsToSingleRow(BlxSequence *blxSeq, SquashedModels *squashed)
+{
+  const int numTrees = squashed->numFrames * 2;
+
+  /* Only add msps that are in the correct strand and frame for each tree (since the
+   * same sequence may have matches against both ref seq strands) */
+  for (GList *mspItem = blxSeq->mspList; mspItem; mspItem = mspItem->next)
+    {
+      MSP *msp  = (MSP*)(mspItem->data);
+      const int idx = squashed->treeIdx(msp->qStrand, msp->qFrame);
+
+      if (typeShownInDetailView(msp->type) && idx >= 0 && squashed->models[idx])
+        squashed->rowMsps[idx] = g_list_prepend(squashed->rowMsps[idx], msp);
+    }
+
+  /* Now add a row to each model, if there is anything to add */
+  for (int idx = 0; idx < numTrees; ++idx)
+    {
+      GList *mspsToAdd = g_list_reverse(squashed->rowMsps[idx]);
+      squashed->rowMsps[idx] = NULL;
+
+      if (!mspsToAdd)
+        continue;
 
       /* If there is only one msp, then we can add specific info about that MSP */
-      MSP *msp = (g_list_length(mspsToAdd) == 1 ? (MSP*)mspsToAdd->data : NULL);
+      MSP *msp = (mspsToAdd->next == NULL ? (MSP*)mspsToAdd->data : NULL);
+      const BlxStrand treeStrand = treeGetStrand(squashed->trees[idx]);
 
       /* Add the hard-coded column data */
       const double score = msp ? msp->score : 0.0;
@@ -271,70 +450,29 @@ static void addSequenceMspsToSingleRow(BlxSequence *blxSeq, GtkWidget *tree, Gtk
       const int start = msp ? msp->sRange.min() : blxSequenceGetStart(blxSeq, treeStrand);
       const int end = msp ? msp->sRange.max() : blxSequenceGetEnd(blxSeq, treeStrand);
 
-      /* Loop through the rest of the columns */
-      GList *item = columnList;
-
-      for ( ; item; item = item->next)
-        {
-          BlxColumnInfo *columnInfo = (BlxColumnInfo*)(item->data);
-
-          if (columnInfo->columnId == BLXCOL_SCORE)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, score, -1);
-          else if (columnInfo->columnId == BLXCOL_ID)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, id, -1);
-          else if (columnInfo->columnId == BLXCOL_START)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, start, -1);
-          else if (columnInfo->columnId == BLXCOL_SEQUENCE)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, mspsToAdd, -1);
-          else if (columnInfo->columnId == BLXCOL_END)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, end, -1);
-          else
-            {
-              GValue *val = blxSequenceGetValue(blxSeq, columnInfo->columnId);
-              if (val) gtk_list_store_set_value(store, &iter, columnInfo->columnIdx, val);
-            }
-        }
-
-      /* Remember which row these msps are in */
-      GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), &iter);
-      GList *mspItem = mspsToAdd;
-
-      for ( ; mspItem; mspItem = mspItem->next)
-        {
-          MSP *curMsp = (MSP*)(mspItem->data);
-          curMsp->treePaths[BLXMODEL_SQUASHED] = gtk_tree_path_to_string(path);
-        }
-
-      gtk_tree_path_free(path);
+      /* The model takes ownership of the list */
+      detailViewModelAddRow(squashed->models[idx], mspsToAdd, TRUE, score, id, start, end);
     }
 }
 
 
-/* Add the msps in the given BlxSequence to the given tree store with a separate
+/* Add the msps in the given BlxSequence to the trees they belong in, with a separate
  * row for each msp */
-static void addSequenceMspsToSeparateRows(BlxSequence *blxSeq, GtkWidget *tree, GtkListStore *store)
+static void addSequenceMspsToSeparateRows(BlxSequence *blxSeq, SquashedModels *squashed)
 {
-  const BlxStrand treeStrand = treeGetStrand(tree);
-  GList *mspItem = blxSeq->mspList;
-
-  for ( ; mspItem; mspItem = mspItem->next)
+  for (GList *mspItem = blxSeq->mspList; mspItem; mspItem = mspItem->next)
     {
       MSP *msp  = (MSP*)(mspItem->data);
+      const int idx = squashed->treeIdx(msp->qStrand, msp->qFrame);
 
-      /* Only add msps that are in the correct strand for this tree (since the same
-       * sequence may have matches against both ref seq strands) */
-      if (typeShownInDetailView(msp->type) &&
-          msp->qStrand == treeStrand &&
-          msp->qFrame == treeGetFrame(tree))
-        {
-          addMspToTree(msp, tree, store);
-        }
+      if (typeShownInDetailView(msp->type) && idx >= 0 && squashed->models[idx])
+        addMspToModel(msp, squashed->models[idx]);
     }
 }
 
 
-/* Add the given BlxSequence as a row in the given tree store */
-static void addSequenceToTree(BlxSequence *blxSeq, GtkWidget *tree, GtkListStore *store)
+/* Add the given BlxSequence to the squashed models */
+static void addSequenceToSquashedModels(BlxSequence *blxSeq, SquashedModels *squashed)
 {
   /* Only add matches and transcripts to the detail-view. Also,
    * we exclude sequences with squash-identical-features set because
@@ -348,215 +486,164 @@ static void addSequenceToTree(BlxSequence *blxSeq, GtkWidget *tree, GtkListStore
   /* If the squash-linked-features property is set, add all msps in this
    * sequence to the same row; otherwise, add them to separate rows*/
   if (blxSequenceGetFlag(blxSeq, MSPFLAG_SQUASH_LINKED_FEATURES))
-    addSequenceMspsToSingleRow(blxSeq, tree, store);
+    addSequenceMspsToSingleRow(blxSeq, squashed);
   else
-    addSequenceMspsToSeparateRows(blxSeq, tree, store);
+    addSequenceMspsToSeparateRows(blxSeq, squashed);
 }
 
 
-/* Comparison function for sorting/determining if two alignments are identical;
- * they are identical if the DNA sequence, start positions, source, score and ID
- * are all identical */
-static int sortByDnaCompareFunc(gconstpointer a, gconstpointer b)
+/* For matches that should be squashed if identical, add one row for each group of
+ * identical matches. Each group is shown in all of the trees for its strand. */
+static void addIdenticalMatchesToSquashedModels(BlxContext *bc, SquashedModels *squashed)
 {
-  double result = 0;
+  GPtrArray *groups = findIdenticalMatchGroups(bc);
 
-  const MSP* const msp1 = *((const MSP**)a);
-  const MSP* const msp2 = *((const MSP**)b);
+  for (int i = 0; i < (int)groups->len; ++i)
+    {
+      GList *group = (GList*)g_ptr_array_index(groups, i);
+      const MSP* const msp = (const MSP*)(group->data);
+      const BlxStrand strand = mspGetRefStrand(msp);
+      gboolean usedGroup = FALSE;
 
-  const char *sequence1 = mspGetMatchSeq(msp1);
-  const char *sequence2 = mspGetMatchSeq(msp2);
+      for (int frame = 1; frame <= squashed->numFrames; ++frame)
+        {
+          const int idx = squashed->treeIdx(strand, frame);
 
-  const gboolean msp1HasSeq = (sequence1 != NULL);
-  const gboolean msp2HasSeq = (sequence2 != NULL);
+          if (idx < 0 || !squashed->models[idx])
+            continue;
 
-  if (msp1HasSeq && msp2HasSeq)
-    {
-      result = msp1->qRange.min() - msp2->qRange.min();
+          /* The model takes ownership of the list, so each tree needs its own copy */
+          GList *mspsToAdd = usedGroup ? g_list_copy(group) : group;
+          usedGroup = TRUE;
 
-      if (result == 0) result = msp1->sRange.length() - msp2->sRange.length();
-      if (result == 0) result = msp1->score - msp2->score;
-      if (result == 0) result = msp1->id - msp2->id;
-      if (result == 0) result = strncmp(sequence1 + msp1->sRange.min() - 1, sequence2 + msp2->sRange.min() - 1, msp1->sRange.length());
-    }
-  else if (!msp1HasSeq && !msp2HasSeq)
-    {
-      result = 0;
-    }
-  else if (!msp1HasSeq)
-    {
-      result = -1;
-    }
-  else
-    {
-      result = 1;
+          detailViewModelAddRow(squashed->models[idx], mspsToAdd, TRUE,
+                                msp->score, msp->id, msp->sRange.min(), msp->sRange.max());
+        }
+
+      if (!usedGroup)
+        g_list_free(group);
     }
 
-  /* For fractional results, round up (or down if negative), so that we still
-   * recognise a fracional difference as a difference (e.g. a difference of
-   * -0.2 in the scores would mean a < b, so we return -1). */
-  if (result > 0)
-    return ceil(result);
-  else if (result < 0)
-    return floor(result);
-  else
-    return 0;
+  g_ptr_array_free(groups, TRUE);
 }
 
 
-/* For matches that should be squashed if identical, add them to the given tree,
- * placing duplicate sequences on the same row as each other to create a compact tree. */
-static void addFeaturesToCompactTree(GtkWidget *tree, GtkListStore *store, GtkWidget *blxWindow)
+/* Create a new (empty) data model for the given tree */
+static DetailViewModel* treeCreateDataModel(GtkWidget *tree)
 {
-  BlxContext *bc = blxWindowGetContext(blxWindow);
-  const BlxStrand treeStrand = treeGetStrand(tree);
+  GtkWidget *detailView = treeGetDetailView(tree);
+  GList *columnList = detailViewGetColumnList(detailView);
+  const int numCols = g_list_length(columnList);
 
-  /* Extract matches that should be squashed if identical into their own array. */
-  GArray *matchArray = bc->featureLists[BLXMSP_MATCH];
-  GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(MSP*), matchArray->len);
+  DetailViewModel *model = detail_view_model_new(columnList);
 
-  int i = 0;
-  for ( ; i < (int)matchArray->len; ++i)
+  /* Set the sort function for each column */
+  int colNum = 0;
+  for ( ; colNum < numCols; ++colNum)
     {
-      MSP *val = g_array_index(matchArray, MSP*, i);
-
-      if (mspGetFlag(val, MSPFLAG_SQUASH_IDENTICAL_FEATURES))
-        g_array_prepend_val(array, val);
+      gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(model), colNum, sortColumnCompareFunc, tree, NULL);
     }
 
-  /* Sort the array by DNA sequence so that duplicates are adjacent. */
-  g_array_sort(array, sortByDnaCompareFunc);
+  /* Sort using precalculated sort keys rather than comparing rows one pair at a time */
+  detailViewModelSetSortKeyFunc(model, treeCalcSortKeys, tree);
 
-  /* Loop through each MSP, compiling a list of MSPs to add to the
-   * current row. */
-  i = 0;
-  MSP *prevMsp = NULL;
-  MSP *msp = mspArrayIdx(array, i);
-  GList *mspsToAdd = NULL;
+  /* The model will only show rows that are in the display range */
+  detailViewModelSetVisibleFunc(model, isTreeRowVisible, tree);
 
-  for ( ; msp || prevMsp; msp = mspArrayIdx(array, ++i))
-    {
-      if (msp && mspGetRefStrand(msp) != treeStrand)
-        continue;
+  return model;
+}
 
-      if (msp && prevMsp && sortByDnaCompareFunc(&prevMsp, &msp) == 0)
-        {
-          /* Same as previous sequence; add to current row */
-          mspsToAdd = g_list_prepend(mspsToAdd, msp);
-        }
-      else
-        {
-          if (g_list_length(mspsToAdd) > 0)
-            {
-              /* Add the current msp list to the tree */
-              GtkTreeIter iter;
-              gtk_list_store_append(store, &iter);
 
-              /* Loop through the columns */
-              GList *item = blxWindowGetColumnList(blxWindow);
+/* Create the 'squashed' data model for every tree in the detail view from the full
+ * list of sequences. In this model, all of the MSPs from the same sequence go on the
+ * same row (if their squash-linked-features flag is set) and identical matches go on
+ * the same row (if their squash-identical-features flag is set). The models for all
+ * of the trees are created in a single pass over the sequences, and each is sorted
+ * now so that switching to it later is cheap. Any existing squashed models are
+ * replaced. */
+void createSquashedTreeModels(GtkWidget *detailView)
+{
+  DetailViewProperties *dvProperties = detailViewGetProperties(detailView);
+  BlxContext *bc = blxWindowGetContext(detailViewGetBlxWindow(detailView));
 
-              for ( ; item; item = item->next)
-                {
-                  BlxColumnInfo *columnInfo = (BlxColumnInfo*)(item->data);
-
-                  if (columnInfo->columnId == BLXCOL_SCORE)
-                    gtk_list_store_set(store, &iter, columnInfo->columnIdx, prevMsp->score, -1);
-                  else if (columnInfo->columnId == BLXCOL_ID)
-                    gtk_list_store_set(store, &iter, columnInfo->columnIdx, prevMsp->id, -1);
-                  else if (columnInfo->columnId == BLXCOL_START)
-                    gtk_list_store_set(store, &iter, columnInfo->columnIdx, prevMsp->sRange.min(), -1);
-                  else if (columnInfo->columnId == BLXCOL_SEQUENCE)
-                    gtk_list_store_set(store, &iter, columnInfo->columnIdx, mspsToAdd, -1);
-                  else if (columnInfo->columnId == BLXCOL_END)
-                    gtk_list_store_set(store, &iter, columnInfo->columnIdx, prevMsp->sRange.max(), -1);
-                  else
-                    {
-                      GValue *val = blxSequenceGetValue(prevMsp->sSequence, columnInfo->columnId);
-                      if (val) gtk_list_store_set_value(store, &iter, columnInfo->columnIdx, val);
-                    }
-                }
+  /* Cancel any pending request to do this in the background */
+  if (dvProperties->squashedModelsIdleId)
+    {
+      g_source_remove(dvProperties->squashedModelsIdleId);
+      dvProperties->squashedModelsIdleId = 0;
+    }
 
-              /* Remember which row these msps are in */
-              GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), &iter);
-              GList *mspItem = mspsToAdd;
+  SquashedModels squashed(detailView);
 
-              for ( ; mspItem; mspItem = mspItem->next)
-                {
-                  MSP *curMsp = (MSP*)(mspItem->data);
-                  curMsp->treePaths[BLXMODEL_SQUASHED] = gtk_tree_path_to_string(path);
-                }
+  for (GList *seqItem = bc->matchSeqs; seqItem; seqItem = seqItem->next)
+    addSequenceToSquashedModels((BlxSequence*)(seqItem->data), &squashed);
 
-              gtk_tree_path_free(path);
+  addIdenticalMatchesToSquashedModels(bc, &squashed);
 
-              /* Reset the list pointer ready for the next row. Note that
-               * we do not free the list because it is now owned by the tree */
-              mspsToAdd = NULL;
-            }
+  for (int i = 0; i < squashed.numFrames * 2; ++i)
+    {
+      GtkWidget *tree = squashed.trees[i];
+
+      if (!tree || !squashed.models[i])
+        continue;
 
-          /* Add the new msp */
-          if (msp)
-            mspsToAdd = g_list_prepend(mspsToAdd, msp);
+      /* Remember the model in the properties so we can switch between this and the
+       * 'unsquashed' tree model. The properties take over our reference to the model. */
+      TreeProperties *properties = treeGetProperties(tree);
+      GtkTreeModel *oldModel = properties->treeModels[BLXMODEL_SQUASHED];
+      GtkTreeModel *model = GTK_TREE_MODEL(squashed.models[i]);
+      properties->treeModels[BLXMODEL_SQUASHED] = model;
+      properties->modelNeedsSort[BLXMODEL_SQUASHED] = TRUE;
+
+      if (oldModel && gtk_tree_view_get_model(GTK_TREE_VIEW(tree)) == oldModel)
+        {
+          /* We're replacing the model from a previous load and the tree is currently
+           * showing it, so switch it to the new one (this also sorts and filters it). */
+          treeUpdateSquashMatches(tree, NULL);
+        }
+      else if (gtk_tree_view_get_model(GTK_TREE_VIEW(tree)) != model)
+        {
+          sortTreeModel(tree, model);
+          properties->modelNeedsSort[BLXMODEL_SQUASHED] = FALSE;
         }
 
-      prevMsp = msp;
+      if (oldModel)
+        g_object_unref(G_OBJECT(oldModel));
     }
-
-  /* Re-sort by default sort order (required for filtering) if this msp type
-   * appears in the detail-view */
-  if (typeShownInDetailView(BLXMSP_MATCH))
-    g_array_sort(bc->featureLists[BLXMSP_MATCH], compareFuncMspArray);
 }
 
 
-/* Add all of the BlxSequences that are in the given tree's strand to the tree */
-void addSequencesToTree(GtkWidget *tree, gpointer data)
+static gboolean onIdleCreateSquashedModels(gpointer data)
 {
-  GList *seqList = (GList*)data;
+  GtkWidget *detailView = GTK_WIDGET(data);
+  DetailViewProperties *dvProperties = detailViewGetProperties(detailView);
 
-  /* Create the data store for the tree. We must know how many columns
-   * we have, and their data types. */
-  GtkWidget *detailView = treeGetDetailView(tree);
-  GList *columnList = detailViewGetColumnList(detailView);
-  const int numCols = g_list_length(columnList);
-  GType *typeList = columnListGetTypes(columnList);
+  dvProperties->squashedModelsIdleId = 0;
+  createSquashedTreeModels(detailView);
 
-  GtkListStore *store = gtk_list_store_newv(numCols, typeList);
+  return FALSE;
+}
 
-  /* Set the sort function for each column */
-  int colNum = 0;
-  for ( ; colNum < numCols; ++colNum)
-    {
-      gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(store), colNum,	sortColumnCompareFunc, tree, NULL);
-    }
 
-  /* Add the rows - one row per sequence. Use the list we've already compiled of all
-   * sequences as BlxSequences */
-  GtkWidget *blxWindow = treeGetBlxWindow(tree);
-  GList *seqItem = seqList;
+/* Request that the squashed data models are (re)created. If the squashed models are in
+ * use then this is done immediately; otherwise it is done in the background when the
+ * application is idle, so that it does not hold up loading. If the user switches to the
+ * squashed models before then, they are created at that point. */
+void queueCreateSquashedTreeModels(GtkWidget *detailView)
+{
+  DetailViewProperties *dvProperties = detailViewGetProperties(detailView);
+  BlxContext *bc = blxWindowGetContext(detailViewGetBlxWindow(detailView));
 
-  for ( ; seqItem; seqItem = seqItem->next)
+  if (bc->modelId == BLXMODEL_SQUASHED)
     {
-      BlxSequence *blxSeq = (BlxSequence*)(seqItem->data);
-      addSequenceToTree(blxSeq, tree, store);
+      createSquashedTreeModels(detailView);
+    }
+  else if (!dvProperties->squashedModelsIdleId)
+    {
+      /* (The sequence list is read when the idle function runs, so if another request
+       * comes in before then it is covered by this one.) */
+      dvProperties->squashedModelsIdleId = g_idle_add_full(G_PRIORITY_LOW, onIdleCreateSquashedModels, detailView, NULL);
     }
-
-  /* Also add one row for each match that has duplcate DNA to the compact tree */
-  addFeaturesToCompactTree(tree, store, blxWindow);
-
-  /* Create a filtered version which will only show sequences that are in the display range */
-  GtkTreeModel *filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(store), NULL);
-  gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(filter), (GtkTreeModelFilterVisibleFunc)isTreeRowVisible, tree, NULL);
-
-  /* Lose the local reference to 'store' because the tree filter has a reference to it. */
-  g_object_unref(G_OBJECT(store));
-
-  /* Remember the base tree store in the properties so we can switch between this and the 'unsquashed' tree model */
-  TreeProperties *properties = treeGetProperties(tree);
-  properties->treeModels[BLXMODEL_SQUASHED] = GTK_TREE_MODEL(filter);
-
-  /* Note that we don't decrement the ref count to 'filter' even though we're losing
-   * the local pointer to it, because we've also added a pointer to it from the tree
-   * properties. */
 }
 
 
@@ -577,12 +664,10 @@ GList* treeGetMsps(GtkTreeModel *model, GtkTreeIter *iter)
 }
 
 
-/* For the given tree view, return the data model used for the visible view
- * (which may be a filtered tree model). */
+/* For the given tree view, return the data model used for the visible view. (This is
+ * the same as the base data model now that the model does its own filtering.) */
 static GtkTreeModel* treeGetVisibleDataModel(GtkTreeView *tree)
 {
-  /* Just return the model stored directly in the tree view. This will be the filter
-   * if there is one, otherwise it will be the original data model. */
   assertTree(GTK_WIDGET(tree));
   return gtk_tree_view_get_model(tree);
 }
@@ -598,29 +683,12 @@ static GtkStatusbar* treeGetStatusBar(GtkWidget *tree)
   //GTK_STATUSBAR(treeGetContext(tree)->statusBar);
 }
 
-/* For the given tree view, return the current base data model i.e. all data in the tree
- * without any filtering. Returns the same as treeGetVisibleDataModel if the tree does
- * not have a filter. */
+/* For the given tree view, return the current data model. The model contains all of
+ * the rows for the tree but only exposes the ones that are in the display range. */
 GtkTreeModel* treeGetBaseDataModel(GtkTreeView *tree)
 {
   assertTree(GTK_WIDGET(tree));
-
-  GtkTreeModel *result = NULL;
-
-  if (tree)
-    {
-      GtkTreeModel *model = gtk_tree_view_get_model(tree);
-      if (model && GTK_IS_TREE_MODEL_FILTER(model))
-        {
-          result = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(model));
-        }
-      else
-        {
-          result = model;
-        }
-    }
-
-  return result;
+  return tree ? gtk_tree_view_get_model(tree) : NULL;
 }
 
 
@@ -632,26 +700,37 @@ void treeUpdateFontSize(GtkWidget *tree, gpointer data)
 }
 
 
-/* This function updates the tree following a change in which tree model we're viewing */
+/* This function updates the tree following a change in which tree model we're viewing.
+ * The models are kept sorted in the background, so this usually only needs to refilter
+ * the rows near the display range. */
 void treeUpdateSquashMatches(GtkWidget *tree, gpointer data)
 {
   BlxContext *bc = treeGetContext(tree);
   TreeProperties *properties = treeGetProperties(tree);
 
+  /* If the squashed models have not been created yet (or are out of date), create them now */
+  if (bc->modelId == BLXMODEL_SQUASHED &&
+      (!properties->treeModels[BLXMODEL_SQUASHED] || detailViewGetProperties(treeGetDetailView(tree))->squashedModelsIdleId))
+    {
+      createSquashedTreeModels(treeGetDetailView(tree));
+    }
+
   /* Find the new model */
   GtkTreeModel *newModel = properties->treeModels[bc->modelId];
 
   if (newModel)
     gtk_tree_view_set_model(GTK_TREE_VIEW(tree), newModel);
 
-  /* Re-sort and re-filter, because the new one might not be up to date */
-  /* Note that we sort the base data model, not the filtered one (i.e. sort all rows,
-   * not just visible ones) */
+  /* Re-sort if the sort order has changed since this model was last shown. Note that
+   * we sort all rows, not just visible ones. Then re-filter because the display range
+   * may have changed. */
   newModel = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
 
   if (newModel)
     {
-      resortTree(tree, NULL);
+      if (properties->modelNeedsSort[bc->modelId])
+        resortTree(tree, NULL);
+
       refilterTree(tree, NULL);
     }
 }
@@ -813,35 +892,16 @@ void refilterTree(GtkWidget *tree, gpointer data)
 {
   assertTree(tree);
 
+  /* The model only checks the rows near the display range */
   GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(tree));
-  gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(model));
-}
-
-
-/* Update the cached path pointer for each msp in this tree row. Should be called
- * after the paths have changed, e.g. after a sort. */
-static gboolean updateMspPaths(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
-{
-  BlxModelId modelId = (BlxModelId)GPOINTER_TO_INT(data);
-  GList *mspItem = treeGetMsps(model, iter);
 
-  for ( ; mspItem; mspItem = mspItem->next)
-    {
-      MSP *msp = (MSP*)(mspItem->data);
-
-      /* clear any existing path string */
-      if (msp->treePaths[modelId])
-        g_free(msp->treePaths[modelId]);
-
-      msp->treePaths[modelId] = gtk_tree_path_to_string(path);
-    }
-
-  return FALSE;
+  if (model)
+    detailViewModelRefilter(DETAIL_VIEW_MODEL(model), treeGetDisplayRange(tree));
 }
 
 
-/* Re-sort the data for the given tree */
-void resortTree(GtkWidget *tree, gpointer data)
+/* Sort the given data model for the given tree by the detail view's current sort columns */
+static void sortTreeModel(GtkWidget *tree, GtkTreeModel *model)
 {
   GtkWidget *detailView = treeGetDetailView(tree);
   DetailViewProperties *dvProperties = detailViewGetProperties(detailView);
@@ -869,14 +929,26 @@ void resortTree(GtkWidget *tree, gpointer data)
 
   /* Not sure if there's a better way to do this, but we can force a re-sort by
    * setting the sort column to something else and then back again. */
-  GtkTreeModel *model = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
   gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model), GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, sortOrder);
   gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model), sortColumn, sortOrder);
+}
 
 
-  /* Update the cached path held by each MSP about the row it is in. */
-  BlxContext *bc = treeGetContext(tree);
-  gtk_tree_model_foreach(model, updateMspPaths, GINT_TO_POINTER(bc->modelId));
+/* Re-sort the data for the given tree. Only the model that the tree is currently
+ * showing is sorted; any other models are flagged so that they get sorted when they
+ * are next shown. */
+void resortTree(GtkWidget *tree, gpointer data)
+{
+  TreeProperties *properties = treeGetProperties(tree);
+  GtkTreeModel *model = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
+
+  if (!model)
+    return;
+
+  sortTreeModel(tree, model);
+
+  for (int i = 0; i < BLXMODEL_NUM_MODELS; ++i)
+    properties->modelNeedsSort[i] = (properties->treeModels[i] != model);
 }
 
 
@@ -1014,7 +1086,10 @@ static void treeCreateProperties(GtkWidget *widget,
 
       int i = 0;
       for ( ; i < BLXMODEL_NUM_MODELS; ++i)
-        properties->treeModels[i] = NULL;
+        {
+          properties->treeModels[i] = NULL;
+          properties->modelNeedsSort[i] = TRUE;
+        }
 
       g_object_set_data(G_OBJECT(widget), "TreeProperties", properties);
       g_signal_connect(G_OBJECT(widget), "destroy", G_CALLBACK(onDestroyTree), NULL);
@@ -1093,21 +1168,18 @@ static void drawRefSeqHeader(GtkWidget *headerWidget, GtkWidget *tree)
     }
 
   GError *error = NULL;
-
-  gchar *segmentToDisplay = getSequenceSegment(bc->refSeq,
-                                               &qRange,
-					       strand,
-					       BLXSEQ_DNA,      /* input ref seq is always in nucleotide coords */
-                                               bc->seqType,     /* required segment is in display coords */
-					       frame,
-					       bc->numFrames,
-					       &bc->refSeqRange,
-					       bc->blastMode,
-					       bc->geneticCode,
-					       bc->displayRev,
-					       bc->displayRev,	/* show backwards if display reversed */
-					       TRUE,		/* always complement reverse strand */
-					       &error);
+  int segmentLen = 0;
+
+  const char *segmentToDisplay = blxRefSeqCacheGetSegment(bc->refSeqCache,
+                                                          &qRange,
+                                                          strand,
+                                                          bc->seqType,     /* required segment is in display coords */
+                                                          bc->numFrames,
+                                                          bc->blastMode,
+                                                          bc->displayRev,  /* show backwards if display reversed */
+                                                          TRUE,            /* always complement reverse strand */
+                                                          &segmentLen,
+                                                          &error);
 
   if (!segmentToDisplay)
     {
@@ -1159,7 +1231,8 @@ static void drawRefSeqHeader(GtkWidget *headerWidget, GtkWidget *tree)
     {
       baseData.displayIdxSelected = detailViewIsDisplayIdxSelected(detailView, displayIdx + offset);
       baseData.dnaIdxSelected = baseData.displayIdxSelected;
-      baseData.baseChar = segmentToDisplay[displayIdx - properties->displayRange.min()];
+      const int segmentIdx = displayIdx - properties->displayRange.min();
+      baseData.baseChar = (segmentIdx < segmentLen) ? segmentToDisplay[segmentIdx] : '\0';
 
       const int x = (int)((gdouble)xStart + (gdouble)(displayIdx - properties->displayRange.min()) * properties->charWidth());
 
@@ -1172,11 +1245,12 @@ static void drawRefSeqHeader(GtkWidget *headerWidget, GtkWidget *tree)
     }
 
   /* Mark up the text to highlight the selected base, if there is one */
-  PangoLayout *layout = gtk_widget_create_pango_layout(detailView, segmentToDisplay);
+  PangoLayout *layout = gtk_widget_create_pango_layout(detailView, NULL);
   pango_layout_set_font_description(layout, detailViewGetFontDesc(detailView));
 
   if (layout)
     {
+      pango_layout_set_text(layout, segmentToDisplay, segmentLen);
       gtk_paint_layout(headerWidget->style, drawable, GTK_STATE_NORMAL, TRUE, NULL, detailView, NULL, xStart, yStart, layout);
       g_object_unref(layout);
     }
@@ -1184,7 +1258,6 @@ static void drawRefSeqHeader(GtkWidget *headerWidget, GtkWidget *tree)
   drawColumnSeparatorLine(headerWidget, drawable, gc, bc);
 
   g_hash_table_unref(basesToHighlight);
-  g_free(segmentToDisplay);
   g_object_unref(gc);
 }
 
@@ -1323,6 +1396,8 @@ static void treeHighlightSelectedBase(GtkWidget *tree, GdkDrawable *drawable)
  * */
 static gboolean onExposeDetailViewTree(GtkWidget *tree, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "detailViewTree");
+
   gboolean handled = FALSE;
   GdkDrawable *drawable = widgetGetDrawable(tree);
 
@@ -2011,68 +2086,39 @@ static gboolean onLeaveTreeHeader(GtkWidget *header, GdkEventCrossing *event, gp
 }
 
 
-/* Add a row to the given tree containing the given MSP */
-void addMspToTree(MSP *msp, GtkWidget *tree, GtkListStore *store)
+/* Add a row to the given tree model containing the given MSP */
+static void addMspToModel(MSP *msp, DetailViewModel *model)
 {
-  if (tree)
+  /* The SequenceCellRenderer expects a GList of MSPs, so put our MSP in a list. For exons,
+   * we want to add the child CDS/UTRs rather than the exon itself, so use the child list.
+   * Note that this means we can have multiple MSPs on the same row even when the 'squash
+   * matches' option is not on (which makes sense because realistically they are the same
+   * object). */
+  if (msp->type == BLXMSP_EXON && g_list_length(msp->childMsps) > 0)
     {
-      GtkWidget *detailView = treeGetDetailView(tree);
-      GList *columnList = detailViewGetColumnList(detailView);
-
-      GtkTreeIter iter;
-      gtk_list_store_append(store, &iter);
-
-      /* The SequenceCellRenderer expects a GList of MSPs, so put our MSP in a list. For exons,
-       * we want to add the child CDS/UTRs rather than the exon itself, so use the child list.
-       * Note that this means we can have multiple MSPs on the same row even when the 'squash
-       * matches' option is not on (which makes sense because realistically they are the same
-       * object). */
-      GList *mspGList = NULL;
-
-      if (msp->type == BLXMSP_EXON && g_list_length(msp->childMsps) > 0)
-        {
-          mspGList = msp->childMsps;
-        }
-      else
-        {
-          mspGList = g_list_append(NULL, msp);
-        }
-
-      /* Loop through the rest of the columns */
-      GList *item = columnList;
-
-      for ( ; item; item = item->next)
-        {
-          BlxColumnInfo *columnInfo = (BlxColumnInfo*)(item->data);
-
-          if (columnInfo->columnId == BLXCOL_SCORE)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, msp->score, -1);
-          else if (columnInfo->columnId == BLXCOL_ID)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, msp->id, -1);
-          else if (columnInfo->columnId == BLXCOL_START)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, msp->sRange.min(), -1);
-          else if (columnInfo->columnId == BLXCOL_SEQUENCE)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, mspGList, -1);
-          else if (columnInfo->columnId == BLXCOL_END)
-            gtk_list_store_set(store, &iter, columnInfo->columnIdx, msp->sRange.max(), -1);
-          else
-            {
-              GValue *val = blxSequenceGetValue(msp->sSequence, columnInfo->columnId);
-              if (val) gtk_list_store_set_value(store, &iter, columnInfo->columnIdx, val);
-            }
-        }
+      detailViewModelAddRow(model, msp->childMsps, FALSE,
+                            msp->score, msp->id, msp->sRange.min(), msp->sRange.max());
+    }
+  else
+    {
+      detailViewModelAddRow(model, g_list_append(NULL, msp), TRUE,
+                            msp->score, msp->id, msp->sRange.min(), msp->sRange.max());
+    }
+}
 
-      /* Remember the path to this tree row for each MSP */
-      GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), &iter);
-      GList *mspItem = mspGList;
 
-      for ( ; mspItem; mspItem = mspItem->next)
-        {
-          MSP *curMsp = (MSP*)(mspItem->data);
-          curMsp->treePaths[BLXMODEL_NORMAL] = gtk_tree_path_to_string(path);
-        }
+/* Add a row containing the given MSP to the normal (i.e. unsquashed) data model for
+ * the given tree. If the model is sorted, the row will be merged into its sorted
+ * position when the tree is next refiltered. */
+void addMspToTree(MSP *msp, GtkWidget *tree)
+{
+  if (tree)
+    {
+      TreeProperties *properties = treeGetProperties(tree);
+      GtkTreeModel *model = properties->treeModels[BLXMODEL_NORMAL];
 
-      gtk_tree_path_free(path);
+      if (model)
+        addMspToModel(msp, DETAIL_VIEW_MODEL(model));
     }
 }
 
@@ -2964,64 +3010,32 @@ static gint sortColumnCompareFunc(GtkTreeModel *model, GtkTreeIter *iter1, GtkTr
 }
 
 
-/* Create the base data store for a detail view tree */
-void treeCreateBaseDataModel(GtkWidget *tree, gpointer data)
+/* Calculate the packed sort keys for the given tree rows from the detail view's
+ * current sort columns */
+static gdouble* treeCalcSortKeys(GList **mspLists, const int numRows, int *numKeys, int *keysVersion, gpointer data)
 {
-  /* Create the data store for the tree view (unless it already exists) */
-  if (treeGetBaseDataModel(GTK_TREE_VIEW(tree)))
-    return;
-
-  /* Create the data store for the tree. We must know how many columns
-   * we have, and their data types. */
-  GtkWidget *detailView = treeGetDetailView(tree);
-  GList *columnList = detailViewGetColumnList(detailView);
-  const int numCols = g_list_length(columnList);
-  GType *typeList = columnListGetTypes(columnList);
-
-  GtkListStore *store = gtk_list_store_newv(numCols, typeList);
-
-  /* Set the sort function for each column */
-  int colNum = 0;
-  for ( ; colNum < numCols; ++colNum)
-    {
-      gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(store), colNum,	sortColumnCompareFunc, tree, NULL);
-    }
-
-  gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(store));
-
-  /* gtk_tree_view_set_model increments the reference count to 'store', so we should
-   * decrement the reference count when we lose our local reference to it. */
-  g_object_unref(G_OBJECT(store));
+  GtkWidget *tree = GTK_WIDGET(data);
+  return detailViewCalcSortKeys(treeGetDetailView(tree), mspLists, numRows, numKeys, keysVersion);
 }
 
 
-/* Create a filtered version of the data store to only show rows that are within the display range. */
-void treeCreateFilteredDataModel(GtkWidget *tree, gpointer data)
+/* Create the base data model for a detail view tree */
+void treeCreateBaseDataModel(GtkWidget *tree, gpointer data)
 {
-  GtkTreeModel *baseModel = treeGetBaseDataModel(GTK_TREE_VIEW(tree));
+  /* Create the data model for the tree view (unless it already exists) */
+  TreeProperties *properties = treeGetProperties(tree);
 
-  /* If there is already a filtered model, there's nothing to do. (If the visible
-   * model is different to the base model, we can assume it's the filtered model.)*/
-  if (treeGetVisibleDataModel(GTK_TREE_VIEW(tree)) != baseModel)
+  if (properties->treeModels[BLXMODEL_NORMAL])
     return;
 
-  GtkTreeModel *filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(baseModel), NULL);
-
-  gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(filter),
-					 (GtkTreeModelFilterVisibleFunc)isTreeRowVisible,
-					 tree,
-					 NULL);
-
-  /* Add the filtered store to the tree view */
-  gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(filter));
-
-  /* Keep a reference to the model in the properties so we can switch between this and the 'squashed' model */
-  TreeProperties *properties = treeGetProperties(tree);
-  properties->treeModels[BLXMODEL_NORMAL] = gtk_tree_view_get_model(GTK_TREE_VIEW(tree));
+  DetailViewModel *model = treeCreateDataModel(tree);
+  gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(model));
 
-  /* Note that we would normally decrement the reference count to 'filter' because we
-   * will lose the local pointer to it.  However, we've also added a pointer to it
-   * from our properties, so we would need to increment the reference count again */
+  /* Keep a reference to the model in the properties so we can switch between this and the
+   * 'squashed' model. gtk_tree_view_set_model adds its own reference, so the properties
+   * just take over our local reference. */
+  properties->treeModels[BLXMODEL_NORMAL] = GTK_TREE_MODEL(model);
+  properties->modelNeedsSort[BLXMODEL_NORMAL] = TRUE;
 }
 
 
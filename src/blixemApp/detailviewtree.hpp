@@ -84,6 +84,7 @@ public:
   gboolean hasSnpHeader;	    /* Whether a SNP track is shown above this tree */
 
   GtkTreeModel *treeModels[BLXMODEL_NUM_MODELS];  /* The tree data store(s) */
+  gboolean modelNeedsSort[BLXMODEL_NUM_MODELS];   /* Whether each data store needs re-sorting before it is next shown */
 };
 
 
@@ -111,8 +112,9 @@ void		  treeUpdateSquashMatches(GtkWidget *tree, gpointer data);
 gboolean	  treeMoveRowSelection(GtkWidget *tree, const gboolean moveUp, const gboolean shiftModifier);
 void		  treeScrollSelectionIntoView(GtkWidget *tree, gpointer data);
 
-void              addMspToTree(MSP *msp, GtkWidget *tree, GtkListStore *store);
-void		  addSequencesToTree(GtkWidget *tree, gpointer data);
+void              addMspToTree(MSP *msp, GtkWidget *tree);
+void              createSquashedTreeModels(GtkWidget *detailView);
+void              queueCreateSquashedTreeModels(GtkWidget *detailView);
 
 void              treeDrawCachedBitmap(GtkWidget *tree, gpointer data);
 
@@ -129,6 +131,5 @@ GtkWidget*	  createDetailViewTree(GtkWidget *grid,
 				       const gboolean includeSnpTrack);
 
 void		   treeCreateBaseDataModel(GtkWidget *tree, gpointer data);
-void		   treeCreateFilteredDataModel(GtkWidget *tree, gpointer data);
 
 #endif /* _detail_view_tree_included_ */
@@ -759,6 +759,8 @@ void exonViewToggleExpanded(GtkWidget *exonView)
 
 static gboolean onExposeExonView(GtkWidget *exonView, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "exonView");
+
   GdkDrawable *drawable = widgetGetDrawable(exonView);
 
   if (!drawable)
@@ -50,6 +50,23 @@
 #define SEQUENCE_CELL_RENDERER_NAME	"SequenceCellRenderer"
 #define GAP_WIDTH_AS_FRACTION		0.375	/* multiplier used to get the width of the "gap" marker based on a fraction of char width */
 #define MIN_GAP_WIDTH			2
+#define GLYPH_ATLAS_FIRST_CHAR		33	/* first char in the glyph atlas alphabet ('!') */
+#define GLYPH_ATLAS_LAST_CHAR		126	/* last char in the glyph atlas alphabet ('~') */
+#define GLYPH_ATLAS_NUM_CHARS		(GLYPH_ATLAS_LAST_CHAR - GLYPH_ATLAS_FIRST_CHAR + 1)
+#define MAX_GLYPH_ATLASES		8	/* max number of font/color combinations to cache */
+
+
+/* A glyph atlas holds the printable ASCII characters pre-rendered in a particular font
+ * and color. The glyphs are laid out in a single row of fixed-width cells so that the
+ * sequence text can be drawn by copying cells rather than laying out text. */
+typedef struct _GlyphAtlas
+  {
+    PangoFontDescription *fontDesc;   /* the font the glyphs were rendered in */
+    GdkColor color;                   /* the color the glyphs were rendered in */
+    cairo_surface_t *surface;         /* the rendered glyphs */
+    int glyphWidth;                   /* the width of each glyph cell in the atlas */
+    int glyphHeight;                  /* the height of the atlas */
+  } GlyphAtlas;
 
 typedef struct _RenderData
   {
@@ -100,6 +117,8 @@ typedef struct _RenderData
     GdkLineStyle exonBoundaryStylePartial;
     gboolean limitUnalignedBases;
     int numUnalignedBases;
+    cairo_t *windowCr;        /* cairo context for 'window', created on first use */
+    cairo_t *drawableCr;      /* cairo context for 'drawable', created on first use */
   } RenderData;
 
 
@@ -122,8 +141,10 @@ static void     sequence_cell_renderer_finalize (GObject *gobject);
 
 static gboolean mspGetVisibleRange(MSP *msp, RenderData *data, IntRange *result);
 void		drawAllVisibleExonBoundaries(GtkWidget *tree, RenderData *data);
+static void     destroyGlyphAtlas(gpointer data, gpointer user_data);
 
-static void mspDrawSequenceText(GtkWidget *tree,
+static void mspDrawSequenceText(SequenceCellRenderer *renderer,
+                                GtkWidget *tree,
                                 gchar *displayText,
                                 const IntRange* const segmentRange,
                                 RenderData *data);
@@ -321,6 +342,7 @@ sequence_cell_renderer_init (SequenceCellRenderer *cellrenderersequence)
   cellrenderersequence->data = NULL;
   cellrenderersequence->mspGList = NULL;
   cellrenderersequence->text = NULL;
+  cellrenderersequence->glyphAtlases = NULL;
 }
 
 
@@ -385,11 +407,12 @@ sequence_cell_renderer_class_init (SequenceCellRendererClass *klass)
 static void
 sequence_cell_renderer_finalize (GObject *object)
 {
-  /*
-   SequenceCellRenderer *cellrenderersequence = SEQUENCE_CELL_RENDERER(object);
-   */
+  SequenceCellRenderer *cellrenderersequence = SEQUENCE_CELL_RENDERER(object);
 
   /* Free any dynamically allocated resources here */
+  g_slist_foreach(cellrenderersequence->glyphAtlases, destroyGlyphAtlas, NULL);
+  g_slist_free(cellrenderersequence->glyphAtlases);
+  cellrenderersequence->glyphAtlases = NULL;
 
   (* G_OBJECT_CLASS (parent_class)->finalize) (object);
 }
@@ -738,47 +761,42 @@ static char blxSeqGetMatchSeqBase(BlxSequence *blxSeq, const int sIdx, const Blx
 }
 
 
-/* Color in the background of a particular base in the given match sequence. Returns
- * the calculated index into the match sequence (for effiency, so that we don't have to
- * recalculate it later on). Returns the equivalent index in the subject sequence, or
- * UNSET_INT if there is none. */
-static void mspDrawBaseBg(MSP *msp,
-                          const int segmentIdx,
-                          const IntRange* const segmentRange,
-                          char *refSeqSegment,
-                          RenderData *data,
-                          const int x,
-                          const int y,
-                          gchar *displayText,
-                          int *sIdx,
-                          int *qIdx)
+/* Work out the background color for a particular base in the given match sequence,
+ * according to how well it matches the reference sequence, and add the base to the
+ * display text. Returns the color, or NULL if the base has no background. The caller
+ * passes the ref seq index of the base and the equivalent index in the match sequence
+ * (or UNSET_INT if there is none). */
+static GdkColor* mspGetBaseBgColor(MSP *msp,
+                                   const int segmentIdx,
+                                   const IntRange* const segmentRange,
+                                   const char *refSeqSegment,
+                                   RenderData *data,
+                                   gchar *displayText,
+                                   const int sIdx,
+                                   const int qIdx)
 {
   char sBase = '\0';
   GdkColor *baseBgColor = NULL;
 
-  /* From the segment index, find the display index and the ref seq coord */
   const int displayIdx = segmentRange->min() + segmentIdx;
-  *qIdx = convertDisplayIdxToDnaIdx(displayIdx, data->bc->seqType, data->qFrame, 1, data->bc->numFrames, data->bc->displayRev, &data->bc->refSeqRange);
-
-  /* Find the match-sequence coord at this ref-seq coord */
-  gboolean found_sIdx = mspGetMatchCoord(msp, *qIdx, data->seqSelected, data->numUnalignedBases, data->bc, sIdx);
+  const gboolean found_sIdx = (sIdx != UNSET_INT);
 
   /* Highlight the base if its base index is selected, or if its sequence is selected.
    * (If it is selected in both, show it in the normal color) */
   gboolean selected = coordIsSelected(data, displayIdx);
 
-  if (!valueWithinRange(*qIdx, &msp->qRange))
+  if (!valueWithinRange(qIdx, &msp->qRange))
     {
       /* We're outside the alignment range. There might still be a base to display if
        * we're displaying unaligned parts of the match sequence or polyA tails; otherwise, we
        * show nothing. */
       if (found_sIdx)
 	{
-          sBase = blxSeqGetMatchSeqBase(msp->sSequence, *sIdx, data->bc->seqType);
+          sBase = blxSeqGetMatchSeqBase(msp->sSequence, sIdx, data->bc->seqType);
 
           if (data->bc->flags[BLXFLAG_SHOW_POLYA_SITE] &&
               (!data->bc->flags[BLXFLAG_SHOW_POLYA_SITE_SELECTED] || data->seqSelected) &&
-              mspCoordInPolyATail(*qIdx, msp))
+              mspCoordInPolyATail(qIdx, msp))
             {
               baseBgColor = selected ? data->polyAColorSelected : data->polyAColor;
             }
@@ -797,7 +815,7 @@ static void mspDrawBaseBg(MSP *msp,
   else
     {
       /* There is a base in the match sequence. See if it matches the ref sequence */
-      sBase = blxSeqGetMatchSeqBase(msp->sSequence, *sIdx, data->bc->seqType);
+      sBase = blxSeqGetMatchSeqBase(msp->sSequence, sIdx, data->bc->seqType);
       char qBase = refSeqSegment[segmentIdx];
 
       if (tolower(sBase) == tolower(qBase))
@@ -823,13 +841,6 @@ static void mspDrawBaseBg(MSP *msp,
 	}
     }
 
-  /* Draw the background color */
-  if (baseBgColor)
-    {
-      gdk_gc_set_foreground(data->gc, baseBgColor);
-      drawRectangle2(data->window, data->drawable, data->gc, TRUE, x, y, ceil(data->charWidth), roundNearest(data->charHeight));
-    }
-
   if (sBase != '\0')
     {
       /* Add this character into the display text */
@@ -839,6 +850,25 @@ static void mspDrawBaseBg(MSP *msp,
     {
       displayText[segmentIdx] = ' ';
     }
+
+  return baseBgColor;
+}
+
+
+/* Draw a background rectangle spanning the bases from firstIdx to lastIdx in the
+ * given segment (inclusive) */
+static void mspDrawBgRun(const int firstIdx,
+                         const int lastIdx,
+                         const IntRange* const segmentRange,
+                         GdkColor *color,
+                         RenderData *data)
+{
+  int x1 = UNSET_INT, x2 = UNSET_INT, y = UNSET_INT;
+  segmentGetCoordsForBaseIdx(firstIdx, segmentRange, data, &x1, &y);
+  segmentGetCoordsForBaseIdx(lastIdx, segmentRange, data, &x2, &y);
+
+  gdk_gc_set_foreground(data->gc, color);
+  drawRectangle2(data->window, data->drawable, data->gc, TRUE, x1, y, x2 - x1 + ceil(data->charWidth), roundNearest(data->charHeight));
 }
 
 
@@ -972,22 +1002,202 @@ static void mspDrawInsertionMarker(int sIdx,
 }
 
 
-/* Draw the given sequence text at the given coords */
-static void mspDrawSequenceText(GtkWidget *tree,
+/* Free the memory used by a glyph atlas */
+static void destroyGlyphAtlas(gpointer data, gpointer user_data)
+{
+  GlyphAtlas *atlas = (GlyphAtlas*)data;
+
+  if (atlas)
+    {
+      pango_font_description_free(atlas->fontDesc);
+      cairo_surface_destroy(atlas->surface);
+      g_free(atlas);
+    }
+}
+
+
+/* Render all the characters in the glyph atlas alphabet in the given font and
+ * color. The surface is created to be compatible with the given cairo context's
+ * target so that copying from it is fast. */
+static GlyphAtlas* createGlyphAtlas(GtkWidget *tree,
+                                    cairo_t *targetCr,
+                                    const PangoFontDescription *fontDesc,
+                                    const GdkColor *color)
+{
+  GlyphAtlas *atlas = g_new0(GlyphAtlas, 1);
+  atlas->fontDesc = pango_font_description_copy(fontDesc);
+  atlas->color = *color;
+
+  PangoLayout *layout = gtk_widget_create_pango_layout(tree, NULL);
+  pango_layout_set_font_description(layout, atlas->fontDesc);
+
+  /* Find the size of the largest glyph; all of the cells will be this size */
+  char c = 0;
+
+  for (c = GLYPH_ATLAS_FIRST_CHAR; c <= GLYPH_ATLAS_LAST_CHAR; ++c)
+    {
+      int width = 0, height = 0;
+      pango_layout_set_text(layout, &c, 1);
+      pango_layout_get_pixel_size(layout, &width, &height);
+
+      atlas->glyphWidth = MAX(atlas->glyphWidth, width);
+      atlas->glyphHeight = MAX(atlas->glyphHeight, height);
+    }
+
+  atlas->surface = cairo_surface_create_similar(cairo_get_target(targetCr),
+                                                CAIRO_CONTENT_COLOR_ALPHA,
+                                                atlas->glyphWidth * GLYPH_ATLAS_NUM_CHARS,
+                                                atlas->glyphHeight);
+
+  cairo_t *cr = cairo_create(atlas->surface);
+  gdk_cairo_set_source_color(cr, &atlas->color);
+
+  for (c = GLYPH_ATLAS_FIRST_CHAR; c <= GLYPH_ATLAS_LAST_CHAR; ++c)
+    {
+      pango_layout_set_text(layout, &c, 1);
+      cairo_move_to(cr, (c - GLYPH_ATLAS_FIRST_CHAR) * atlas->glyphWidth, 0);
+      pango_cairo_show_layout(cr, layout);
+    }
+
+  cairo_destroy(cr);
+  g_object_unref(layout);
+
+  return atlas;
+}
+
+
+/* Get the glyph atlas for the given font and color, creating it if it does not
+ * exist yet. The most recently used atlas is kept at the start of the cache and
+ * the least recently used is dropped if the cache is full. */
+static GlyphAtlas* rendererGetGlyphAtlas(SequenceCellRenderer *renderer,
+                                         GtkWidget *tree,
+                                         cairo_t *targetCr,
+                                         const GdkColor *color)
+{
+  const PangoFontDescription *fontDesc = tree->style->font_desc;
+  GSList *item = renderer->glyphAtlases;
+
+  for ( ; item; item = item->next)
+    {
+      GlyphAtlas *atlas = (GlyphAtlas*)(item->data);
+
+      if (atlas->color.red == color->red &&
+          atlas->color.green == color->green &&
+          atlas->color.blue == color->blue &&
+          pango_font_description_equal(atlas->fontDesc, fontDesc))
+        {
+          if (item != renderer->glyphAtlases)
+            {
+              renderer->glyphAtlases = g_slist_remove_link(renderer->glyphAtlases, item);
+              renderer->glyphAtlases = g_slist_concat(item, renderer->glyphAtlases);
+            }
+
+          return atlas;
+        }
+    }
+
+  if (g_slist_length(renderer->glyphAtlases) >= MAX_GLYPH_ATLASES)
+    {
+      GSList *last = g_slist_last(renderer->glyphAtlases);
+      destroyGlyphAtlas(last->data, NULL);
+      renderer->glyphAtlases = g_slist_delete_link(renderer->glyphAtlases, last);
+    }
+
+  GlyphAtlas *atlas = createGlyphAtlas(tree, targetCr, fontDesc, color);
+  renderer->glyphAtlases = g_slist_prepend(renderer->glyphAtlases, atlas);
+
+  return atlas;
+}
+
+
+/* Copy the glyphs for the given text from the atlas to the given cairo context. The
+ * glyph for each character is placed at the same position as the background for that
+ * base, so that the text lines up exactly with the background. */
+static void drawGlyphs(cairo_t *cr,
+                       GlyphAtlas *atlas,
+                       const gchar *displayText,
+                       const int textLen,
+                       const IntRange* const segmentRange,
+                       RenderData *data)
+{
+  int i = 0;
+
+  for ( ; i < textLen; ++i)
+    {
+      const int c = (unsigned char)displayText[i];
+
+      if (c < GLYPH_ATLAS_FIRST_CHAR || c > GLYPH_ATLAS_LAST_CHAR)
+        continue;
+
+      int x = UNSET_INT, y = UNSET_INT;
+      segmentGetCoordsForBaseIdx(i, segmentRange, data, &x, &y);
+
+      cairo_set_source_surface(cr, atlas->surface, x - (c - GLYPH_ATLAS_FIRST_CHAR) * atlas->glyphWidth, y);
+      cairo_rectangle(cr, x, y, atlas->glyphWidth, atlas->glyphHeight);
+      cairo_fill(cr);
+    }
+}
+
+
+/* Returns true if all the chars in the given text are either spaces or are in the
+ * glyph atlas alphabet */
+static gboolean textIsInGlyphAtlas(const gchar *text, const int textLen)
+{
+  int i = 0;
+
+  for ( ; i < textLen; ++i)
+    {
+      const int c = (unsigned char)text[i];
+
+      if (c != ' ' && (c < GLYPH_ATLAS_FIRST_CHAR || c > GLYPH_ATLAS_LAST_CHAR))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Draw the given sequence text at the given coords. The glyphs are copied from a
+ * pre-rendered atlas for the current font and text color, which is much quicker
+ * than creating a new text layout for every segment. We fall back to drawing a
+ * layout if the text contains anything unexpected. */
+static void mspDrawSequenceText(SequenceCellRenderer *renderer,
+                                GtkWidget *tree,
                                 gchar *displayText,
                                 const IntRange* const segmentRange,
                                 RenderData *data)
 {
-  if (g_utf8_validate(displayText, -1, NULL))
+  const int textLen = strlen(displayText);
+
+  if (textIsInGlyphAtlas(displayText, textLen))
+    {
+      if (data->window && !data->windowCr)
+        data->windowCr = gdk_cairo_create(data->window);
+
+      if (data->drawable && !data->drawableCr)
+        data->drawableCr = gdk_cairo_create(data->drawable);
+
+      cairo_t *targetCr = data->windowCr ? data->windowCr : data->drawableCr;
+
+      if (targetCr)
+        {
+          GlyphAtlas *atlas = rendererGetGlyphAtlas(renderer, tree, targetCr, &tree->style->text[data->state]);
+
+          if (data->windowCr)
+            drawGlyphs(data->windowCr, atlas, displayText, textLen, segmentRange, data);
+
+          if (data->drawableCr)
+            drawGlyphs(data->drawableCr, atlas, displayText, textLen, segmentRange, data);
+        }
+    }
+  else if (g_utf8_validate(displayText, -1, NULL))
     {
       /* Get the coords for the first base. The display text should have been
        * was constructed such that everything else will line up from here. */
       int x, y;
       segmentGetCoordsForBaseIdx(0, segmentRange, data, &x, &y);
 
-      PangoFontDescription *font_desc = pango_font_description_copy(tree->style->font_desc);
-      PangoLayout *layout = pangoGetLayoutFromText(displayText, tree, font_desc);
-      pango_font_description_free(font_desc);
+      PangoLayout *layout = pangoGetLayoutFromText(displayText, tree, tree->style->font_desc);
 
       if (layout)
 	{
@@ -1003,7 +1213,6 @@ static void mspDrawSequenceText(GtkWidget *tree,
     {
       g_warning("Invalid string constructed when trying to display sequence.\n");
     }
-
 }
 
 
@@ -1107,20 +1316,17 @@ static void drawMsp(SequenceCellRenderer *renderer,
   IntRange qRange(coord1, coord2);
 
   GError *error = NULL;
-  gchar *refSeqSegment = getSequenceSegment(data->bc->refSeq,
-                                            &qRange,
-					    data->qStrand,
-                                            BLXSEQ_DNA,               /* ref seq is always in nucleotide coords */
-					    data->bc->seqType,        /* required segment is in display coords */
-					    data->qFrame,
-					    data->bc->numFrames,
-					    &data->bc->refSeqRange,
-					    data->bc->blastMode,
-					    data->bc->geneticCode,
-					    data->bc->displayRev,
-					    data->bc->displayRev,
-					    TRUE,
-					    &error);
+  int segmentLen = 0;
+  const char *refSeqSegment = blxRefSeqCacheGetSegment(data->bc->refSeqCache,
+                                                       &qRange,
+                                                       data->qStrand,
+                                                       data->bc->seqType,        /* required segment is in display coords */
+                                                       data->bc->numFrames,
+                                                       data->bc->blastMode,
+                                                       data->bc->displayRev,
+                                                       TRUE,
+                                                       &segmentLen,
+                                                       &error);
 
   if (!refSeqSegment)
     {
@@ -1136,22 +1342,56 @@ static void drawMsp(SequenceCellRenderer *renderer,
     }
 
   /* We'll populate a string with the characters we want to display as we loop through the indices. */
-  const int segmentLen = strlen(refSeqSegment);
   gchar displayText[segmentLen + 1];
   displayText[0] = '\0';
 
-  int lastFoundSIdx = UNSET_INT;  /* remember the last index where we found a valid base */
-  int lastFoundQIdx = UNSET_INT;  /* remember the last index where we found a valid base */
+  /* First find the base in the match sequence at each index and the background color
+   * according to how well it matches. Consecutive bases with the same background color
+   * are drawn as a single rectangle. */
+  int sIdxs[segmentLen + 1];
+  int qIdxs[segmentLen + 1];
+  GdkColor *runColor = NULL;
+  int runStart = 0;
 
+  /* From the segment index, find the display index and the ref seq coord, and then find
+   * the match-sequence coords for all of the ref-seq coords in one pass */
   int segmentIdx = 0;
   for ( ; segmentIdx < segmentLen; ++segmentIdx)
+    {
+      const int displayIdx = segmentRange.min() + segmentIdx;
+      qIdxs[segmentIdx] = convertDisplayIdxToDnaIdx(displayIdx, data->bc->seqType, data->qFrame, 1, data->bc->numFrames, data->bc->displayRev, &data->bc->refSeqRange);
+    }
+
+  mspGetMatchCoordArray(msp, qIdxs, segmentLen, data->seqSelected, data->numUnalignedBases, data->bc, sIdxs);
+
+  for (segmentIdx = 0; segmentIdx < segmentLen; ++segmentIdx)
+    {
+      GdkColor *baseBgColor = mspGetBaseBgColor(msp, segmentIdx, &segmentRange, refSeqSegment, data, displayText, sIdxs[segmentIdx], qIdxs[segmentIdx]);
+
+      if (baseBgColor != runColor)
+        {
+          if (runColor)
+            mspDrawBgRun(runStart, segmentIdx - 1, &segmentRange, runColor, data);
+
+          runColor = baseBgColor;
+          runStart = segmentIdx;
+        }
+    }
+
+  if (runColor)
+    mspDrawBgRun(runStart, segmentLen - 1, &segmentRange, runColor, data);
+
+  /* Now draw the markers on top of the background */
+  int lastFoundSIdx = UNSET_INT;  /* remember the last index where we found a valid base */
+  int lastFoundQIdx = UNSET_INT;  /* remember the last index where we found a valid base */
+
+  for (segmentIdx = 0; segmentIdx < segmentLen; ++segmentIdx)
     {
       int x = UNSET_INT, y = UNSET_INT;
       segmentGetCoordsForBaseIdx(segmentIdx, &segmentRange, data, &x, &y);
 
-      /* Find the base in the match sequence and draw the background color according to how well it matches */
-      int sIdx = UNSET_INT, qIdx = UNSET_INT;
-      mspDrawBaseBg(msp, segmentIdx, &segmentRange, refSeqSegment, data, x, y, displayText, &sIdx, &qIdx);
+      const int sIdx = sIdxs[segmentIdx];
+      const int qIdx = qIdxs[segmentIdx];
 
       /* If there is an insertion (i.e. extra bases on the match sequence) between this
        * and the previous coord, draw a marker */
@@ -1172,9 +1412,7 @@ static void drawMsp(SequenceCellRenderer *renderer,
 //  insertChar(displayText, &segmentIdx, '\0', msp);
 
   /* Draw the sequence text */
-  mspDrawSequenceText(tree, displayText, &segmentRange, data);
-
-  g_free(refSeqSegment);
+  mspDrawSequenceText(renderer, tree, displayText, &segmentRange, data);
 }
 
 
@@ -1385,7 +1623,9 @@ static void rendererDrawMsps(SequenceCellRenderer *renderer,
     detailViewProperties->exonBoundaryLineStyle,
     detailViewProperties->exonBoundaryLineStylePartial,
     bc->flags[BLXFLAG_LIMIT_UNALIGNED_BASES],
-    detailViewProperties->numUnalignedBases
+    detailViewProperties->numUnalignedBases,
+    NULL,
+    NULL
   };
 
   /* If a range is selected highlight it now in case we don't come to process it (in
@@ -1465,6 +1705,12 @@ static void rendererDrawMsps(SequenceCellRenderer *renderer,
 
   drawAllVisibleExonBoundaries(tree, &data);
 
+  if (data.windowCr)
+    cairo_destroy(data.windowCr);
+
+  if (data.drawableCr)
+    cairo_destroy(data.drawableCr);
+
   g_object_unref(gc);
 
   if (data.selectionRange)
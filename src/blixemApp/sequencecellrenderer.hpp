@@ -84,6 +84,8 @@ typedef struct _SequenceCellRenderer
   GList *mspGList;  /* property for the sequence column. Contains the MSP(s) to be displayed in this row */
   GList *data;      /* property for data that is set for every column */
 
+  GSList *glyphAtlases; /* cache of pre-rendered sequence glyphs (one GlyphAtlas per font/color) */
+
 } SequenceCellRenderer;
 
 
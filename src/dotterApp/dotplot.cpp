@@ -162,8 +162,8 @@ static void                       calculateDotplotBorders(GtkWidget *dotplot, Do
 static GdkColormap*               insertGreyRamp (DotplotProperties *properties);
 static void                       transformGreyRampImage(GdkImage *image, unsigned char *pixmap, DotplotProperties *properties);
 static void                       initPixmap(unsigned char **pixmap, const int width, const int height);
-static const char*                getShortMspName(const MSP* const msp);
 static void                       calculateImageHsps(int strength, int sx, int sy, int ex, int ey, DotplotProperties *properties);
+static void                       calculateImageHsp(const MSP *msp, gpointer data);
 static void                       getMspScreenCoords(const MSP* const msp, DotplotProperties *properties, int *sx, int *ex, int *sy, int *ey);
 static void                       setCoordsFromPos(GtkWidget *dotplot, const int x, const int y);
 static void                       getCoordsFromPos(GtkWidget *dotplot, const int x, const int y, int *refCoord, int *matchCoord);
@@ -460,28 +460,13 @@ void setHspMode(GtkWidget *dotplot, DotterHspMode hspMode)
           initPixmap(&properties->hspPixmap, properties->image->width, properties->image->height);
         }
 
-      /* For greyscale mode, loop through all match MSPs and set the pixel strength */
+      /* For greyscale mode, loop through the match MSPs in the visible range and set the pixel strength */
       if (properties->hspMode == DOTTER_HSPS_GREYSCALE)
         {
           resetPixmapBackground(properties->hspPixmap, properties);
-          MSP *msp = dc->mspList;
 
-          for ( ; msp; msp = msp->next)
-            {
-              const char *mspName = getShortMspName(msp);
-              if (!mspName || strcmp(mspName, dc->matchSeqName))
-                {
-                  /* Not an MSP from our match sequence */
-                  continue;
-                }
-
-              int sx, ex, sy, ey;
-              getMspScreenCoords(msp, properties, &sx, &ex, &sy, &ey);
-
-              /* Draw as greyscale pixmap */
-              const int strength = (int)msp->score;
-              calculateImageHsps(strength, sx, sy, ex, ey, properties);
-            }
+          DotterWindowContext *dwc = properties->dotterWinCtx;
+          dotterHspIndexForeach(dc->hspIndex, &dwc->refSeqRange, &dwc->matchSeqRange, calculateImageHsp, properties);
 
           /* Overwrite the image with the HSP pixmap */
           transformGreyRampImage(properties->image, properties->hspPixmap, properties);
@@ -585,6 +570,8 @@ void toggleCrosshairFullscreen(GtkWidget *dotplot)
 /* Expose handler for dot-plot window */
 static gboolean onExposeDotplot(GtkWidget *dotplot, GdkEventExpose *event, gpointer data)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_REDRAW, "dotplot");
+
   GdkDrawable *window = GTK_LAYOUT(dotplot)->bin_window;
   DotplotProperties *properties = dotplotGetProperties(dotplot);
 
@@ -1217,7 +1204,7 @@ static void createScoreVec(DotterWindowContext *dwc, const int vecLen, const int
   int rowIdx = 0;
   for ( ; rowIdx < vecLen; ++rowIdx)
     {
-      scoreVec[rowIdx] = (gint32*)handleAlloc(handle, qlen * sizeof(gint32));
+      scoreVec[rowIdx] = (gint32*)handleAllocAligned(handle, qlen * sizeof(gint32), HANDLE_CACHE_LINE_SIZE);
     }
 
   if (dc->blastMode != BLXMODE_BLASTN)
@@ -1429,15 +1416,12 @@ static void doCalculateImage(const BlxStrand qStrand,
 }
 
 
-/* Print some debug info for the calculateImage function to stdout */
-static void printCalculateImageStats(DotterWindowContext *dwc, const int qlen, const int slen)
+/* Print some statistics for the calculateImage function to stdout: the number of
+ * dots calculated and the time this took */
+static void printCalculateImageStats(DotterWindowContext *dwc, const int qlen, const int slen, const double seconds)
 {
   DotterContext *dc = dwc->dotterCtx;
 
-  double speed = 17.2;  /* Speed in Mdots/seconds. SGI MIPS R10000 (clobber) */
-  /* speed = 5.7;  DEC Alpha AXP 3000/700 */
-  /* speed = 3.7;  SGI R4400: */
-
   double numDots = qlen/1e6*slen; /* total number of dots (millions) */
 
   if (dwc->selfComp)
@@ -1449,24 +1433,12 @@ static void printCalculateImageStats(DotterWindowContext *dwc, const int qlen, c
   if (dc->blastMode == BLXMODE_BLASTX)
     numDots *= 3;
 
-  int min = (int)(numDots/speed/60);
-  int sec = (int)(numDots/speed) - min*60;
-
-  g_message("%d vs. %d residues => %.2f million dots. ", qlen, slen, numDots);
-
-  if (min+sec >= 2)
-    {
-      g_message("(Takes ");
-
-      if (min)
-        g_message("%d:%.2d minutes", min, sec);
-      else
-        g_message("%d seconds", sec);
-
-      g_message(" on an SGI MIPS R10000)");
-    }
+  if (seconds > 0.0)
+    g_message("%d vs. %d residues => %.2f million dots in %.2f seconds (%.1f million dots/second)\n",
+              qlen, slen, numDots, seconds, numDots / seconds);
+  else
+    g_message("%d vs. %d residues => %.2f million dots\n", qlen, slen, numDots);
 
-  g_message("\n");
   fflush(stdout);
 }
 
@@ -1475,6 +1447,8 @@ static void printCalculateImageStats(DotterWindowContext *dwc, const int qlen, c
  * diagonal for each pixel into *pixelmap */
 static void calculateImage(DotplotProperties *properties)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_PLOT, "calculateImage");
+
   DEBUG_ENTER("calculateImage");
 
   g_assert(properties->slidingWinSize > 0);
@@ -1491,8 +1465,7 @@ static void calculateImage(DotplotProperties *properties)
   const int slen = dwc->matchSeqRange.length();
   const int win2 = properties->slidingWinSize/2;
 
-  /* Print some statistics about what we're about to do */
-  printCalculateImageStats(dwc, qlen, slen);
+  GTimer *timer = g_timer_new();
 
   /* Find the offset of the current display range within the full range of the bit of reference sequence we have */
   const int qOffset = dc->refSeqStrand == BLXSTRAND_REVERSE
@@ -1511,14 +1484,15 @@ static void calculateImage(DotplotProperties *properties)
   gint32 **scoreVec = NULL;
   createScoreVec(dwc, vecLen, pepQSeqLen, &handle, &scoreVec);
 
-  gint32 *sIndex = (gint32*)handleAlloc(&handle, slen * sizeof(gint32));
+  gint32 *sIndex = (gint32*)handleAllocAligned(&handle, slen * sizeof(gint32), HANDLE_CACHE_LINE_SIZE);
   populateMatchSeqBinaryVals(dwc, slen, getTranslationTable(dc->matchSeqType, BLXSTRAND_FORWARD), sIndex);
 
   /* Allocate some vectors for use in averaging the values for whole rows at a time. Initialise the
-   * 'zero' array now but leave the sum arrays because these will be reset in doCalculateWindow. */
-  gint32 *zero = (gint32*)handleAlloc(&handle, pepQSeqLen * sizeof(gint32));
-  gint32 *sum1 = (gint32*)handleAlloc(&handle, pepQSeqLen * sizeof(gint32));
-  gint32 *sum2 = (gint32*)handleAlloc(&handle, pepQSeqLen * sizeof(gint32));
+   * 'zero' array now but leave the sum arrays because these will be reset in doCalculateWindow.
+   * These are processed a whole row at a time so are aligned to cache lines. */
+  gint32 *zero = (gint32*)handleAllocAligned(&handle, pepQSeqLen * sizeof(gint32), HANDLE_CACHE_LINE_SIZE);
+  gint32 *sum1 = (gint32*)handleAllocAligned(&handle, pepQSeqLen * sizeof(gint32), HANDLE_CACHE_LINE_SIZE);
+  gint32 *sum2 = (gint32*)handleAllocAligned(&handle, pepQSeqLen * sizeof(gint32), HANDLE_CACHE_LINE_SIZE);
 
   int idx = 0;
   for (idx = 0; idx < pepQSeqLen; ++idx)
@@ -1594,6 +1568,10 @@ static void calculateImage(DotplotProperties *properties)
 
   handleDestroy(&handle);
 
+  /* Print some statistics about what we've done */
+  printCalculateImageStats(dwc, qlen, slen, g_timer_elapsed(timer, NULL));
+  g_timer_destroy(timer);
+
   DEBUG_EXIT("calculateImage returning ");
 }
 
@@ -2722,24 +2700,6 @@ static void drawImage(GtkWidget *dotplot, GdkDrawable *drawable)
 }
 
 
-/* Utility to cut off anything before the ':' in an MSP name. Returns the full name if
- * there is no colon. Returns a pointer into the original name, so the result should not
- * be free'd */
-static const char* getShortMspName(const MSP* const msp)
-{
-  const char *result = NULL;
-  const char *sName = mspGetSName(msp);
-
-  if (sName)
-    {
-      const char *mspName = strchr(sName, ':');
-      result = mspName ? ++mspName : sName;
-    }
-
-  return result;
-}
-
-
 static void calculateImageHsps(int strength, int sx, int sy, int ex, int ey, DotplotProperties *properties)
 {
   /* Get zero-based coords from the edge of the drawing rectangle */
@@ -2799,6 +2759,51 @@ static void getMspScreenCoords(const MSP* const msp, DotplotProperties *properti
 }
 
 
+/* Called for each HSP in the visible range when drawing HSPs as a greyscale pixmap */
+static void calculateImageHsp(const MSP *msp, gpointer data)
+{
+  DotplotProperties *properties = (DotplotProperties*)data;
+
+  int sx, ex, sy, ey;
+  getMspScreenCoords(msp, properties, &sx, &ex, &sy, &ey);
+
+  const int strength = (int)msp->score;
+  calculateImageHsps(strength, sx, sy, ex, ey, properties);
+}
+
+
+/* Data used when collecting the HSP lines to draw */
+typedef struct _HspLineData
+{
+  DotplotProperties *properties;
+  GArray *segments[3];                /* lines to draw in each of the low/medium/high score colors */
+} HspLineData;
+
+
+/* Called for each HSP in the visible range when drawing HSPs as lines. Adds a line segment
+ * for the HSP to the array for its color. */
+static void addHspLine(const MSP *msp, gpointer data)
+{
+  HspLineData *lineData = (HspLineData*)data;
+  DotplotProperties *properties = lineData->properties;
+
+  /* In "function" mode the color depends on the score; otherwise all lines are the high color */
+  int colorIdx = 2;
+
+  if (properties->hspMode == DOTTER_HSPS_FUNC)
+    {
+      if (msp->score < 75.0)
+        colorIdx = 0;
+      else if (msp->score < 100.0)
+        colorIdx = 1;
+    }
+
+  GdkSegment segment;
+  getMspScreenCoords(msp, properties, &segment.x1, &segment.x2, &segment.y1, &segment.y2);
+  g_array_append_val(lineData->segments[colorIdx], segment);
+}
+
+
 static void drawHsps(GtkWidget *dotplot, GdkDrawable *drawable)
 {
   DotplotProperties *properties = dotplotGetProperties(dotplot);
@@ -2809,62 +2814,43 @@ static void drawHsps(GtkWidget *dotplot, GdkDrawable *drawable)
       return;
     }
 
-  GdkGC *gc = gdk_gc_new(drawable);
+  DotterWindowContext *dwc = properties->dotterWinCtx;
+  DotterContext *dc = dwc->dotterCtx;
 
-  DotterContext *dc = properties->dotterWinCtx->dotterCtx;
+  if (dotterHspIndexGetCount(dc->hspIndex) < 1)
+    return;
+
+  /* Collect the lines for the HSPs in the visible range, grouped by color, so that we can
+   * draw each group in a single call */
+  HspLineData lineData;
+  lineData.properties = properties;
+
+  const DotterColorId colorIds[] = {DOTCOLOR_HSP_LOW, DOTCOLOR_HSP_MEDIUM, DOTCOLOR_HSP_HIGH};
+  int i = 0;
+
+  for (i = 0; i < 3; ++i)
+    lineData.segments[i] = g_array_new(FALSE, FALSE, sizeof(GdkSegment));
+
+  dotterHspIndexForeach(dc->hspIndex, &dwc->refSeqRange, &dwc->matchSeqRange, addHspLine, &lineData);
+
+  GdkGC *gc = gdk_gc_new(drawable);
 
   /* we'll clip the hsp lines to the dotplot drawing area */
   gdk_gc_set_clip_origin(gc, 0, 0);
   gdk_gc_set_clip_rectangle(gc, &properties->plotRect);
 
-  /* Loop through all MSPs */
-  MSP *msp = dc->mspList;
-  int sx, ex, sy, ey; /* start/end coordinates [0..n] */
-
-  for (msp = dc->mspList; msp;  msp = msp->next)
+  for (i = 0; i < 3; ++i)
     {
-      const char *mspName = getShortMspName(msp);
-      if (!mspName || strcmp(mspName, dc->matchSeqName) != 0)
-        {
-          /* Not an MSP from our sequence */
-          continue;
-        }
+      GArray *segments = lineData.segments[i];
 
-      getMspScreenCoords(msp, properties, &sx, &ex, &sy, &ey);
-
-      if (properties->hspMode == DOTTER_HSPS_LINE)
+      if (segments->len > 0)
         {
-          /* Draw in red */
-          GdkColor hspLineColor;
-          gdk_color_parse("red", &hspLineColor);
-          gdk_colormap_alloc_color(gdk_colormap_get_system(), &hspLineColor, TRUE, TRUE);
-          gdk_gc_set_foreground(gc, &hspLineColor);
-
-          gdk_draw_line(drawable, gc, sx, sy, ex, ey);
+          GdkColor *color = getGdkColor(colorIds[i], dc->defaultColors, FALSE, dwc->usePrintColors);
+          gdk_gc_set_foreground(gc, color);
+          gdk_draw_segments(drawable, gc, (GdkSegment*)segments->data, segments->len);
         }
-      else if (properties->hspMode == DOTTER_HSPS_FUNC)
-        {
-          /* Get color based on score: */
-          GdkColor scoreColor;
 
-          if (msp->score < 75.0)
-            {
-              gdk_color_parse("dark red", &scoreColor);
-            }
-          if (msp->score < 100.0)
-            {
-              gdk_color_parse("magenta", &scoreColor);
-            }
-          else
-            {
-              gdk_color_parse("red", &scoreColor);
-            }
-
-          gdk_colormap_alloc_color(gdk_colormap_get_system(), &scoreColor, TRUE, TRUE);
-          gdk_gc_set_foreground(gc, &scoreColor);
-
-          gdk_draw_line(drawable, gc, sx, sy, ex, ey);
-        }
+      g_array_free(segments, TRUE);
     }
 
   g_object_unref(gc);
@@ -514,6 +514,11 @@ static void createDotterColors(DotterContext *dc)
   createBlxColor(dc->defaultColors, DOTCOLOR_BREAKLINE, "Breakline color", "Color of the separator lines between sequences, if there were multiple sequences in the input file", BLX_GREEN, BLX_GREEN, NULL, NULL);
   createBlxColor(dc->defaultColors, DOTCOLOR_CANONICAL, "Canonical", "Canonical splice sites", BLX_GREEN, BLX_GREEN, NULL, NULL);
   createBlxColor(dc->defaultColors, DOTCOLOR_NON_CANONICAL, "Non-canonical", "Non-canonical splice sites", BLX_RED, BLX_RED, NULL, NULL);
+
+  /* hsps */
+  createBlxColor(dc->defaultColors, DOTCOLOR_HSP_LOW, "Low-scoring HSP", "Line color for HSPs with a score below 75", BLX_DARK_RED, BLX_DARK_RED, BLX_DARK_RED, BLX_DARK_RED);
+  createBlxColor(dc->defaultColors, DOTCOLOR_HSP_MEDIUM, "Medium-scoring HSP", "Line color for HSPs with a score below 100", BLX_MAGENTA, BLX_MAGENTA, BLX_MAGENTA, BLX_MAGENTA);
+  createBlxColor(dc->defaultColors, DOTCOLOR_HSP_HIGH, "HSP", "Line color for HSPs", BLX_RED, BLX_RED, BLX_RED, BLX_RED);
 }
 
 
@@ -610,6 +615,9 @@ static DotterContext* createDotterContext(DotterOptions *options,
   result->matchSeqType = (blastMode == BLXMODE_BLASTN ? BLXSEQ_DNA : BLXSEQ_PEPTIDE);
   result->matchSeqStrand = matchSeqStrand;
 
+  /* Only the MSPs for our match sequence are ever drawn, so index them now */
+  result->hspIndex = dotterHspIndexCreate(mspList, result->matchSeqName);
+
   result->refSeqFullRange.set(options->qoffset + 1, options->qoffset + strlen(options->qseq));
   result->matchSeqFullRange.set(options->soffset + 1, options->soffset + strlen(options->sseq));
 
@@ -649,6 +657,10 @@ static DotterContext* createDotterContext(DotterOptions *options,
       const gboolean rev = (result->hozScaleRev);
       char *refSeqToUse = (rev ? result->refSeqRev : result->refSeq);
 
+      /* Translate all frames in a single pass over the sequence */
+      char *translations[3];
+      blxTranslateFrames(refSeqToUse, result->geneticCode, result->numFrames, translations);
+
       int i = 0;
       for (i = 0; i < result->numFrames; i++)
         {
@@ -659,7 +671,7 @@ static DotterContext* createDotterContext(DotterOptions *options,
           int frame = UNSET_INT;
           convertToDisplayIdx(startCoord, TRUE, result, 1, &frame);
 
-          result->peptideSeqs[frame - 1] = blxTranslate(refSeqToUse + i, result->geneticCode);
+          result->peptideSeqs[frame - 1] = translations[i];
 
           DEBUG_OUT("Frame %d starts at coord %d for hoz seq strand = %d.\n", frame, startCoord, result->refSeqStrand);
         }
@@ -711,6 +723,8 @@ static void destroyDotterContext(DotterContext **dc)
       }
 
     /* destroy the msps, sequence structs and colors */
+    dotterHspIndexDestroy((*dc)->hspIndex);
+    (*dc)->hspIndex = NULL;
     destroyMspList(&(*dc)->mspList);
     destroyBlxSequenceList(&(*dc)->seqList);
     destroyDotterColors((*dc));
@@ -0,0 +1,205 @@
+/*  File: dotterHspIndex.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See dotterHspIndex.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <dotterApp/dotterHspIndex.hpp>
+
+
+#define HSP_INDEX_HSPS_PER_BIN   4        /* target average number of HSPs starting in each bin */
+#define HSP_INDEX_MAX_BINS       65536    /* upper limit on the number of bins */
+
+
+/* The HSPs are held in an array sorted by start coord on the reference sequence, and
+ * binned by reference-sequence coord. Each bin lists (as indexes into the HSP array) all
+ * the HSPs that overlap it, so an HSP spanning several bins appears in each of them. The
+ * bins are stored contiguously: the entries for bin i are binEntries[binStart[i]] to
+ * binEntries[binStart[i+1] - 1]. */
+struct _DotterHspIndex
+{
+  std::vector<const MSP*> hsps;
+  int qMin;                             /* min ref seq coord covered by the bins */
+  int binSize;                          /* number of ref seq coords in each bin */
+  int numBins;
+  std::vector<int> binStart;
+  std::vector<int> binEntries;
+};
+
+
+/* Utility to cut off anything before the ':' in an MSP name. Returns the full name if
+ * there is no colon. Returns a pointer into the original name, so the result should not
+ * be free'd */
+static const char* getShortMspName(const MSP* const msp)
+{
+  const char *result = NULL;
+  const char *sName = mspGetSName(msp);
+
+  if (sName)
+    {
+      const char *mspName = strchr(sName, ':');
+      result = mspName ? ++mspName : sName;
+    }
+
+  return result;
+}
+
+
+static int hspIndexGetBin(const DotterHspIndex *index, const int qCoord)
+{
+  int result = (qCoord - index->qMin) / index->binSize;
+  return std::max(0, std::min(result, index->numBins - 1));
+}
+
+
+/* Create an index of the MSPs in the given list that are for the given match sequence */
+DotterHspIndex* dotterHspIndexCreate(MSP *mspList, const char *matchSeqName)
+{
+  DotterHspIndex *index = new DotterHspIndex;
+  index->qMin = 0;
+  index->binSize = 1;
+  index->numBins = 0;
+
+  int qMax = 0;
+
+  for (const MSP *msp = mspList; msp; msp = msp->next)
+    {
+      const char *mspName = getShortMspName(msp);
+
+      if (mspName && matchSeqName && strcmp(mspName, matchSeqName) == 0)
+        {
+          if (index->hsps.empty() || msp->qRange.min() < index->qMin)
+            index->qMin = msp->qRange.min();
+
+          if (index->hsps.empty() || msp->qRange.max() > qMax)
+            qMax = msp->qRange.max();
+
+          index->hsps.push_back(msp);
+        }
+    }
+
+  if (index->hsps.empty())
+    return index;
+
+  std::sort(index->hsps.begin(), index->hsps.end(),
+            [](const MSP *a, const MSP *b) { return a->qRange.min() < b->qRange.min(); });
+
+  /* Choose a bin size that gives a few HSPs per bin on average */
+  const int numHsps = index->hsps.size();
+  const gint64 qSpan = (gint64)qMax - index->qMin + 1;
+  const int targetBins = std::max(1, std::min(numHsps / HSP_INDEX_HSPS_PER_BIN, HSP_INDEX_MAX_BINS));
+
+  index->binSize = std::max((gint64)1, (qSpan + targetBins - 1) / targetBins);
+  index->numBins = (qSpan + index->binSize - 1) / index->binSize;
+
+  /* Count the entries in each bin, then fill them in */
+  index->binStart.assign(index->numBins + 1, 0);
+
+  for (const MSP *msp : index->hsps)
+    {
+      const int lastBin = hspIndexGetBin(index, msp->qRange.max());
+
+      for (int bin = hspIndexGetBin(index, msp->qRange.min()); bin <= lastBin; ++bin)
+        ++index->binStart[bin + 1];
+    }
+
+  for (int bin = 0; bin < index->numBins; ++bin)
+    index->binStart[bin + 1] += index->binStart[bin];
+
+  index->binEntries.resize(index->binStart[index->numBins]);
+  std::vector<int> binFill(index->binStart.begin(), index->binStart.end() - 1);
+
+  for (int i = 0; i < numHsps; ++i)
+    {
+      const MSP *msp = index->hsps[i];
+      const int lastBin = hspIndexGetBin(index, msp->qRange.max());
+
+      for (int bin = hspIndexGetBin(index, msp->qRange.min()); bin <= lastBin; ++bin)
+        index->binEntries[binFill[bin]++] = i;
+    }
+
+  return index;
+}
+
+
+void dotterHspIndexDestroy(DotterHspIndex *index)
+{
+  delete index;
+}
+
+
+/* Return the number of HSPs in the index */
+int dotterHspIndexGetCount(const DotterHspIndex *index)
+{
+  return index ? index->hsps.size() : 0;
+}
+
+
+/* Call the given function on each HSP whose extent overlaps the given ref seq and match
+ * seq ranges. Each HSP is visited once, in order of start coord within each bin. */
+void dotterHspIndexForeach(const DotterHspIndex *index,
+                           const IntRange *qRange,
+                           const IntRange *sRange,
+                           DotterHspFunc func,
+                           gpointer data)
+{
+  if (!index || index->numBins < 1)
+    return;
+
+  const int qMax = index->qMin + index->numBins * index->binSize - 1;
+
+  if (qRange->max() < index->qMin || qRange->min() > qMax)
+    return;
+
+  const int firstBin = hspIndexGetBin(index, qRange->min());
+  const int lastBin = hspIndexGetBin(index, qRange->max());
+
+  for (int bin = firstBin; bin <= lastBin; ++bin)
+    {
+      for (int i = index->binStart[bin]; i < index->binStart[bin + 1]; ++i)
+        {
+          const MSP *msp = index->hsps[index->binEntries[i]];
+
+          /* An HSP that spans several bins is listed in each of them; only visit it from the
+           * first bin that is in the query range */
+          if (std::max(hspIndexGetBin(index, msp->qRange.min()), firstBin) != bin)
+            continue;
+
+          if (rangesOverlap(&msp->qRange, qRange) && rangesOverlap(&msp->sRange, sRange))
+            func(msp, data);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/*  File: dotterHspIndex.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Spatial index of the HSPs that Dotter draws over the dot-plot.
+ *
+ *              Only MSPs for Dotter's match sequence are ever drawn, so they
+ *              are filtered out of the full MSP list once, when the index is
+ *              created. They are then binned by reference-sequence coord so
+ *              that the HSPs overlapping the visible part of the plot can be
+ *              found without scanning the whole list.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _dotter_hsp_index_included_
+#define _dotter_hsp_index_included_
+
+#include <seqtoolsUtils/blxmsp.hpp>
+
+
+typedef struct _DotterHspIndex DotterHspIndex;
+
+/* Function called for each HSP found by dotterHspIndexForeach */
+typedef void (*DotterHspFunc)(const MSP *msp, gpointer data);
+
+
+DotterHspIndex*         dotterHspIndexCreate(MSP *mspList, const char *matchSeqName);
+void                    dotterHspIndexDestroy(DotterHspIndex *index);
+
+int                     dotterHspIndexGetCount(const DotterHspIndex *index);
+void                    dotterHspIndexForeach(const DotterHspIndex *index,
+                                              const IntRange *qRange,
+                                              const IntRange *sRange,
+                                              DotterHspFunc func,
+                                              gpointer data);
+
+
+#endif /* _dotter_hsp_index_included_ */
@@ -38,6 +38,7 @@
 #include <seqtoolsUtils/blxGff3Parser.hpp>
 #include <seqtoolsUtils/blxparser.hpp>
 #include <seqtoolsUtils/blxmsp.hpp>
+#include <seqtoolsUtils/blxPackedSeq.hpp>
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
@@ -147,6 +148,10 @@
 \n\
   --session_colour=<colour_str>\n\
     Set the background colour of the dotter window\n\
+\n\
+  --trace=<file>\n\
+    Write timing information to <file> on exit in Chrome trace-event format\n\
+    (or set the SEQTOOLS_TRACE environment variable to the file name)\n\
 \n\
   --compiled\n\
     Show package compile date\n\
@@ -413,6 +418,9 @@ int main(int argc, char **argv)
       {"negate-coords",         no_argument,        0, 'N'},
       {"session_colour",        required_argument,  0, 0},
       {"sleep",                 required_argument,  0, 0},
+      {"shared-data",           required_argument,  0, 0},
+      {"shared-ref",            required_argument,  0, 0},
+      {"trace",                 required_argument,  0, 0},
       {0, 0, 0, 0}
     };
 
@@ -422,6 +430,10 @@ int main(int argc, char **argv)
   int          optionIndex; /* getopt_long stores the index into the option struct here */
   int          optc;        /* the current option gets stored here */
   int sleepSecs = -1;
+  int sharedDataFd = -1;      /* shared memory segment passed by blixem/dotter, if any */
+  int sharedRefFd = -1;       /* packed reference sequence shared by blixem, if any */
+  int sharedRefOffset = 0;    /* index of our horizontal sequence in the shared reference sequence */
+  char *traceFile = NULL;     /* file to write timing trace to, if any */
 
   while ((optc = getopt_long(argc, argv, optstring, long_options, &optionIndex)) != EOF)
     {
@@ -458,6 +470,28 @@ int main(int argc, char **argv)
               {
                 sleepSecs = convertStringToInt(optarg);
               }
+            else if (stringsEqual(long_options[optionIndex].name, "shared-data", TRUE))
+              {
+                sharedDataFd = convertStringToInt(optarg);
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "shared-ref", TRUE))
+              {
+                const char *cp = strchr(optarg, ':');
+
+                if (cp)
+                  {
+                    sharedRefFd = atoi(optarg);
+                    sharedRefOffset = atoi(cp + 1);
+                  }
+                else
+                  {
+                    g_critical("Invalid value for shared-ref argument: expected <fd>:<offset> but got '%s'\n", optarg);
+                  }
+              }
+            else if (stringsEqual(long_options[optionIndex].name, "trace", TRUE))
+              {
+                traceFile = g_strdup(optarg);
+              }
             break;
 
 	  case '?':
@@ -513,6 +547,10 @@ int main(int argc, char **argv)
   if (sleepSecs > 0)
     usleep(sleepSecs * 1000);
 
+  /* Enable timing instrumentation, if requested by --trace or the environment */
+  seqtoolsTraceInit(traceFile);
+  g_free(traceFile);
+
   /* We're in batch mode if we've specified a save file or an export file */
   const gboolean batchMode = options.savefile || options.exportfile;
 
@@ -589,7 +627,54 @@ int main(int argc, char **argv)
       options.qlen = atoi(argv[optind + 1]);
       options.sname = g_strdup(argv[optind + 2]);
       options.slen = atoi(argv[optind + 3]);
+    }
+
+  if (options.selfcall && sharedDataFd >= 0)
+    {
+      /* The sequences and features have been passed in a shared memory segment. If we
+       * were also given the shared reference sequence then the horizontal sequence is not
+       * in the segment; we decode it from the reference sequence instead. */
+      DEBUG_OUT("Reading sequences and features from shared memory...\n");
+      GError *tmpError = NULL;
+
+      if (!blxPackedDataReadFromSharedMemory(sharedDataFd, sharedRefFd >= 0 ? 0 : options.qlen, options.slen,
+                                             &options.qseq, &options.sseq,
+                                             &seqList, &MSPlist, featureLists, &tmpError))
+        {
+          g_message("%s", tmpError->message);
+          exit(EXIT_FAILURE);
+        }
 
+      if (sharedRefFd >= 0)
+        {
+          BlxPackedSeq *refSeq = blxPackedSeqMapShared(sharedRefFd, &tmpError);
+
+          if (!refSeq)
+            {
+              g_message("%s", tmpError->message);
+              exit(EXIT_FAILURE);
+            }
+          else if (sharedRefOffset < 0 || sharedRefOffset + options.qlen > blxPackedSeqGetLength(refSeq))
+            {
+              g_message("Shared reference sequence segment %d - %d is out of range (length %d)\n",
+                        sharedRefOffset, sharedRefOffset + options.qlen, blxPackedSeqGetLength(refSeq));
+              exit(EXIT_FAILURE);
+            }
+
+          g_free(options.qseq);
+          options.qseq = blxPackedSeqDecodeNew(refSeq, sharedRefOffset, options.qlen, FALSE, FALSE);
+          blxPackedSeqDestroy(refSeq);
+        }
+
+      /* really horrible hack (see below) */
+      if (featureLists[BLXMSP_FS_SEG]->len > 0)
+        options.breaklinesOn = TRUE;
+
+      fclose(stdin);
+      DEBUG_OUT("...done.\n");
+    }
+  else if (options.selfcall)
+    {
       /* Allocate memory for the sequences, now we know their lengths */
       options.qseq = (char*)g_malloc(sizeof(char) * (options.qlen+1));
       options.sseq = (char*)g_malloc(sizeof(char) * (options.slen+1));
@@ -37,6 +37,7 @@
 #define _dotter_p_h_included_
 
 #include <dotterApp/dotter.hpp>
+#include <dotterApp/dotterHspIndex.hpp>
 #include <seqtoolsUtils/version.hpp>
 #include <config.h>
 
@@ -123,6 +124,9 @@ typedef enum
   DOTCOLOR_BREAKLINE,                       /* the color of break-lines between sequences */
   DOTCOLOR_CANONICAL,
   DOTCOLOR_NON_CANONICAL,
+  DOTCOLOR_HSP_LOW,                         /* color of HSP lines with a low score (if coloring by score) */
+  DOTCOLOR_HSP_MEDIUM,                      /* color of HSP lines with a medium score (if coloring by score) */
+  DOTCOLOR_HSP_HIGH,                        /* color of HSP lines with a high score, or all HSP lines if not coloring by score */
 
   DOTCOLOR_NUM_COLORS
 } DotterColorId;
@@ -156,6 +160,7 @@ typedef struct _DotterContext
   gint32 matrix[CONS_MATRIX_SIZE][CONS_MATRIX_SIZE];        /* matrix for determining conserved matches */
   char *matrixName;                         /* matrix name */
   MSP *mspList;                             /* list of all MSPs in dotter */
+  DotterHspIndex *hspIndex;                 /* the MSPs for the match sequence, indexed by position */
   GList *seqList;                           /* list of all matches sequences as BlxSequences */
   GSList *windowList;                       /* list of all windows that use this context */
 
@@ -39,13 +39,23 @@
 #include <seqtoolsUtils/blxmsp.hpp>
 #include <seqtoolsUtils/seqtoolsFetch.hpp>
 #include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <string>
+#include <algorithm>
 #include <map>
 
 using namespace std;
 
 
+/* The batch parser uses g_get_num_processors. configure checks for this version
+ * too, but fail clearly here in case the library was built some other way. */
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+#error "GLib 2.36 or greater is required"
+#endif
+
+
 /* globals */
 static std::map<GQuark, BlxDataType*> g_dataTypes;
 
@@ -53,6 +63,9 @@ static std::map<GQuark, BlxDataType*> g_dataTypes;
 #define SOURCE_DATA_TYPES_GROUP "source-data-types" /* group name for stanza where default data types are specified for sources */
 #define DATA_TYPE_TAG "dataType" /* tag name for dataType */
 
+#define GFF_BATCH_MAX_LINES    65536   /* max number of lines to collect in a batch before parsing them */
+#define GFF_BATCH_CHUNK_LINES  2048    /* number of lines in a batch that are parsed by a single thread */
+
 
 /* Error codes and domain */
 #define BLX_GFF3_ERROR g_quark_from_string("GFF 3 parser")
@@ -111,9 +124,44 @@ typedef struct _BlxGffData
     GQuark filename;    /* optional filename e.g. for fetching data from a bam file */
     char *fetchCommand; /* optional command which will be used for fetching sequence data */
     char *fetchArgs;    /* optional command which will be used for fetching sequence data */
+
+    GSList *messages;   /* warnings found while parsing the line; these are reported when the
+                         * blixem object is created because parsing may be done in a worker thread */
   } BlxGffData;
 
 
+/* A warning/info message saved while parsing a GFF line */
+typedef struct _GffMessage
+{
+  GLogLevelFlags logLevel;
+  char *text;
+} GffMessage;
+
+
+/* A batch of GFF body lines that are parsed together. The text of the lines
+ * is copied into a single buffer (each line terminated by a nul) and is then
+ * tokenised in place by the parser. */
+struct _BlxGffBatch
+{
+  GString *text;        /* the text of all the lines in the batch */
+  GArray *lineStarts;   /* offset into text of the start of each line */
+  GArray *lineNums;     /* line number in the input file of each line */
+};
+
+
+/* Data shared by the threads parsing a batch of GFF lines. Each thread
+ * parses a separate chunk of lines into its own section of the results
+ * arrays, so no locking is needed. */
+typedef struct _GffBatchParseData
+{
+  BlxGffBatch *batch;
+  GSList *supportedTypes;
+  const IntRange *refSeqRange;
+  BlxGffData *gffData;  /* array of results, one per line */
+  GError **errors;      /* array of errors, one per line */
+} GffBatchParseData;
+
+
 /* Data used while parsing a gap string */
 typedef struct _GapStringData
 {
@@ -128,23 +176,25 @@ typedef struct _GapStringData
   MSP **lastMsp;          /* the last msp in the main msp list */
   MSP **mspList;          /* the main msp list */
   GList **seqList;        /* the list of sequence structs */
+  GSList *lastGap;        /* the last item in the current msp's gaps list, so that we can append in constant time */
   GError *error;          /* gets set if there is an error */
 } GapStringData;
 
 
-static void           parseGffColumns(GString *line_string, const int lineNum, GList **seqList, GSList *supportedTypes, const IntRange* const refSeqRange, BlxGffData *gffData, GError **error);
-static void           parseAttributes(char *attributes, GList **seqList, const int lineNum, BlxGffData *gffData, GError **error);
-static void           parseTagDataPair(char *text, const int lineNum, GList **seqList, BlxGffData *gffData, GError **error);
-static void           parseNameTag(char *data, char **sName, const int lineNum, GError **error);
-static void           parseTargetTag(char *data, const int lineNum, GList **seqList, BlxGffData *gffData, GError **error);
-static void           parseCommandTag(char *data, const int lineNum, GList **seqList, BlxGffData *gffData, GError **error);
+static void           parseGffColumns(char *line, const int lineNum, GSList *supportedTypes, const IntRange* const refSeqRange, BlxGffData *gffData, GError **error);
+static void           parseAttributes(char *attributes, const int lineNum, BlxGffData *gffData, GError **error);
+static void           parseTagDataPair(char *text, const int lineNum, BlxGffData *gffData, GError **error);
+static void           parseNameTag(char *data, const int lineNum, BlxGffData *gffData, GError **error);
+static void           parseTargetTag(char *data, const int lineNum, BlxGffData *gffData, GError **error);
+static void           parseCommandTag(char *data, const int lineNum, BlxGffData *gffData, GError **error);
 static void           parseSequenceTag(const char *text, const int lineNum, BlxGffData *gffData, GError **error);
 static void           parseGapString(char *text, BlxGapFormat gapFormat, MSP *msp, const int resFactor, GArray* featureLists[], MSP **lastMsp, MSP **mspList, GList **seqList, GError **error);
 
 static BlxStrand      readStrand(char *token, GError **error);
 //static void           parseMspType(char *token, MSP *msp, GSList *supportedTypes, GError **error);
 static const char*           parseCigarStringSection(const char *text, GapStringData *data);
-static int            validateNumTokens(char **tokens, const int minReqd, const int maxReqd, GError **error);
+static int            splitInPlace(char *text, const char delimiter, char **tokens, const int maxTokens);
+static void           validateNumTokens(const int numTokens, const int minReqd, const int maxReqd, GError **error);
 //static void           validateMsp(const MSP *msp, GError **error);
 static void           addGffType(GSList **supportedTypes, const char *name, const char *soId, BlxMspType blxType);
 static void           destroyGffType(BlxGffType **gffType);
@@ -172,6 +222,63 @@ static void freeGffData(BlxGffData *gffData)
 }
 
 
+/* Initialise the given gffdata struct to its default (unset) values */
+static void initGffData(BlxGffData *gffData)
+{
+  memset(gffData, 0, sizeof(BlxGffData));
+
+  gffData->mspType = BLXMSP_NONE;
+  gffData->qStart = UNSET_INT;
+  gffData->qEnd = UNSET_INT;
+  gffData->score = UNSET_INT;
+  gffData->percentId = UNSET_INT;
+  gffData->qStrand = BLXSTRAND_NONE;
+  gffData->phase = UNSET_INT;
+  gffData->sStrand = BLXSTRAND_NONE;
+  gffData->sStart = UNSET_INT;
+  gffData->sEnd = UNSET_INT;
+  gffData->gapFormat = BLX_GAP_STRING_INVALID;
+}
+
+
+/* Save a warning message about the line being parsed. Parsing may happen in
+ * a worker thread, where we can't use the log handlers, so messages are
+ * reported later by reportGffMessages. */
+static void gffDataAddMessage(BlxGffData *gffData, const GLogLevelFlags logLevel, const char *formatStr, ...)
+{
+  va_list argp;
+  va_start(argp, formatStr);
+
+  GffMessage *message = g_new(GffMessage, 1);
+  message->logLevel = logLevel;
+  message->text = g_strdup_vprintf(formatStr, argp);
+
+  va_end(argp);
+
+  gffData->messages = g_slist_prepend(gffData->messages, message);
+}
+
+
+/* Report any messages that were saved while parsing the given line, and
+ * free the list. Must be called from the main thread. */
+static void reportGffMessages(BlxGffData *gffData)
+{
+  /* Messages were prepended so reverse them to report them in order */
+  gffData->messages = g_slist_reverse(gffData->messages);
+
+  for (GSList *item = gffData->messages; item; item = item->next)
+    {
+      GffMessage *message = (GffMessage*)(item->data);
+      g_log(G_LOG_DOMAIN, message->logLevel, "%s", message->text);
+      g_free(message->text);
+      g_free(message);
+    }
+
+  g_slist_free(gffData->messages);
+  gffData->messages = NULL;
+}
+
+
 /* Free all memory used by the given list of supported GFF types */
 void blxDestroyGffTypeList(GSList **supportedTypes)
 {
@@ -718,6 +825,69 @@ static void createBlixemObject(BlxGffData *gffData,
 }
 
 
+/* Report an error from parsing the given GFF line */
+static void reportGffLineError(GError *error, const int lineNum)
+{
+  static int num_errors = 0 ;
+  const int max_errors = 20 ; /* Limit the number of errors we report in case there are, say, thousands
+                               * of lines we can't read */
+
+  ++num_errors ;
+
+  if (num_errors <= max_errors)
+    {
+      prefixError(error, "[line %d] Error parsing GFF data. ", lineNum);
+      reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+    }
+  else if (num_errors == max_errors + 1)
+    {
+      g_warning("Truncating error report (more than %d errors in reading GFF file)\n", max_errors);
+      g_error_free(error);
+    }
+  else
+    {
+      g_error_free(error);
+    }
+}
+
+
+/* Create the blixem object for a GFF line that has been parsed into the given
+ * struct (or report the error if the parse failed). Must be called from the
+ * main thread, and lines must be processed in file order, because objects are
+ * linked to their parents by ID as they are created. */
+static void processParsedGffLine(BlxGffData *gffData,
+                                 GError *error,
+                                 const int lineNum,
+                                 GArray* featureLists[],
+                                 MSP **lastMsp,
+                                 MSP **mspList,
+                                 GList **seqList,
+                                 GList *columnList,
+                                 GSList *styles,
+                                 const int resFactor,
+                                 GKeyFile *keyFile,
+                                 GHashTable *lookupTable,
+                                 GHashTable *fetchMethods)
+{
+  reportGffMessages(gffData);
+
+  /* Create a blixem object based on the parsed data */
+  if (!error)
+    {
+      createBlixemObject(gffData, featureLists, lastMsp, mspList, seqList, columnList, styles, resFactor, keyFile, lookupTable, fetchMethods, &error);
+    }
+  else
+    {
+      g_free(gffData->sequence);
+      gffData->sequence = NULL;
+      freeGffData(gffData);
+    }
+
+  if (error)
+    reportGffLineError(error, lineNum);
+}
+
+
 /* Parse GFF3 data */
 void parseGff3Body(const int lineNum,
                    GArray* featureLists[],
@@ -737,45 +907,166 @@ void parseGff3Body(const int lineNum,
 {
   //DEBUG_ENTER("parseGff3Body [line=%d]", lineNum);
 
-  static int num_errors = 0 ;
-  const int max_errors = 20 ; /* Limit the number of errors we report in case there are, say, thousands
-                               * of lines we can't read */
-
-  /* Parse the data into a temporary struct */
-  BlxGffData gffData = {NULL, NULL, BLXMSP_NONE,
-                        UNSET_INT, UNSET_INT, UNSET_INT, UNSET_INT, BLXSTRAND_NONE, UNSET_INT,
-			NULL, NULL, BLXSTRAND_NONE,
-                        UNSET_INT, UNSET_INT, NULL, NULL, NULL, NULL, BLX_GAP_STRING_INVALID, 0, 0, NULL, NULL};
+  /* Parse the data into a temporary struct. Note that this tokenises the
+   * line in place. */
+  BlxGffData gffData;
+  initGffData(&gffData);
 
   GError *error = NULL;
-  parseGffColumns(line_string, lineNum, seqList, supportedTypes, refSeqRange, &gffData, &error);
+  parseGffColumns(line_string->str, lineNum, supportedTypes, refSeqRange, &gffData, &error);
 
-  /* Create a blixem object based on the parsed data */
-  if (!error)
+  processParsedGffLine(&gffData, error, lineNum, featureLists, lastMsp, mspList, seqList, columnList,
+                       styles, resFactor, keyFile, lookupTable, fetchMethods);
+
+  //DEBUG_EXIT("parseGff3Body");
+}
+
+
+/* Create an empty batch for collecting GFF body lines */
+BlxGffBatch* createGffBatch()
+{
+  BlxGffBatch *batch = g_new(BlxGffBatch, 1);
+
+  batch->text = g_string_sized_new(MAXLINE + 1);
+  batch->lineStarts = g_array_new(FALSE, FALSE, sizeof(gsize));
+  batch->lineNums = g_array_new(FALSE, FALSE, sizeof(int));
+
+  return batch;
+}
+
+
+void destroyGffBatch(BlxGffBatch **batch)
+{
+  if (batch && *batch)
     {
-      createBlixemObject(&gffData, featureLists, lastMsp, mspList, seqList, columnList, styles, resFactor, keyFile, lookupTable, fetchMethods, &error);
+      g_string_free((*batch)->text, TRUE);
+      g_array_free((*batch)->lineStarts, TRUE);
+      g_array_free((*batch)->lineNums, TRUE);
+      g_free(*batch);
+      *batch = NULL;
     }
+}
 
-  if (error)
+
+/* Add a line of GFF body data to the batch. The line is copied up to the
+ * first newline. Returns true if the batch is now full, in which case it
+ * should be parsed with parseGff3BodyBatch before adding more lines. */
+gboolean gffBatchAddLine(BlxGffBatch *batch, const char *line, const int lineNum)
+{
+  const char *lineEnd = strchr(line, '\n');
+  const gsize len = lineEnd ? (gsize)(lineEnd - line) : strlen(line);
+  const gsize lineStart = batch->text->len;
+
+  g_string_append_len(batch->text, line, len);
+  g_string_append_c(batch->text, '\0');
+
+  g_array_append_val(batch->lineStarts, lineStart);
+  g_array_append_val(batch->lineNums, lineNum);
+
+  return (batch->lineStarts->len >= GFF_BATCH_MAX_LINES);
+}
+
+
+/* Parse the given chunk of lines from a batch. This is thread-safe: it only
+ * reads the shared input and writes results for its own lines. */
+static void parseGffBatchChunk(GffBatchParseData *parseData, const int chunk)
+{
+  BlxGffBatch *batch = parseData->batch;
+  const int numLines = batch->lineStarts->len;
+  const int endIdx = min((chunk + 1) * GFF_BATCH_CHUNK_LINES, numLines);
+
+  for (int i = chunk * GFF_BATCH_CHUNK_LINES; i < endIdx; ++i)
     {
-      ++num_errors ;
+      char *line = batch->text->str + g_array_index(batch->lineStarts, gsize, i);
+      const int lineNum = g_array_index(batch->lineNums, int, i);
 
-      if (num_errors <= max_errors)
-        {
-          prefixError(error, "[line %d] Error parsing GFF data. ", lineNum);
-          reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
-        }
-      else if (num_errors == max_errors + 1)
+      initGffData(&parseData->gffData[i]);
+      parseGffColumns(line, lineNum, parseData->supportedTypes, parseData->refSeqRange, &parseData->gffData[i], &parseData->errors[i]);
+    }
+}
+
+
+/* Thread-pool function to parse a chunk of a batch. The chunk number is
+ * passed as the task data, offset by 1 because the thread pool does not
+ * accept null data. */
+static void parseGffBatchChunkThreadFunc(gpointer data, gpointer user_data)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_PARSE, "parseGffChunk");
+
+  parseGffBatchChunk((GffBatchParseData*)user_data, GPOINTER_TO_INT(data) - 1);
+}
+
+
+/* Parse all of the lines in the given batch of GFF body lines and create the
+ * blixem objects for them. The lines are parsed in chunks in parallel and
+ * then the objects are created in file order on this thread, so the result
+ * (including the linking of child features to parents by ID and Parent) is
+ * the same as parsing the lines one at a time with parseGff3Body. The batch
+ * is emptied ready for re-use. Does nothing if the batch is empty. */
+void parseGff3BodyBatch(BlxGffBatch *batch,
+                        GArray* featureLists[],
+                        MSP **lastMsp,
+                        MSP **mspList,
+                        GList **seqList,
+                        GList *columnList,
+                        GSList *supportedTypes,
+                        GSList *styles,
+                        const int resFactor,
+                        GKeyFile *keyFile,
+                        const IntRange* const refSeqRange,
+                        GHashTable *lookupTable,
+                        GHashTable *fetchMethods)
+{
+  const int numLines = batch ? batch->lineStarts->len : 0;
+
+  if (numLines < 1)
+    return;
+
+  GffBatchParseData parseData = {batch, supportedTypes, refSeqRange,
+                                 g_new(BlxGffData, numLines), g_new0(GError*, numLines)};
+
+  const int numChunks = (numLines + GFF_BATCH_CHUNK_LINES - 1) / GFF_BATCH_CHUNK_LINES;
+  const int numThreads = min(numChunks, (int)g_get_num_processors());
+
+  if (numThreads > 1)
+    {
+      GThreadPool *pool = g_thread_pool_new(parseGffBatchChunkThreadFunc, &parseData, numThreads, FALSE, NULL);
+
+      if (pool)
         {
-          g_warning("Truncating error report (more than %d errors in reading GFF file)\n", max_errors);
+          for (int chunk = 0; chunk < numChunks; ++chunk)
+            g_thread_pool_push(pool, GINT_TO_POINTER(chunk + 1), NULL);
+
+          /* Wait for all the chunks to finish */
+          g_thread_pool_free(pool, FALSE, TRUE);
         }
       else
         {
-          g_error_free(error);
+          for (int chunk = 0; chunk < numChunks; ++chunk)
+            parseGffBatchChunk(&parseData, chunk);
         }
     }
+  else
+    {
+      for (int chunk = 0; chunk < numChunks; ++chunk)
+        parseGffBatchChunk(&parseData, chunk);
+    }
 
-  //DEBUG_EXIT("parseGff3Body");
+  /* Create the objects in file order */
+  for (int i = 0; i < numLines; ++i)
+    {
+      processParsedGffLine(&parseData.gffData[i], parseData.errors[i], g_array_index(batch->lineNums, int, i),
+                           featureLists, lastMsp, mspList, seqList, columnList, styles, resFactor, keyFile,
+                           lookupTable, fetchMethods);
+    }
+
+  g_free(parseData.gffData);
+  g_free(parseData.errors);
+
+  /* Empty the batch */
+  g_string_truncate(batch->text, 0);
+  g_array_set_size(batch->lineStarts, 0);
+  g_array_set_size(batch->lineNums, 0);
 }
 
 
@@ -891,30 +1182,33 @@ static BlxStrand readStrand(char *token, GError **error)
 }
 
 
-/* Parse the columns in a GFF line and populate the parsed info into the given MSP. */
-static void parseGffColumns(GString *line_string,
+/* Parse the columns in a GFF line and populate the parsed info into the given struct. The
+ * line is tokenised in place, i.e. the tab delimiters are overwritten. This does not use the
+ * log handlers (warnings are saved in gffData instead) so it is safe to call from a worker
+ * thread. */
+static void parseGffColumns(char *line,
                             const int lineNum,
-                            GList **seqList,
                             GSList *supportedTypes,
                             const IntRange* const refSeqRange,
 			    BlxGffData *gffData,
                             GError **error)
 {
-    /* Split the line into its tab-separated columns. We should get 9 of them */
-  char **tokens = g_strsplit_set(line_string->str, "\t", -1);   /* -1 means do all tokens. */
+  /* Split the line into its tab-separated columns. We should get 8 or 9 of them */
+  char *tokens[9];
+  const int numTokens = splitInPlace(line, '\t', tokens, 9);
 
   /* This error should get set if there is a fatal error reading this line. */
   GError *tmpError = NULL;
 
-  validateNumTokens(tokens, 8, 9, &tmpError);
+  validateNumTokens(numTokens, 8, 9, &tmpError);
 
   if (!tmpError)
     {
       /* Reference sequence name */
-      gffData->qName = tokens[0] ? g_ascii_strup(tokens[0], -1) : NULL;
+      gffData->qName = g_ascii_strup(tokens[0], -1);
 
       /* Source (optional) */
-      if (tokens[1] && strcmp(tokens[1], "."))
+      if (strcmp(tokens[1], "."))
           {
             gffData->source = g_uri_unescape_string(tokens[1], NULL);
           }
@@ -970,7 +1264,7 @@ static void parseGffColumns(GString *line_string,
 
           if (gffData->mspType == BLXMSP_CDS)
             {
-              g_warning("[line %d] CDS type does not have phase specified.\n", lineNum);
+              gffDataAddMessage(gffData, G_LOG_LEVEL_WARNING, "[line %d] CDS type does not have phase specified.\n", lineNum);
             }
         }
       else
@@ -979,11 +1273,9 @@ static void parseGffColumns(GString *line_string,
         }
 
       /* Parse the optional attributes */
-      char *attributes = tokens[8];
-
-      if (attributes)
+      if (numTokens > 8)
         {
-          parseAttributes(attributes, seqList, lineNum, gffData, &tmpError);
+          parseAttributes(tokens[8], lineNum, gffData, &tmpError);
         }
     }
 
@@ -991,72 +1283,75 @@ static void parseGffColumns(GString *line_string,
     {
       g_propagate_error(error, tmpError);
     }
-
-  g_strfreev(tokens);
 }
 
 
 /* Parse the given text, which contains attributes of the format "tag=data". The data
  * can contain multiple values, separated by spaces. Space characters within the data must
- * be escaped. Populates the match sequence into 'sequence' if found in one of the attributes. */
+ * be escaped. Populates the match sequence into 'sequence' if found in one of the attributes.
+ * The text is tokenised in place. */
 static void parseAttributes(char *attributes,
-			    GList **seqList,
 			    const int lineNum,
 			    BlxGffData *gffData,
 			    GError **error)
 {
-  /* Attributes are separated by semi colons */
-  char **tokens = g_strsplit_set(attributes, ";", -1);   /* -1 means do all tokens. */
-
-  /* Loop through all the tags and read their data. */
-  char **token = tokens;
-  GError *tmpError = NULL;
+  /* Attributes are separated by semi colons. Loop through all the tags and read their
+   * data, stopping at the first empty one. Errors for individual tags are not fatal. */
+  char *token = attributes;
 
-  while (token && *token && **token && !tmpError)
+  while (token)
     {
-      parseTagDataPair(*token, lineNum, seqList, gffData, &tmpError);
-      reportAndClearIfError(&tmpError, G_LOG_LEVEL_CRITICAL);
-      ++token;
-    }
+      char *next = strchr(token, ';');
 
-  if (tmpError)
-    {
-      g_propagate_error(error, tmpError);
-    }
+      if (next)
+        *next++ = '\0';
+
+      if (*token == '\0')
+        break;
+
+      GError *tmpError = NULL;
+      parseTagDataPair(token, lineNum, gffData, &tmpError);
+
+      if (tmpError)
+        {
+          gffDataAddMessage(gffData, G_LOG_LEVEL_CRITICAL, "%s", tmpError->message);
+          g_error_free(tmpError);
+        }
 
-  g_strfreev(tokens);
+      token = next;
+    }
 }
 
 
-/* Parse a tag/data pair of the format "tag=data" */
+/* Parse a tag/data pair of the format "tag=data". The text is tokenised in place. */
 static void parseTagDataPair(char *text,
                              const int lineNum,
-                             GList **seqList,
 			     BlxGffData *gffData,
                              GError **error)
 {
   //DEBUG_ENTER("parseTagDataPair(text='%s')", text);
 
-  /* Split on the "=" and check that we get 3 tokens */
-  char **tokens = g_strsplit_set(text, "=", -1);
+  /* Split on the "=" and check that we get 2 tokens */
+  char *tokens[2];
+  const int numTokens = splitInPlace(text, '=', tokens, 2);
 
   GError *tmpError = NULL;
-  validateNumTokens(tokens, 2, 2, &tmpError);
+  validateNumTokens(numTokens, 2, 2, &tmpError);
 
   if (!tmpError)
     {
       /* Call the relevant function to parse data for this tag */
       if (!strcmp(tokens[0], "Name"))
         {
-          parseNameTag(tokens[1], &gffData->sName, lineNum, &tmpError);
+          parseNameTag(tokens[1], lineNum, gffData, &tmpError);
         }
       else if (!strcmp(tokens[0], "Target"))
         {
-          parseTargetTag(tokens[1], lineNum, seqList, gffData, &tmpError);
+          parseTargetTag(tokens[1], lineNum, gffData, &tmpError);
         }
       else if (!strcmp(tokens[0], "command"))
         {
-          parseCommandTag(tokens[1], lineNum, seqList, gffData, &tmpError);
+          parseCommandTag(tokens[1], lineNum, gffData, &tmpError);
         }
       else if (!strcmp(tokens[0], "Gap"))
         {
@@ -1094,10 +1389,12 @@ static void parseTagDataPair(char *text,
         }
       else if (!strcmp(tokens[0], "ID"))
         {
+          g_free(gffData->idTag);
           gffData->idTag = g_strdup(tokens[1]);
         }
       else if (!strcmp(tokens[0], "Parent"))
         {
+          g_free(gffData->parentIdTag);
 	  gffData->parentIdTag = g_strdup(tokens[1]);
         }
       else if (!strcmp(tokens[0], "percentID"))
@@ -1110,6 +1407,7 @@ static void parseTagDataPair(char *text,
         }
       else if (!strcmp(tokens[0], "variant_sequence"))
         {
+          g_free(gffData->sequence);
           gffData->sequence = g_strdup(tokens[1]);
         }
       else if (!strcmp(tokens[0], DATA_TYPE_TAG))
@@ -1128,57 +1426,56 @@ static void parseTagDataPair(char *text,
 
   if (tmpError)
     {
-      prefixError(tmpError, "Error processing data for tag '%s'. ", text);
+      prefixError(tmpError, "Error processing data for tag '%s'. ", tokens[0]);
       g_propagate_error(error, tmpError);
     }
 
-  g_strfreev(tokens);
-
   //DEBUG_EXIT("parseTagDataPair");
 }
 
 
 /* Parse the data from the 'Name' tag */
-static void parseNameTag(char *data, char **sName, const int lineNum, GError **error)
+static void parseNameTag(char *data, const int lineNum, BlxGffData *gffData, GError **error)
 {
   if (data)
     {
-      if (*sName == NULL)
+      if (gffData->sName == NULL)
 	{
-	  *sName = g_ascii_strup(data, -1);
+	  gffData->sName = g_ascii_strup(data, -1);
 	}
-      else if (!stringsEqual(data, *sName, FALSE))
+      else if (!stringsEqual(data, gffData->sName, FALSE))
 	{
-	  g_warning("[line %d] Warning: Name attribute '%s' differs from previously-set name '%s'. Ignoring new value.\n", lineNum, data, *sName);
+	  gffDataAddMessage(gffData, G_LOG_LEVEL_WARNING, "[line %d] Warning: Name attribute '%s' differs from previously-set name '%s'. Ignoring new value.\n", lineNum, data, gffData->sName);
 	}
     }
 }
 
 
-/* Parse the data from a 'Target' tag */
-static void parseTargetTag(char *data, const int lineNum, GList **seqList, BlxGffData *gffData, GError **error)
+/* Parse the data from a 'Target' tag. The data is tokenised in place. */
+static void parseTargetTag(char *data, const int lineNum, BlxGffData *gffData, GError **error)
 {
   /* Split on spaces */
-  char **tokens = g_strsplit_set(data, " ", -1); /* -1 means all tokens */
+  char *tokens[4];
+  const int numTokens = splitInPlace(data, ' ', tokens, 4);
 
   GError *tmpError = NULL;
-  int numTokens = validateNumTokens(tokens, 3, 4, &tmpError);
+  validateNumTokens(numTokens, 3, 4, &tmpError);
 
   if (!tmpError)
     {
       if (gffData->sName == NULL)
         {
-          gffData->sName = tokens[0] ? g_strdup(tokens[0]) : NULL;
-          gffData->sName_orig = tokens[0] ? g_ascii_strup(gffData->sName, -1) : NULL;
+          gffData->sName = g_strdup(tokens[0]);
+          gffData->sName_orig = g_ascii_strup(gffData->sName, -1);
         }
       else if (!stringsEqual(gffData->sName, tokens[0], FALSE))
         {
-          g_warning("[line %d] Warning: Target name '%s' differs from previously-set name '%s'. Overriding old value.\n", lineNum, tokens[0], gffData->sName);
+          gffDataAddMessage(gffData, G_LOG_LEVEL_WARNING, "[line %d] Warning: Target name '%s' differs from previously-set name '%s'. Overriding old value.\n", lineNum, tokens[0], gffData->sName);
 
           /* It's easiest if the Target tag overrides other values, because this is where we set
            * the name in the BlxSequence. */
           g_free(gffData->sName);
-          gffData->sName = tokens[0] ? g_ascii_strup(tokens[0], -1) : NULL;
+          gffData->sName = g_ascii_strup(tokens[0], -1);
         }
 
       gffData->sStart = convertStringToInt(tokens[1]);
@@ -1192,28 +1489,28 @@ static void parseTargetTag(char *data, const int lineNum, GList **seqList, BlxGf
 
    if (tmpError)
      {
-       prefixError(tmpError, "Error parsing 'Target' tag '%s'", data);
+       prefixError(tmpError, "Error parsing 'Target' tag '%s'", tokens[0]);
        g_propagate_error(error, tmpError);
      }
-
-  g_strfreev(tokens);
 }
 
 
-/* A function to replace all occurances of substring 'from' with substring 'to' in the given
- * string. Taken from http://stackoverflow.com/questions/3418231/replace-part-of-a-string-with-another-string */
-void stringReplace(string& str, const string& from, const string& to)
+/* Get the character for the given gff escape sequence (which must be at
+ * least 3 chars long), or 0 if it is not one that we unescape. */
+static char getGffEscapedChar(const char *cp)
 {
-  if(from.empty())
-    return;
+  char result = 0;
 
-  size_t start_pos = 0;
+  if (cp[1] == '3' && cp[2] == 'D')
+    result = '=';
+  else if (cp[1] == '3' && cp[2] == 'B')
+    result = ';';
+  else if (cp[1] == '2' && cp[2] == '6')
+    result = ',';
+  else if (cp[1] == '2' && cp[2] == 'C')
+    result = '&';
 
-  while((start_pos = str.find(from, start_pos)) != string::npos)
-    {
-      str.replace(start_pos, from.length(), to);
-      start_pos += to.length();
-    }
+  return result;
 }
 
 
@@ -1225,14 +1522,28 @@ static char* unescapeGffString(const char *src)
 
   if (src)
     {
-      string dest(src);
+      /* The result can only be shorter than the source, so unescape in a single pass
+       * into a buffer of the same length */
+      result = (char*)g_malloc(strlen(src) + 1);
+      char *dest = result;
+      const char *cp = src;
+
+      while (*cp)
+        {
+          const char escapedChar = (*cp == '%' && cp[1] && cp[2]) ? getGffEscapedChar(cp) : 0;
 
-      stringReplace(dest, "%3D", "=");
-      stringReplace(dest, "%3B", ";");
-      stringReplace(dest, "%26", ",");
-      stringReplace(dest, "%2C", "&");
+          if (escapedChar)
+            {
+              *dest++ = escapedChar;
+              cp += 3;
+            }
+          else
+            {
+              *dest++ = *cp++;
+            }
+        }
 
-      result = g_strdup(dest.c_str());
+      *dest = '\0';
     }
 
   return result;
@@ -1240,7 +1551,7 @@ static char* unescapeGffString(const char *src)
 
 
 /* Parse the data from a 'command' tag */
-static void parseCommandTag(char *data, const int lineNum, GList **seqList, BlxGffData *gffData, GError **error)
+static void parseCommandTag(char *data, const int lineNum, BlxGffData *gffData, GError **error)
 {
   if (data && !gffData->fetchCommand)
     {
@@ -1251,9 +1562,7 @@ static void parseCommandTag(char *data, const int lineNum, GList **seqList, BlxG
       if (cp)
         len = cp - data;
 
-      gffData->fetchCommand = (char*)g_malloc(sizeof(char) * (len + 1));
-      strncpy(gffData->fetchCommand, data, len);
-      gffData->fetchCommand[len] = '\0';
+      gffData->fetchCommand = g_strndup(data, len);
 
       if (cp)
         {
@@ -1267,6 +1576,7 @@ static void parseCommandTag(char *data, const int lineNum, GList **seqList, BlxG
 /* Parse the data from the 'sequence' tag */
 static void parseSequenceTag(const char *text, const int lineNum, BlxGffData *gffData, GError **error)
 {
+  g_free(gffData->sequence);
   gffData->sequence = g_strdup(text);
 }
 
@@ -1332,7 +1642,7 @@ static void parseGapString(char *text,
   GError *tmpError = NULL;
 
   GapStringData gapStringData = {gapFormat, &msp, qDirection, sDirection, resFactor, &q, &s,
-                                 featureLists, lastMsp, mspList, seqList, NULL};
+                                 featureLists, lastMsp, mspList, seqList, NULL, NULL};
 
   const char *cp = text;
 
@@ -1355,66 +1665,50 @@ static void parseGapString(char *text,
 }
 
 
-/* Get the length part of a gap string section, e.g. if the text is "M76"
- * then this returns 76 */
-static int getCigarStringSectionLen(const char *text, BlxGapFormat gapFormat)
+/* Get the length and operator parts of a gap string section, e.g. if the text is "M76"
+ * (or "76M" for a bam cigar) then this returns 76 and sets the operator to 'M'. Sets
+ * cp_out to point to the start of the next section. This scans the text once rather than
+ * once for the length and again for the operator. */
+static int getCigarStringSection(const char *text, BlxGapFormat gapFormat, char *op_out, const char **cp_out)
 {
   int result = 0;
+  char op = 0;
+  char *cp = (char*)text;
 
   switch (gapFormat)
     {
     case BLX_GAP_STRING_GFF3: /* e.g. M76 */
-      result = convertStringToInt(text+1);
-      break;
+      op = *cp;
+      result = (int)strtol(cp + 1, &cp, 10);
 
-    case BLX_GAP_STRING_BAM_CIGAR: /* e.g. 76M */
-      result = convertStringToInt(text); /* uses atoi, which will ignore characters after */
-      break;
+      /* Move cp on to the start of the next section in the cigar, i.e. next alpha char */
+      for ( ; *cp && !isalpha(*cp); ++cp);
 
-    default:
-      g_warning("Invalid gap string format\n");
       break;
-    };
 
-  return result;
-}
+    case BLX_GAP_STRING_BAM_CIGAR: /* e.g. 76M */
+      result = (int)strtol(cp, &cp, 10);
 
+      for ( ; *cp && !isalpha(*cp); ++cp); /* find first alphabetic character */
 
-/* Get the operator part of a gap string section, e.g. if the text is "M76"
- * then this returns 'M' */
-static char getCigarStringSectionOperator(const char *text, BlxGapFormat gapFormat, const char **cp_out)
-{
-  char result = 0;
-  const char *cp = text;
+      op = *cp;
 
-  switch (gapFormat)
-    {
-    case BLX_GAP_STRING_GFF3:
-      result = *cp;
+      /* Move cp on to the start of the next section in the cigar, i.e. next digit */
+      if (*cp)
+        ++cp;
 
-      /* Move cp on to the start of the next section in the cigar, i.e. next alpha char */
-      for (++cp ; cp && *cp && !isalpha(*cp); ++cp);
+      for ( ; *cp && !isdigit(*cp); ++cp);
 
       break;
 
-    case BLX_GAP_STRING_BAM_CIGAR:
-      {
-        for ( ; cp && *cp && !isalpha(*cp); ++cp); /* find first alphabetic character */
-
-        if (cp)
-          result = *cp;
-
-        /* Move cp on to the start of the next section in the cigar, i.e. next digit */
-        for (cp++ ; cp && *cp && !isdigit(*cp); ++cp);
-
-        break;
-      }
-
     default:
       g_warning("Invalid gap string format\n");
       break;
     };
 
+  if (op_out)
+    *op_out = op;
+
   if (cp_out)
     *cp_out = cp;
 
@@ -1435,7 +1729,18 @@ static void parseCigarStringMatch(GapStringData *data, const int numNucleotides,
   int newS = *data->s + (data->sDirection * (numPeptides - 1));
 
   CoordRange *newRange = new CoordRange;
-  msp->gaps = g_slist_append(msp->gaps, newRange);
+
+  /* Append to the gaps list, using the tail pointer if we have it to avoid walking the whole list */
+  if (data->lastGap)
+    {
+      g_slist_append(data->lastGap, newRange);
+      data->lastGap = data->lastGap->next;
+    }
+  else
+    {
+      msp->gaps = g_slist_append(msp->gaps, newRange);
+      data->lastGap = g_slist_last(msp->gaps);
+    }
 
   newRange->qStart = *data->q;
   newRange->qEnd = newQ;
@@ -1478,6 +1783,7 @@ static void parseCigarStringIntron(GapStringData *data, const int numNucleotides
     newMsp->sRange.setMax(*data->s - 1);
 
   *data->msp = newMsp;
+  data->lastGap = NULL;
 }
 
 static void parseCigarStringDeletion(GapStringData *data, const int numNucleotides, const int numPeptides)
@@ -1555,11 +1861,10 @@ static const char* parseCigarStringSection(const char *text,
 {
   /* Get the digit part of the string, which indicates the number of display coords (peptides in peptide matches,
    * nucleotides in nucelotide matches). */
-  const int numPeptides = getCigarStringSectionLen(text, data->gapFormat);
-  int numNucleotides = numPeptides * data->resFactor;
-
   const char *cp = text;
-  char op = getCigarStringSectionOperator(text, data->gapFormat, &cp);
+  char op = 0;
+  const int numPeptides = getCigarStringSection(text, data->gapFormat, &op, &cp);
+  int numNucleotides = numPeptides * data->resFactor;
 
   /*! \todo If the operator is not valid for this type of cigar string
    * then we should set the error and return. However, for historic
@@ -1643,28 +1948,43 @@ static const char* parseCigarStringSection(const char *text,
 }
 
 
-/* Validate the number of tokens in a given list. Checks that there are between 'min' and 'max'
- * tokens. If not, set the error. Returns the number of tokens. */
-static int validateNumTokens(char **tokens, const int minReqd, const int maxReqd, GError **error)
+/* Split the given text in place on the given delimiter, i.e. replace each delimiter with
+ * a terminating nul. Pointers to the start of the first maxTokens tokens are placed in
+ * 'tokens'. Returns the total number of tokens, which may be more than maxTokens. This gives
+ * the same tokens as g_strsplit but without allocating memory. */
+static int splitInPlace(char *text, const char delimiter, char **tokens, const int maxTokens)
 {
-  char **token = tokens;
   int count = 0;
+  char *cp = text;
 
-  while (token && *token)
+  while (cp)
     {
+      if (count < maxTokens)
+        tokens[count] = cp;
+
       ++count;
-      ++token;
-    }
 
-  if (count < minReqd || count > maxReqd)
-    {
-      g_set_error(error, BLX_GFF3_ERROR, BLX_GFF3_ERROR_INVALID_NUM_TOKENS, "Expected between %d and %d columns but found %d\n", minReqd, maxReqd, count);
+      cp = strchr(cp, delimiter);
+
+      if (cp)
+        *cp++ = '\0';
     }
 
   return count;
 }
 
 
+/* Validate the number of tokens found. Checks that there are between 'min' and 'max'
+ * tokens. If not, set the error. */
+static void validateNumTokens(const int numTokens, const int minReqd, const int maxReqd, GError **error)
+{
+  if (numTokens < minReqd || numTokens > maxReqd)
+    {
+      g_set_error(error, BLX_GFF3_ERROR, BLX_GFF3_ERROR_INVALID_NUM_TOKENS, "Expected between %d and %d columns but found %d\n", minReqd, maxReqd, numTokens);
+    }
+}
+
+
 /* Create a gff type with the given info and add it to the given list */
 static void addGffType(GSList **supportedTypes, const char *name, const char *soId, BlxMspType blxType)
 {
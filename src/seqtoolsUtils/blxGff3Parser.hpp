@@ -54,6 +54,10 @@ typedef struct _BlxGffType
   } BlxGffType;
 
 
+/* A batch of GFF body lines that are parsed together (see parseGff3BodyBatch) */
+typedef struct _BlxGffBatch BlxGffBatch;
+
+
 
 /* This enum is to record the type of data currently being parsed by the parser. An input file can
  * contain multiple types of data. The start of a new section of data is indicated by a header
@@ -131,6 +135,24 @@ void parseGff3Body(const int lineNum,
                    GHashTable *lookupTable,
                    GHashTable *fetchMethods);
 
+BlxGffBatch* createGffBatch();
+void destroyGffBatch(BlxGffBatch **batch);
+gboolean gffBatchAddLine(BlxGffBatch *batch, const char *line, const int lineNum);
+
+void parseGff3BodyBatch(BlxGffBatch *batch,
+                        GArray* featureLists[],
+                        MSP **lastMsp,
+                        MSP **mspList,
+                        GList **seqList,
+                        GList *columnList,
+                        GSList *supportedTypes,
+                        GSList *styles,
+                        const int resFactor,
+                        GKeyFile *keyFile,
+                        const IntRange* const refSeqRange,
+                        GHashTable *lookupTable,
+                        GHashTable *fetchMethods);
+
 void parseFastaSeqHeader(char *line, const int lineNum,
                          char **refSeq, char *refSeqName, IntRange *refSeqRange,
                          char ***readSeq, int *readSeqLen, int *readSeqMaxLen,
@@ -0,0 +1,594 @@
+/*  File: blxIndexedSeq.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See blxIndexedSeq.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <seqtoolsUtils/blxIndexedSeq.hpp>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* Error codes and domain */
+#define BLX_INDEXED_SEQ_ERROR g_quark_from_string("IndexedSeq")
+
+typedef enum {
+  BLX_INDEXED_SEQ_ERROR_OPEN,          /* could not open or read the file/index */
+  BLX_INDEXED_SEQ_ERROR_FORMAT,        /* the file/index is not in the expected format */
+  BLX_INDEXED_SEQ_ERROR_NOT_FOUND,     /* the requested sequence is not in the file */
+  BLX_INDEXED_SEQ_ERROR_RANGE,         /* the requested region is not valid */
+} BlxIndexedSeqError;
+
+
+#define FAI_SUFFIX              ".fai"
+#define TWO_BIT_SUFFIX          ".2bit"
+#define TWO_BIT_SIGNATURE       0x1A412743
+
+
+/* Details of the region that was requested */
+typedef struct _SeqRegion
+{
+  char *name;                   /* sequence name, or NULL for the first sequence in the file */
+  int start;                    /* 1-based start coord, or UNSET_INT for the start of the sequence */
+  int end;                      /* 1-based end coord, or UNSET_INT for the end of the sequence */
+} SeqRegion;
+
+
+/* Returns true if the given file is a FASTA file with a .fai index, or a .2bit file */
+gboolean indexedSeqFileIsIndexed(const char *filename)
+{
+  if (!filename)
+    return FALSE;
+
+  if (indexedSeqFileIsTwoBit(filename))
+    return TRUE;
+
+  char *faiFilename = g_strconcat(filename, FAI_SUFFIX, NULL);
+  const gboolean result = g_file_test(faiFilename, G_FILE_TEST_IS_REGULAR);
+  g_free(faiFilename);
+
+  return result;
+}
+
+
+gboolean indexedSeqFileIsTwoBit(const char *filename)
+{
+  return filename && g_str_has_suffix(filename, TWO_BIT_SUFFIX);
+}
+
+
+/* Parse a samtools-style region string, i.e. "name" or "name:start-end". Commas are
+ * allowed as thousands separators in the coords. */
+static void parseRegion(const char *regionStr, SeqRegion *region)
+{
+  region->name = NULL;
+  region->start = UNSET_INT;
+  region->end = UNSET_INT;
+
+  if (!regionStr || !*regionStr)
+    return;
+
+  const char *cp = strrchr(regionStr, ':');
+
+  if (cp)
+    {
+      /* Strip commas from the coords */
+      char *coords = g_strdup(cp + 1);
+      char *dest = coords;
+
+      for (const char *src = coords; *src; ++src)
+        {
+          if (*src != ',')
+            *dest++ = *src;
+        }
+
+      *dest = '\0';
+
+      int start = 0, end = 0;
+      char extra = '\0';
+
+      if (sscanf(coords, "%d-%d%c", &start, &end, &extra) == 2)
+        {
+          region->name = g_strndup(regionStr, cp - regionStr);
+          region->start = start;
+          region->end = end;
+        }
+
+      g_free(coords);
+    }
+
+  if (!region->name)
+    region->name = g_strdup(regionStr);
+}
+
+
+/* Check the requested region against the length of the sequence and fill in any unset
+ * coords. Returns false and sets the error if the region is invalid. */
+static gboolean validateRegion(SeqRegion *region, const char *seqName, const int seqLen, GError **error)
+{
+  if (region->start == UNSET_INT)
+    region->start = 1;
+
+  if (region->end == UNSET_INT)
+    region->end = seqLen;
+
+  if (region->start < 1 || region->end > seqLen || region->start > region->end)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_RANGE,
+                  "Invalid region %d-%d for sequence '%s' (sequence length is %d)\n",
+                  region->start, region->end, seqName, seqLen);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Check that the given sequence contains only valid chars, replacing any non-ascii
+ * chars (which GTK can't display) with the padding char. This is the bulk equivalent of
+ * validating each char as it is read from a FASTA file; we give a single warning rather
+ * than one per char. */
+static void validateSeq(char *seq, const int len, const BlxSeqType seqType)
+{
+  gboolean valid[256];
+
+  for (int c = 0; c < 256; ++c)
+    valid[c] = isValidIupacChar((char)c, seqType);
+
+  int numInvalid = 0;
+  int numReplaced = 0;
+  char firstInvalid = '\0';
+
+  for (int i = 0; i < len; ++i)
+    {
+      const unsigned char c = seq[i];
+
+      if (!valid[c])
+        {
+          if (c >= 0x80)
+            {
+              seq[i] = SEQUENCE_CHAR_INVALID;
+              ++numReplaced;
+            }
+          else if (numInvalid++ == 0)
+            {
+              firstInvalid = c;
+            }
+        }
+    }
+
+  if (numInvalid > 0)
+    g_critical("FASTA input contains %d invalid %s character(s), e.g. '%c'\n", numInvalid, (seqType == BLXSEQ_PEPTIDE ? "peptide" : "nucleotide"), firstInvalid);
+
+  if (numReplaced > 0)
+    g_critical("FASTA input contains %d bad (non-UTF8) character(s) - they will be replaced by '%c'\n", numReplaced, SEQUENCE_CHAR_INVALID);
+}
+
+
+/*******************************************************************
+ *                      FASTA with .fai index                      *
+ *******************************************************************/
+
+/* One line from a .fai file */
+typedef struct _FaiEntry
+{
+  gint64 length;                /* number of bases in the sequence */
+  gint64 offset;                /* file offset of the first base */
+  gint64 lineBases;             /* number of bases on each line */
+  gint64 lineWidth;             /* number of bytes on each line, including the newline */
+} FaiEntry;
+
+
+/* Find the entry for the given sequence in the .fai index (or the first entry if name is
+ * null). Returns false if not found. The sequence name is returned in seqName_out. */
+static gboolean faiFindEntry(const char *faiFilename, const char *name, FaiEntry *entry,
+                             char *seqName_out, const gsize seqNameSize, GError **error)
+{
+  char *contents = NULL;
+
+  if (!g_file_get_contents(faiFilename, &contents, NULL, error))
+    return FALSE;
+
+  gboolean found = FALSE;
+  char **lines = g_strsplit(contents, "\n", -1);
+
+  for (char **line = lines; *line && !found; ++line)
+    {
+      char **fields = g_strsplit(*line, "\t", -1);
+
+      if (g_strv_length(fields) >= 5 && (!name || strcmp(fields[0], name) == 0))
+        {
+          entry->length = g_ascii_strtoll(fields[1], NULL, 10);
+          entry->offset = g_ascii_strtoll(fields[2], NULL, 10);
+          entry->lineBases = g_ascii_strtoll(fields[3], NULL, 10);
+          entry->lineWidth = g_ascii_strtoll(fields[4], NULL, 10);
+
+          g_strlcpy(seqName_out, fields[0], seqNameSize);
+          found = TRUE;
+        }
+
+      g_strfreev(fields);
+    }
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  if (!found)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_NOT_FOUND, "Sequence '%s' not found in index '%s'\n", name ? name : "", faiFilename);
+    }
+  else if (entry->lineBases < 1 || entry->lineWidth < entry->lineBases || entry->length < 0 || entry->offset < 0)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_FORMAT, "Invalid entry for sequence '%s' in index '%s'\n", seqName_out, faiFilename);
+      found = FALSE;
+    }
+
+  return found;
+}
+
+
+/* Get the file offset of the given 0-based base index */
+static gint64 faiGetOffset(const FaiEntry *entry, const gint64 idx)
+{
+  return entry->offset + (idx / entry->lineBases) * entry->lineWidth + idx % entry->lineBases;
+}
+
+
+static char* readFaiSeq(const char *filename, SeqRegion *region, char *seqName_out, const gsize seqNameSize,
+                        const BlxSeqType seqType, GError **error)
+{
+  char *faiFilename = g_strconcat(filename, FAI_SUFFIX, NULL);
+  FaiEntry entry;
+
+  const gboolean found = faiFindEntry(faiFilename, region->name, &entry, seqName_out, seqNameSize, error);
+  g_free(faiFilename);
+
+  if (!found || !validateRegion(region, seqName_out, entry.length, error))
+    return NULL;
+
+  /* Read the bytes that span the region, including any newlines, in one go */
+  const gint64 fileStart = faiGetOffset(&entry, region->start - 1);
+  const gint64 fileEnd = faiGetOffset(&entry, region->end - 1);
+  const gsize numBytes = fileEnd - fileStart + 1;
+
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_OPEN, "Cannot open '%s': %s\n", filename, g_strerror(errno));
+      return NULL;
+    }
+
+  char *result = (char*)g_malloc(numBytes + 1);
+  gsize numRead = 0;
+
+  while (numRead < numBytes)
+    {
+      const ssize_t n = pread(fd, result + numRead, numBytes - numRead, fileStart + numRead);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        break;
+
+      numRead += n;
+    }
+
+  close(fd);
+
+  if (numRead < numBytes)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_OPEN, "Error reading '%s': expected %lu bytes but only read %lu\n",
+                  filename, (unsigned long)numBytes, (unsigned long)numRead);
+      g_free(result);
+      return NULL;
+    }
+
+  /* Strip the line endings in place */
+  char *dest = result;
+
+  for (gsize i = 0; i < numBytes; ++i)
+    {
+      if (result[i] != '\n' && result[i] != '\r')
+        *dest++ = result[i];
+    }
+
+  *dest = '\0';
+
+  const int len = dest - result;
+
+  if (len != region->end - region->start + 1)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_FORMAT,
+                  "Read %d bases for region %s:%d-%d but expected %d; the index may be out of date\n",
+                  len, seqName_out, region->start, region->end, region->end - region->start + 1);
+      g_free(result);
+      return NULL;
+    }
+
+  validateSeq(result, len, seqType);
+
+  return result;
+}
+
+
+/*******************************************************************
+ *                         UCSC .2bit files                        *
+ *******************************************************************/
+
+/* A memory-mapped .2bit file */
+typedef struct _TwoBitFile
+{
+  const guchar *data;
+  gsize size;
+  gboolean swap;                /* whether the file's byte order differs from ours */
+  gboolean offsets64;           /* version 1 files have 64-bit sequence offsets */
+  gsize pos;                    /* current read position */
+  gboolean overrun;             /* set if we tried to read beyond the end of the file */
+} TwoBitFile;
+
+
+static guint32 twoBitReadInt(TwoBitFile *tb)
+{
+  if (tb->pos + 4 > tb->size)
+    {
+      tb->overrun = TRUE;
+      return 0;
+    }
+
+  guint32 result;
+  memcpy(&result, tb->data + tb->pos, 4);
+  tb->pos += 4;
+
+  return tb->swap ? GUINT32_SWAP_LE_BE(result) : result;
+}
+
+
+static guint64 twoBitReadOffset(TwoBitFile *tb)
+{
+  if (!tb->offsets64)
+    return twoBitReadInt(tb);
+
+  if (tb->pos + 8 > tb->size)
+    {
+      tb->overrun = TRUE;
+      return 0;
+    }
+
+  guint64 result;
+  memcpy(&result, tb->data + tb->pos, 8);
+  tb->pos += 8;
+
+  return tb->swap ? GUINT64_SWAP_LE_BE(result) : result;
+}
+
+
+/* Apply the given N or mask blocks to the region [start, end) of the sequence. The block
+ * arrays are at the current position in the file. */
+static void twoBitApplyBlocks(TwoBitFile *tb, const guint32 numBlocks, const int start, const int end,
+                              char *seq, const gboolean isMask)
+{
+  const gsize startsPos = tb->pos;
+  const gsize sizesPos = startsPos + (gsize)numBlocks * 4;
+
+  for (guint32 i = 0; i < numBlocks && !tb->overrun; ++i)
+    {
+      tb->pos = startsPos + (gsize)i * 4;
+      const gint64 blockStart = twoBitReadInt(tb);
+      tb->pos = sizesPos + (gsize)i * 4;
+      const gint64 blockEnd = blockStart + twoBitReadInt(tb);
+
+      const gint64 from = MAX(blockStart, (gint64)start);
+      const gint64 to = MIN(blockEnd, (gint64)end);
+
+      for (gint64 j = from; j < to; ++j)
+        seq[j - start] = isMask ? g_ascii_tolower(seq[j - start]) : 'N';
+    }
+
+  tb->pos = sizesPos + (gsize)numBlocks * 4;
+}
+
+
+static char* readTwoBitSeq(const char *filename, SeqRegion *region, char *seqName_out, const gsize seqNameSize,
+                           const BlxSeqType seqType, GError **error)
+{
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_OPEN, "Cannot open '%s': %s\n", filename, g_strerror(errno));
+
+      if (fd >= 0)
+        close(fd);
+
+      return NULL;
+    }
+
+  TwoBitFile tb = {NULL, (gsize)st.st_size, FALSE, FALSE, 0, FALSE};
+  void *mapped = (st.st_size > 0) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (mapped == MAP_FAILED)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_OPEN, "Cannot map '%s': %s\n", filename, g_strerror(errno));
+      return NULL;
+    }
+
+  tb.data = (const guchar*)mapped;
+
+  /* Header: signature, version, sequence count, reserved */
+  char *result = NULL;
+  guint32 signature = twoBitReadInt(&tb);
+
+  if (signature != TWO_BIT_SIGNATURE)
+    {
+      tb.swap = TRUE;
+      signature = GUINT32_SWAP_LE_BE(signature);
+    }
+
+  const guint32 version = twoBitReadInt(&tb);
+  const guint32 seqCount = twoBitReadInt(&tb);
+  twoBitReadInt(&tb);
+
+  tb.offsets64 = (version == 1);
+
+  if (signature != TWO_BIT_SIGNATURE || version > 1 || tb.overrun)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_FORMAT, "'%s' is not a valid .2bit file\n", filename);
+      munmap(mapped, tb.size);
+      return NULL;
+    }
+
+  /* Look up the sequence in the index */
+  guint64 seqOffset = 0;
+  gboolean found = FALSE;
+
+  for (guint32 i = 0; i < seqCount && !found && !tb.overrun; ++i)
+    {
+      const guint32 nameLen = (tb.pos < tb.size) ? tb.data[tb.pos] : 0;
+      const char *name = (const char*)tb.data + tb.pos + 1;
+      tb.pos += 1 + nameLen;
+
+      const guint64 offset = twoBitReadOffset(&tb);
+
+      if (!tb.overrun && (!region->name || (strlen(region->name) == nameLen && strncmp(name, region->name, nameLen) == 0)))
+        {
+          /* The names in the index are not nul-terminated */
+          const gsize copyLen = MIN((gsize)nameLen, seqNameSize - 1);
+          memcpy(seqName_out, name, copyLen);
+          seqName_out[copyLen] = '\0';
+          seqOffset = offset;
+          found = TRUE;
+        }
+    }
+
+  if (!found)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_NOT_FOUND, "Sequence '%s' not found in '%s'\n", region->name ? region->name : "", filename);
+      munmap(mapped, tb.size);
+      return NULL;
+    }
+
+  /* Sequence record: dna size, N blocks, mask blocks, reserved, packed dna */
+  tb.pos = seqOffset;
+  const guint32 dnaSize = twoBitReadInt(&tb);
+
+  if (!tb.overrun && validateRegion(region, seqName_out, dnaSize, error))
+    {
+      const int start = region->start - 1; /* 0-based, half-open */
+      const int end = region->end;
+      const int len = end - start;
+
+      const gsize nBlocksPos = tb.pos;
+      const guint32 nBlockCount = twoBitReadInt(&tb);
+      tb.pos += (gsize)nBlockCount * 8;
+      const guint32 maskBlockCount = twoBitReadInt(&tb);
+      tb.pos += (gsize)maskBlockCount * 8;
+      twoBitReadInt(&tb); /* reserved */
+
+      const gsize dnaPos = tb.pos;
+
+      if (tb.overrun || dnaPos + ((gsize)end + 3) / 4 > tb.size)
+        {
+          g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_FORMAT, "'%s' is truncated\n", filename);
+        }
+      else
+        {
+          /* Unpack the bases; each byte holds 4 bases, most significant bits first */
+          static const char bases[] = "TCAG";
+          result = (char*)g_malloc(len + 1);
+
+          for (int i = start; i < end; ++i)
+            {
+              const guchar packed = tb.data[dnaPos + i / 4];
+              result[i - start] = bases[(packed >> (6 - 2 * (i % 4))) & 3];
+            }
+
+          result[len] = '\0';
+
+          /* Now apply the N blocks and lower-case mask blocks */
+          tb.pos = nBlocksPos;
+          twoBitReadInt(&tb);
+          twoBitApplyBlocks(&tb, nBlockCount, start, end, result, FALSE);
+          twoBitReadInt(&tb);
+          twoBitApplyBlocks(&tb, maskBlockCount, start, end, result, TRUE);
+
+          validateSeq(result, len, seqType);
+        }
+    }
+  else if (tb.overrun)
+    {
+      g_set_error(error, BLX_INDEXED_SEQ_ERROR, BLX_INDEXED_SEQ_ERROR_FORMAT, "'%s' is truncated\n", filename);
+    }
+
+  munmap(mapped, tb.size);
+
+  return result;
+}
+
+
+/* Read the given region of a sequence from an indexed FASTA file or a .2bit file.
+ * The region is in samtools format ("name" or "name:start-end"); if it is null, the
+ * whole of the first sequence in the file is read. On success, returns the sequence
+ * (which should be free'd with g_free), the name of the sequence in seqName_out and
+ * the 1-based coords that were read in range_out. */
+char* readIndexedSeq(const char *filename,
+                     const char *regionStr,
+                     char *seqName_out,
+                     const gsize seqNameSize,
+                     IntRange *range_out,
+                     const BlxSeqType seqType,
+                     GError **error)
+{
+  SeqRegion region;
+  parseRegion(regionStr, &region);
+
+  char *result = NULL;
+
+  if (indexedSeqFileIsTwoBit(filename))
+    result = readTwoBitSeq(filename, &region, seqName_out, seqNameSize, seqType, error);
+  else
+    result = readFaiSeq(filename, &region, seqName_out, seqNameSize, seqType, error);
+
+  if (result && range_out)
+    range_out->set(region.start, region.end);
+
+  g_free(region.name);
+
+  return result;
+}
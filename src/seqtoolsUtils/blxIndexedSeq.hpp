@@ -0,0 +1,66 @@
+/*  File: blxIndexedSeq.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Random-access loading of a region of a reference sequence
+ *              from an indexed file.
+ *
+ *              Two formats are supported: FASTA files with a samtools-style
+ *              .fai index alongside them (<file>.fai), and UCSC packed
+ *              .2bit files. Only the bytes covering the requested region
+ *              are read, so opening a small window on a chromosome-sized
+ *              file does not require reading (or holding) the whole
+ *              sequence.
+ *
+ *              Regions are given in samtools style, i.e. "name" for the
+ *              whole sequence or "name:start-end" for 1-based inclusive
+ *              coords within it.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_indexed_seq_included_
+#define _blx_indexed_seq_included_
+
+#include <glib.h>
+#include <seqtoolsUtils/utilities.hpp>
+
+
+gboolean                indexedSeqFileIsIndexed(const char *filename);
+gboolean                indexedSeqFileIsTwoBit(const char *filename);
+
+char*                   readIndexedSeq(const char *filename,
+                                       const char *region,
+                                       char *seqName_out,
+                                       const gsize seqNameSize,
+                                       IntRange *range_out,
+                                       const BlxSeqType seqType,
+                                       GError **error);
+
+
+#endif /* _blx_indexed_seq_included_ */
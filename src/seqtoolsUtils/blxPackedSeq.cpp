@@ -0,0 +1,610 @@
+/*  File: blxPackedSeq.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See blxPackedSeq.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <seqtoolsUtils/blxPackedSeq.hpp>
+#include <seqtoolsUtils/blxmsp.hpp>
+#include <seqtoolsUtils/utilities.hpp>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+
+/* The packed image is laid out as:
+ *
+ *   header | base codes | (padding) | exception runs | lower-case runs
+ *
+ * The codes are packed most significant bits first, i.e. the first base is in the top
+ * bits of the first byte. Positions covered by an exception run hold an arbitrary code. */
+
+#define BLX_PACKED_SEQ_MAGIC       "BLXSEQ01"  /* identifies the image format; change the
+                                                  version digits if the layout changes */
+#define BLX_PACKED_SEQ_ALIGN       8           /* alignment of the run arrays */
+#define FOUR_BIT_EXCEPTION_CODE    4           /* code stored at exception positions in 4-bit images (N) */
+
+
+/* The characters represented by each code in the two encodings */
+static const char g_twoBitBases[] = "ACGT";
+static const char g_fourBitBases[] = "ACGTNRYSWKMBDHV-";
+
+
+typedef struct _PackedSeqHeader
+{
+  char magic[8];
+  guint32 bitsPerBase;          /* 2 or 4 */
+  guint32 length;               /* number of bases */
+  guint32 numExceptions;
+  guint32 numLowerRuns;
+  guint64 exceptionsOffset;
+  guint64 lowerRunsOffset;
+  guint64 totalSize;
+} PackedSeqHeader;
+
+
+/* A run of positions that are all the same character that the encoding can't represent,
+ * or a run of lower-case positions */
+typedef struct _PackedSeqRun
+{
+  guint32 start;
+  guint32 len;
+  gint32 base;                  /* the character, for exception runs; unused for lower-case runs */
+} PackedSeqRun;
+
+
+struct _BlxPackedSeq
+{
+  char *image;                  /* the packed image (see above) */
+  gsize imageSize;
+  gboolean mapped;              /* true if the image is mapped from shared memory rather than allocated */
+  int sharedFd;                 /* the shared-memory segment holding the image, or -1 */
+
+  const PackedSeqHeader *header;
+  const guchar *codes;
+  const PackedSeqRun *exceptions;
+  const PackedSeqRun *lowerRuns;
+};
+
+
+/* Lookup tables. The code tables give the code for each character or -1 if the
+ * encoding can't represent it; the decode tables give the characters for every
+ * possible byte of codes. */
+static gint8 g_twoBitCodes[256];
+static gint8 g_fourBitCodes[256];
+static char g_twoBitDecode[256][4];
+static char g_fourBitDecode[256][2];
+static char g_complement[256];
+
+
+static void initPackedSeqTables()
+{
+  static gsize initialised = 0;
+
+  if (g_once_init_enter(&initialised))
+    {
+      memset(g_twoBitCodes, -1, sizeof(g_twoBitCodes));
+      memset(g_fourBitCodes, -1, sizeof(g_fourBitCodes));
+
+      for (int i = 0; i < 4; ++i)
+        {
+          g_twoBitCodes[(guchar)g_twoBitBases[i]] = i;
+          g_twoBitCodes[(guchar)g_ascii_tolower(g_twoBitBases[i])] = i;
+        }
+
+      for (int i = 0; i < 16; ++i)
+        {
+          g_fourBitCodes[(guchar)g_fourBitBases[i]] = i;
+          g_fourBitCodes[(guchar)g_ascii_tolower(g_fourBitBases[i])] = i;
+        }
+
+      for (int byte = 0; byte < 256; ++byte)
+        {
+          for (int i = 0; i < 4; ++i)
+            g_twoBitDecode[byte][i] = g_twoBitBases[(byte >> (6 - 2 * i)) & 3];
+
+          for (int i = 0; i < 2; ++i)
+            g_fourBitDecode[byte][i] = g_fourBitBases[(byte >> (4 - 4 * i)) & 15];
+
+          g_complement[byte] = complementChar((char)byte, NULL);
+        }
+
+      g_once_init_leave(&initialised, 1);
+    }
+}
+
+
+static gsize packedSeqCodesSize(const guint64 length, const guint32 bitsPerBase)
+{
+  return (length * bitsPerBase + 7) / 8;
+}
+
+
+static guint64 packedSeqAlign(const guint64 offset)
+{
+  return (offset + BLX_PACKED_SEQ_ALIGN - 1) & ~(guint64)(BLX_PACKED_SEQ_ALIGN - 1);
+}
+
+
+/* Count the runs of characters that the encoding with the given code table can't represent */
+static guint32 countExceptionRuns(const char *seq, const int len, const gint8 *codeTable)
+{
+  guint32 result = 0;
+
+  for (int i = 0; i < len; ++i)
+    {
+      if (codeTable[(guchar)seq[i]] < 0 && (i == 0 || seq[i] != seq[i - 1]))
+        ++result;
+    }
+
+  return result;
+}
+
+
+/* Check that the run array is sorted, non-overlapping and within the sequence */
+static gboolean packedSeqRunsValid(const PackedSeqRun *runs, const guint32 numRuns, const guint32 length)
+{
+  guint64 prevEnd = 0;
+
+  for (guint32 i = 0; i < numRuns; ++i)
+    {
+      if (runs[i].start < prevEnd || (guint64)runs[i].start + runs[i].len > length)
+        return FALSE;
+
+      prevEnd = (guint64)runs[i].start + runs[i].len;
+    }
+
+  return TRUE;
+}
+
+
+/* Check that the given image is a valid packed sequence, so that we never read outside it */
+static gboolean packedSeqImageValid(const char *image, const gsize size)
+{
+  if (size < sizeof(PackedSeqHeader))
+    return FALSE;
+
+  const PackedSeqHeader *header = (const PackedSeqHeader*)image;
+
+  if (memcmp(header->magic, BLX_PACKED_SEQ_MAGIC, sizeof(header->magic)) != 0 ||
+      (header->bitsPerBase != 2 && header->bitsPerBase != 4) ||
+      header->totalSize != size ||
+      header->exceptionsOffset < sizeof(PackedSeqHeader) + packedSeqCodesSize(header->length, header->bitsPerBase) ||
+      header->exceptionsOffset % BLX_PACKED_SEQ_ALIGN != 0 ||
+      header->lowerRunsOffset < header->exceptionsOffset + (guint64)header->numExceptions * sizeof(PackedSeqRun) ||
+      header->lowerRunsOffset % BLX_PACKED_SEQ_ALIGN != 0 ||
+      header->totalSize < header->lowerRunsOffset + (guint64)header->numLowerRuns * sizeof(PackedSeqRun))
+    {
+      return FALSE;
+    }
+
+  return (packedSeqRunsValid((const PackedSeqRun*)(image + header->exceptionsOffset), header->numExceptions, header->length) &&
+          packedSeqRunsValid((const PackedSeqRun*)(image + header->lowerRunsOffset), header->numLowerRuns, header->length));
+}
+
+
+/* Point the packed sequence at the given image */
+static void packedSeqSetImage(BlxPackedSeq *packed, char *image, const gsize size, const gboolean mapped)
+{
+  packed->image = image;
+  packed->imageSize = size;
+  packed->mapped = mapped;
+
+  packed->header = (const PackedSeqHeader*)image;
+  packed->codes = (const guchar*)(image + sizeof(PackedSeqHeader));
+  packed->exceptions = (const PackedSeqRun*)(image + packed->header->exceptionsOffset);
+  packed->lowerRuns = (const PackedSeqRun*)(image + packed->header->lowerRunsOffset);
+}
+
+
+static void packedSeqFreeImage(BlxPackedSeq *packed)
+{
+  if (packed->mapped)
+    munmap(packed->image, packed->imageSize);
+  else
+    g_free(packed->image);
+
+  packed->image = NULL;
+}
+
+
+/* Pack the first len characters of the given sequence. Returns NULL if packing the
+ * sequence would not save any space (e.g. because it is a peptide sequence). The
+ * result should be free'd with blxPackedSeqDestroy. */
+BlxPackedSeq* blxPackedSeqCreate(const char *seq, const int len)
+{
+  if (!seq || len <= 0)
+    return NULL;
+
+  initPackedSeqTables();
+
+  /* Use whichever encoding gives the smaller result once the exceptions are included */
+  const guint32 numTwoBitExceptions = countExceptionRuns(seq, len, g_twoBitCodes);
+  const guint32 numFourBitExceptions = countExceptionRuns(seq, len, g_fourBitCodes);
+  const gboolean twoBit = (packedSeqCodesSize(len, 2) + numTwoBitExceptions * sizeof(PackedSeqRun) <=
+                           packedSeqCodesSize(len, 4) + numFourBitExceptions * sizeof(PackedSeqRun));
+
+  const gint8 *codeTable = twoBit ? g_twoBitCodes : g_fourBitCodes;
+  guint32 numLowerRuns = 0;
+
+  for (int i = 0; i < len; ++i)
+    {
+      if (g_ascii_islower(seq[i]) && (i == 0 || !g_ascii_islower(seq[i - 1])))
+        ++numLowerRuns;
+    }
+
+  PackedSeqHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BLX_PACKED_SEQ_MAGIC, sizeof(header.magic));
+  header.bitsPerBase = twoBit ? 2 : 4;
+  header.length = len;
+  header.numExceptions = twoBit ? numTwoBitExceptions : numFourBitExceptions;
+  header.numLowerRuns = numLowerRuns;
+  header.exceptionsOffset = packedSeqAlign(sizeof(header) + packedSeqCodesSize(len, header.bitsPerBase));
+  header.lowerRunsOffset = packedSeqAlign(header.exceptionsOffset + header.numExceptions * sizeof(PackedSeqRun));
+  header.totalSize = header.lowerRunsOffset + header.numLowerRuns * sizeof(PackedSeqRun);
+
+  if (header.totalSize >= (guint64)len)
+    return NULL;
+
+  char *image = (char*)g_malloc0(header.totalSize);
+  memcpy(image, &header, sizeof(header));
+
+  guchar *codes = (guchar*)(image + sizeof(header));
+  PackedSeqRun *exceptions = (PackedSeqRun*)(image + header.exceptionsOffset);
+  PackedSeqRun *lowerRuns = (PackedSeqRun*)(image + header.lowerRunsOffset);
+  PackedSeqRun *exception = NULL;
+  PackedSeqRun *lowerRun = NULL;
+
+  const int basesPerByte = 8 / header.bitsPerBase;
+
+  for (int i = 0; i < len; ++i)
+    {
+      const guchar c = seq[i];
+      int code = codeTable[c];
+
+      if (code < 0)
+        {
+          if (i == 0 || seq[i - 1] != seq[i])
+            {
+              exception = exception ? exception + 1 : exceptions;
+              exception->start = i;
+              exception->base = c;
+            }
+
+          ++exception->len;
+          code = twoBit ? 0 : FOUR_BIT_EXCEPTION_CODE;
+        }
+
+      if (g_ascii_islower(c))
+        {
+          if (i == 0 || !g_ascii_islower(seq[i - 1]))
+            {
+              lowerRun = lowerRun ? lowerRun + 1 : lowerRuns;
+              lowerRun->start = i;
+            }
+
+          ++lowerRun->len;
+        }
+
+      codes[i / basesPerByte] |= code << (8 - header.bitsPerBase * (i % basesPerByte + 1));
+    }
+
+  BlxPackedSeq *packed = g_new0(BlxPackedSeq, 1);
+  packed->sharedFd = -1;
+  packedSeqSetImage(packed, image, header.totalSize, FALSE);
+
+  return packed;
+}
+
+
+/* Map a packed sequence that another process shared with blxPackedSeqShare from the
+ * given file descriptor. The mapping is read-only. Closes the file descriptor. */
+BlxPackedSeq* blxPackedSeqMapShared(const int fd, GError **error)
+{
+  initPackedSeqTables();
+
+  BlxPackedSeq *packed = NULL;
+  GError *tmpError = NULL;
+  struct stat st;
+  char *image = NULL;
+
+  if (fstat(fd, &st) != 0)
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error accessing shared memory segment: %s\n", g_strerror(errno));
+    }
+  else if ((gsize)st.st_size < sizeof(PackedSeqHeader))
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment is too small (%ld bytes)\n", (long)st.st_size);
+    }
+  else
+    {
+      image = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (image == MAP_FAILED)
+        {
+          image = NULL;
+          g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error mapping shared memory segment: %s\n", g_strerror(errno));
+        }
+      else if (!packedSeqImageValid(image, st.st_size))
+        {
+          g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment does not contain a valid packed sequence\n");
+        }
+    }
+
+  if (!tmpError)
+    {
+      packed = g_new0(BlxPackedSeq, 1);
+      packed->sharedFd = -1;
+      packedSeqSetImage(packed, image, st.st_size, TRUE);
+    }
+  else
+    {
+      if (image)
+        munmap(image, st.st_size);
+
+      prefixError(tmpError, "Error reading shared reference sequence: ");
+      g_propagate_error(error, tmpError);
+    }
+
+  close(fd);
+
+  return packed;
+}
+
+
+void blxPackedSeqDestroy(BlxPackedSeq *packed)
+{
+  if (!packed)
+    return;
+
+  packedSeqFreeImage(packed);
+
+  if (packed->sharedFd >= 0)
+    close(packed->sharedFd);
+
+  g_free(packed);
+}
+
+
+/* Move the packed image into a sealed anonymous shared-memory segment, so that child
+ * processes can map it (see blxPackedSeqGetSharedFd) rather than being sent a copy. Our
+ * own copy is replaced by a read-only mapping of the segment, so this does not use any
+ * extra memory. Because the image is replaced, this must not be called while another
+ * thread may be decoding from the packed sequence. */
+gboolean blxPackedSeqShare(BlxPackedSeq *packed, GError **error)
+{
+  g_return_val_if_fail(packed, FALSE);
+
+  if (packed->sharedFd >= 0)
+    return TRUE;
+
+  GError *tmpError = NULL;
+  char *segment = NULL;
+  int fd = blxCreateSharedMemoryFile("seqtools-refseq", &tmpError);
+
+  if (fd >= 0 && ftruncate(fd, packed->imageSize) != 0)
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error sizing shared memory segment: %s\n", g_strerror(errno));
+    }
+
+  if (!tmpError)
+    {
+      segment = (char*)mmap(NULL, packed->imageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (segment == MAP_FAILED)
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error mapping shared memory segment: %s\n", g_strerror(errno));
+    }
+
+  if (!tmpError)
+    {
+      memcpy(segment, packed->image, packed->imageSize);
+      munmap(segment, packed->imageSize);
+
+#ifdef F_ADD_SEALS
+      /* Seal the segment so that readers can rely on it not changing. Not all file
+       * types support sealing so ignore failures. */
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+
+      segment = (char*)mmap(NULL, packed->imageSize, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (segment == MAP_FAILED)
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error mapping shared memory segment: %s\n", g_strerror(errno));
+    }
+
+  if (tmpError)
+    {
+      if (fd >= 0)
+        close(fd);
+
+      prefixError(tmpError, "Error sharing reference sequence: ");
+      g_propagate_error(error, tmpError);
+      return FALSE;
+    }
+
+  const gsize size = packed->imageSize;
+  packedSeqFreeImage(packed);
+  packedSeqSetImage(packed, segment, size, TRUE);
+  packed->sharedFd = fd;
+
+  return TRUE;
+}
+
+
+/* Get the file descriptor of the shared-memory segment holding the packed sequence, or
+ * -1 if it has not been shared. The descriptor is close-on-exec and remains owned by
+ * the packed sequence. */
+int blxPackedSeqGetSharedFd(const BlxPackedSeq *packed)
+{
+  return packed ? packed->sharedFd : -1;
+}
+
+
+int blxPackedSeqGetLength(const BlxPackedSeq *packed)
+{
+  return packed ? packed->header->length : 0;
+}
+
+
+int blxPackedSeqGetBitsPerBase(const BlxPackedSeq *packed)
+{
+  return packed ? packed->header->bitsPerBase : 0;
+}
+
+
+/* The number of bytes used by the packed image */
+gsize blxPackedSeqGetSize(const BlxPackedSeq *packed)
+{
+  return packed ? packed->imageSize : 0;
+}
+
+
+/* Apply the runs that overlap the region [start, end) to the decoded bases for that
+ * region. Lower-case runs lower-case the bases; exception runs overwrite them. */
+static void applyRuns(const PackedSeqRun *runs, const guint32 numRuns, const guint32 start, const guint32 end,
+                      char *dest, const gboolean isLower)
+{
+  /* Binary search for the first run that ends after the start of the region */
+  guint32 lo = 0;
+  guint32 hi = numRuns;
+
+  while (lo < hi)
+    {
+      const guint32 mid = lo + (hi - lo) / 2;
+
+      if (runs[mid].start + runs[mid].len <= start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (guint32 i = lo; i < numRuns && runs[i].start < end; ++i)
+    {
+      const guint32 from = std::max(runs[i].start, start);
+      const guint32 to = std::min(runs[i].start + runs[i].len, end);
+
+      if (isLower)
+        {
+          for (guint32 j = from; j < to; ++j)
+            dest[j - start] = g_ascii_tolower(dest[j - start]);
+        }
+      else
+        {
+          memset(dest + (from - start), runs[i].base, to - from);
+        }
+    }
+}
+
+
+/* Decode len bases starting at the 0-based index start into dest (which is not
+ * nul-terminated). The result is complemented and/or reversed if requested, which gives
+ * the same result as calling blxComplement/g_strreverse on the plain sequence. */
+void blxPackedSeqDecode(const BlxPackedSeq *packed,
+                        const int start,
+                        const int len,
+                        const gboolean complement,
+                        const gboolean reverse,
+                        char *dest)
+{
+  g_return_if_fail(packed && start >= 0 && len >= 0 && (guint64)start + len <= packed->header->length);
+
+  const guchar *codes = packed->codes;
+  const int end = start + len;
+  char *cp = dest;
+  int i = start;
+
+  if (packed->header->bitsPerBase == 2)
+    {
+      /* Decode a whole byte (4 bases) at a time, apart from at the ends */
+      for ( ; i < end && (i & 3); ++i)
+        *cp++ = g_twoBitDecode[codes[i >> 2]][i & 3];
+
+      for ( ; i + 4 <= end; i += 4, cp += 4)
+        memcpy(cp, g_twoBitDecode[codes[i >> 2]], 4);
+
+      for ( ; i < end; ++i)
+        *cp++ = g_twoBitDecode[codes[i >> 2]][i & 3];
+    }
+  else
+    {
+      for ( ; i < end && (i & 1); ++i)
+        *cp++ = g_fourBitDecode[codes[i >> 1]][i & 1];
+
+      for ( ; i + 2 <= end; i += 2, cp += 2)
+        memcpy(cp, g_fourBitDecode[codes[i >> 1]], 2);
+
+      for ( ; i < end; ++i)
+        *cp++ = g_fourBitDecode[codes[i >> 1]][i & 1];
+    }
+
+  applyRuns(packed->lowerRuns, packed->header->numLowerRuns, start, end, dest, TRUE);
+  applyRuns(packed->exceptions, packed->header->numExceptions, start, end, dest, FALSE);
+
+  if (complement)
+    {
+      for (int j = 0; j < len; ++j)
+        dest[j] = g_complement[(guchar)dest[j]];
+    }
+
+  if (reverse)
+    std::reverse(dest, dest + len);
+}
+
+
+/* As blxPackedSeqDecode but returns the result as a new nul-terminated string, which
+ * should be free'd with g_free */
+char* blxPackedSeqDecodeNew(const BlxPackedSeq *packed,
+                            const int start,
+                            const int len,
+                            const gboolean complement,
+                            const gboolean reverse)
+{
+  char *result = (char*)g_malloc(len + 1);
+  blxPackedSeqDecode(packed, start, len, complement, reverse, result);
+  result[len] = '\0';
+
+  return result;
+}
+
+
+/* Get the base at the given 0-based index */
+char blxPackedSeqGetBase(const BlxPackedSeq *packed, const int idx)
+{
+  char result = ' ';
+  blxPackedSeqDecode(packed, idx, 1, FALSE, FALSE, &result);
+
+  return result;
+}
@@ -0,0 +1,84 @@
+/*  File: blxPackedSeq.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Compact storage of a nucleotide sequence.
+ *
+ *              The bases are stored with 2 bits each (A, C, G, T) when the
+ *              sequence is mostly unambiguous, or with 4 bits each (the
+ *              IUPAC codes plus gap) when it has a lot of ambiguity codes.
+ *              Any character that the chosen encoding cannot represent
+ *              (e.g. N in a 2-bit sequence) is stored in a list of
+ *              exception runs, and lower-case (soft-masked) regions are
+ *              stored as a list of runs, so the original sequence is always
+ *              reproduced exactly.
+ *
+ *              The packed sequence is a single self-contained image, so it
+ *              can be moved into a sealed shared-memory segment and mapped
+ *              read-only by other processes (i.e. Dotter) rather than each
+ *              of them holding its own copy. Segments are decoded into a
+ *              caller-supplied buffer a block of bases at a time.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _blx_packed_seq_included_
+#define _blx_packed_seq_included_
+
+#include <glib.h>
+
+
+typedef struct _BlxPackedSeq BlxPackedSeq;
+
+
+BlxPackedSeq*           blxPackedSeqCreate(const char *seq, const int len);
+BlxPackedSeq*           blxPackedSeqMapShared(const int fd, GError **error);
+void                    blxPackedSeqDestroy(BlxPackedSeq *packed);
+
+gboolean                blxPackedSeqShare(BlxPackedSeq *packed, GError **error);
+int                     blxPackedSeqGetSharedFd(const BlxPackedSeq *packed);
+
+int                     blxPackedSeqGetLength(const BlxPackedSeq *packed);
+int                     blxPackedSeqGetBitsPerBase(const BlxPackedSeq *packed);
+gsize                   blxPackedSeqGetSize(const BlxPackedSeq *packed);
+
+char                    blxPackedSeqGetBase(const BlxPackedSeq *packed, const int idx);
+void                    blxPackedSeqDecode(const BlxPackedSeq *packed,
+                                           const int start,
+                                           const int len,
+                                           const gboolean complement,
+                                           const gboolean reverse,
+                                           char *dest);
+char*                   blxPackedSeqDecodeNew(const BlxPackedSeq *packed,
+                                              const int start,
+                                              const int len,
+                                              const gboolean complement,
+                                              const gboolean reverse);
+
+
+#endif /* _blx_packed_seq_included_ */
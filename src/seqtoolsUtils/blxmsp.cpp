@@ -33,9 +33,15 @@
  *----------------------------------------------------------------------------
  */
 
+#include <config.h>
 #include <seqtoolsUtils/blxmsp.hpp>
 #include <seqtoolsUtils/utilities.hpp>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <algorithm>
 
 using namespace std;
@@ -43,6 +49,7 @@ using namespace std;
 
 #define POLYA_TAIL_BASES_TO_CHECK -1 /* number of bases to check when looking for a polyA tail (-1
                                         means check all of the unaligned sequence) */
+#define MSP_CHUNK_SIZE            4096 /* number of MSPs per chunk when processing MSPs in parallel */
 
 
 /* Globals */
@@ -702,13 +709,6 @@ char *mspGetCoordsAsString(const MSP* const msp)
 }
 
 
-/* Return the path in the given tree model that this MSP lies in */
-gchar* mspGetTreePath(const MSP* const msp, BlxModelId modelId)
-{
-  return msp->treePaths[modelId];
-}
-
-
 ///* Returns true if a feature-series by the given name exists in the feature-series array and
 // * and, if so, sets index_out with its index. */
 //static gboolean fsArrayFindByName(GArray *fsArray, FeatureSeries *fs, int *index_out)
@@ -819,6 +819,86 @@ MSP* mspArrayIdx(const GArray* const array, const int idx)
 }
 
 
+/* Create an array of pointers to the MSPs in the given list, so that it can be split
+ * into chunks. The result should be free'd with g_ptr_array_free(array, TRUE). */
+GPtrArray* mspListToArray(MSP *mspList)
+{
+  GPtrArray *result = g_ptr_array_new();
+
+  for (MSP *msp = mspList; msp; msp = msp->next)
+    g_ptr_array_add(result, msp);
+
+  return result;
+}
+
+
+/* Returns the number of chunks that mspArrayProcessChunks will split the given array into */
+int mspArrayGetNumChunks(const GPtrArray* const msps)
+{
+  return (msps->len + MSP_CHUNK_SIZE - 1) / MSP_CHUNK_SIZE;
+}
+
+
+/* Data passed to the thread pool for processing chunks of an MSP array */
+typedef struct _MspChunkData
+{
+  GPtrArray *msps;
+  BlxMspChunkFunc func;
+  gpointer data;
+} MspChunkData;
+
+
+static void processMspChunk(MspChunkData *chunkData, const int chunk)
+{
+  const int startIdx = chunk * MSP_CHUNK_SIZE;
+  const int endIdx = min(startIdx + MSP_CHUNK_SIZE, (int)chunkData->msps->len);
+
+  chunkData->func((MSP**)chunkData->msps->pdata + startIdx, endIdx - startIdx, chunk, chunkData->data);
+}
+
+
+/* Thread-pool function to process a chunk of MSPs. The chunk number is passed as the
+ * task data, offset by 1 because the thread pool does not accept null data. */
+static void processMspChunkThreadFunc(gpointer data, gpointer user_data)
+{
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FINALISE, "processMspChunk");
+
+  processMspChunk((MspChunkData*)user_data, GPOINTER_TO_INT(data) - 1);
+}
+
+
+/* Split the given array of MSPs into chunks and call the given function on each chunk.
+ * The chunks are processed in parallel if there is more than one, so the function must
+ * only modify the MSPs it is given and its own chunk's results. In particular it must not
+ * report messages because these may update the GUI; it should save them and the caller
+ * should report them once all chunks are done. Returns when all chunks are complete. */
+void mspArrayProcessChunks(GPtrArray *msps, BlxMspChunkFunc func, gpointer data)
+{
+  const int numChunks = mspArrayGetNumChunks(msps);
+  const int numThreads = min(numChunks, (int)g_get_num_processors());
+
+  MspChunkData chunkData = {msps, func, data};
+  GThreadPool *pool = NULL;
+
+  if (numThreads > 1)
+    pool = g_thread_pool_new(processMspChunkThreadFunc, &chunkData, numThreads, FALSE, NULL);
+
+  if (pool)
+    {
+      for (int chunk = 0; chunk < numChunks; ++chunk)
+        g_thread_pool_push(pool, GINT_TO_POINTER(chunk + 1), NULL);
+
+      /* Wait for all the chunks to finish */
+      g_thread_pool_free(pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (int chunk = 0; chunk < numChunks; ++chunk)
+        processMspChunk(&chunkData, chunk);
+    }
+}
+
+
 /* Check if the given character is a polyA character (i.e. 'a', or if the strand is reverse 't') */
 static gboolean isPolyAChar(const char c, const BlxStrand strand)
 {
@@ -1393,14 +1473,15 @@ static BlxSequence* blxSequenceFindByName(const char *name, GList *allSeqs)
 }
 
 
-/* Get the "parent" sequence of the given protein variant. Assumes the variant
+/* Get the name of the "parent" sequence of the given protein variant. Assumes the variant
  * contains a dash '-' in the name followed by the variant number as a digit.
- * e.g. SW:P51531-2.2. The function looks for a sequence with the same name but
- * with this dash and the following digit(s) (up to the end of the name or the '.'
- * if there is one) removed. Returns NULL if no parent was found. */
-BlxSequence* blxSequenceGetVariantParent(const BlxSequence *variant, GList *allSeqs)
+ * e.g. SW:P51531-2.2. The parent name is the same name but with this dash and the
+ * following digit(s) (up to the end of the name or the '.' if there is one) removed.
+ * Returns NULL if the name is not a variant name; otherwise the result should be
+ * free'd with g_free. */
+char* blxSequenceGetVariantParentName(const BlxSequence *variant)
 {
-  BlxSequence *result = NULL;
+  char *result = NULL;
 
   const char *variantName = blxSequenceGetName(variant);
 
@@ -1440,7 +1521,10 @@ BlxSequence* blxSequenceGetVariantParent(const BlxSequence *variant, GList *allS
 
           *insertPoint = '\0';
 
-          result = blxSequenceFindByName(parentName, allSeqs);
+          result = parentName;
+        }
+      else
+        {
           g_free(parentName);
         }
     }
@@ -1449,6 +1533,23 @@ BlxSequence* blxSequenceGetVariantParent(const BlxSequence *variant, GList *allS
 }
 
 
+/* Get the "parent" sequence of the given protein variant (see
+ * blxSequenceGetVariantParentName). Returns NULL if no parent was found. */
+BlxSequence* blxSequenceGetVariantParent(const BlxSequence *variant, GList *allSeqs)
+{
+  BlxSequence *result = NULL;
+  char *parentName = blxSequenceGetVariantParentName(variant);
+
+  if (parentName)
+    {
+      result = blxSequenceFindByName(parentName, allSeqs);
+      g_free(parentName);
+    }
+
+  return result;
+}
+
+
 /* Destroy all of the BlxSequences */
 void destroyBlxSequenceList(GList **seqList)
 {
@@ -1753,6 +1854,40 @@ gint compareFuncMspArray(gconstpointer a, gconstpointer b)
 }
 
 
+/* Less-than version of compareFuncMspArray for use with the std sort algorithms */
+static bool mspArrayLessThan(const MSP* const msp1, const MSP* const msp2)
+{
+  return compareMsps(msp1, msp2) < 0;
+}
+
+
+/* Sort an array of MSPs into the same order as compareFuncMspArray. New MSPs are appended
+ * to the feature arrays as they are loaded, so the array is normally a sorted section
+ * followed by a batch of new MSPs. Rather than re-sorting the whole array we just sort the
+ * new batch and then merge it into the sorted section, which takes linear time. The result
+ * is the same as a stable sort of the whole array. */
+static void mspArraySortIncremental(GArray *array)
+{
+  if (!array || array->len < 2)
+    return;
+
+  MSP **msps = (MSP**)(array->data);
+  const int len = array->len;
+
+  /* Find the end of the sorted section */
+  int sortedLen = 1;
+
+  while (sortedLen < len && !mspArrayLessThan(msps[sortedLen], msps[sortedLen - 1]))
+    ++sortedLen;
+
+  if (sortedLen < len)
+    {
+      stable_sort(msps + sortedLen, msps + len, mspArrayLessThan);
+      inplace_merge(msps, msps + sortedLen, msps + len, mspArrayLessThan);
+    }
+}
+
+
 /* returns true if the given msp should be output when piping features to dotter */
 static gboolean outputMsp(const MSP* const msp, IntRange *range1, IntRange *range2)
 {
@@ -2059,6 +2194,498 @@ void readMspFromText(MSP *msp, char *text)
 }
 
 
+/*******************************************************************
+ *       Packed binary handoff of features to Dotter               *
+ *******************************************************************/
+
+/* As an alternative to piping the sequences and features to Dotter as text, Blixem can
+ * pack them into a single binary segment in anonymous shared memory and pass Dotter the
+ * file descriptor. Dotter maps the segment read-only and builds its sequences and MSPs
+ * directly from the fixed-size records, which avoids formatting and re-parsing every
+ * feature. The layout of the segment is:
+ *
+ *   header | seq1 | seq2 | (padding) | sequence records | msp records | string table
+ *
+ * Each sequence record is followed in the msp array by its numMsps msp records. Strings
+ * are stored as offsets into the string table, where offset 0 is reserved to mean NULL. */
+
+#define BLX_PACKED_DATA_MAGIC      "BLXDOT01"  /* identifies the segment format; change the
+                                                  version digits if the records change */
+#define BLX_PACKED_DATA_ALIGN      8           /* alignment of the record arrays */
+
+
+typedef struct _BlxPackedHeader
+{
+  char magic[8];
+  guint32 seq1Len;
+  guint32 seq2Len;
+  guint32 numSeqs;
+  guint32 numMsps;
+  guint64 seqsOffset;
+  guint64 mspsOffset;
+  guint64 stringsOffset;
+  guint64 totalSize;
+} BlxPackedHeader;
+
+
+typedef struct _BlxPackedSequence
+{
+  gint32 type;
+  gint32 strand;
+  guint32 numMsps;
+  guint32 name;                 /* string table offsets */
+  guint32 idTag;
+} BlxPackedSequence;
+
+
+typedef struct _BlxPackedMsp
+{
+  gdouble score;
+  gdouble id;
+  gint32 type;
+  gint32 phase;
+  gint32 qStart;
+  gint32 qEnd;
+  gint32 sStart;
+  gint32 sEnd;
+  gint32 qStrand;
+  gint32 qFrame;
+  guint32 qname;                /* string table offsets */
+  guint32 sname;
+  guint32 desc;
+  guint32 padding;
+} BlxPackedMsp;
+
+
+struct _BlxPackedData
+{
+  const char *seq1;
+  int seq1Len;
+  const char *seq2;
+  int seq2Len;
+
+  GArray *seqs;                 /* array of BlxPackedSequence */
+  GArray *msps;                 /* array of BlxPackedMsp */
+  GString *strings;             /* the string table */
+  GHashTable *stringOffsets;    /* maps each string in the table to its offset, so that
+                                   repeated names are only stored once */
+};
+
+
+static gsize packedDataAlign(const gsize offset)
+{
+  return (offset + BLX_PACKED_DATA_ALIGN - 1) & ~((gsize)BLX_PACKED_DATA_ALIGN - 1);
+}
+
+
+/* Create the packer for the given sequences. The sequences are not copied, so they must
+ * persist until the data has been written. */
+BlxPackedData* blxPackedDataCreate(const char *seq1, const int seq1Len, const char *seq2, const int seq2Len)
+{
+  BlxPackedData *data = g_new0(BlxPackedData, 1);
+
+  data->seq1 = seq1;
+  data->seq1Len = seq1Len;
+  data->seq2 = seq2;
+  data->seq2Len = seq2Len;
+
+  data->seqs = g_array_new(FALSE, FALSE, sizeof(BlxPackedSequence));
+  data->msps = g_array_new(FALSE, FALSE, sizeof(BlxPackedMsp));
+  data->strings = g_string_new_len("", 1); /* reserve offset 0 for NULL */
+  data->stringOffsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  return data;
+}
+
+
+void blxPackedDataDestroy(BlxPackedData *data)
+{
+  if (data)
+    {
+      g_array_free(data->seqs, TRUE);
+      g_array_free(data->msps, TRUE);
+      g_string_free(data->strings, TRUE);
+      g_hash_table_destroy(data->stringOffsets);
+      g_free(data);
+    }
+}
+
+
+/* Add the given string to the string table (if not already there) and return its offset */
+static guint32 packedDataAddString(BlxPackedData *data, const char *str)
+{
+  if (!str)
+    return 0;
+
+  gpointer value = NULL;
+
+  if (g_hash_table_lookup_extended(data->stringOffsets, str, NULL, &value))
+    return GPOINTER_TO_UINT(value);
+
+  const guint32 offset = data->strings->len;
+  g_string_append_len(data->strings, str, strlen(str) + 1);
+  g_hash_table_insert(data->stringOffsets, g_strdup(str), GUINT_TO_POINTER(offset));
+
+  return offset;
+}
+
+
+static void packedDataAddSequence(BlxPackedData *data, const BlxSequence *blxSeq, const char *name, const int numMsps)
+{
+  BlxPackedSequence rec;
+  rec.type = blxSeq->type;
+  rec.strand = blxSeq->strand;
+  rec.numMsps = numMsps;
+  rec.name = packedDataAddString(data, name);
+  rec.idTag = packedDataAddString(data, blxSeq->idTag);
+
+  g_array_append_val(data->seqs, rec);
+}
+
+
+static void packedDataAddMsp(BlxPackedData *data, const MSP* const msp,
+                             const int qStart, const int qEnd, const char *qname)
+{
+  BlxPackedMsp rec;
+  rec.score = msp->score;
+  rec.id = msp->id;
+  rec.type = msp->type;
+  rec.phase = msp->phase;
+  rec.qStart = qStart;
+  rec.qEnd = qEnd;
+  rec.sStart = msp->sRange.min();
+  rec.sEnd = msp->sRange.max();
+  rec.qStrand = msp->qStrand;
+  rec.qFrame = msp->qFrame;
+  rec.qname = packedDataAddString(data, qname);
+  rec.sname = packedDataAddString(data, msp->sname);
+  rec.desc = packedDataAddString(data, msp->desc);
+  rec.padding = 0;
+
+  g_array_append_val(data->msps, rec);
+}
+
+
+/* Packed equivalent of writeTranscriptToOutput: adds the exons of the given transcript
+ * that lie within the ref seq range, converted to transcript coords */
+void blxPackedDataAddTranscript(BlxPackedData *data, const BlxSequence* const blxSeq, const IntRange* const refSeqRange)
+{
+  g_return_if_fail(data && blxSeq && blxSeq->type == BLXSEQUENCE_TRANSCRIPT);
+
+  const char* transcriptName = blxSequenceGetName(blxSeq);
+  const guint seqIdx = data->seqs->len;
+  int numMsps = 0;
+  int i = 0; /* keeps track of current transcript coord */
+
+  /* Add the sequence record first and fill in the msp count once we know it */
+  packedDataAddSequence(data, blxSeq, transcriptName, 0);
+
+  GList *mspItem = blxSeq->mspList;
+
+  for ( ; mspItem; mspItem = mspItem->next)
+    {
+      const MSP* msp = (const MSP*)(mspItem->data);
+
+      /* Only output exons without child msps that are within range (see writeTranscriptToOutput) */
+      if (mspIsBoxFeature(msp) && !msp->childMsps &&
+          msp->qRange.min() < refSeqRange->max() && msp->qRange.max() > refSeqRange->min())
+        {
+          const int start = i + 1;
+          const int end = start + msp->qRange.length() - 1;
+
+          packedDataAddMsp(data, msp, start, end, transcriptName);
+          ++numMsps;
+
+          i = end;
+        }
+    }
+
+  if (numMsps > 0)
+    g_array_index(data->seqs, BlxPackedSequence, seqIdx).numMsps = numMsps;
+  else
+    g_array_set_size(data->seqs, seqIdx);
+}
+
+
+/* Packed equivalent of writeBlxSequenceToOutput */
+void blxPackedDataAddBlxSequence(BlxPackedData *data, const BlxSequence *blxSeq, IntRange *range1, IntRange *range2)
+{
+  g_return_if_fail(data);
+
+  if (!blxSeq || (blxSeq->type != BLXSEQUENCE_TRANSCRIPT && blxSeq->type != BLXSEQUENCE_MATCH))
+    return;
+
+  const int numMsps = countMspsToOutput(blxSeq, range1, range2);
+
+  if (numMsps < 1)
+    return;
+
+  packedDataAddSequence(data, blxSeq, blxSequenceGetName(blxSeq), numMsps);
+
+  GList *mspItem = blxSeq->mspList;
+
+  for ( ; mspItem; mspItem = mspItem->next)
+    {
+      const MSP* const msp = (const MSP*)(mspItem->data);
+
+      if (outputMsp(msp, range1, range2))
+        packedDataAddMsp(data, msp, msp->qRange.min(), msp->qRange.max(), msp->qname);
+    }
+}
+
+
+/* Create an anonymous, close-on-exec file to hold a shared-memory segment. The name is
+ * only used for debugging. Returns -1 on failure. */
+int blxCreateSharedMemoryFile(const char *name, GError **error)
+{
+  int fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+
+  if (fd < 0)
+    {
+      /* Fall back to an unlinked temp file (which will normally be in the page cache) */
+      char *tmpl = g_strdup_printf("%s-XXXXXX", name);
+      char *filename = NULL;
+      fd = g_file_open_tmp(tmpl, &filename, error);
+
+      if (fd >= 0)
+        {
+          unlink(filename);
+          fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+      g_free(filename);
+      g_free(tmpl);
+    }
+
+  return fd;
+}
+
+
+/* Write the packed data to a new anonymous shared-memory segment. Returns the file
+ * descriptor of the segment, which the caller must close, or -1 if there was an error.
+ * The descriptor is close-on-exec; the caller must clear that flag in the child process
+ * it wants to pass the segment to. */
+int blxPackedDataWriteToSharedMemory(BlxPackedData *data, GError **error)
+{
+  g_return_val_if_fail(data, -1);
+
+  BlxPackedHeader header;
+  memcpy(header.magic, BLX_PACKED_DATA_MAGIC, sizeof(header.magic));
+  header.seq1Len = data->seq1Len;
+  header.seq2Len = data->seq2Len;
+  header.numSeqs = data->seqs->len;
+  header.numMsps = data->msps->len;
+  header.seqsOffset = packedDataAlign(sizeof(header) + data->seq1Len + data->seq2Len);
+  header.mspsOffset = packedDataAlign(header.seqsOffset + data->seqs->len * sizeof(BlxPackedSequence));
+  header.stringsOffset = header.mspsOffset + data->msps->len * sizeof(BlxPackedMsp);
+  header.totalSize = header.stringsOffset + data->strings->len;
+
+  GError *tmpError = NULL;
+  int fd = blxCreateSharedMemoryFile("seqtools-dotter", &tmpError);
+
+  if (fd >= 0 && ftruncate(fd, header.totalSize) != 0)
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error sizing shared memory segment: %s\n", g_strerror(errno));
+    }
+
+  char *segment = NULL;
+
+  if (!tmpError)
+    {
+      segment = (char*)mmap(NULL, header.totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (segment == MAP_FAILED)
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error mapping shared memory segment: %s\n", g_strerror(errno));
+    }
+
+  if (!tmpError)
+    {
+      memcpy(segment, &header, sizeof(header));
+      memcpy(segment + sizeof(header), data->seq1, data->seq1Len);
+      memcpy(segment + sizeof(header) + data->seq1Len, data->seq2, data->seq2Len);
+      memcpy(segment + header.seqsOffset, data->seqs->data, data->seqs->len * sizeof(BlxPackedSequence));
+      memcpy(segment + header.mspsOffset, data->msps->data, data->msps->len * sizeof(BlxPackedMsp));
+      memcpy(segment + header.stringsOffset, data->strings->str, data->strings->len);
+
+      munmap(segment, header.totalSize);
+
+#ifdef F_ADD_SEALS
+      /* Seal the segment so the reader can rely on it not changing under it. Not all
+       * file types support sealing so ignore failures. */
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    }
+
+  if (tmpError)
+    {
+      if (fd >= 0)
+        close(fd);
+
+      fd = -1;
+      prefixError(tmpError, "Error creating shared data for Dotter: ");
+      g_propagate_error(error, tmpError);
+    }
+
+  return fd;
+}
+
+
+/* Get a string from the packed string table, or NULL if the offset is 0 or out of range */
+static const char* packedDataGetString(const char *strings, const guint64 stringsSize, const guint32 offset)
+{
+  return (offset > 0 && offset < stringsSize) ? strings + offset : NULL;
+}
+
+
+/* Read the sequences and features written by blxPackedDataWriteToSharedMemory from the
+ * given file descriptor. The sequence lengths must match those expected. On success,
+ * the sequences are returned as newly-allocated strings, the blxsequences are appended
+ * to seqList and the msps to mspList and featureLists. Closes the file descriptor. */
+gboolean blxPackedDataReadFromSharedMemory(const int fd,
+                                           const int seq1Len,
+                                           const int seq2Len,
+                                           char **seq1_out,
+                                           char **seq2_out,
+                                           GList **seqList,
+                                           MSP **mspList,
+                                           GArray* featureLists[],
+                                           GError **error)
+{
+  GError *tmpError = NULL;
+  const char *segment = NULL;
+  struct stat st;
+  const BlxPackedHeader *header = NULL;
+
+  if (fstat(fd, &st) != 0)
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error accessing shared memory segment: %s\n", g_strerror(errno));
+    }
+  else if ((gsize)st.st_size < sizeof(BlxPackedHeader))
+    {
+      g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment is too small (%ld bytes)\n", (long)st.st_size);
+    }
+  else
+    {
+      segment = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (segment == MAP_FAILED)
+        {
+          segment = NULL;
+          g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Error mapping shared memory segment: %s\n", g_strerror(errno));
+        }
+    }
+
+  if (!tmpError)
+    {
+      /* Validate the header so that we never read outside the segment */
+      header = (const BlxPackedHeader*)segment;
+
+      if (memcmp(header->magic, BLX_PACKED_DATA_MAGIC, sizeof(header->magic)) != 0)
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment has an unrecognised format\n");
+      else if ((int)header->seq1Len != seq1Len || (int)header->seq2Len != seq2Len)
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment sequence lengths (%u, %u) do not match expected lengths (%d, %d)\n",
+                    header->seq1Len, header->seq2Len, seq1Len, seq2Len);
+      else if (header->totalSize != (guint64)st.st_size ||
+               header->seqsOffset < sizeof(BlxPackedHeader) + header->seq1Len + header->seq2Len ||
+               header->mspsOffset < header->seqsOffset + (guint64)header->numSeqs * sizeof(BlxPackedSequence) ||
+               header->stringsOffset < header->mspsOffset + (guint64)header->numMsps * sizeof(BlxPackedMsp) ||
+               header->stringsOffset >= header->totalSize ||
+               segment[header->totalSize - 1] != '\0')
+        g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment is corrupt\n");
+    }
+
+  if (!tmpError)
+    {
+      const char *seqData = segment + sizeof(BlxPackedHeader);
+
+      *seq1_out = g_strndup(seqData, seq1Len);
+      *seq2_out = g_strndup(seqData + seq1Len, seq2Len);
+
+      const BlxPackedSequence *seqRecs = (const BlxPackedSequence*)(segment + header->seqsOffset);
+      const BlxPackedMsp *mspRecs = (const BlxPackedMsp*)(segment + header->mspsOffset);
+      const char *strings = segment + header->stringsOffset;
+      const guint64 stringsSize = header->totalSize - header->stringsOffset;
+
+      /* Find the current end of the msp list so we can append to it */
+      MSP *lastMsp = *mspList;
+      while (lastMsp && lastMsp->next)
+        lastMsp = lastMsp->next;
+
+      GList *newSeqs = NULL;
+      guint mspIdx = 0;
+
+      for (guint seqIdx = 0; seqIdx < header->numSeqs && !tmpError; ++seqIdx)
+        {
+          const BlxPackedSequence *seqRec = &seqRecs[seqIdx];
+
+          if (seqRec->numMsps > header->numMsps - mspIdx)
+            {
+              g_set_error(&tmpError, BLX_ERROR, BLX_ERROR_SHARED_DATA, "Shared memory segment is corrupt\n");
+              break;
+            }
+
+          BlxSequence *blxSeq = createEmptyBlxSequence();
+          blxSeq->type = (BlxSequenceType)seqRec->type;
+          blxSeq->strand = (BlxStrand)seqRec->strand;
+
+          const char *name = packedDataGetString(strings, stringsSize, seqRec->name);
+          blxSequenceSetValueFromString(blxSeq, BLXCOL_SEQNAME, name);
+          blxSeq->idTag = g_strdup(packedDataGetString(strings, stringsSize, seqRec->idTag));
+
+          newSeqs = g_list_prepend(newSeqs, blxSeq);
+
+          for (guint i = 0; i < seqRec->numMsps; ++i, ++mspIdx)
+            {
+              const BlxPackedMsp *mspRec = &mspRecs[mspIdx];
+
+              if (mspRec->type < 0 || mspRec->type >= BLXMSP_NUM_TYPES)
+                continue;
+
+              MSP *msp = createEmptyMsp(&lastMsp, mspList);
+
+              msp->type = (BlxMspType)mspRec->type;
+              msp->score = mspRec->score;
+              msp->id = mspRec->id;
+              msp->phase = mspRec->phase;
+              msp->qRange.set(mspRec->qStart, mspRec->qEnd);
+              msp->sRange.set(mspRec->sStart, mspRec->sEnd);
+              msp->qStrand = (BlxStrand)mspRec->qStrand;
+              msp->qFrame = mspRec->qFrame;
+              msp->qname = g_strdup(packedDataGetString(strings, stringsSize, mspRec->qname));
+              msp->sname = g_strdup(packedDataGetString(strings, stringsSize, mspRec->sname));
+              msp->desc = g_strdup(packedDataGetString(strings, stringsSize, mspRec->desc));
+
+              featureLists[msp->type] = g_array_append_val(featureLists[msp->type], msp);
+
+              blxSeq->mspList = g_list_prepend(blxSeq->mspList, msp);
+              msp->sSequence = blxSeq;
+            }
+
+          blxSeq->mspList = g_list_reverse(blxSeq->mspList);
+        }
+
+      *seqList = g_list_concat(*seqList, g_list_reverse(newSeqs));
+    }
+
+  if (segment)
+    munmap((void*)segment, st.st_size);
+
+  close(fd);
+
+  if (tmpError)
+    {
+      g_propagate_error(error, tmpError);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
 /* Insert the given MSP into the given list */
 static void insertMsp(MSP *msp, MSP **mspList, MSP **lastMsp)
 {
@@ -2088,10 +2715,6 @@ MSP* createEmptyMsp(MSP **lastMsp, MSP **mspList)
 {
   MSP *msp = new MSP;
 
-  int i = 0;
-  for ( ; i < BLXMODEL_NUM_MODELS; ++i)
-    msp->treePaths[i] = NULL;
-
   msp->next = NULL;
   msp->childMsps = NULL;
 
@@ -2115,6 +2738,8 @@ MSP* createEmptyMsp(MSP **lastMsp, MSP **mspList)
 
   msp->xy = NULL;
   msp->gaps = NULL;
+  msp->gapBlocks = NULL;
+  msp->numGapBlocks = 0;
 
   insertMsp(msp, mspList, lastMsp);
 
@@ -2186,6 +2811,13 @@ void destroyMspData(MSP *msp)
       msp->gaps = NULL;
     }
 
+  if (msp->gapBlocks)
+    {
+      g_free(msp->gapBlocks);
+      msp->gapBlocks = NULL;
+      msp->numGapBlocks = 0;
+    }
+
   if (msp->xy)
     {
       g_array_free(msp->xy, TRUE);
@@ -2874,7 +3506,7 @@ static int getOffsetToCodonStart(const int coord, const int numFrames, const Blx
 /* Calculate the reference sequence reading frame that the given MSP belongs to, if not
  * already set. Requires either the phase to be set, or the frame to already be set; otherwise
  * assumes a phase of 0 and gives a warning. */
-static void calcReadingFrame(MSP *msp, const BlxSeqType seqType, const int numFrames, const IntRange* const refSeqRange)
+static void calcReadingFrame(MSP *msp, const BlxSeqType seqType, const int numFrames, const IntRange* const refSeqRange, GSList **warnings)
 {
   /* For matches and exons, calculate frame if the phase is known, because the old code that
    * used to pass the reading frame in exblx files seemed to occasionally pass an incorrect reading frame. */
@@ -2911,7 +3543,7 @@ static void calcReadingFrame(MSP *msp, const BlxSeqType seqType, const int numFr
 
 	      if (msp->qFrame != frame && seqType == BLXSEQ_PEPTIDE)
 		{
-		  g_warning("MSP '%s' (q=%d-%d; s=%d-%d) has reading frame '%d' but calculated frame was '%d'\n", mspGetSName(msp), msp->qRange.min(), msp->qRange.max(), msp->sRange.min(), msp->sRange.max(), msp->qFrame, frame);
+		  *warnings = g_slist_prepend(*warnings, g_strdup_printf("MSP '%s' (q=%d-%d; s=%d-%d) has reading frame '%d' but calculated frame was '%d'\n", mspGetSName(msp), msp->qRange.min(), msp->qRange.max(), msp->sRange.min(), msp->sRange.max(), msp->qFrame, frame));
 		}
 	    }
 	  else
@@ -2924,13 +3556,41 @@ static void calcReadingFrame(MSP *msp, const BlxSeqType seqType, const int numFr
 
       if (msp->qFrame == UNSET_INT)
 	{
-	  g_warning("Reading frame could not be calculated for MSP '%s' (q=%d-%d; s=%d-%d) - setting to 1.\n", mspGetSName(msp), msp->qRange.min(), msp->qRange.max(), msp->sRange.min(), msp->sRange.max());
+	  *warnings = g_slist_prepend(*warnings, g_strdup_printf("Reading frame could not be calculated for MSP '%s' (q=%d-%d; s=%d-%d) - setting to 1.\n", mspGetSName(msp), msp->qRange.min(), msp->qRange.max(), msp->sRange.min(), msp->sRange.max()));
 	  msp->qFrame = 1;
 	}
     }
 }
 
 
+/* Data for adjusting the coords and calculating the reading frames of chunks of MSPs */
+typedef struct _MspCoordsData
+{
+  int offset;
+  BlxSeqType seqType;
+  int numFrames;
+  const IntRange *refSeqRange;
+  gboolean calcFrame;
+  GSList **warnings;            /* warning messages for each chunk (in reverse order) */
+} MspCoordsData;
+
+
+/* Adjust the coords of a chunk of MSPs by the offset and calculate their reading frames */
+static void calcMspCoordsChunk(MSP **msps, const int numMsps, const int chunk, gpointer data)
+{
+  MspCoordsData *coordsData = (MspCoordsData*)data;
+
+  for (int i = 0; i < numMsps; ++i)
+    {
+      adjustMspCoordsByOffset(msps[i], coordsData->offset);
+      mspIndexGaps(msps[i]);
+
+      if (coordsData->calcFrame)
+        calcReadingFrame(msps[i], coordsData->seqType, coordsData->numFrames, coordsData->refSeqRange, &coordsData->warnings[chunk]);
+    }
+}
+
+
 /* Should be called after all parsed data has been added to a BlxSequence. Calculates summary
  * data and the introns etc. */
 void finaliseBlxSequences(GArray* featureLists[],
@@ -2944,25 +3604,35 @@ void finaliseBlxSequences(GArray* featureLists[],
 			  const gboolean calcFrame,
                           GHashTable *lookupTable)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_FINALISE, "finaliseBlxSequences");
+
   GError *tmpError = NULL;
 
   /* Loop through all MSPs and adjust their coords by the offest, then calculate their reading
-   * frame. Also find the last MSP in the list. */
-  MSP *msp = *mspList;
-  MSP *lastMsp = msp;
+   * frame. Each MSP is independent so this is done in parallel chunks. Also find the last MSP
+   * in the list. */
+  GPtrArray *msps = mspListToArray(*mspList);
+  MSP *lastMsp = msps->len ? (MSP*)g_ptr_array_index(msps, msps->len - 1) : NULL;
+
+  const int numChunks = mspArrayGetNumChunks(msps);
+  MspCoordsData coordsData = {offset, seqType, numFrames, refSeqRange, calcFrame, g_new0(GSList*, numChunks)};
 
-  while (msp)
+  mspArrayProcessChunks(msps, calcMspCoordsChunk, &coordsData);
+
+  /* Report any warnings now we're back on the main thread, in MSP order */
+  for (int chunk = 0; chunk < numChunks; ++chunk)
     {
-      adjustMspCoordsByOffset(msp, offset);
+      coordsData.warnings[chunk] = g_slist_reverse(coordsData.warnings[chunk]);
 
-      if (calcFrame)
-	calcReadingFrame(msp, seqType, numFrames, refSeqRange);
+      for (GSList *item = coordsData.warnings[chunk]; item; item = item->next)
+        g_warning("%s", (char*)(item->data));
 
-      msp = msp->next;
-      if (msp)
-        lastMsp = msp;
+      g_slist_free_full(coordsData.warnings[chunk], g_free);
     }
 
+  g_free(coordsData.warnings);
+  g_ptr_array_free(msps, TRUE);
+
   /* Loop through all BlxSequences */
   GList *seqItem = *seqList;
 
@@ -2996,12 +3666,13 @@ void finaliseBlxSequences(GArray* featureLists[],
 
   /* Sort msp arrays by start coord (only applicable to msp types that
    * appear in the detail-view because the order is only applicable when
-   * filtering detail-view rows) */
+   * filtering detail-view rows). The arrays were sorted when any previous
+   * features were loaded, so we only need to sort in the new ones. */
   int typeId = 0;
   for ( ; typeId < BLXMSP_NUM_TYPES; ++typeId)
     {
       if (typeShownInDetailView((BlxMspType)typeId))
-        g_array_sort(featureLists[typeId], compareFuncMspArray);
+        mspArraySortIncremental(featureLists[typeId]);
     }
 }
 
@@ -3140,6 +3811,79 @@ ColinearityType mspIsColinear(const MSP* const msp1, const MSP* const msp2)
 }
 
 
+static bool gapBlockLessThan(const MspGapBlock &block1, const MspGapBlock &block2)
+{
+  return block1.qMin < block2.qMin;
+}
+
+
+static bool gapBlockEndsBefore(const MspGapBlock &block, const int qIdx)
+{
+  return block.qMax < qIdx;
+}
+
+
+/* Cache the given MSP's gaps as a contiguous array of blocks, sorted by ref seq coord,
+ * so that we can binary-search them (the gaps list may be in either direction depending
+ * on the ref seq strand). This must be called again if the gaps list is changed. */
+void mspIndexGaps(MSP *msp)
+{
+  g_free(msp->gapBlocks);
+  msp->gapBlocks = NULL;
+  msp->numGapBlocks = g_slist_length(msp->gaps);
+
+  if (msp->numGapBlocks < 1)
+    return;
+
+  msp->gapBlocks = g_new(MspGapBlock, msp->numGapBlocks);
+  MspGapBlock *block = msp->gapBlocks;
+
+  for (GSList *rangeItem = msp->gaps; rangeItem; rangeItem = rangeItem->next, ++block)
+    {
+      CoordRange *range = (CoordRange*)(rangeItem->data);
+      getCoordRangeExtents(range, &block->qMin, &block->qMax, &block->sMin, &block->sMax);
+    }
+
+  sort(msp->gapBlocks, msp->gapBlocks + msp->numGapBlocks, gapBlockLessThan);
+}
+
+
+/* Find the gap block in the given MSP that contains the given ref seq coord. Returns the
+ * index of the block in the MSP's gapBlocks array, or -1 if the coord is not inside any
+ * block (i.e. it is in a gap or outside the alignment). The hint is the index of a block
+ * to try first, e.g. the result of the previous lookup when looking up consecutive
+ * coords, or -1 if there is none; otherwise the blocks are binary-searched. */
+int mspFindGapBlock(const MSP* const msp, const int qIdx, const int hint)
+{
+  const MspGapBlock *blocks = msp->gapBlocks;
+  const int numBlocks = msp->numGapBlocks;
+
+  /* Consecutive coords are usually in the same block or the next one along (in
+   * either direction, depending on the direction we're stepping through the coords) */
+  if (hint >= 0)
+    {
+      const int candidates[] = {hint, hint + 1, hint - 1};
+
+      for (int i = 0; i < 3; ++i)
+        {
+          const int idx = candidates[i];
+
+          if (idx >= 0 && idx < numBlocks && qIdx >= blocks[idx].qMin && qIdx <= blocks[idx].qMax)
+            return idx;
+        }
+    }
+
+  /* Find the first block that ends at or after the coord, and check whether the
+   * coord is inside it */
+  const MspGapBlock *block = lower_bound(blocks, blocks + numBlocks, qIdx, gapBlockEndsBefore);
+
+  if (block < blocks + numBlocks && qIdx >= block->qMin)
+    return block - blocks;
+
+  return -1;
+}
+
+
 /* Return the value of the given boolean flag */
 gboolean dataTypeGetFlag(const BlxDataType* const dataType, const MspFlag flag)
 {
@@ -3630,7 +4374,7 @@ void blxColumnCreate(BlxColumnId columnId,
   columnInfo->type = type;
 
   /* Place it in the list. List must be sorted in the same order
-   * as the GtkListStore or gtk_list_store_set fails */
+   * as the tree data model's column types */
   *columnList = g_list_insert_sorted(*columnList, columnInfo, columnIdxCompareFunc);
 }
 
@@ -72,7 +72,8 @@ typedef enum
   BLX_ERROR_STRING_NOT_FOUND,       /* error code for when a search string is not found */
   BLX_ERROR_SEQ_NAME_NOT_FOUND,     /* the sequence name(s) being searched for were not found */
   BLX_ERROR_SEQ_DATA_MISMATCH,      /* same sequence was parsed more than once and data does not match */
-  BLX_ERROR_INVALID_COLUMN          /* error when an invalid column is requested */
+  BLX_ERROR_INVALID_COLUMN,         /* error when an invalid column is requested */
+  BLX_ERROR_SHARED_DATA             /* error creating or reading the shared data segment passed to dotter */
 } BlxError;
 
 
@@ -271,11 +272,21 @@ typedef enum
 } BlxCurveShape;
 
 
+/* One block of a gapped alignment, i.e. the same as one of the CoordRanges in an
+ * MSP's gaps list but with the coords in ascending order. */
+typedef struct _MspGapBlock
+{
+  int qMin;
+  int qMax;
+  int sMin;
+  int sMax;
+} MspGapBlock;
+
+
 /* Structure holding information about a feature (see note at the top of this
  * file about the naming of this struct). */
 typedef struct _MSP
 {
-  gchar* treePaths[BLXMODEL_NUM_MODELS]; /* identifies the row in the tree data model this msp is in (for the model given by the modelId) */
 
   struct _MSP       *next;
   GList             *childMsps;    /* Child MSPs of this MSP if it has them, e.g. an exon has CDS and UTR children (part_of relationship). */
@@ -308,6 +319,8 @@ typedef struct _MSP
   char              *desc;         /* Optional description text for the MSP */
   GSList            *gaps;         /* Array of "gaps" in this homolgy (this is a bit of a misnomer because the array
                                     * gives the ranges of the bits that align rather than the ranges of the gaps in between */
+  MspGapBlock       *gapBlocks;    /* The same ranges as the gaps list, as an array sorted by ref seq coord so that it can be searched quickly (see mspIndexGaps) */
+  int               numGapBlocks;  /* The number of items in the gapBlocks array */
 
   BlxStyle          *style;        /* Specifies drawing style for this MSP, e.g. fill color and line color */
 
@@ -319,6 +332,16 @@ typedef struct _MSP
 } MSP ;
 
 
+/* Function to process a chunk of MSPs (see mspArrayProcessChunks). The chunk number can
+ * be used to index per-chunk results, which can then be combined once all chunks are done. */
+typedef void (*BlxMspChunkFunc)(MSP **msps, const int numMsps, const int chunk, gpointer data);
+
+
+/* Opaque type holding sequences and features packed into binary records for handing
+ * over to Dotter in shared memory (see blxPackedDataCreate) */
+typedef struct _BlxPackedData BlxPackedData;
+
+
 /* MSP functions */
 gboolean              typeIsExon(const BlxMspType mspType);
 gboolean              typeIsIntron(const BlxMspType mspType);
@@ -373,9 +396,11 @@ const char*           mspGetGeneName(const MSP* const msp);
 const char*           mspGetTissueType(const MSP* const msp);
 const char*           mspGetStrain(const MSP* const msp);
 char*                 mspGetCoordsAsString(const MSP* const msp);
-gchar*                mspGetTreePath(const MSP* const msp, BlxModelId modelId);
 
 MSP*                  mspArrayIdx(const GArray* const array, const int idx);
+GPtrArray*            mspListToArray(MSP *mspList);
+int                   mspArrayGetNumChunks(const GPtrArray* const msps);
+void                  mspArrayProcessChunks(GPtrArray *msps, BlxMspChunkFunc func, gpointer data);
 gint                  compareFuncMspPos(gconstpointer a, gconstpointer b);
 gint                  compareFuncMspArray(gconstpointer a, gconstpointer b);
 
@@ -403,6 +428,9 @@ void                  mspFlagSetDefault(const MspFlag flag, const gboolean value
 
 ColinearityType       mspIsColinear(const MSP* const msp1, const MSP* const msp2);
 
+void                  mspIndexGaps(MSP *msp);
+int                   mspFindGapBlock(const MSP* const msp, const int qIdx, const int hint);
+
 int                   getMaxMspLen();
 void                  setMaxMspLen(const int len);
 
@@ -412,6 +440,15 @@ BlxSequence*          readBlxSequenceFromText(char *text, int *numMsps);
 void                  writeMspToOutput(GIOChannel *ioChannel, const MSP* const msp, GError **error);
 void                  readMspFromText(MSP *msp, char *text);
 
+BlxPackedData*        blxPackedDataCreate(const char *seq1, const int seq1Len, const char *seq2, const int seq2Len);
+void                  blxPackedDataDestroy(BlxPackedData *data);
+void                  blxPackedDataAddTranscript(BlxPackedData *data, const BlxSequence* const blxSeq, const IntRange* const refSeqRange);
+void                  blxPackedDataAddBlxSequence(BlxPackedData *data, const BlxSequence *blxSeq, IntRange *range1, IntRange *range2);
+int                   blxCreateSharedMemoryFile(const char *name, GError **error);
+int                   blxPackedDataWriteToSharedMemory(BlxPackedData *data, GError **error);
+gboolean              blxPackedDataReadFromSharedMemory(const int fd, const int seq1Len, const int seq2Len, char **seq1_out, char **seq2_out,
+                                                        GList **seqList, MSP **mspList, GArray* featureLists[], GError **error);
+
 void                  destroyMspList(MSP **mspList);
 void                  destroyBlxSequenceList(GList **seqList);
 void                  destroyMspData(MSP *msp);
@@ -462,6 +499,7 @@ const char*           blxSequenceGetSequence(const BlxSequence *seq);
 gboolean              blxSequenceRequiresSeqData(const BlxSequence *seq);
 gboolean              blxSequenceRequiresOptionalData(const BlxSequence *seq);
 gboolean              blxSequenceRequiresColumnData(const BlxSequence *seq, const BlxColumnId columnId);
+char*                 blxSequenceGetVariantParentName(const BlxSequence *variant);
 BlxSequence*          blxSequenceGetVariantParent(const BlxSequence *variant, GList *allSeqs);
 char*                 blxSequenceGetInfo(BlxSequence *blxSeq, const gboolean allowNewlines, GList *columnList);
 int                   blxSequenceGetStart(const BlxSequence *seq, const BlxStrand strand);
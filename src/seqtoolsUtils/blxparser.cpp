@@ -186,6 +186,15 @@ static void parseLine(char *line, const int lineNum, BlxBlastMode *blastMode, co
 }
 
 
+/* Returns true if the given line should be added to the batch of GFF body
+ * lines, i.e. if we're in the GFF body and it is a (non-empty) data line
+ * rather than a comment or directive that may change the parser state. */
+static gboolean isGffBodyLine(const char *line, const BlxParserState parserState)
+{
+  return (parserState == GFF_3_BODY && line && *line && *line != '\n' && *line != '#');
+}
+
+
 /* Utility to determine if we're at the end of a file stream (if given) or the
  * end of the buffer (if given) */
 static gboolean endOfFileOrBuffer(FILE *file, const char *buffer)
@@ -207,6 +216,8 @@ static void parseFileOrBuffer(MSP **MSPlist, FILE *file, const char *buffer_in,
                               char **seq1, char *seq1name, IntRange *seq1Range, char **seq2, char *seq2name,
                               GKeyFile *keyFile, GHashTable *lookupTable, GHashTable *fetchMethods, GError **error)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_PARSE, "parseFeatures");
+
   g_return_if_fail(file || buffer_in);
 
   const int resFactor = getResFactorFromMode(*blastMode);
@@ -235,6 +246,9 @@ static void parseFileOrBuffer(MSP **MSPlist, FILE *file, const char *buffer_in,
   int readSeqMaxLen = UNSET_INT;    /* current max length of the buffer */
   int readSeqLen = UNSET_INT;       /* current end pos of the data in the buffer */
 
+  /* GFF body lines are collected into batches, which can be parsed in parallel */
+  BlxGffBatch *gffBatch = createGffBatch();
+
   while (!endOfFileOrBuffer(file, buffer) && parserState != PARSER_ERROR)
     {
       ++lineNum;
@@ -248,11 +262,30 @@ static void parseFileOrBuffer(MSP **MSPlist, FILE *file, const char *buffer_in,
       else
         line = nextLineOfBuffer(&buffer, line_string);
 
+      if (isGffBodyLine(line, parserState))
+        {
+          if (gffBatchAddLine(gffBatch, line, lineNum))
+            {
+              parseGff3BodyBatch(gffBatch, featureLists, &msp, MSPlist, seqList, columnList, supportedTypes, styles,
+                                 resFactor, keyFile, seq1Range, lookupTable, fetchMethods);
+            }
+
+          continue;
+        }
+
+      /* Anything else may change the parser state, so finish any pending GFF lines first */
+      parseGff3BodyBatch(gffBatch, featureLists, &msp, MSPlist, seqList, columnList, supportedTypes, styles,
+                         resFactor, keyFile, seq1Range, lookupTable, fetchMethods);
+
       parseLine(line, lineNum, blastMode, resFactor, &msp, line_string,
                 seq1, seq1name, seq1Range, seq2, seq2name, &parserState, featureLists, MSPlist, seqList, columnList, supportedTypes,
                 styles, &readSeq, &readSeqLen, &readSeqMaxLen, keyFile, lookupTable, fetchMethods, error);
     }
 
+  parseGff3BodyBatch(gffBatch, featureLists, &msp, MSPlist, seqList, columnList, supportedTypes, styles,
+                     resFactor, keyFile, seq1Range, lookupTable, fetchMethods);
+
+  destroyGffBatch(&gffBatch);
   g_string_free(line_string, TRUE) ;			    /* free everything, buffer and all. */
 
   if (seq1Range)
@@ -488,6 +521,8 @@ static char *concatenateFastaSeqs(FILE *seqfile, char *seqName, int *startCoord,
  */
 char *readFastaSeq(FILE *seqfile, char *seqName, int *startCoord, int *endCoord, const BlxSeqType seqType)
 {
+  SEQTOOLS_TRACE_SPAN(TRACE_CAT_PARSE, "readFastaSeq");
+
   if (seqfile == stdin)
     return readFastaSeqFromStdin(seqfile, seqName, startCoord, endCoord, seqType);
   else
@@ -55,6 +55,7 @@ BlxFetchMethod* createBlxFetchMethod(const char *fetchName)
   result->separator = NULL;
   result->errors = NULL;
   result->outputType = BLXFETCH_OUTPUT_INVALID;
+  result->maxParallel = DEFAULT_FETCH_MAX_PARALLEL;
 
   return result;
 }
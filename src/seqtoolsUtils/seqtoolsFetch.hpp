@@ -38,6 +38,8 @@
 
 #include <glib.h>
 
+#define DEFAULT_FETCH_MAX_PARALLEL   4      /* default number of concurrent fetches per fetch method */
+
 /* These are the supported fetch modes. ***If you add anything here, also add it in fetchModeStr*** */
 typedef enum
   {
@@ -89,6 +91,7 @@ typedef struct _BlxFetchMethod
   char *separator;                  /* separator when combining multiple sequence names into a list */
   GArray *errors;                   /* array of messages (as GQuarks) that indicate that an error occurred, e.g. "no match" */
   BlxFetchOutputType outputType;    /* the output format to expect from the fetch command */
+  int maxParallel;                  /* max number of fetches using this method that may run at once (bulk fetch only) */
 } BlxFetchMethod;
 
 #endif /* DEF_SEQTOOLS_FETCH_HPP */
@@ -0,0 +1,311 @@
+/*  File: seqtoolsTrace.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: See seqtoolsTrace.hpp
+ *----------------------------------------------------------------------------
+ */
+
+#include <seqtoolsUtils/seqtoolsTrace.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* A completed span */
+typedef struct _TraceEvent
+{
+  const char *category;
+  const char *name;
+  gint64 startTime;             /* microseconds since tracing started */
+  gint64 duration;              /* microseconds */
+  int threadId;
+} TraceEvent;
+
+
+/* Totals for all spans with the same category and name, for the summary */
+typedef struct _TraceSummaryItem
+{
+  const char *category;
+  const char *name;
+  int count;
+  gint64 total;
+  gint64 max;
+} TraceSummaryItem;
+
+
+gboolean g_seqtoolsTraceEnabled = FALSE;
+
+static GMutex g_traceMutex;                     /* protects g_traceEvents */
+static GArray *g_traceEvents = NULL;            /* array of TraceEvent */
+static FILE *g_traceFile = NULL;
+static char *g_traceFileName = NULL;
+static gint64 g_traceStartTime = 0;
+static gint g_traceNumThreads = 0;              /* number of thread IDs allocated so far */
+
+static thread_local int t_traceThreadId = 0;    /* 1-based ID of the current thread, or 0 if not allocated yet */
+
+
+/* Get the ID of the current thread. IDs are allocated in the order that threads first
+ * record a span; the thread that enables tracing is always 1. */
+static int traceGetThreadId()
+{
+  if (!t_traceThreadId)
+    t_traceThreadId = g_atomic_int_add(&g_traceNumThreads, 1) + 1;
+
+  return t_traceThreadId;
+}
+
+
+/* Replace any "%p" in the given filename with the process ID. Returns a newly-allocated string. */
+static char* traceExpandFileName(const char *filename)
+{
+  GString *result = g_string_new(NULL);
+
+  for (const char *cp = filename; *cp; ++cp)
+    {
+      if (cp[0] == '%' && cp[1] == 'p')
+        {
+          g_string_append_printf(result, "%d", (int)getpid());
+          ++cp;
+        }
+      else
+        {
+          g_string_append_c(result, *cp);
+        }
+    }
+
+  return g_string_free(result, FALSE);
+}
+
+
+/* Write the given string to the given file as a JSON string literal */
+static void traceWriteJsonString(FILE *file, const char *str)
+{
+  fputc('"', file);
+
+  for (const char *cp = str; *cp; ++cp)
+    {
+      if (*cp == '"' || *cp == '\\')
+        fprintf(file, "\\%c", *cp);
+      else if ((unsigned char)*cp < 0x20)
+        fprintf(file, "\\u%04x", (unsigned char)*cp);
+      else
+        fputc(*cp, file);
+    }
+
+  fputc('"', file);
+}
+
+
+/* Write all recorded spans to the trace file in Chrome trace-event format. "X"
+ * (complete) events are used, so nesting is implied by the times on each thread. */
+static void traceWriteEvents(FILE *file)
+{
+  const int pid = (int)getpid();
+  const char *processName = g_get_prgname() ? g_get_prgname() : "seqtools";
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  /* Metadata events to name the process and threads */
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,\"args\":{\"name\":", pid);
+  traceWriteJsonString(file, processName);
+  fprintf(file, "}}");
+
+  const int numThreads = g_atomic_int_get(&g_traceNumThreads);
+
+  for (int threadId = 1; threadId <= numThreads; ++threadId)
+    {
+      if (threadId == 1)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,\"args\":{\"name\":\"main\"}}", pid);
+      else
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}", pid, threadId, threadId - 1);
+    }
+
+  for (guint i = 0; i < g_traceEvents->len; ++i)
+    {
+      const TraceEvent *event = &g_array_index(g_traceEvents, TraceEvent, i);
+
+      fprintf(file, ",\n{\"name\":");
+      traceWriteJsonString(file, event->name);
+      fprintf(file, ",\"cat\":");
+      traceWriteJsonString(file, event->category);
+      fprintf(file, ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+              event->startTime, event->duration, pid, event->threadId);
+    }
+
+  fprintf(file, "\n]}\n");
+}
+
+
+/* Sort function to order summary items by decreasing total time */
+static gint traceSummaryCompareFunc(gconstpointer a, gconstpointer b)
+{
+  const TraceSummaryItem *item1 = (const TraceSummaryItem*)a;
+  const TraceSummaryItem *item2 = (const TraceSummaryItem*)b;
+
+  if (item1->total != item2->total)
+    return item1->total > item2->total ? -1 : 1;
+
+  return strcmp(item1->name, item2->name);
+}
+
+
+/* Print the total, mean and max time for each distinct span to stderr. Spans are
+ * aggregated by category and name, regardless of which thread recorded them. */
+static void traceWriteSummary(FILE *file)
+{
+  GHashTable *lookup = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  GArray *items = g_array_new(FALSE, TRUE, sizeof(TraceSummaryItem));
+
+  for (guint i = 0; i < g_traceEvents->len; ++i)
+    {
+      const TraceEvent *event = &g_array_index(g_traceEvents, TraceEvent, i);
+      char *key = g_strdup_printf("%s\t%s", event->category, event->name);
+      gpointer value = NULL;
+      TraceSummaryItem *item = NULL;
+
+      if (g_hash_table_lookup_extended(lookup, key, NULL, &value))
+        {
+          item = &g_array_index(items, TraceSummaryItem, GPOINTER_TO_INT(value));
+          g_free(key);
+        }
+      else
+        {
+          g_hash_table_insert(lookup, key, GINT_TO_POINTER(items->len));
+          g_array_set_size(items, items->len + 1);
+          item = &g_array_index(items, TraceSummaryItem, items->len - 1);
+          item->category = event->category;
+          item->name = event->name;
+        }
+
+      ++item->count;
+      item->total += event->duration;
+
+      if (event->duration > item->max)
+        item->max = event->duration;
+    }
+
+  g_array_sort(items, traceSummaryCompareFunc);
+
+  fprintf(file, "\nTrace summary (%.3f seconds elapsed, trace written to %s)\n",
+          (g_get_monotonic_time() - g_traceStartTime) / 1e6, g_traceFileName);
+  fprintf(file, "%-10s %-32s %8s %12s %12s %12s\n", "category", "span", "calls", "total ms", "mean ms", "max ms");
+
+  for (guint i = 0; i < items->len; ++i)
+    {
+      const TraceSummaryItem *item = &g_array_index(items, TraceSummaryItem, i);
+
+      fprintf(file, "%-10s %-32s %8d %12.3f %12.3f %12.3f\n",
+              item->category, item->name, item->count,
+              item->total / 1e3, item->total / 1e3 / item->count, item->max / 1e3);
+    }
+
+  g_array_free(items, TRUE);
+  g_hash_table_destroy(lookup);
+}
+
+
+/* Called on exit to write out the trace file and summary */
+static void traceOnExit()
+{
+  if (!g_seqtoolsTraceEnabled)
+    return;
+
+  g_mutex_lock(&g_traceMutex);
+
+  /* Stop recording; spans still open on other threads are discarded */
+  g_seqtoolsTraceEnabled = FALSE;
+
+  traceWriteEvents(g_traceFile);
+
+  if (fclose(g_traceFile) != 0)
+    fprintf(stderr, "Error writing trace file '%s'\n", g_traceFileName);
+
+  traceWriteSummary(stderr);
+
+  g_array_free(g_traceEvents, TRUE);
+  g_traceEvents = NULL;
+  g_traceFile = NULL;
+
+  g_mutex_unlock(&g_traceMutex);
+}
+
+
+/* Enable tracing. The trace is written to the given file or, if that is null,
+ * to the file given by the SEQTOOLS_TRACE environment variable. Does nothing if
+ * neither is set. This should be called from the main thread before any spans
+ * are recorded. */
+void seqtoolsTraceInit(const char *filename)
+{
+  if (g_seqtoolsTraceEnabled)
+    return;
+
+  if (!filename || !*filename)
+    filename = g_getenv(SEQTOOLS_TRACE_ENV_VAR);
+
+  if (!filename || !*filename)
+    return;
+
+  g_traceFileName = traceExpandFileName(filename);
+  g_traceFile = fopen(g_traceFileName, "w");
+
+  if (!g_traceFile)
+    {
+      g_warning("Tracing disabled: could not open trace file '%s' for writing\n", g_traceFileName);
+      g_free(g_traceFileName);
+      g_traceFileName = NULL;
+      return;
+    }
+
+  g_traceEvents = g_array_sized_new(FALSE, FALSE, sizeof(TraceEvent), 1024);
+  g_traceStartTime = g_get_monotonic_time();
+
+  /* Make sure the calling thread gets ID 1 */
+  traceGetThreadId();
+
+  atexit(traceOnExit);
+  g_seqtoolsTraceEnabled = TRUE;
+}
+
+
+/* Record a completed span. Times are from g_get_monotonic_time. Normally called via
+ * SeqtoolsTraceSpan rather than directly. */
+void seqtoolsTraceRecord(const char *category, const char *name, const gint64 startTime, const gint64 endTime)
+{
+  TraceEvent event = {category, name, startTime - g_traceStartTime, endTime - startTime, traceGetThreadId()};
+
+  g_mutex_lock(&g_traceMutex);
+
+  if (g_seqtoolsTraceEnabled)
+    g_array_append_val(g_traceEvents, event);
+
+  g_mutex_unlock(&g_traceMutex);
+}
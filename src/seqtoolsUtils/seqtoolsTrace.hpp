@@ -0,0 +1,117 @@
+/*  File: seqtoolsTrace.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Scoped timing and trace-event instrumentation.
+ *
+ *              A span is recorded by declaring a SEQTOOLS_TRACE_SPAN at the
+ *              start of the block to be timed; the span ends when the block
+ *              exits. Spans may be nested and may be recorded from any
+ *              thread. The instrumentation is always compiled in, but it
+ *              does nothing (other than test a flag) unless tracing has
+ *              been enabled with seqtoolsTraceInit.
+ *
+ *              When tracing is enabled, the recorded spans are written to
+ *              the trace file on exit in the Chrome trace-event JSON format
+ *              (viewable in chrome://tracing or Perfetto), and a summary of
+ *              the total time spent in each span is printed to stderr.
+ *
+ *              Any "%p" in the trace filename is replaced by the process ID,
+ *              so that programs launched by another traced program (e.g.
+ *              Dotter launched from Blixem, which inherits the environment)
+ *              write to their own file rather than overwriting it.
+ *
+ *              Span categories and names must be string literals (or
+ *              otherwise persist until exit) because only the pointers are
+ *              stored.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _seqtools_trace_included_
+#define _seqtools_trace_included_
+
+#include <glib.h>
+
+
+/* Environment variable that enables tracing if the --trace argument is not given */
+#define SEQTOOLS_TRACE_ENV_VAR          "SEQTOOLS_TRACE"
+
+/* Categories used to group spans in the trace output */
+#define TRACE_CAT_PARSE                 "parse"
+#define TRACE_CAT_FETCH                 "fetch"
+#define TRACE_CAT_FINALISE              "finalise"
+#define TRACE_CAT_DEPTH                 "depth"
+#define TRACE_CAT_TREE                  "tree"
+#define TRACE_CAT_PLOT                  "plot"
+#define TRACE_CAT_REDRAW                "redraw"
+
+
+/* Declare a span that times the enclosing block */
+#define SEQTOOLS_TRACE_SPAN(category, name) \
+  SeqtoolsTraceSpan SEQTOOLS_TRACE_CONCAT(traceSpan_, __LINE__)(category, name)
+
+#define SEQTOOLS_TRACE_CONCAT(a, b)     SEQTOOLS_TRACE_CONCAT_(a, b)
+#define SEQTOOLS_TRACE_CONCAT_(a, b)    a##b
+
+
+extern gboolean g_seqtoolsTraceEnabled;
+
+
+void                    seqtoolsTraceInit(const char *filename);
+void                    seqtoolsTraceRecord(const char *category, const char *name, const gint64 startTime, const gint64 endTime);
+
+
+/* Records the time between its construction and destruction as a span */
+class SeqtoolsTraceSpan
+{
+public:
+  SeqtoolsTraceSpan(const char *category, const char *name)
+    : m_category(category),
+      m_name(name),
+      m_startTime(g_seqtoolsTraceEnabled ? g_get_monotonic_time() : 0)
+  {
+  }
+
+  ~SeqtoolsTraceSpan()
+  {
+    if (m_startTime)
+      seqtoolsTraceRecord(m_category, m_name, m_startTime, g_get_monotonic_time());
+  }
+
+private:
+  SeqtoolsTraceSpan(const SeqtoolsTraceSpan&);
+  SeqtoolsTraceSpan& operator=(const SeqtoolsTraceSpan&);
+
+  const char *m_category;
+  const char *m_name;
+  gint64 m_startTime;                   /* monotonic time in microseconds, or 0 if tracing is off */
+};
+
+
+#endif /* _seqtools_trace_included_ */
@@ -57,6 +57,86 @@ typedef enum
 
 /* THIS FILE NEEDS RENAMING TO SOMETHING LIKE utils.c */
 
+
+#define CODON_INVALID   64      /* index into the genetic code of the ambiguous amino acid */
+#define BASE_INVALID    4       /* base index for anything that is not A, C, G, T or U */
+
+
+/* Lookup tables, indexed by character, built from the iupac table on first use:
+ * - the complement of each valid nucleotide (preserving case), or 0 if not valid;
+ * - the 2-bit index of each base as used in the genetic code (A=0, C=1, G=2, T/U=3),
+ *   or BASE_INVALID. */
+static char g_complementTable[256];
+static char g_baseIndexTable[256];
+
+
+static void initTranslationTables()
+{
+  static gsize initialised = 0;
+
+  if (g_once_init_enter(&initialised))
+    {
+      int c = 0;
+
+      for ( ; c < 256; ++c)
+        {
+          g_complementTable[c] = 0;
+          g_baseIndexTable[c] = BASE_INVALID;
+        }
+
+      int idx = 0;
+
+      for ( ; idx < IUPACSYMNUM; ++idx)
+        {
+          const unsigned char sym = iupac[idx].sym;
+          g_complementTable[sym] = iupac[idx].symcomp;
+          g_complementTable[tolower(sym)] = tolower(iupac[idx].symcomp);
+        }
+
+      g_baseIndexTable['A'] = g_baseIndexTable['a'] = 0;
+      g_baseIndexTable['C'] = g_baseIndexTable['c'] = 1;
+      g_baseIndexTable['G'] = g_baseIndexTable['g'] = 2;
+      g_baseIndexTable['T'] = g_baseIndexTable['t'] = 3;
+      g_baseIndexTable['U'] = g_baseIndexTable['u'] = 3;
+
+      g_once_init_leave(&initialised, 1);
+    }
+}
+
+
+/* Complement a single char using the lookup table. Invalid chars are returned unchanged. */
+static inline char complementFromTable(const char inputChar)
+{
+  const char result = g_complementTable[(unsigned char)inputChar];
+  return result ? result : inputChar;
+}
+
+
+/* Translate the codon starting at the given position (which must have at least 3 bases) */
+static inline int getCodonIdx(const char *seq)
+{
+  const int b1 = g_baseIndexTable[(unsigned char)seq[0]];
+  const int b2 = g_baseIndexTable[(unsigned char)seq[1]];
+  const int b3 = g_baseIndexTable[(unsigned char)seq[2]];
+
+  if (b1 == BASE_INVALID || b2 == BASE_INVALID || b3 == BASE_INVALID)
+    return CODON_INVALID;
+
+  return (b1 << 4) | (b2 << 2) | b3;
+}
+
+
+/* Get the lengths of the amino acid strings in the given genetic code so that we can
+ * copy them without looking at them again for every codon */
+static void getCodeLengths(char **code, int codeLens[CODON_INVALID + 1])
+{
+  int i = 0;
+
+  for ( ; i <= CODON_INVALID; ++i)
+    codeLens[i] = strlen(code[i]);
+}
+
+
 /* Function: Translate(char *seq, char **code)
  *
  * Given a ptr to the start of a nucleic acid sequence, and a genetic code, translate the sequence
@@ -76,70 +156,117 @@ typedef enum
 char *blxTranslate(const char *seq, char **code)
 {
   char *aaseq = NULL ;					    /* RETURN: the translation */
-  int   codon;						    /* index for codon         */
-  char *aaptr;						    /* ptr into aaseq */
-  int   i;
 
   if (seq && *seq)
     {
-      aaseq = (char *)g_malloc(strlen(seq) + 1) ;
-
-      for (aaptr = aaseq ; *seq != '\0' && *(seq+1) != '\0' && *(seq+2) != '\0'; seq += 3)
-	{
-	  /* calculate the lookup value for this codon */
-	  codon = 0;
-	  for (i = 0; i < 3; i++)
-	    {
-	      codon *= 4;
-
-	      switch (*(seq + i))
-		{
-		case 'A': case 'a':             break;
-		case 'C': case 'c': codon += 1; break;
-		case 'G': case 'g': codon += 2; break;
-		case 'T': case 't': codon += 3; break;
-		case 'U': case 'u': codon += 3; break;
-		default: codon = 64; break;
-		}
-
-	      if (codon == 64)
-		break;
-	    }
-
-	  strcpy(aaptr, code[codon]);
-	  aaptr += strlen(code[codon]);
-	}
+      initTranslationTables();
+
+      int codeLens[CODON_INVALID + 1];
+      getCodeLengths(code, codeLens);
+
+      const int len = strlen(seq);
+      aaseq = (char *)g_malloc(len + 1) ;
+      char *aaptr = aaseq;
+      int i = 0;
+
+      for ( ; i + 2 < len; i += 3)
+        {
+          const int codon = getCodonIdx(seq + i);
+          memcpy(aaptr, code[codon], codeLens[codon]);
+          aaptr += codeLens[codon];
+        }
+
+      *aaptr = '\0';
     }
 
   return aaseq ;
 }
 
 
+/* Translate the given nucleic acid sequence in each of the first numFrames reading
+ * frames (i.e. starting at offsets 0, 1 and 2) in a single pass over the sequence. The
+ * results are equivalent to calling blxTranslate(seq + frame, code) for each frame and
+ * are returned in the results array, which must have space for numFrames entries. Frames
+ * with no bases are returned as NULL, as blxTranslate would. */
+void blxTranslateFrames(const char *seq, char **code, const int numFrames, char **results)
+{
+  g_return_if_fail(numFrames >= 1 && numFrames <= 3);
+
+  const int len = seq ? strlen(seq) : 0;
+  char *aaptrs[3] = {NULL, NULL, NULL};
+  int frame = 0;
+
+  for ( ; frame < numFrames; ++frame)
+    {
+      results[frame] = NULL;
+
+      if (frame < len)
+        {
+          results[frame] = (char *)g_malloc(len - frame + 1);
+          aaptrs[frame] = results[frame];
+        }
+    }
+
+  if (len < 1)
+    return;
+
+  initTranslationTables();
+
+  int codeLens[CODON_INVALID + 1];
+  getCodeLengths(code, codeLens);
+
+  /* Roll a 6-bit codon index along the sequence, remembering where the last invalid base
+   * was so that we can tell when the current codon is ambiguous. */
+  int codon = 0;
+  int lastInvalid = -3; /* position of the most recent invalid base */
+  int i = 0;
+
+  for ( ; i < len; ++i)
+    {
+      const int base = g_baseIndexTable[(unsigned char)seq[i]];
+
+      if (base == BASE_INVALID)
+        lastInvalid = i;
+
+      codon = ((codon << 2) | (base & 3)) & 63;
+
+      const int start = i - 2; /* start of the codon ending at this base */
+
+      if (start >= 0)
+        {
+          frame = start % 3;
+
+          if (frame < numFrames)
+            {
+              const int idx = (lastInvalid >= start) ? CODON_INVALID : codon;
+              memcpy(aaptrs[frame], code[idx], codeLens[idx]);
+              aaptrs[frame] += codeLens[idx];
+            }
+        }
+    }
+
+  for (frame = 0; frame < numFrames; ++frame)
+    {
+      if (aaptrs[frame])
+        *aaptrs[frame] = '\0';
+    }
+}
+
+
 /* Get the complement of the given nucleotide. Returns the original char and sets
  * the error if no valid complement exists */
 char complementChar(const char inputChar, GError **error)
 {
-  /* Loop through each iupac code looking for this char. iupac chars are all
-   * uppercase */
-  char result = '\0';
-  char c = toupper(inputChar);
-  int idx = 0;
+  initTranslationTables();
 
-  for ( ; c != iupac[idx].sym && idx < IUPACSYMNUM; idx++);
+  char result = g_complementTable[(unsigned char)inputChar];
 
-  if (idx >= IUPACSYMNUM)
+  if (!result)
     {
       /* not found; return original char */
       result = inputChar;
       g_set_error(error, SEQTOOLS_TRANSLATION_ERROR, SEQTOOLS_ERROR_INVALID_NUCLEOTIDE, "Invalid nucleotide '%c'; could not find complement.\n", inputChar);
     }
-  else
-    {
-      result = iupac[idx].symcomp;
-
-      if (islower(inputChar))
-        result = tolower(result);
-    }
 
   return result;
 }
@@ -164,13 +291,15 @@ char *revComplement(char *comp, char *seq)
   if (seq == NULL)
     return NULL;
 
+  initTranslationTables();
+
   bases = strlen(seq);
 
   fwdp = comp;
   bckp = seq + bases -1;
   for (pos = 0; pos < bases; pos++)
     {
-      *fwdp = complementChar(*bckp, NULL);
+      *fwdp = complementFromTable(*bckp);
       fwdp++;
       bckp--;
     }
@@ -189,19 +318,16 @@ char *revComplement(char *comp, char *seq)
 void blxComplement(char *seq)
 {
   char *fwdp;
-  long  pos;
 
   if (seq == NULL)
     return ;
 
-  fwdp = seq;
-  for (pos = 0; pos < (int)strlen(seq); pos++)
+  initTranslationTables();
+
+  for (fwdp = seq; *fwdp; fwdp++)
     {
-      *fwdp = complementChar(*fwdp, NULL);
-      fwdp++;
+      *fwdp = complementFromTable(*fwdp);
     }
 
-  *fwdp = '\0';
-
   return ;
 }
@@ -39,6 +39,7 @@
 #include <math.h>
 #include <algorithm>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/utsname.h>
@@ -3393,28 +3394,166 @@ void getFontCharSize(GtkWidget *widget,
  *                      Memory
 ***********************************************************/
 
-/* Create a handle. A handle is just a GSList so should be initialised to NULL */
+/* A chunk of memory in a handle. The usable memory follows directly after this header. */
+struct _BlxHandleChunk
+{
+  BlxHandleChunk *next;
+  gsize size;                   /* number of usable bytes in this chunk */
+  gsize used;                   /* number of bytes that have been handed out from this chunk */
+};
+
+/* Size of the chunk header, rounded up so that the chunk data is suitably aligned for any type */
+#define HANDLE_DEFAULT_ALIGNMENT  (alignof(max_align_t))
+#define HANDLE_CHUNK_HEADER_SIZE  ((sizeof(BlxHandleChunk) + HANDLE_DEFAULT_ALIGNMENT - 1) & ~(HANDLE_DEFAULT_ALIGNMENT - 1))
+
+/* Allocations bigger than this get a chunk to themselves rather than wasting the rest of the current chunk */
+#define HANDLE_MAX_SHARED_ALLOC   (HANDLE_CHUNK_SIZE / 4)
+
+
+static guchar* handleChunkData(BlxHandleChunk *chunk)
+{
+  return (guchar*)chunk + HANDLE_CHUNK_HEADER_SIZE;
+}
+
+/* Return the number of bytes of padding needed before the next free byte in the given chunk
+ * to give the requested alignment */
+static gsize handleChunkPadding(BlxHandleChunk *chunk, const gsize alignment)
+{
+  const guintptr addr = (guintptr)(handleChunkData(chunk) + chunk->used);
+  return (alignment - (addr & (alignment - 1))) & (alignment - 1);
+}
+
+static BlxHandleChunk* handleChunkCreate(BlxHandle handle, const gsize size)
+{
+  BlxHandleChunk *chunk = (BlxHandleChunk*)g_malloc(HANDLE_CHUNK_HEADER_SIZE + size);
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+
+  ++handle->stats.numChunks;
+  handle->stats.bytesReserved += size;
+
+  return chunk;
+}
+
+
+/* Create a handle. Memory allocated from the handle is free'd when the handle is destroyed */
 BlxHandle handleCreate()
 {
-  BlxHandle handle = new BlxHandleStruct;
-  handle->memoryList = NULL;
+  BlxHandle handle = g_new0(BlxHandleStruct, 1);
+  handle->chunks = NULL;
   return handle;
 }
 
-/* Utility to allocate memory of the given size with g_malloc. Returns the allocated memory and
- * adds a pointer to it to the given handle (list), so that all memory allocated to this list can be destroyed
- * with handleDestroy */
-gpointer handleAlloc(BlxHandle *handle, size_t numBytes)
+/* Allocate memory of the given size from the given handle, aligned to the given number of
+ * bytes (which must be a power of 2; use HANDLE_CACHE_LINE_SIZE for buffers that will be
+ * processed with vector instructions). The memory is owned by the handle and is free'd,
+ * along with all other memory allocated from the handle, by handleDestroy. Returns NULL
+ * if numBytes is 0. */
+gpointer handleAllocAligned(BlxHandle *handle, size_t numBytes, size_t alignment)
 {
-  gpointer result = g_malloc(numBytes);
+  g_return_val_if_fail(handle && *handle, NULL);
+  g_return_val_if_fail(alignment > 0 && (alignment & (alignment - 1)) == 0, NULL);
+
+  if (numBytes == 0)
+    return NULL;
+
+  BlxHandle h = *handle;
+  BlxHandleChunk *chunk = h->chunks;
+  gsize padding = chunk ? handleChunkPadding(chunk, alignment) : 0;
+
+  if (!chunk || chunk->used + padding + numBytes > chunk->size)
+    {
+      if (numBytes + alignment > HANDLE_MAX_SHARED_ALLOC)
+        {
+          /* Big allocation: give it its own chunk. Insert it after the current chunk so that
+           * we can carry on allocating from the space left in the current one. */
+          chunk = handleChunkCreate(h, numBytes + alignment - 1);
+
+          if (h->chunks)
+            {
+              chunk->next = h->chunks->next;
+              h->chunks->next = chunk;
+            }
+          else
+            {
+              h->chunks = chunk;
+            }
+        }
+      else
+        {
+          /* Start a new chunk; any space left in the old one is abandoned */
+          chunk = handleChunkCreate(h, HANDLE_CHUNK_SIZE);
+          chunk->next = h->chunks;
+          h->chunks = chunk;
+        }
+
+      padding = handleChunkPadding(chunk, alignment);
+    }
+
+  gpointer result = handleChunkData(chunk) + chunk->used + padding;
+  chunk->used += padding + numBytes;
 
-  /* prepend so that we delete data in reverse order */
-  (*handle)->memoryList = g_slist_prepend((*handle)->memoryList, result);
+  ++h->stats.numAllocs;
+  h->stats.bytesUsed += padding + numBytes;
+
+  if (h->stats.bytesUsed > h->stats.peakBytesUsed)
+    h->stats.peakBytesUsed = h->stats.bytesUsed;
 
   return result;
 }
 
-/* Utilitiy to call g_free on all elements in the given handle. Frees the handle too and sets it to null. */
+/* Allocate memory of the given size from the given handle, suitably aligned for any type.
+ * The memory is free'd, along with all other memory allocated from the handle, by
+ * handleDestroy. */
+gpointer handleAlloc(BlxHandle *handle, size_t numBytes)
+{
+  return handleAllocAligned(handle, numBytes, HANDLE_DEFAULT_ALIGNMENT);
+}
+
+/* Free all memory allocated from the given handle but keep the handle so that it can be
+ * re-used. One standard-sized chunk is kept to avoid re-allocating it. The peak usage
+ * statistic is preserved. */
+void handleReset(BlxHandle handle)
+{
+  if (!handle)
+    return;
+
+  BlxHandleChunk *keep = NULL;
+  BlxHandleChunk *chunk = handle->chunks;
+
+  while (chunk)
+    {
+      BlxHandleChunk *next = chunk->next;
+
+      if (!keep && chunk->size == HANDLE_CHUNK_SIZE)
+        {
+          keep = chunk;
+          keep->next = NULL;
+          keep->used = 0;
+        }
+      else
+        {
+          g_free(chunk);
+        }
+
+      chunk = next;
+    }
+
+  handle->chunks = keep;
+  handle->stats.numChunks = keep ? 1 : 0;
+  handle->stats.bytesReserved = keep ? keep->size : 0;
+  handle->stats.bytesUsed = 0;
+}
+
+/* Get usage statistics for the given handle */
+void handleGetStats(const BlxHandle handle, BlxHandleStats *stats)
+{
+  if (handle && stats)
+    *stats = handle->stats;
+}
+
+/* Utility to free all memory allocated from the given handle. Frees the handle too and sets it to null. */
 void handleDestroy(BlxHandle *handle)
 {
   DEBUG_ENTER("handleDestroy");
@@ -3422,14 +3561,20 @@ void handleDestroy(BlxHandle *handle)
   if (handle == NULL || *handle == NULL)
     return;
 
-  GSList *listItem = (*handle)->memoryList;
-  for ( ; listItem; listItem = listItem->next)
+  DEBUG_OUT("Handle used %lu bytes (peak %lu) in %lu allocations from %lu chunks (%lu bytes)\n",
+            (unsigned long)(*handle)->stats.bytesUsed, (unsigned long)(*handle)->stats.peakBytesUsed,
+            (unsigned long)(*handle)->stats.numAllocs, (unsigned long)(*handle)->stats.numChunks,
+            (unsigned long)(*handle)->stats.bytesReserved);
+
+  BlxHandleChunk *chunk = (*handle)->chunks;
+
+  while (chunk)
     {
-      g_free(listItem->data);
-      listItem->data = NULL;
+      BlxHandleChunk *next = chunk->next;
+      g_free(chunk);
+      chunk = next;
     }
 
-  g_slist_free((*handle)->memoryList);
   g_free(*handle);
   *handle = NULL;
 
@@ -37,6 +37,7 @@
 #define _utilities_h_included_
 
 #include <gtk/gtk.h>
+#include <seqtoolsUtils/seqtoolsTrace.hpp>
 
 #define UNSET_INT                     -1   /* this value indicates an unset integer */
 #define DEFAULT_LABEL_X_PAD           0    /* default x padding to use for header labels */
@@ -203,11 +204,28 @@ typedef struct _BlxColor
   } BlxColor;
 
 
-/* This handle holds a list of pointers to all memory allocated via this handle.
- * Use handleDestroy to free the handle and all its allocated memory. */
+/* A handle is an arena: memory allocated via the handle is carved sequentially out of
+ * large chunks, and individual allocations are never free'd. Use handleDestroy to free
+ * the handle and all its allocated memory in one go. */
+#define HANDLE_CHUNK_SIZE         65536   /* default size of each chunk of memory in a handle */
+#define HANDLE_CACHE_LINE_SIZE    64      /* alignment used by handleAllocAligned */
+
+typedef struct _BlxHandleChunk BlxHandleChunk;
+
+/* Usage statistics for a handle */
+typedef struct _BlxHandleStats
+  {
+    gsize numAllocs;              /* number of allocations made */
+    gsize numChunks;              /* number of chunks currently held */
+    gsize bytesUsed;              /* number of bytes currently handed out (including alignment padding) */
+    gsize bytesReserved;          /* number of bytes currently held in chunks */
+    gsize peakBytesUsed;          /* maximum of bytesUsed over the life of the handle */
+  } BlxHandleStats;
+
 typedef struct _BlxHandle
   {
-    GSList *memoryList;
+    BlxHandleChunk *chunks;       /* list of chunks; the first is the one currently being allocated from */
+    BlxHandleStats stats;
   } BlxHandleStruct, *BlxHandle;
 
 
@@ -376,7 +394,10 @@ BlxSeqType            determineSeqType(char *seq, GError **error);
 void                  argvAdd(int *argc, char ***argv, const char *s);
 char*                 getSystemErrorText();
 gpointer              handleAlloc(BlxHandle *handle, size_t numBytes);
+gpointer              handleAllocAligned(BlxHandle *handle, size_t numBytes, size_t alignment);
 BlxHandle             handleCreate();
+void                  handleReset(BlxHandle handle);
+void                  handleGetStats(const BlxHandle handle, BlxHandleStats *stats);
 void                  handleDestroy(BlxHandle *handle);
 BlxStyle*             getBlxStyle(const char *styleName, GSList *styles, GError **error);
 
@@ -671,6 +692,7 @@ gboolean                           seqtoolsLaunchWebBrowser(const char *link, GE
 
 /* translate.c */
 char*                              blxTranslate(const char *seq, char **code);
+void                               blxTranslateFrames(const char *seq, char **code, const int numFrames, char **results);
 void                               blxComplement(char *seq) ;
 char*                              revComplement(char *comp, char *seq) ;
 char                               complementChar(const char inputChar, GError **error);
@@ -0,0 +1,897 @@
+/*  File: seqtoolsBench.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Benchmark driver for the SeqTools hot paths.
+ *
+ *              Generates deterministic synthetic inputs (DNA and protein
+ *              sequences, multiple alignments and GFF3 alignment files) at
+ *              sizes that can be scaled up from the command line, times
+ *              each benchmark over a number of runs, and writes the
+ *              results as JSON so that they can be tracked over time.
+ *
+ *              Library-level code (translation, GFF3 parsing and
+ *              finaliseBlxSequences) is linked in and timed in-process.
+ *              The application cores (Dotter's calculateImage, Belvu's
+ *              distance/tree/subfamily/bootstrap code and Blixem's depth
+ *              calculation) are timed by running the programs in their
+ *              batch modes, which execute those paths without opening a
+ *              display.
+ *
+ *              Run via "make bench" from the top-level build directory.
+ *----------------------------------------------------------------------------
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <glib/gstdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <seqtoolsUtils/blxmsp.hpp>
+#include <seqtoolsUtils/blxparser.hpp>
+#include <seqtoolsUtils/blxGff3Parser.hpp>
+#include <test/testRandom.hpp>
+
+
+extern char *stdcode1[];        /* 1-letter amino acid translation code */
+
+
+#define BENCH_SEED              20240101        /* seed for the synthetic data generators */
+#define BENCH_DEFAULT_REPEAT    3               /* default number of timed runs per benchmark */
+#define BENCH_FASTA_LINE_LEN    60
+#define BENCH_REF_SEQ_NAME      "benchref"
+#define BENCH_NAME_SIZE         255             /* parseFS requires at least this much space for sequence names */
+
+
+#define USAGE_TEXT "\n\
+ Usage: seqtools-bench [options]\n\
+\n\
+ Runs the SeqTools benchmarks on synthetic data and writes the results as JSON.\n\
+\n\
+ Options:\n\
+  --bin-dir=<dir>\n\
+    Top-level build directory containing dotterApp/, belvuApp/ and blixemApp/ (default: ../..)\n\
+\n\
+  --filter=<text>\n\
+    Only run benchmarks whose name contains <text>.\n\
+\n\
+  --keep-data\n\
+    Do not delete the generated input files (their location is reported on stderr).\n\
+\n\
+  --output=<file>\n\
+    Write the JSON results to <file> (default: stdout).\n\
+\n\
+  --repeat=<n>\n\
+    Number of timed runs per benchmark (default: 3). The minimum, median and mean are reported.\n\
+\n\
+  --scale=<n>\n\
+    Multiply all input sizes by <n> (default: 1).\n\
+\n\
+  -h, --help\n\
+    Show this usage information.\n\
+\n\
+"
+
+
+/* Command-line options */
+typedef struct _BenchOptions
+{
+  char *binDir;
+  char *outputFile;
+  char *filter;
+  int scale;
+  int repeat;
+  int keepData;
+  char *dataDir;                /* temp directory holding the generated inputs */
+} BenchOptions;
+
+
+/* The timings for one benchmark */
+typedef struct _BenchResult
+{
+  std::string name;
+  std::string params;           /* JSON object describing the input size */
+  std::vector<double> timesMs;
+  std::string error;            /* set if the benchmark failed */
+} BenchResult;
+
+
+/* Function timed by an in-process benchmark */
+typedef gboolean (*BenchFunc)(gpointer data, GError **error);
+
+
+/***********************************************************
+ *                 Synthetic data generators               *
+ ***********************************************************/
+
+static char* generateSeq(TestRandom *rng, const int len, const char *alphabet)
+{
+  const int alphabetLen = strlen(alphabet);
+  char *result = (char*)g_malloc(len + 1);
+
+  for (int i = 0; i < len; ++i)
+    result[i] = alphabet[testRandomInt(rng, alphabetLen)];
+
+  result[len] = '\0';
+  return result;
+}
+
+
+/* Return a copy of the given sequence with a proportion of the residues substituted */
+static char* mutateSeq(TestRandom *rng, const char *seq, const double rate, const char *alphabet)
+{
+  const int alphabetLen = strlen(alphabet);
+  char *result = g_strdup(seq);
+
+  for (char *cp = result; *cp; ++cp)
+    {
+      if (testRandomChance(rng, rate))
+        *cp = alphabet[testRandomInt(rng, alphabetLen)];
+    }
+
+  return result;
+}
+
+
+static gboolean writeFastaFile(const char *filename, const char *name, const char *seq, GError **error)
+{
+  GString *contents = g_string_new(NULL);
+  g_string_append_printf(contents, ">%s\n", name);
+
+  const int len = strlen(seq);
+
+  for (int i = 0; i < len; i += BENCH_FASTA_LINE_LEN)
+    {
+      g_string_append_len(contents, seq + i, std::min(BENCH_FASTA_LINE_LEN, len - i));
+      g_string_append_c(contents, '\n');
+    }
+
+  const gboolean ok = g_file_set_contents(filename, contents->str, contents->len, error);
+  g_string_free(contents, TRUE);
+
+  return ok;
+}
+
+
+/* Write a Stockholm alignment of numSeqs protein sequences of the given length, all
+ * descended from a common ancestor so that the distances are meaningful */
+static gboolean writeAlignmentFile(TestRandom *rng, const char *filename, const int numSeqs, const int len, GError **error)
+{
+  static const char *aminoAcids = "ACDEFGHIKLMNPQRSTVWY";
+  char *ancestor = generateSeq(rng, len, aminoAcids);
+
+  GString *contents = g_string_new("# STOCKHOLM 1.0\n");
+
+  for (int i = 0; i < numSeqs; ++i)
+    {
+      /* Derive each sequence from one of a handful of subfamily founders */
+      char *seq = mutateSeq(rng, ancestor, 0.1 + 0.05 * (i % 8), aminoAcids);
+
+      int numResidues = len;
+
+      for (char *cp = seq; *cp; ++cp)
+        {
+          if (testRandomChance(rng, 0.05))
+            {
+              *cp = '.';
+              --numResidues;
+            }
+        }
+
+      g_string_append_printf(contents, "BENCH%d_SYNTH/1-%d %s\n", i + 1, numResidues, seq);
+      g_free(seq);
+    }
+
+  g_string_append(contents, "//\n");
+
+  const gboolean ok = g_file_set_contents(filename, contents->str, contents->len, error);
+
+  g_string_free(contents, TRUE);
+  g_free(ancestor);
+
+  return ok;
+}
+
+
+/* Write a GFF3 file of numReads nucleotide alignments against the given reference
+ * sequence. Each alignment carries its sequence so that no fetching is required. */
+static gboolean writeGffFile(TestRandom *rng, const char *filename, const char *refSeq, const int numReads, const int readLen, GError **error)
+{
+  static const char *bases = "acgt";
+  const int refLen = strlen(refSeq);
+
+  GString *contents = g_string_new("##gff-version 3\n");
+  g_string_append_printf(contents, "##sequence-region %s 1 %d\n", BENCH_REF_SEQ_NAME, refLen);
+
+  char *readSeq = (char*)g_malloc(readLen + 1);
+  char *revSeq = (char*)g_malloc(readLen + 1);
+
+  for (int i = 0; i < numReads; ++i)
+    {
+      const int start = testRandomInt(rng, refLen - readLen) + 1;
+      const int end = start + readLen - 1;
+      const gboolean forward = testRandomChance(rng, 0.5);
+
+      strncpy(readSeq, refSeq + start - 1, readLen);
+      readSeq[readLen] = '\0';
+
+      for (char *cp = readSeq; *cp; ++cp)
+        {
+          if (testRandomChance(rng, 0.02))
+            *cp = bases[testRandomInt(rng, 4)];
+        }
+
+      if (!forward)
+        revComplement(revSeq, readSeq);
+
+      g_string_append_printf(contents, "%s\tbench\tnucleotide_match\t%d\t%d\t%d.000000\t%c\t.\tTarget=READ%d 1 %d +;percentID=98;sequence=%s\n",
+                             BENCH_REF_SEQ_NAME, start, end, readLen, forward ? '+' : '-', i + 1, readLen,
+                             forward ? readSeq : revSeq);
+    }
+
+  const gboolean ok = g_file_set_contents(filename, contents->str, contents->len, error);
+
+  g_string_free(contents, TRUE);
+  g_free(readSeq);
+  g_free(revSeq);
+
+  return ok;
+}
+
+
+/***********************************************************
+ *                        Timing                           *
+ ***********************************************************/
+
+static gboolean benchIsSelected(BenchOptions *options, const char *name)
+{
+  return !options->filter || strstr(name, options->filter);
+}
+
+
+static double elapsedMs(const gint64 startTime)
+{
+  return (g_get_monotonic_time() - startTime) / 1000.0;
+}
+
+
+/* Time the given function options->repeat times */
+static void runFuncBenchmark(BenchOptions *options, std::vector<BenchResult> &results,
+                             const char *name, const std::string &params, BenchFunc func, gpointer data)
+{
+  if (!benchIsSelected(options, name))
+    return;
+
+  g_message("Running %s %s\n", name, params.c_str());
+
+  BenchResult result;
+  result.name = name;
+  result.params = params;
+
+  for (int i = 0; i < options->repeat && result.error.empty(); ++i)
+    {
+      GError *error = NULL;
+      const gint64 startTime = g_get_monotonic_time();
+
+      if (func(data, &error))
+        result.timesMs.push_back(elapsedMs(startTime));
+      else
+        result.error = error ? error->message : "failed";
+
+      if (error)
+        g_error_free(error);
+    }
+
+  results.push_back(result);
+}
+
+
+/* Time running the given command options->repeat times. Output is discarded. */
+static void runCommandBenchmark(BenchOptions *options, std::vector<BenchResult> &results,
+                                const char *name, const std::string &params, char **argv)
+{
+  if (!benchIsSelected(options, name))
+    return;
+
+  g_message("Running %s %s\n", name, params.c_str());
+
+  BenchResult result;
+  result.name = name;
+  result.params = params;
+
+  if (!g_file_test(argv[0], G_FILE_TEST_IS_EXECUTABLE))
+    result.error = std::string("program not found: ") + argv[0];
+
+  for (int i = 0; i < options->repeat && result.error.empty(); ++i)
+    {
+      GError *error = NULL;
+      int exitStatus = 0;
+      const gint64 startTime = g_get_monotonic_time();
+
+      const gboolean ok = g_spawn_sync(options->dataDir, argv, NULL,
+                                       (GSpawnFlags)(G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL),
+                                       NULL, NULL, NULL, NULL, &exitStatus, &error);
+
+      const double ms = elapsedMs(startTime);
+
+      if (!ok)
+        result.error = error->message;
+      else if (!WIFEXITED(exitStatus) || WEXITSTATUS(exitStatus) != 0)
+        result.error = "command exited with a non-zero status";
+      else
+        result.timesMs.push_back(ms);
+
+      if (error)
+        g_error_free(error);
+    }
+
+  results.push_back(result);
+}
+
+
+static char* dataFile(BenchOptions *options, const char *filename)
+{
+  return g_build_filename(options->dataDir, filename, NULL);
+}
+
+
+static char* binFile(BenchOptions *options, const char *appDir, const char *program)
+{
+  char *result = g_build_filename(options->binDir, appDir, program, NULL);
+
+  if (!g_path_is_absolute(result))
+    {
+      /* Commands are run from the data directory so make the path absolute */
+      char *cwd = g_get_current_dir();
+      char *tmp = g_build_filename(cwd, result, NULL);
+      g_free(cwd);
+      g_free(result);
+      result = tmp;
+    }
+
+  return result;
+}
+
+
+/***********************************************************
+ *                   Translation benchmarks                *
+ ***********************************************************/
+
+typedef struct _TranslateData
+{
+  char *seq;
+  char *buffer;
+} TranslateData;
+
+
+static gboolean benchTranslate(gpointer data, GError **error)
+{
+  TranslateData *td = (TranslateData*)data;
+  g_free(blxTranslate(td->seq, stdcode1));
+  return TRUE;
+}
+
+
+static gboolean benchTranslateFrames(gpointer data, GError **error)
+{
+  TranslateData *td = (TranslateData*)data;
+  char *frames[3] = {NULL, NULL, NULL};
+
+  blxTranslateFrames(td->seq, stdcode1, 3, frames);
+
+  for (int i = 0; i < 3; ++i)
+    g_free(frames[i]);
+
+  return TRUE;
+}
+
+
+static gboolean benchRevComplement(gpointer data, GError **error)
+{
+  TranslateData *td = (TranslateData*)data;
+  revComplement(td->buffer, td->seq);
+  return TRUE;
+}
+
+
+static void runTranslateBenchmarks(BenchOptions *options, std::vector<BenchResult> &results)
+{
+  const int sizes[] = {1000000, 10000000};
+
+  for (const int baseSize : sizes)
+    {
+      const int len = baseSize * options->scale;
+      TestRandom rng;
+      testRandomInit(&rng, BENCH_SEED);
+
+      TranslateData td;
+      td.seq = generateSeq(&rng, len, "acgt");
+      td.buffer = (char*)g_malloc(len + 1);
+
+      const std::string params = "{\"length\": " + std::to_string(len) + "}";
+
+      runFuncBenchmark(options, results, "translate/blxTranslate", params, benchTranslate, &td);
+      runFuncBenchmark(options, results, "translate/blxTranslateFrames", params, benchTranslateFrames, &td);
+      runFuncBenchmark(options, results, "translate/revComplement", params, benchRevComplement, &td);
+
+      g_free(td.seq);
+      g_free(td.buffer);
+    }
+}
+
+
+/***********************************************************
+ *              GFF3 parsing and finalising                *
+ ***********************************************************/
+
+/* Parse the given GFF file and then finalise the sequences, timing the two phases
+ * separately. Each run parses from scratch. */
+static void runGffBenchmarks(BenchOptions *options, std::vector<BenchResult> &results,
+                             const char *gffFile, const int refLen, const std::string &params)
+{
+  const gboolean doParse = benchIsSelected(options, "blixem/gff3Parse");
+  const gboolean doFinalise = benchIsSelected(options, "blixem/finaliseBlxSequences");
+
+  if (!doParse && !doFinalise)
+    return;
+
+  g_message("Running blixem/gff3Parse and blixem/finaliseBlxSequences %s\n", params.c_str());
+
+  BenchResult parseResult, finaliseResult;
+  parseResult.name = "blixem/gff3Parse";
+  finaliseResult.name = "blixem/finaliseBlxSequences";
+  parseResult.params = finaliseResult.params = params;
+
+  GSList *supportedTypes = blxCreateSupportedGffTypeList(BLXSEQ_DNA);
+  GList *columnList = NULL;
+  blxColumnCreate(BLXCOL_SEQNAME, FALSE, "Name", G_TYPE_STRING, NULL, 0, TRUE, TRUE, FALSE, FALSE, FALSE, "Name", NULL, NULL, &columnList);
+
+  IntRange refSeqRange(1, refLen);
+
+  for (int i = 0; i < options->repeat && parseResult.error.empty(); ++i)
+    {
+      FILE *file = fopen(gffFile, "r");
+
+      if (!file)
+        {
+          parseResult.error = finaliseResult.error = std::string("cannot open ") + gffFile;
+          break;
+        }
+
+      MSP *mspList = NULL;
+      GList *seqList = NULL;
+      GArray* featureLists[BLXMSP_NUM_TYPES];
+
+      for (int typeId = 0; typeId < BLXMSP_NUM_TYPES; ++typeId)
+        featureLists[typeId] = g_array_new(TRUE, FALSE, sizeof(MSP*));
+
+      GHashTable *lookupTable = g_hash_table_new(g_direct_hash, g_direct_equal);
+      BlxBlastMode blastMode = BLXMODE_BLASTN;
+      char *seq1 = NULL, *seq2 = NULL;
+      char seq1name[BENCH_NAME_SIZE + 1] = "", seq2name[BENCH_NAME_SIZE + 1] = "";
+      GError *error = NULL;
+
+      gint64 startTime = g_get_monotonic_time();
+
+      parseFS(&mspList, file, &blastMode, featureLists, &seqList, columnList, supportedTypes, NULL,
+              &seq1, seq1name, NULL, &seq2, seq2name, NULL, lookupTable, NULL, &error);
+
+      parseResult.timesMs.push_back(elapsedMs(startTime));
+      fclose(file);
+
+      if (error)
+        {
+          parseResult.error = finaliseResult.error = error->message;
+          g_error_free(error);
+        }
+      else
+        {
+          startTime = g_get_monotonic_time();
+
+          finaliseBlxSequences(featureLists, &mspList, &seqList, columnList, 0, BLXSEQ_DNA, 1, &refSeqRange, TRUE, lookupTable);
+
+          finaliseResult.timesMs.push_back(elapsedMs(startTime));
+        }
+
+      destroyMspList(&mspList);
+      destroyBlxSequenceList(&seqList);
+
+      for (int typeId = 0; typeId < BLXMSP_NUM_TYPES; ++typeId)
+        g_array_free(featureLists[typeId], TRUE);
+
+      g_hash_table_destroy(lookupTable);
+      g_free(seq1);
+      g_free(seq2);
+    }
+
+  blxDestroyGffTypeList(&supportedTypes);
+
+  if (doParse)
+    results.push_back(parseResult);
+
+  if (doFinalise)
+    results.push_back(finaliseResult);
+}
+
+
+static gboolean runBlixemBenchmarks(BenchOptions *options, std::vector<BenchResult> &results, GError **error)
+{
+  const int sizes[] = {10000, 100000};
+  char *blixem = binFile(options, "blixemApp", "blixem");
+
+  for (const int baseSize : sizes)
+    {
+      const int numReads = baseSize * options->scale;
+      const int readLen = 100;
+      const int refLen = std::max(100000, numReads * 10);
+
+      TestRandom rng;
+      testRandomInit(&rng, BENCH_SEED);
+
+      char *refSeq = generateSeq(&rng, refLen, "acgt");
+      char *refFile = dataFile(options, "blixem_ref.fasta");
+      char *gffFile = dataFile(options, "blixem_align.gff");
+
+      gboolean ok = writeFastaFile(refFile, BENCH_REF_SEQ_NAME, refSeq, error) &&
+                    writeGffFile(&rng, gffFile, refSeq, numReads, readLen, error);
+
+      if (ok)
+        {
+          const std::string params = "{\"features\": " + std::to_string(numReads) + ", \"ref_length\": " + std::to_string(refLen) + "}";
+
+          runGffBenchmarks(options, results, gffFile, refLen, params);
+
+          /* Parse, finalise and calculate the depth, then write it out */
+          char *depthArg = g_strdup_printf("--batch-depth=%s", G_DIR_SEPARATOR_S "dev" G_DIR_SEPARATOR_S "null");
+          char *argv[] = {blixem, (char*)"-t", (char*)"N", (char*)"--batch", depthArg, refFile, gffFile, NULL};
+          runCommandBenchmark(options, results, "blixem/batchDepth", params, argv);
+          g_free(depthArg);
+        }
+
+      g_free(refSeq);
+      g_free(refFile);
+      g_free(gffFile);
+
+      if (!ok)
+        break;
+    }
+
+  g_free(blixem);
+
+  return (error == NULL || *error == NULL);
+}
+
+
+/***********************************************************
+ *                   Dotter benchmarks                     *
+ ***********************************************************/
+
+static gboolean runDotterBenchmarks(BenchOptions *options, std::vector<BenchResult> &results, GError **error)
+{
+  const int sizes[] = {2000, 5000, 10000};
+  char *dotter = binFile(options, "dotterApp", "dotter");
+  char *qFile = dataFile(options, "dotter_q.fasta");
+  char *sFile = dataFile(options, "dotter_s.fasta");
+  char *outFile = dataFile(options, "dotter_out.dot");
+  gboolean ok = TRUE;
+
+  for (int i = 0; ok && i < (int)G_N_ELEMENTS(sizes); ++i)
+    {
+      const int len = sizes[i] * options->scale;
+
+      TestRandom rng;
+      testRandomInit(&rng, BENCH_SEED);
+
+      /* Make the vertical sequence a mutated copy of the horizontal one so that the plot
+       * has a strong diagonal, as in real use */
+      char *qSeq = generateSeq(&rng, len, "acgt");
+      char *sSeq = mutateSeq(&rng, qSeq, 0.1, "acgt");
+
+      ok = writeFastaFile(qFile, "benchq", qSeq, error) && writeFastaFile(sFile, "benchs", sSeq, error);
+
+      if (ok)
+        {
+          const std::string params = "{\"length\": " + std::to_string(len) + "}";
+          char *argv[] = {dotter, (char*)"-b", outFile, qFile, sFile, NULL};
+          runCommandBenchmark(options, results, "dotter/calculateImage", params, argv);
+        }
+
+      g_free(qSeq);
+      g_free(sSeq);
+    }
+
+  g_free(dotter);
+  g_free(qFile);
+  g_free(sFile);
+  g_free(outFile);
+
+  return ok;
+}
+
+
+/***********************************************************
+ *                    Belvu benchmarks                     *
+ ***********************************************************/
+
+static gboolean runBelvuBenchmarks(BenchOptions *options, std::vector<BenchResult> &results, GError **error)
+{
+  const int sizes[] = {100, 300};
+  const int alignLen = 300;
+  char *belvu = binFile(options, "belvuApp", "belvu");
+  char *alnFile = dataFile(options, "belvu_align.stock");
+  gboolean ok = TRUE;
+
+  for (int i = 0; ok && i < (int)G_N_ELEMENTS(sizes); ++i)
+    {
+      const int numSeqs = sizes[i] * options->scale;
+
+      TestRandom rng;
+      testRandomInit(&rng, BENCH_SEED);
+
+      ok = writeAlignmentFile(&rng, alnFile, numSeqs, alignLen, error);
+
+      if (ok)
+        {
+          const std::string params = "{\"sequences\": " + std::to_string(numSeqs) + ", \"length\": " + std::to_string(alignLen) + "}";
+
+          /* Print the distance matrix and exit */
+          char *distArgv[] = {belvu, (char*)"-T", (char*)"p", (char*)"-o", (char*)"tree", alnFile, NULL};
+          runCommandBenchmark(options, results, "belvu/distanceMatrix", params, distArgv);
+
+          char *njArgv[] = {belvu, (char*)"-T", (char*)"n", (char*)"-o", (char*)"tree", alnFile, NULL};
+          runCommandBenchmark(options, results, "belvu/neighborJoining", params, njArgv);
+
+          char *upgmaArgv[] = {belvu, (char*)"-T", (char*)"u", (char*)"-o", (char*)"tree", alnFile, NULL};
+          runCommandBenchmark(options, results, "belvu/upgma", params, upgmaArgv);
+
+          char *subfamArgv[] = {belvu, (char*)"-X", (char*)"0.5", alnFile, NULL};
+          runCommandBenchmark(options, results, "belvu/subfamilies", params, subfamArgv);
+
+          const std::string bootParams = "{\"sequences\": " + std::to_string(numSeqs) + ", \"length\": " + std::to_string(alignLen) + ", \"bootstraps\": 10}";
+          char *bootArgv[] = {belvu, (char*)"-T", (char*)"n", (char*)"-b", (char*)"10", (char*)"-B", alnFile, NULL};
+          runCommandBenchmark(options, results, "belvu/bootstrap", bootParams, bootArgv);
+        }
+    }
+
+  g_free(belvu);
+  g_free(alnFile);
+
+  return ok;
+}
+
+
+/***********************************************************
+ *                        Output                           *
+ ***********************************************************/
+
+static void appendJsonString(GString *json, const char *str)
+{
+  g_string_append_c(json, '"');
+
+  for (const char *cp = str; *cp; ++cp)
+    {
+      if (*cp == '"' || *cp == '\\')
+        g_string_append_printf(json, "\\%c", *cp);
+      else if ((unsigned char)*cp < 0x20)
+        g_string_append_printf(json, "\\u%04x", *cp);
+      else
+        g_string_append_c(json, *cp);
+    }
+
+  g_string_append_c(json, '"');
+}
+
+
+static GString* createJson(BenchOptions *options, std::vector<BenchResult> &results)
+{
+  GString *json = g_string_new("{\n");
+
+  struct utsname unameData;
+  const char *host = (uname(&unameData) == 0) ? unameData.machine : "unknown";
+
+  GDateTime *now = g_date_time_new_now_utc();
+  char *timestamp = g_date_time_format(now, "%Y-%m-%dT%H:%M:%SZ");
+  g_date_time_unref(now);
+
+  g_string_append(json, "  \"version\": ");
+  appendJsonString(json, SEQTOOLS_VERSION);
+  g_string_append(json, ",\n  \"timestamp\": ");
+  appendJsonString(json, timestamp);
+  g_string_append(json, ",\n  \"machine\": ");
+  appendJsonString(json, host);
+  g_string_append_printf(json, ",\n  \"scale\": %d,\n  \"repeat\": %d,\n  \"benchmarks\": [", options->scale, options->repeat);
+
+  g_free(timestamp);
+
+  for (size_t i = 0; i < results.size(); ++i)
+    {
+      BenchResult &result = results[i];
+
+      g_string_append(json, i > 0 ? ",\n    {" : "\n    {");
+      g_string_append(json, "\"name\": ");
+      appendJsonString(json, result.name.c_str());
+      g_string_append_printf(json, ", \"params\": %s", result.params.c_str());
+
+      if (!result.error.empty())
+        {
+          g_string_append(json, ", \"status\": \"error\", \"error\": ");
+          appendJsonString(json, result.error.c_str());
+        }
+      else
+        {
+          std::vector<double> sorted(result.timesMs);
+          std::sort(sorted.begin(), sorted.end());
+
+          double total = 0.0;
+          for (double ms : sorted)
+            total += ms;
+
+          g_string_append_printf(json, ", \"status\": \"ok\", \"runs\": %d, \"min_ms\": %.3f, \"median_ms\": %.3f, \"mean_ms\": %.3f",
+                                 (int)sorted.size(), sorted.front(), sorted[sorted.size() / 2], total / sorted.size());
+        }
+
+      g_string_append(json, "}");
+    }
+
+  g_string_append(json, "\n  ]\n}\n");
+
+  return json;
+}
+
+
+/* Recursively delete the generated data directory */
+static void removeDataDir(const char *dirName)
+{
+  GDir *dir = g_dir_open(dirName, 0, NULL);
+
+  if (dir)
+    {
+      const char *filename = NULL;
+
+      while ((filename = g_dir_read_name(dir)))
+        {
+          char *path = g_build_filename(dirName, filename, NULL);
+          g_unlink(path);
+          g_free(path);
+        }
+
+      g_dir_close(dir);
+    }
+
+  g_rmdir(dirName);
+}
+
+
+int main(int argc, char **argv)
+{
+  BenchOptions options = {NULL, NULL, NULL, 1, BENCH_DEFAULT_REPEAT, FALSE, NULL};
+
+  static struct option long_options[] =
+    {
+      {"bin-dir",       required_argument,  0, 'd'},
+      {"filter",        required_argument,  0, 'f'},
+      {"help",          no_argument,        0, 'h'},
+      {"keep-data",     no_argument,        &options.keepData, 1},
+      {"output",        required_argument,  0, 'o'},
+      {"repeat",        required_argument,  0, 'r'},
+      {"scale",         required_argument,  0, 's'},
+      {0, 0, 0, 0}
+    };
+
+  int optc;
+
+  while ((optc = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+      switch (optc)
+        {
+        case 0:   break; /* flag set by getopt_long */
+        case 'd': options.binDir = g_strdup(optarg);        break;
+        case 'f': options.filter = g_strdup(optarg);        break;
+        case 'o': options.outputFile = g_strdup(optarg);    break;
+        case 'r': options.repeat = atoi(optarg);            break;
+        case 's': options.scale = atoi(optarg);             break;
+        case 'h':
+          fprintf(stdout, USAGE_TEXT);
+          exit(EXIT_SUCCESS);
+        default:
+          fprintf(stderr, USAGE_TEXT);
+          exit(EXIT_FAILURE);
+        }
+    }
+
+  if (options.scale < 1 || options.repeat < 1)
+    g_error("--scale and --repeat must be at least 1\n");
+
+  if (!options.binDir)
+    options.binDir = g_build_filename("..", "..", NULL);
+
+  GError *error = NULL;
+  options.dataDir = g_dir_make_tmp("seqtools-bench-XXXXXX", &error);
+
+  if (!options.dataDir)
+    g_error("Cannot create data directory: %s\n", error->message);
+
+  std::vector<BenchResult> results;
+
+  runTranslateBenchmarks(&options, results);
+
+  if (!runBlixemBenchmarks(&options, results, &error) ||
+      !runDotterBenchmarks(&options, results, &error) ||
+      !runBelvuBenchmarks(&options, results, &error))
+    {
+      prefixError(error, "Error generating benchmark data: ");
+      reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+    }
+
+  GString *json = createJson(&options, results);
+
+  if (options.outputFile)
+    {
+      if (!g_file_set_contents(options.outputFile, json->str, json->len, &error))
+        {
+          prefixError(error, "Error writing results: ");
+          reportAndClearIfError(&error, G_LOG_LEVEL_WARNING);
+        }
+      else
+        {
+          g_message("Results written to %s\n", options.outputFile);
+        }
+    }
+  else
+    {
+      fputs(json->str, stdout);
+    }
+
+  g_string_free(json, TRUE);
+
+  if (options.keepData)
+    g_message("Benchmark data kept in %s\n", options.dataDir);
+  else
+    removeDataDir(options.dataDir);
+
+  int numFailed = 0;
+  for (BenchResult &result : results)
+    {
+      if (!result.error.empty())
+        {
+          g_warning("%s failed: %s\n", result.name.c_str(), result.error.c_str());
+          ++numFailed;
+        }
+    }
+
+  return (numFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
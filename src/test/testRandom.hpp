@@ -0,0 +1,75 @@
+/*  File: testRandom.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Seeded random number generator shared by the unit tests and
+ *              the benchmark driver.
+ *
+ *              We use our own simple xorshift generator rather than rand()
+ *              so that the generated test data is identical on every
+ *              platform.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _test_random_included_
+#define _test_random_included_
+
+#include <glib.h>
+
+
+typedef struct _TestRandom
+{
+  guint64 state;
+} TestRandom;
+
+
+static inline void testRandomInit(TestRandom *rng, const guint64 seed)
+{
+  rng->state = seed ? seed : 1;
+}
+
+
+/* Return a random number in the range [0, max) */
+static inline guint32 testRandomInt(TestRandom *rng, const guint32 max)
+{
+  rng->state ^= rng->state << 13;
+  rng->state ^= rng->state >> 7;
+  rng->state ^= rng->state << 17;
+  return (guint32)(rng->state % max);
+}
+
+
+/* Return true with the given probability */
+static inline gboolean testRandomChance(TestRandom *rng, const double probability)
+{
+  return testRandomInt(rng, 1000000) < probability * 1000000;
+}
+
+
+#endif /* _test_random_included_ */
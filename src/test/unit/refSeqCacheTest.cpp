@@ -0,0 +1,260 @@
+/*  File: refSeqCacheTest.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Unit test for Blixem's reference sequence cache.
+ *
+ *              Segments returned by blxRefSeqCacheGetSegment are compared
+ *              with the result of getSequenceSegment (which builds each
+ *              segment from scratch) for random ranges on both strands, in
+ *              nucleotide and peptide (i.e. all frames), reversed and
+ *              unreversed, and for each blast mode. This is done for a
+ *              cache of the plain-text sequence, a cache of the packed
+ *              sequence, and a cache of the packed sequence after it has
+ *              been moved to shared memory (as handed to Dotter). Each cache
+ *              is queried from several threads at once, because the cache
+ *              builds its contents on demand and decodes packed segments
+ *              into per-thread buffers.
+ *----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <seqtoolsUtils/blxPackedSeq.hpp>
+#include <blixemApp/blxRefSeqCache.hpp>
+#include <test/unit/unitTest.hpp>
+
+
+using namespace std;
+
+
+extern char *stdcode1[];        /* 1-letter amino acid translation code */
+
+
+#define TEST_NUM_SEQS           8       /* number of reference sequences to test */
+#define TEST_MAX_SEQ_LEN        50000   /* maximum length of the reference sequences */
+#define TEST_NUM_THREADS        4       /* number of threads querying each cache at once */
+#define TEST_NUM_QUERIES        2000    /* number of segments requested by each thread */
+#define TEST_MAX_SEGMENT_LEN    300     /* maximum length of most segments */
+#define TEST_MAX_LONG_SEGMENT   30000   /* maximum length of the occasional long segment */
+
+
+/* The data for the threads that query a cache */
+typedef struct _CacheTestData
+{
+  const char *refSeq;           /* the plain-text reference sequence to compare against */
+  IntRange refSeqRange;
+  BlxRefSeqCache *cache;
+  const char *cacheName;        /* used when reporting failures */
+  guint64 seed;                 /* seed for this thread's random queries */
+} CacheTestData;
+
+
+/* Create a random reference sequence. It is made up of blocks of upper- and
+ * lower-case bases and N's, so that it is compressible by blxPackedSeqCreate. If
+ * ambiguous is true it also has blocks of gaps and other IUPAC codes, so that the
+ * 4-bit rather than the 2-bit encoding is used. */
+static char* createRefSeq(TestRandom *rng, const int len, const gboolean ambiguous)
+{
+  char *result = (char*)g_malloc(len + 1);
+  int i = 0;
+
+  while (i < len)
+    {
+      const int blockLen = min(len - i, 1 + (int)testRandomInt(rng, 500));
+      const int blockType = testRandomInt(rng, 10);
+
+      if (blockType == 0)
+        unitTestRandomSeq(rng, result + i, blockLen, "N", 1);
+      else if (blockType == 1 && ambiguous)
+        unitTestRandomSeq(rng, result + i, blockLen, "-", 1);
+      else if (blockType == 2 && ambiguous)
+        unitTestRandomSeq(rng, result + i, blockLen, "RYMKSWHBVD", 10);
+      else if (blockType < 5)
+        unitTestRandomSeq(rng, result + i, blockLen, "acgt", 4);
+      else
+        unitTestRandomSeq(rng, result + i, blockLen, "ACGT", 4);
+
+      i += blockLen;
+    }
+
+  result[len] = '\0';
+
+  return result;
+}
+
+
+/* Request random segments from the cache and compare them with getSequenceSegment */
+static gpointer cacheTestThreadFunc(gpointer data)
+{
+  CacheTestData *testData = (CacheTestData*)data;
+  const IntRange *refSeqRange = &testData->refSeqRange;
+  const int refSeqLen = refSeqRange->length();
+  const int numFrames = 3;
+
+  TestRandom rng;
+  testRandomInit(&rng, testData->seed);
+
+  for (int i = 0; i < TEST_NUM_QUERIES; ++i)
+    {
+      /* Mostly short segments, but some long ones, and some that overlap the ends
+       * of the reference sequence (by up to a few bases more than a triplet, so
+       * that the out-of-range warning is also tested) */
+      const int maxLen = (i % 10 == 0 ? TEST_MAX_LONG_SEGMENT : TEST_MAX_SEGMENT_LEN);
+      const int start = refSeqRange->min() - 6 + (int)testRandomInt(&rng, refSeqLen + 12);
+      IntRange qRange(start, start + (int)testRandomInt(&rng, maxLen));
+
+      const BlxStrand strand = testRandomInt(&rng, 2) ? BLXSTRAND_FORWARD : BLXSTRAND_REVERSE;
+      const BlxSeqType destSeqType = testRandomInt(&rng, 2) ? BLXSEQ_DNA : BLXSEQ_PEPTIDE;
+      const BlxBlastMode blastMode = (BlxBlastMode)(BLXMODE_BLASTX + testRandomInt(&rng, BLXMODE_BLASTP - BLXMODE_BLASTX + 1));
+      const gboolean reverseResult = testRandomInt(&rng, 2);
+      const gboolean allowComplement = testRandomInt(&rng, 2);
+
+      GError *expectedError = NULL;
+      char *expected = getSequenceSegment(testData->refSeq, &qRange, strand, BLXSEQ_DNA, destSeqType,
+                                          1, numFrames, refSeqRange, blastMode, stdcode1,
+                                          FALSE, reverseResult, allowComplement, &expectedError);
+
+      GError *error = NULL;
+      int len = 0;
+      const char *result = blxRefSeqCacheGetSegment(testData->cache, &qRange, strand, destSeqType,
+                                                    numFrames, blastMode, reverseResult, allowComplement,
+                                                    &len, &error);
+
+      const gboolean ok = (result == NULL) == (expected == NULL) &&
+        (!expected || ((int)strlen(expected) == len && !strncmp(result, expected, len)));
+
+      UNIT_CHECK(ok, "%s: segment %d-%d (strand=%d, type=%d, mode=%d, reverse=%d, complement=%d): got \"%.*s\", expected \"%s\"",
+                 testData->cacheName, qRange.min(), qRange.max(), strand, destSeqType, blastMode, reverseResult, allowComplement,
+                 result ? min(len, 60) : 6, result ? result : "(null)", expected ? expected : "(null)");
+
+      UNIT_CHECK((error == NULL) == (expectedError == NULL), "%s: segment %d-%d: error %s",
+                 testData->cacheName, qRange.min(), qRange.max(), error ? "set" : "not set");
+
+      g_free(expected);
+
+      if (expectedError)
+        g_error_free(expectedError);
+
+      if (error)
+        g_error_free(error);
+    }
+
+  return NULL;
+}
+
+
+/* Query the given cache from several threads at once */
+static void testCache(const char *refSeq, const IntRange *refSeqRange, BlxRefSeqCache *cache,
+                      const char *cacheName, TestRandom *rng)
+{
+  CacheTestData testData[TEST_NUM_THREADS];
+  GThread *threads[TEST_NUM_THREADS];
+
+  for (int i = 0; i < TEST_NUM_THREADS; ++i)
+    {
+      testData[i].refSeq = refSeq;
+      testData[i].refSeqRange.set(refSeqRange->min(), refSeqRange->max());
+      testData[i].cache = cache;
+      testData[i].cacheName = cacheName;
+      testData[i].seed = 1 + testRandomInt(rng, G_MAXUINT32);
+
+      threads[i] = g_thread_new(cacheName, cacheTestThreadFunc, &testData[i]);
+    }
+
+  for (int i = 0; i < TEST_NUM_THREADS; ++i)
+    g_thread_join(threads[i]);
+}
+
+
+int main(int argc, char **argv)
+{
+  TestRandom rng;
+  testRandomInit(&rng, UNIT_TEST_SEED);
+
+  for (int i = 0; i < TEST_NUM_SEQS; ++i)
+    {
+      /* Include a very short sequence and a range that does not start at 1 */
+      const int len = (i == 0 ? 5 : 1 + testRandomInt(&rng, TEST_MAX_SEQ_LEN));
+      const int offset = (int)testRandomInt(&rng, 1000) - 500;
+      const IntRange refSeqRange(offset + 1, offset + len);
+      char *refSeq = createRefSeq(&rng, len, i % 2);
+
+      BlxRefSeqCache *cache = blxRefSeqCacheCreate(refSeq, NULL, &refSeqRange, stdcode1);
+      testCache(refSeq, &refSeqRange, cache, "plain", &rng);
+      blxRefSeqCacheDestroy(cache);
+
+      /* Packing does nothing if it would not save any space, e.g. for very short sequences */
+      BlxPackedSeq *packedSeq = blxPackedSeqCreate(refSeq, len);
+
+      if (packedSeq)
+        {
+          cache = blxRefSeqCacheCreate(NULL, packedSeq, &refSeqRange, stdcode1);
+          testCache(refSeq, &refSeqRange, cache, "packed", &rng);
+          blxRefSeqCacheDestroy(cache);
+
+          /* Move it to shared memory and map it again as Dotter would */
+          GError *error = NULL;
+
+          if (blxPackedSeqShare(packedSeq, &error))
+            {
+              BlxPackedSeq *mappedSeq = blxPackedSeqMapShared(dup(blxPackedSeqGetSharedFd(packedSeq)), &error);
+              UNIT_CHECK(mappedSeq != NULL, "could not map shared packed sequence: %s", error ? error->message : "");
+
+              if (mappedSeq)
+                {
+                  cache = blxRefSeqCacheCreate(NULL, mappedSeq, &refSeqRange, stdcode1);
+                  testCache(refSeq, &refSeqRange, cache, "shared", &rng);
+                  blxRefSeqCacheDestroy(cache);
+                  blxPackedSeqDestroy(mappedSeq);
+                }
+            }
+          else
+            {
+              UNIT_CHECK(FALSE, "could not share packed sequence: %s", error ? error->message : "");
+            }
+
+          if (error)
+            g_error_free(error);
+
+          blxPackedSeqDestroy(packedSeq);
+        }
+      else
+        {
+          UNIT_CHECK(len < 100, "sequence of length %d was not packed", len);
+        }
+
+      g_free(refSeq);
+    }
+
+  return unitTestResult("refSeqCacheTest");
+}
@@ -0,0 +1,350 @@
+/*  File: translateTest.cpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Unit test for the table-driven complement and translation
+ *              functions in translate.cpp.
+ *
+ *              complementChar, blxComplement, revComplement, blxTranslate
+ *              and blxTranslateFrames are compared against the original
+ *              loop implementations, which are kept here as the reference.
+ *              Every character is complemented; every codon over the IUPAC
+ *              alphabet (upper and lower case) and the gap characters is
+ *              translated; and random sequences are complemented,
+ *              reverse-complemented and translated in all frames of both
+ *              strands, with both the 1- and 3-letter genetic codes.
+ *----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include <seqtoolsUtils/utilities.hpp>
+#include <test/unit/unitTest.hpp>
+
+
+extern char *stdcode1[];        /* 1-letter amino acid translation code */
+extern char *stdcode3[];        /* 3-letter amino acid translation code */
+
+
+#define TEST_NUM_RANDOM_SEQS    20000   /* number of random sequences to test */
+#define TEST_MAX_SEQ_LEN        100     /* maximum length of the random sequences */
+
+
+/* The IUPAC nucleotide codes and their complements, as in the iupac table in
+ * iupac.hpp (which we can't include because it defines the table itself) */
+static const char *g_refIupacSyms  = "ACGTUN-RYMKSWHBVD";
+static const char *g_refIupacComps = "TGCAAN-YRKMSWDVBH";
+
+/* The characters to build test sequences from: every IUPAC code in upper and
+ * lower case, the gap characters, and some invalid characters */
+static const char *g_testAlphabet = "ACGTUNRYMKSWHBVDacgtunrymkswhbvd-.xZ*";
+
+
+/***********************************************************
+ *                 Reference implementations               *
+ ***********************************************************/
+
+/* These are the implementations from before the lookup tables were introduced */
+
+static char refComplementChar(const char inputChar, gboolean *found)
+{
+  /* Loop through each iupac code looking for this char. iupac chars are all
+   * uppercase */
+  char result = '\0';
+  char c = toupper(inputChar);
+  int idx = 0;
+  const int numSyms = strlen(g_refIupacSyms);
+
+  for ( ; idx < numSyms && c != g_refIupacSyms[idx]; idx++);
+
+  if (idx >= numSyms)
+    {
+      /* not found; return original char */
+      result = inputChar;
+      *found = FALSE;
+    }
+  else
+    {
+      result = g_refIupacComps[idx];
+      *found = TRUE;
+
+      if (islower(inputChar))
+        result = tolower(result);
+    }
+
+  return result;
+}
+
+
+static void refComplement(char *seq)
+{
+  gboolean found = FALSE;
+
+  for (char *fwdp = seq; *fwdp; fwdp++)
+    *fwdp = refComplementChar(*fwdp, &found);
+}
+
+
+static char* refRevComplement(char *comp, const char *seq)
+{
+  const long bases = strlen(seq);
+  gboolean found = FALSE;
+
+  char *fwdp = comp;
+  const char *bckp = seq + bases - 1;
+
+  for (long pos = 0; pos < bases; pos++)
+    *fwdp++ = refComplementChar(*bckp--, &found);
+
+  *fwdp = '\0';
+
+  return comp;
+}
+
+
+/* The original code didn't nul-terminate the result if the sequence had fewer than
+ * three bases; otherwise this is unchanged */
+static char* refTranslate(const char *seq, char **code)
+{
+  char *aaseq = NULL;
+  int codon;
+  char *aaptr;
+  int i;
+
+  if (seq && *seq)
+    {
+      aaseq = (char *)g_malloc(strlen(seq) + 1);
+
+      for (aaptr = aaseq ; *seq != '\0' && *(seq+1) != '\0' && *(seq+2) != '\0'; seq += 3)
+        {
+          /* calculate the lookup value for this codon */
+          codon = 0;
+          for (i = 0; i < 3; i++)
+            {
+              codon *= 4;
+
+              switch (*(seq + i))
+                {
+                case 'A': case 'a':             break;
+                case 'C': case 'c': codon += 1; break;
+                case 'G': case 'g': codon += 2; break;
+                case 'T': case 't': codon += 3; break;
+                case 'U': case 'u': codon += 3; break;
+                default: codon = 64; break;
+                }
+
+              if (codon == 64)
+                break;
+            }
+
+          strcpy(aaptr, code[codon]);
+          aaptr += strlen(code[codon]);
+        }
+
+      *aaptr = '\0';
+    }
+
+  return aaseq;
+}
+
+
+/***********************************************************
+ *                          Tests                          *
+ ***********************************************************/
+
+static const char* strOrNull(const char *str)
+{
+  return str ? str : "(null)";
+}
+
+
+/* Check complementChar against the reference for every character */
+static void testComplementChar()
+{
+  for (int c = 1; c < 256; ++c)
+    {
+      gboolean refFound = FALSE;
+      const char expected = refComplementChar((char)c, &refFound);
+
+      GError *error = NULL;
+      const char result = complementChar((char)c, &error);
+
+      UNIT_CHECK(result == expected, "complementChar('%c' (%d)): got '%c', expected '%c'", c, c, result, expected);
+      UNIT_CHECK((error == NULL) == refFound, "complementChar('%c' (%d)): error %s", c, c, error ? "set" : "not set");
+
+      if (error)
+        g_error_free(error);
+    }
+}
+
+
+/* Check blxComplement and revComplement for the given sequence */
+static void checkComplement(const char *seq)
+{
+  const int len = strlen(seq);
+  char *expected = g_strdup(seq);
+  char *result = g_strdup(seq);
+
+  refComplement(expected);
+  blxComplement(result);
+  UNIT_CHECK(!strcmp(result, expected), "blxComplement(\"%s\"): got \"%s\", expected \"%s\"", seq, result, expected);
+
+  char *expectedRev = (char*)g_malloc(len + 1);
+  char *resultRev = (char*)g_malloc(len + 1);
+
+  refRevComplement(expectedRev, seq);
+  revComplement(resultRev, (char*)seq);
+  UNIT_CHECK(!strcmp(resultRev, expectedRev), "revComplement(\"%s\"): got \"%s\", expected \"%s\"", seq, resultRev, expectedRev);
+
+  g_free(expected);
+  g_free(result);
+  g_free(expectedRev);
+  g_free(resultRev);
+}
+
+
+/* Check blxTranslate and blxTranslateFrames against the reference for all frames of the
+ * given sequence */
+static void checkTranslateFrames(const char *seq, char **code, const char *codeName)
+{
+  const int len = strlen(seq);
+
+  for (int numFrames = 1; numFrames <= 3; ++numFrames)
+    {
+      char *results[3] = {NULL, NULL, NULL};
+      blxTranslateFrames(seq, code, numFrames, results);
+
+      for (int frame = 0; frame < numFrames; ++frame)
+        {
+          char *expected = (frame < len ? refTranslate(seq + frame, code) : NULL);
+
+          UNIT_CHECK((results[frame] == NULL) == (expected == NULL) && (!expected || !strcmp(results[frame], expected)),
+                     "blxTranslateFrames(\"%s\", %s, %d) frame %d: got \"%s\", expected \"%s\"",
+                     seq, codeName, numFrames, frame, strOrNull(results[frame]), strOrNull(expected));
+
+          if (numFrames == 3)
+            {
+              char *result = (frame < len ? blxTranslate(seq + frame, code) : NULL);
+
+              UNIT_CHECK((result == NULL) == (expected == NULL) && (!expected || !strcmp(result, expected)),
+                         "blxTranslate(\"%s\", %s): got \"%s\", expected \"%s\"",
+                         seq + frame, codeName, strOrNull(result), strOrNull(expected));
+
+              g_free(result);
+            }
+
+          g_free(expected);
+          g_free(results[frame]);
+        }
+    }
+}
+
+
+/* Check the given sequence: complement it, and translate all frames of both strands */
+static void checkSeq(const char *seq)
+{
+  checkComplement(seq);
+
+  char *revComp = (char*)g_malloc(strlen(seq) + 1);
+  refRevComplement(revComp, seq);
+
+  checkTranslateFrames(seq, stdcode1, "stdcode1");
+  checkTranslateFrames(revComp, stdcode1, "stdcode1");
+  checkTranslateFrames(seq, stdcode3, "stdcode3");
+  checkTranslateFrames(revComp, stdcode3, "stdcode3");
+
+  g_free(revComp);
+}
+
+
+/* Check every sequence of up to three characters from the test alphabet, i.e.
+ * every codon */
+static void testAllCodons()
+{
+  const int alphabetLen = strlen(g_testAlphabet);
+  char seq[4];
+
+  checkSeq("");
+
+  for (int i = 0; i < alphabetLen; ++i)
+    {
+      seq[0] = g_testAlphabet[i];
+      seq[1] = '\0';
+      checkSeq(seq);
+
+      for (int j = 0; j < alphabetLen; ++j)
+        {
+          seq[1] = g_testAlphabet[j];
+          seq[2] = '\0';
+          checkSeq(seq);
+
+          for (int k = 0; k < alphabetLen; ++k)
+            {
+              seq[2] = g_testAlphabet[k];
+              seq[3] = '\0';
+              checkSeq(seq);
+            }
+        }
+    }
+}
+
+
+/* Check random sequences. Most are made up of the four bases in mixed case, so that
+ * there are plenty of valid codons, but some use the full test alphabet. */
+static void testRandomSeqs()
+{
+  TestRandom rng;
+  testRandomInit(&rng, UNIT_TEST_SEED);
+
+  const char *bases = "ACGTacgt";
+  char seq[TEST_MAX_SEQ_LEN + 1];
+
+  for (int i = 0; i < TEST_NUM_RANDOM_SEQS; ++i)
+    {
+      const int len = testRandomInt(&rng, TEST_MAX_SEQ_LEN + 1);
+
+      if (i % 4 == 0)
+        unitTestRandomSeq(&rng, seq, len, g_testAlphabet, strlen(g_testAlphabet));
+      else
+        unitTestRandomSeq(&rng, seq, len, bases, strlen(bases));
+
+      checkSeq(seq);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+  testComplementChar();
+  testAllCodons();
+  testRandomSeqs();
+
+  return unitTestResult("translateTest");
+}
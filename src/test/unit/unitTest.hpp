@@ -0,0 +1,104 @@
+/*  File: unitTest.hpp
+ *  Copyright [2018-2024] EMBL-European Bioinformatics Institute
+ *  Copyright (c) 2006-2017 Genome Research Ltd
+ * ---------------------------------------------------------------------------
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ---------------------------------------------------------------------------
+ * This file is part of the SeqTools sequence analysis package,
+ * written by
+ *      Gemma Barson      (Sanger Institute, UK)  <gb10@sanger.ac.uk>
+ *
+ * based on original code by
+ *      Erik Sonnhammer   (SBC, Sweden)           <Erik.Sonnhammer@sbc.su.se>
+ *
+ * and utilizing code taken from the AceDB and ZMap packages, written by
+ *      Richard Durbin    (Sanger Institute, UK)  <rd@sanger.ac.uk>
+ *      Jean Thierry-Mieg (CRBM du CNRS, France)  <mieg@kaa.crbm.cnrs-mop.fr>
+ *      Ed Griffiths      (Sanger Institute, UK)  <edgrif@sanger.ac.uk>
+ *      Roy Storey        (Sanger Institute, UK)  <rds@sanger.ac.uk>
+ *      Malcolm Hinsley   (Sanger Institute, UK)  <mh17@sanger.ac.uk>
+ *
+ * Description: Helpers shared by the unit tests.
+ *
+ *              Each unit test is a standalone program that is run by
+ *              "make check". It checks a piece of library code against a
+ *              reference implementation (usually the simple original code
+ *              that the optimised version replaced), reports each mismatch
+ *              on stderr and exits with a failure status if there were
+ *              any. The tests do not need a display.
+ *----------------------------------------------------------------------------
+ */
+
+#ifndef _unit_test_included_
+#define _unit_test_included_
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <test/testRandom.hpp>
+
+
+#define UNIT_TEST_SEED          20240101        /* seed for the random test data */
+#define UNIT_TEST_MAX_REPORTS   20              /* stop printing failures after this many */
+
+
+/* Count of failed checks */
+static gint g_unitTestNumFailed = 0;
+
+
+/* Record a failed check if the condition is false. The message is only printed for
+ * the first few failures, so that a systematic error doesn't flood the output. May
+ * be used from multiple threads. */
+#define UNIT_CHECK(condition, ...)                                      \
+  do                                                                    \
+    {                                                                   \
+      if (!(condition))                                                 \
+        {                                                               \
+          if (g_atomic_int_add(&g_unitTestNumFailed, 1) < UNIT_TEST_MAX_REPORTS) \
+            {                                                           \
+              fprintf(stderr, "%s:%d: check failed: ", __FILE__, __LINE__); \
+              fprintf(stderr, __VA_ARGS__);                             \
+              fprintf(stderr, "\n");                                    \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
+
+/* Print a summary and return the exit status for the test program */
+static inline int unitTestResult(const char *testName)
+{
+  const int numFailed = g_atomic_int_get(&g_unitTestNumFailed);
+
+  if (numFailed > 0)
+    {
+      fprintf(stderr, "%s: %d check(s) failed\n", testName, numFailed);
+      return EXIT_FAILURE;
+    }
+
+  fprintf(stderr, "%s: all checks passed\n", testName);
+  return EXIT_SUCCESS;
+}
+
+
+/* Fill the buffer with len random characters from the alphabet and nul-terminate it */
+static inline void unitTestRandomSeq(TestRandom *rng, char *buffer, const int len, const char *alphabet, const int alphabetLen)
+{
+  for (int i = 0; i < len; ++i)
+    buffer[i] = alphabet[testRandomInt(rng, alphabetLen)];
+
+  buffer[len] = '\0';
+}
+
+
+#endif /* _unit_test_included_ */